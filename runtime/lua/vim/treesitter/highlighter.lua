@@ -147,6 +147,9 @@ function TSHighlighter.new(tree, opts)
   -- A map of highlight states.
   -- This state is kept during rendering across each line update.
   self._highlight_states = {}
+  -- Captures of the highlight queries for each tree, as plain values.
+  -- Kept until the buffer changes, redraws without edits reuse them.
+  self._capture_caches = setmetatable({}, { __mode = 'k' })
   self._queries = {}
 
   -- Queries for a specific language can be overridden by a custom
@@ -185,8 +188,7 @@ end
 function TSHighlighter:get_highlight_state(tstree)
   if not self._highlight_states[tstree] then
     self._highlight_states[tstree] = {
-      next_row = 0,
-      iter = nil
+      next_capture = nil,
     }
   end
 
@@ -198,8 +200,53 @@ function TSHighlighter:reset_highlight_state()
   self._highlight_states = {}
 end
 
+---@private
+--- Gets the capture cache of @param tstree, usable for drawing from @param line.
+function TSHighlighter:get_capture_cache(tstree, root_node, highlighter_query, line)
+  local cache = self._capture_caches[tstree]
+  if not cache or cache.start_row > line then
+    local _, _, root_end_row, _ = root_node:range()
+    cache = {
+      start_row = line,
+      -- { start_row, start_col, end_row, end_col, hl, priority } in the order
+      -- of the query, which is by start position
+      captures = {},
+      -- the captures that span more than one row
+      multiline = {},
+      iter = highlighter_query:query():iter_captures(root_node, self.bufnr, line, root_end_row + 1),
+    }
+    self._capture_caches[tstree] = cache
+  end
+
+  return cache
+end
+
+---@private
+--- Runs the query of @param cache until it has all captures that start on or
+--- before @param line.
+local function fill_capture_cache(cache, highlighter_query, line)
+  local captures = cache.captures
+  while cache.iter and (#captures == 0 or captures[#captures][1] <= line) do
+    local capture, node, metadata = cache.iter()
+    if capture == nil then
+      cache.iter = nil
+      break
+    end
+
+    local start_row, start_col, end_row, end_col = node:range()
+    local entry = { start_row, start_col, end_row, end_col,
+                    highlighter_query.hl_cache[capture],
+                    tonumber(metadata.priority) or 100 } -- Low but leaves room below
+    captures[#captures + 1] = entry
+    if end_row > start_row then
+      cache.multiline[#cache.multiline + 1] = entry
+    end
+  end
+end
+
 ---@private
 function TSHighlighter:on_bytes(_, _, start_row, _, _, _, _, _, new_end)
+  self._capture_caches = setmetatable({}, { __mode = 'k' })
   a.nvim__buf_redraw_range(self.bufnr, start_row, start_row + new_end + 1)
 end
 
@@ -226,6 +273,16 @@ function TSHighlighter:get_query(lang)
   return self._queries[lang]
 end
 
+---@private
+local function set_capture_extmark(buf, capture)
+  a.nvim_buf_set_extmark(buf, ns, capture[1], capture[2],
+                         { end_line = capture[3], end_col = capture[4],
+                           hl_group = capture[5],
+                           ephemeral = true,
+                           priority = capture[6],
+                          })
+end
+
 ---@private
 local function on_line_impl(self, buf, line)
   self.tree:for_each_tree(function(tstree, tree)
@@ -243,29 +300,37 @@ local function on_line_impl(self, buf, line)
     -- Some injected languages may not have highlight queries.
     if not highlighter_query:query() then return end
 
-    if state.iter == nil then
-      state.iter = highlighter_query:query():iter_captures(root_node, self.bufnr, line, root_end_row + 1)
-    end
+    local cache = self:get_capture_cache(tstree, root_node, highlighter_query, line)
+    fill_capture_cache(cache, highlighter_query, line)
+    local captures = cache.captures
 
-    while line >= state.next_row do
-      local capture, node, metadata = state.iter()
-
-      if capture == nil then break end
-
-      local start_row, start_col, end_row, end_col = node:range()
-      local hl = highlighter_query.hl_cache[capture]
+    if state.next_capture == nil then
+      -- First line drawn: captures that started above it and still cover it.
+      for _, capture in ipairs(cache.multiline) do
+        if capture[5] and capture[1] < line and capture[3] >= line then
+          set_capture_extmark(buf, capture)
+        end
+      end
 
-      if hl and end_row >= line then
-        a.nvim_buf_set_extmark(buf, ns, start_row, start_col,
-                               { end_line = end_row, end_col = end_col,
-                                 hl_group = hl,
-                                 ephemeral = true,
-                                 priority = tonumber(metadata.priority) or 100 -- Low but leaves room below
-                                })
+      -- Find the first capture that starts on this line.
+      local lo, hi = 1, #captures + 1
+      while lo < hi do
+        local mid = math.floor((lo + hi) / 2)
+        if captures[mid][1] < line then
+          lo = mid + 1
+        else
+          hi = mid
+        end
       end
-      if start_row > line then
-        state.next_row = start_row
+      state.next_capture = lo
+    end
+
+    while state.next_capture <= #captures and captures[state.next_capture][1] <= line do
+      local capture = captures[state.next_capture]
+      if capture[5] and capture[3] >= line then
+        set_capture_extmark(buf, capture)
       end
+      state.next_capture = state.next_capture + 1
     end
   end, true)
 end
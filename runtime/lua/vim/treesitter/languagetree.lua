@@ -128,6 +128,68 @@ function LanguageTree:parse()
     vim.list_extend(changes, tree_changes)
   end
 
+  return self:_parse_injections(changes)
+end
+
+--- Like |LanguageTree:parse()|, but the text of the buffer is parsed on a
+--- worker thread, so that editing is not blocked by large buffers.
+--- Only the tree of this language is parsed in the background, child
+--- languages are parsed when the result has arrived.
+---
+--- When the buffer changes before the result arrives, the result is dropped
+--- and the tree stays invalid. Falls back to |LanguageTree:parse()| for
+--- string sources and included regions.
+---
+---@param callback Invoked with the trees and changes like the return values
+---                of |LanguageTree:parse()|, or nothing when the result was dropped.
+function LanguageTree:parse_async(callback)
+  if self._valid or type(self._source) ~= "number"
+      or (self._regions and #self._regions > 0) then
+    callback(self:parse())
+    return
+  end
+
+  -- Only one parse is in flight, later callers wait for its result.
+  if self._async_callbacks then
+    table.insert(self._async_callbacks, callback)
+    return
+  end
+  self._async_callbacks = { callback }
+
+  local function on_result(tree, tree_changes)
+    local callbacks = self._async_callbacks
+    self._async_callbacks = nil
+
+    if tree and not self._valid then
+      self._trees = { tree }
+      self:_do_callback('changedtree', tree_changes, tree)
+      local trees, changes = self:_parse_injections(vim.list_extend({}, tree_changes))
+      for _, cb in ipairs(callbacks) do
+        cb(trees, changes)
+      end
+    else
+      for _, cb in ipairs(callbacks) do
+        if self._valid then
+          cb(self._trees, {})
+        else
+          cb()
+        end
+      end
+    end
+  end
+
+  local ok, err = pcall(self._parser._parse_async, self._parser, self._trees[1],
+                        self._source, on_result)
+  if not ok then
+    -- Nothing is in flight, let the next call start again.
+    self._async_callbacks = nil
+    error(err)
+  end
+end
+
+--- Parses the child languages injected in the trees of this language.
+---@private
+function LanguageTree:_parse_injections(changes)
   local injections_by_lang = self:_get_injections()
   local seen_langs = {}
 
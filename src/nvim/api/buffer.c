@@ -27,6 +27,7 @@
 #include "nvim/memory.h"
 #include "nvim/move.h"
 #include "nvim/ops.h"
+#include "nvim/syntax.h"
 #include "nvim/undo.h"
 #include "nvim/vim.h"
 #include "nvim/window.h"
@@ -247,6 +248,7 @@ void nvim__buf_redraw_range(Buffer buffer, Integer first, Integer last, Error *e
     return;
   }
 
+  decor_cache_invalidate(buf, (linenr_T)first+1, (linenr_T)last+1);
   redraw_buf_range_later(buf, (linenr_T)first+1, (linenr_T)last);
 }
 
@@ -1363,6 +1365,18 @@ Dictionary nvim__buf_stats(Buffer buffer, Error *err)
     PUT(rv, "uhp_extmark_size", INTEGER_OBJ((Integer)kv_size(uhp->uh_extmark)));
   }
 
+  // Bytes of memory used for the text, the undo tree, extmarks, syntax state
+  // stacks and decorations.
+  size_t extmark_bytes, decor_bytes;
+  extmark_mem_size(buf, &extmark_bytes, &decor_bytes);
+  PUT(rv, "memline_bytes", INTEGER_OBJ((Integer)ml_mem_size(buf)));
+  PUT(rv, "undo_bytes", INTEGER_OBJ((Integer)u_mem_size(buf)));
+  PUT(rv, "extmark_bytes", INTEGER_OBJ((Integer)extmark_bytes));
+  PUT(rv, "syntax_bytes", INTEGER_OBJ((Integer)syn_stack_mem_size(&buf->b_s)));
+  PUT(rv, "decor_bytes", INTEGER_OBJ((Integer)decor_bytes));
+  // Syntax parsing does not have to start above this line.
+  PUT(rv, "syntax_lnum", INTEGER_OBJ((Integer)syn_stack_valid_lnum(&buf->b_s)));
+
   return rv;
 }
 
@@ -239,6 +239,9 @@ ArrayOf(Integer) nvim_buf_get_extmark_by_id(Buffer buffer, Integer ns_id,
 /// @param opts  Optional parameters. Keys:
 ///          - limit:  Maximum number of marks to return
 ///          - details Whether to include the details dict
+///          - overlap Also include the marks which start before `start`
+///                    (or before `end` when traversing backwards) and end
+///                    at or after it.
 /// @param[out] err   Error details, if any
 /// @return List of [extmark_id, row, col] tuples in "traversal order".
 Array nvim_buf_get_extmarks(Buffer buffer, Integer ns_id, Object start, Object end, Dictionary opts,
@@ -259,6 +262,7 @@ Array nvim_buf_get_extmarks(Buffer buffer, Integer ns_id, Object start, Object e
 
   Integer limit = -1;
   bool details = false;
+  bool overlap = false;
 
   for (size_t i = 0; i < opts.size; i++) {
     String k = opts.items[i].key;
@@ -278,6 +282,15 @@ Array nvim_buf_get_extmarks(Buffer buffer, Integer ns_id, Object start, Object e
         api_set_error(err, kErrorTypeValidation, "details is not an boolean");
         return rv;
       }
+    } else if (strequal("overlap", k.data)) {
+      if (v->type == kObjectTypeBoolean) {
+        overlap = v->data.boolean;
+      } else if (v->type == kObjectTypeInteger) {
+        overlap = v->data.integer;
+      } else {
+        api_set_error(err, kErrorTypeValidation, "overlap is not an boolean");
+        return rv;
+      }
     } else {
       api_set_error(err, kErrorTypeValidation, "unexpected key: %s", k.data);
       return rv;
@@ -311,7 +324,8 @@ Array nvim_buf_get_extmarks(Buffer buffer, Integer ns_id, Object start, Object e
 
 
   ExtmarkInfoArray marks = extmark_get(buf, (uint64_t)ns_id, l_row, l_col,
-                                       u_row, u_col, (int64_t)limit, reverse);
+                                       u_row, u_col, (int64_t)limit, reverse,
+                                       overlap);
 
   for (size_t i = 0; i < kv_size(marks); i++) {
     ADD(rv, ARRAY_OBJ(extmark_to_array(kv_A(marks, i), true, (bool)details)));
@@ -321,113 +335,19 @@ Array nvim_buf_get_extmarks(Buffer buffer, Integer ns_id, Object start, Object e
   return rv;
 }
 
-/// Creates or updates an extmark.
-///
-/// To create a new extmark, pass id=0. The extmark id will be returned.
-/// To move an existing mark, pass its id.
-///
-/// It is also allowed to create a new mark by passing in a previously unused
-/// id, but the caller must then keep track of existing and unused ids itself.
-/// (Useful over RPC, to avoid waiting for the return value.)
-///
-/// Using the optional arguments, it is possible to use this to highlight
-/// a range of text, and also to associate virtual text to the mark.
-///
-/// @param buffer  Buffer handle, or 0 for current buffer
-/// @param ns_id  Namespace id from |nvim_create_namespace()|
-/// @param line  Line where to place the mark, 0-based. |api-indexing|
-/// @param col  Column where to place the mark, 0-based. |api-indexing|
-/// @param opts  Optional parameters.
-///               - id : id of the extmark to edit.
-///               - end_row : ending line of the mark, 0-based inclusive.
-///               - end_col : ending col of the mark, 0-based exclusive.
-///               - hl_group : name of the highlight group used to highlight
-///                   this mark.
-///               - hl_eol : when true, for a multiline highlight covering the
-///                          EOL of a line, continue the highlight for the rest
-///                          of the screen line (just like for diff and
-///                          cursorline highlight).
-///               - virt_text : virtual text to link to this mark.
-///                   A list of [text, highlight] tuples, each representing a
-///                   text chunk with specified highlight. `highlight` element
-///                   can either be a a single highlight group, or an array of
-///                   multiple highlight groups that will be stacked
-///                   (highest priority last). A highlight group can be supplied
-///                   either as a string or as an integer, the latter which
-///                   can be obtained using |nvim_get_hl_id_by_name|.
-///               - virt_text_pos : position of virtual text. Possible values:
-///                 - "eol": right after eol character (default)
-///                 - "overlay": display over the specified column, without
-///                              shifting the underlying text.
-///                 - "right_align": display right aligned in the window.
-///               - virt_text_win_col : position the virtual text at a fixed
-///                                     window column (starting from the first
-///                                     text column)
-///               - virt_text_hide : hide the virtual text when the background
-///                                  text is selected or hidden due to
-///                                  horizontal scroll 'nowrap'
-///               - hl_mode : control how highlights are combined with the
-///                           highlights of the text. Currently only affects
-///                           virt_text highlights, but might affect `hl_group`
-///                           in later versions.
-///                 - "replace": only show the virt_text color. This is the
-///                              default
-///                 - "combine": combine with background text color
-///                 - "blend": blend with background text color.
-///
-///               - virt_lines : virtual lines to add next to this mark
-///                   This should be an array over lines, where each line in
-///                   turn is an array over [text, highlight] tuples. In
-///                   general, buffer and window options do not affect the
-///                   display of the text. In particular 'wrap'
-///                   and 'linebreak' options do not take effect, so
-///                   the number of extra screen lines will always match
-///                   the size of the array. However the 'tabstop' buffer
-///                   option is still used for hard tabs. By default lines are
-///                   placed below the buffer line containing the mark.
-///
-///               - virt_lines_above: place virtual lines above instead.
-///               - virt_lines_leftcol: Place extmarks in the leftmost
-///                                     column of the window, bypassing
-///                                     sign and number columns.
+/// Checks the arguments of |nvim_buf_set_extmark()| and fills in "mark" and
+/// "decor" from them.
 ///
-///               - ephemeral : for use with |nvim_set_decoration_provider|
-///                   callbacks. The mark will only be used for the current
-///                   redraw cycle, and not be permantently stored in the
-///                   buffer.
-///               - right_gravity : boolean that indicates the direction
-///                   the extmark will be shifted in when new text is inserted
-///                   (true for right, false for left).  defaults to true.
-///               - end_right_gravity : boolean that indicates the direction
-///                   the extmark end position (if it exists) will be shifted
-///                   in when new text is inserted (true for right, false
-///                   for left). Defaults to false.
-///               - priority: a priority value for the highlight group. For
-///                   example treesitter highlighting uses a value of 100.
-/// @param[out]  err   Error details, if any
-/// @return Id of the created/updated extmark
-Integer nvim_buf_set_extmark(Buffer buffer, Integer ns_id, Integer line, Integer col,
-                             Dict(set_extmark) *opts, Error *err)
-  FUNC_API_SINCE(7)
+/// @return  false when an error was given.
+static bool extmark_parse(buf_T *buf, Integer line, Integer col, Dict(set_extmark) *opts,
+                          ExtmarkPut *mark, Decoration *decor, bool *ephemeral, Error *err)
 {
-  Decoration decor = DECORATION_INIT;
-
-  buf_T *buf = find_buffer_by_handle(buffer, err);
-  if (!buf) {
-    goto error;
-  }
-
-  if (!ns_initialized((uint64_t)ns_id)) {
-    api_set_error(err, kErrorTypeValidation, "Invalid ns_id");
-    goto error;
-  }
-
   uint64_t id = 0;
   if (opts->id.type == kObjectTypeInteger && opts->id.data.integer > 0) {
     id = (uint64_t)opts->id.data.integer;
   } else if (HAS_KEY(opts->id)) {
     api_set_error(err, kErrorTypeValidation, "id is not a positive integer");
-    goto error;
+    return false;
   }
 
   int line2 = -1;
@@ -436,7 +356,7 @@ Integer nvim_buf_set_extmark(Buffer buffer, Integer ns_id, Integer line, Integer
   if (HAS_KEY(opts->end_line)) {
     if (HAS_KEY(opts->end_row)) {
       api_set_error(err, kErrorTypeValidation, "cannot use both end_row and end_line");
-      goto error;
+      return false;
     }
     opts->end_row = opts->end_line;
   }
@@ -445,13 +365,13 @@ Integer nvim_buf_set_extmark(Buffer buffer, Integer ns_id, Integer line, Integer
     Integer val = opts->end_row.data.integer;
     if (val < 0 || val > buf->b_ml.ml_line_count) {
       api_set_error(err, kErrorTypeValidation, "end_row value outside range");
-      goto error;
+      return false;
     } else {
       line2 = (int)val;
     }
   } else if (HAS_KEY(opts->end_row)) {
     api_set_error(err, kErrorTypeValidation, "end_row is not an integer");
-    goto error;
+    return false;
   }
 
   colnr_T col2 = -1;
@@ -459,84 +379,84 @@ Integer nvim_buf_set_extmark(Buffer buffer, Integer ns_id, Integer line, Integer
     Integer val = opts->end_col.data.integer;
     if (val < 0 || val > MAXCOL) {
       api_set_error(err, kErrorTypeValidation, "end_col value outside range");
-      goto error;
+      return false;
     } else {
       col2 = (int)val;
     }
   } else if (HAS_KEY(opts->end_col)) {
     api_set_error(err, kErrorTypeValidation, "end_col is not an integer");
-    goto error;
+    return false;
   }
 
   if (HAS_KEY(opts->hl_group)) {
-    decor.hl_id = object_to_hl_id(opts->hl_group, "hl_group", err);
+    decor->hl_id = object_to_hl_id(opts->hl_group, "hl_group", err);
     if (ERROR_SET(err)) {
-      goto error;
+      return false;
     }
   }
 
   if (opts->virt_text.type == kObjectTypeArray) {
-    decor.virt_text = parse_virt_text(opts->virt_text.data.array, err,
-                                      &decor.virt_text_width);
+    decor->virt_text = parse_virt_text(opts->virt_text.data.array, err,
+                                      &decor->virt_text_width);
     if (ERROR_SET(err)) {
-      goto error;
+      return false;
     }
   } else if (HAS_KEY(opts->virt_text)) {
     api_set_error(err, kErrorTypeValidation, "virt_text is not an Array");
-    goto error;
+    return false;
   }
 
   if (opts->virt_text_pos.type == kObjectTypeString) {
     String str = opts->virt_text_pos.data.string;
     if (strequal("eol", str.data)) {
-      decor.virt_text_pos = kVTEndOfLine;
+      decor->virt_text_pos = kVTEndOfLine;
     } else if (strequal("overlay", str.data)) {
-      decor.virt_text_pos = kVTOverlay;
+      decor->virt_text_pos = kVTOverlay;
     } else if (strequal("right_align", str.data)) {
-      decor.virt_text_pos = kVTRightAlign;
+      decor->virt_text_pos = kVTRightAlign;
     } else {
       api_set_error(err, kErrorTypeValidation, "virt_text_pos: invalid value");
-      goto error;
+      return false;
     }
   } else if (HAS_KEY(opts->virt_text_pos)) {
     api_set_error(err, kErrorTypeValidation, "virt_text_pos is not a String");
-    goto error;
+    return false;
   }
 
   if (opts->virt_text_win_col.type == kObjectTypeInteger) {
-    decor.col = (int)opts->virt_text_win_col.data.integer;
-    decor.virt_text_pos = kVTWinCol;
+    decor->col = (int)opts->virt_text_win_col.data.integer;
+    decor->virt_text_pos = kVTWinCol;
   } else if (HAS_KEY(opts->virt_text_win_col)) {
     api_set_error(err, kErrorTypeValidation,
                   "virt_text_win_col is not a Number of the correct size");
-    goto error;
+    return false;
   }
 
 #define OPTION_TO_BOOL(target, name, val) \
   target = api_object_to_bool(opts->name, #name, val, err); \
   if (ERROR_SET(err)) { \
-    goto error; \
+    return false; \
   }
 
-  OPTION_TO_BOOL(decor.virt_text_hide, virt_text_hide, false);
-  OPTION_TO_BOOL(decor.hl_eol, hl_eol, false);
+  OPTION_TO_BOOL(decor->virt_text_hide, virt_text_hide, false);
+  OPTION_TO_BOOL(decor->hl_eol, hl_eol, false);
 
   if (opts->hl_mode.type == kObjectTypeString) {
     String str = opts->hl_mode.data.string;
     if (strequal("replace", str.data)) {
-      decor.hl_mode = kHlModeReplace;
+      decor->hl_mode = kHlModeReplace;
     } else if (strequal("combine", str.data)) {
-      decor.hl_mode = kHlModeCombine;
+      decor->hl_mode = kHlModeCombine;
     } else if (strequal("blend", str.data)) {
-      decor.hl_mode = kHlModeBlend;
+      decor->hl_mode = kHlModeBlend;
     } else {
       api_set_error(err, kErrorTypeValidation,
                     "virt_text_pos: invalid value");
-      goto error;
+      return false;
     }
   } else if (HAS_KEY(opts->hl_mode)) {
     api_set_error(err, kErrorTypeValidation, "hl_mode is not a String");
-    goto error;
+    return false;
   }
 
   bool virt_lines_leftcol = false;
@@ -547,34 +467,34 @@ Integer nvim_buf_set_extmark(Buffer buffer, Integer ns_id, Integer line, Integer
     for (size_t j = 0; j < a.size; j++) {
       if (a.items[j].type != kObjectTypeArray) {
         api_set_error(err, kErrorTypeValidation, "virt_text_line item is not an Array");
-        goto error;
+        return false;
       }
       int dummig;
       VirtText jtem = parse_virt_text(a.items[j].data.array, err, &dummig);
-      kv_push(decor.virt_lines, ((struct virt_line){ jtem, virt_lines_leftcol }));
+      kv_push(decor->virt_lines, ((struct virt_line){ jtem, virt_lines_leftcol }));
       if (ERROR_SET(err)) {
-        goto error;
+        return false;
       }
     }
   } else if (HAS_KEY(opts->virt_lines)) {
     api_set_error(err, kErrorTypeValidation, "virt_lines is not an Array");
-    goto error;
+    return false;
   }
 
 
-  OPTION_TO_BOOL(decor.virt_lines_above, virt_lines_above, false);
+  OPTION_TO_BOOL(decor->virt_lines_above, virt_lines_above, false);
 
   if (opts->priority.type == kObjectTypeInteger) {
     Integer val = opts->priority.data.integer;
 
     if (val < 0 || val > UINT16_MAX) {
       api_set_error(err, kErrorTypeValidation, "priority is not a valid value");
-      goto error;
+      return false;
     }
-    decor.priority = (DecorPriority)val;
+    decor->priority = (DecorPriority)val;
   } else if (HAS_KEY(opts->priority)) {
     api_set_error(err, kErrorTypeValidation, "priority is not a Number of the correct size");
-    goto error;
+    return false;
   }
 
   bool right_gravity = true;
@@ -585,7 +505,7 @@ Integer nvim_buf_set_extmark(Buffer buffer, Integer ns_id, Integer line, Integer
   if (line2 == -1 && col2 == -1 && HAS_KEY(opts->end_right_gravity)) {
     api_set_error(err, kErrorTypeValidation,
                   "cannot set end_right_gravity without setting end_row or end_col");
-    goto error;
+    return false;
   }
 
   bool end_right_gravity = false;
@@ -593,26 +513,25 @@ Integer nvim_buf_set_extmark(Buffer buffer, Integer ns_id, Integer line, Integer
 
   size_t len = 0;
 
-  bool ephemeral = false;
-  OPTION_TO_BOOL(ephemeral, ephemeral, false);
+  OPTION_TO_BOOL(*ephemeral, ephemeral, false);
 
   if (line < 0 || line > buf->b_ml.ml_line_count) {
     api_set_error(err, kErrorTypeValidation, "line value outside range");
-    goto error;
+    return false;
   } else if (line < buf->b_ml.ml_line_count) {
-    len = ephemeral ? MAXCOL : STRLEN(ml_get_buf(buf, (linenr_T)line+1, false));
+    len = *ephemeral ? MAXCOL : STRLEN(ml_get_buf(buf, (linenr_T)line+1, false));
   }
 
   if (col == -1) {
     col = (Integer)len;
   } else if (col < -1 || col > (Integer)len) {
     api_set_error(err, kErrorTypeValidation, "col value outside range");
-    goto error;
+    return false;
   }
 
   if (col2 >= 0) {
     if (line2 >= 0 && line2 < buf->b_ml.ml_line_count) {
-      len = ephemeral ? MAXCOL : STRLEN(ml_get_buf(buf, (linenr_T)line2 + 1, false));
+      len = *ephemeral ? MAXCOL : STRLEN(ml_get_buf(buf, (linenr_T)line2 + 1, false));
     } else if (line2 == buf->b_ml.ml_line_count) {
       // We are trying to add an extmark past final newline
       len = 0;
@@ -622,51 +541,273 @@ Integer nvim_buf_set_extmark(Buffer buffer, Integer ns_id, Integer line, Integer
     }
     if (col2 > (Integer)len) {
       api_set_error(err, kErrorTypeValidation, "end_col value outside range");
-      goto error;
+      return false;
     }
   } else if (line2 >= 0) {
     col2 = 0;
   }
 
-  Decoration *d = NULL;
 
-  if (ephemeral) {
-    d = &decor;
-  } else if (kv_size(decor.virt_text) || kv_size(decor.virt_lines)
-             || decor.priority != DECOR_PRIORITY_BASE
-             || decor.hl_eol) {
+  *mark = (ExtmarkPut){
+    .mark_id = id,
+    .row = (int)line,
+    .col = (colnr_T)col,
+    .end_row = line2,
+    .end_col = col2,
+    .right_gravity = right_gravity,
+    .end_right_gravity = end_right_gravity,
+  };
+  return true;
+}
+
+/// @return  The decoration to store with an extmark for "decor", NULL when
+///          there is none.
+static Decoration *extmark_decor_alloc(Decoration *decor)
+{
+  if (kv_size(decor->virt_text) || kv_size(decor->virt_lines)
+      || decor->priority != DECOR_PRIORITY_BASE
+      || decor->hl_eol) {
     // TODO(bfredl): this is a bit sketchy. eventually we should
     // have predefined decorations for both marks/ephemerals
-    d = xcalloc(1, sizeof(*d));
-    *d = decor;
-  } else if (decor.hl_id) {
-    d = decor_hl(decor.hl_id);
+    Decoration *d = xcalloc(1, sizeof(*d));
+    *d = *decor;
+    return d;
+  } else if (decor->hl_id) {
+    return decor_hl(decor->hl_id);
+  }
+  return NULL;
+}
+
+/// Creates or updates an extmark.
+///
+/// To create a new extmark, pass id=0. The extmark id will be returned.
+/// To move an existing mark, pass its id.
+///
+/// It is also allowed to create a new mark by passing in a previously unused
+/// id, but the caller must then keep track of existing and unused ids itself.
+/// (Useful over RPC, to avoid waiting for the return value.)
+///
+/// Using the optional arguments, it is possible to use this to highlight
+/// a range of text, and also to associate virtual text to the mark.
+///
+/// @param buffer  Buffer handle, or 0 for current buffer
+/// @param ns_id  Namespace id from |nvim_create_namespace()|
+/// @param line  Line where to place the mark, 0-based. |api-indexing|
+/// @param col  Column where to place the mark, 0-based. |api-indexing|
+/// @param opts  Optional parameters.
+///               - id : id of the extmark to edit.
+///               - end_row : ending line of the mark, 0-based inclusive.
+///               - end_col : ending col of the mark, 0-based exclusive.
+///               - hl_group : name of the highlight group used to highlight
+///                   this mark.
+///               - hl_eol : when true, for a multiline highlight covering the
+///                          EOL of a line, continue the highlight for the rest
+///                          of the screen line (just like for diff and
+///                          cursorline highlight).
+///               - virt_text : virtual text to link to this mark.
+///                   A list of [text, highlight] tuples, each representing a
+///                   text chunk with specified highlight. `highlight` element
+///                   can either be a a single highlight group, or an array of
+///                   multiple highlight groups that will be stacked
+///                   (highest priority last). A highlight group can be supplied
+///                   either as a string or as an integer, the latter which
+///                   can be obtained using |nvim_get_hl_id_by_name|.
+///               - virt_text_pos : position of virtual text. Possible values:
+///                 - "eol": right after eol character (default)
+///                 - "overlay": display over the specified column, without
+///                              shifting the underlying text.
+///                 - "right_align": display right aligned in the window.
+///               - virt_text_win_col : position the virtual text at a fixed
+///                                     window column (starting from the first
+///                                     text column)
+///               - virt_text_hide : hide the virtual text when the background
+///                                  text is selected or hidden due to
+///                                  horizontal scroll 'nowrap'
+///               - hl_mode : control how highlights are combined with the
+///                           highlights of the text. Currently only affects
+///                           virt_text highlights, but might affect `hl_group`
+///                           in later versions.
+///                 - "replace": only show the virt_text color. This is the
+///                              default
+///                 - "combine": combine with background text color
+///                 - "blend": blend with background text color.
+///
+///               - virt_lines : virtual lines to add next to this mark
+///                   This should be an array over lines, where each line in
+///                   turn is an array over [text, highlight] tuples. In
+///                   general, buffer and window options do not affect the
+///                   display of the text. In particular 'wrap'
+///                   and 'linebreak' options do not take effect, so
+///                   the number of extra screen lines will always match
+///                   the size of the array. However the 'tabstop' buffer
+///                   option is still used for hard tabs. By default lines are
+///                   placed below the buffer line containing the mark.
+///
+///               - virt_lines_above: place virtual lines above instead.
+///               - virt_lines_leftcol: Place extmarks in the leftmost
+///                                     column of the window, bypassing
+///                                     sign and number columns.
+///
+///               - ephemeral : for use with |nvim_set_decoration_provider|
+///                   callbacks. The mark will only be used for the current
+///                   redraw cycle, and not be permantently stored in the
+///                   buffer.
+///               - right_gravity : boolean that indicates the direction
+///                   the extmark will be shifted in when new text is inserted
+///                   (true for right, false for left).  defaults to true.
+///               - end_right_gravity : boolean that indicates the direction
+///                   the extmark end position (if it exists) will be shifted
+///                   in when new text is inserted (true for right, false
+///                   for left). Defaults to false.
+///               - priority: a priority value for the highlight group. For
+///                   example treesitter highlighting uses a value of 100.
+/// @param[out]  err   Error details, if any
+/// @return Id of the created/updated extmark
+Integer nvim_buf_set_extmark(Buffer buffer, Integer ns_id, Integer line, Integer col,
+                             Dict(set_extmark) *opts, Error *err)
+  FUNC_API_SINCE(7)
+{
+  Decoration decor = DECORATION_INIT;
+  ExtmarkPut mark;
+  bool ephemeral = false;
+
+  buf_T *buf = find_buffer_by_handle(buffer, err);
+  if (!buf) {
+    goto error;
+  }
+
+  if (!ns_initialized((uint64_t)ns_id)) {
+    api_set_error(err, kErrorTypeValidation, "Invalid ns_id");
+    goto error;
+  }
+
+  if (!extmark_parse(buf, line, col, opts, &mark, &decor, &ephemeral, err)) {
+    goto error;
   }
 
   // TODO(bfredl): synergize these two branches even more
   if (ephemeral && decor_state.buf == buf) {
-    decor_add_ephemeral((int)line, (int)col, line2, col2, &decor);
+    decor_add_ephemeral(mark.row, mark.col, mark.end_row, mark.end_col, &decor);
   } else {
     if (ephemeral) {
       api_set_error(err, kErrorTypeException, "not yet implemented");
       goto error;
     }
 
-    extmark_set(buf, (uint64_t)ns_id, &id, (int)line, (colnr_T)col, line2, col2,
-                d, right_gravity, end_right_gravity, kExtmarkNoUndo);
+    extmark_set(buf, (uint64_t)ns_id, &mark.mark_id, mark.row, mark.col, mark.end_row,
+                mark.end_col, extmark_decor_alloc(&decor), mark.right_gravity,
+                mark.end_right_gravity, kExtmarkNoUndo);
 
     if (kv_size(decor.virt_lines)) {
       redraw_buf_line_later(buf, MIN(buf->b_ml.ml_line_count, line+1+(decor.virt_lines_above?0:1)));
     }
   }
 
-  return (Integer)id;
+  return (Integer)mark.mark_id;
 
 error:
   clear_virttext(&decor.virt_text);
   return 0;
 }
 
+/// Creates or updates many extmarks at once.
+///
+/// Does the same as calling |nvim_buf_set_extmark()| for each item of
+/// {marks}, but is much faster for many marks, because they are added to the
+/// buffer together. Nothing is changed when an item is invalid.
+///
+/// @param buffer  Buffer handle, or 0 for current buffer
+/// @param ns_id  Namespace id from |nvim_create_namespace()|
+/// @param marks  List of `[line, col, opts]` items, with the arguments of
+///               |nvim_buf_set_extmark()|. `opts` can be omitted, "ephemeral"
+///               is not supported.
+/// @param opts  Optional parameters.
+///               - clear : delete all other extmarks of the namespace, thus
+///                 replacing them with {marks}.
+/// @param[out]  err   Error details, if any
+/// @return List of the ids of the created/updated extmarks, in the order of
+///         {marks}
+ArrayOf(Integer) nvim_buf_set_extmarks(Buffer buffer, Integer ns_id, Array marks,
+                                       Dictionary opts, Error *err)
+  FUNC_API_SINCE(9)
+{
+  Array rv = ARRAY_DICT_INIT;
+  bool clear = false;
+
+  buf_T *buf = find_buffer_by_handle(buffer, err);
+  if (!buf) {
+    return rv;
+  }
+
+  if (!ns_initialized((uint64_t)ns_id)) {
+    api_set_error(err, kErrorTypeValidation, "Invalid ns_id");
+    return rv;
+  }
+
+  for (size_t i = 0; i < opts.size; i++) {
+    String k = opts.items[i].key;
+    Object *v = &opts.items[i].value;
+    if (strequal("clear", k.data)) {
+      clear = api_object_to_bool(*v, "clear", false, err);
+      if (ERROR_SET(err)) {
+        return rv;
+      }
+    } else {
+      api_set_error(err, kErrorTypeValidation, "unexpected key: %s", k.data);
+      return rv;
+    }
+  }
+
+  ExtmarkPut *items = xcalloc(MAX(marks.size, 1), sizeof(ExtmarkPut));
+  size_t count = 0;
+  for (; count < marks.size; count++) {
+    Object item = marks.items[count];
+    Array a = item.type == kObjectTypeArray ? item.data.array : (Array)ARRAY_DICT_INIT;
+    if (a.size < 2 || a.size > 3
+        || a.items[0].type != kObjectTypeInteger
+        || a.items[1].type != kObjectTypeInteger
+        || (a.size == 3 && a.items[2].type != kObjectTypeDictionary
+            && !(a.items[2].type == kObjectTypeArray && a.items[2].data.array.size == 0))) {
+      api_set_error(err, kErrorTypeValidation,
+                    "marks item %zu is not a [line, col, opts] Array", count);
+      break;
+    }
+
+    KeyDict_set_extmark mark_opts = { 0 };
+    if (a.size == 3 && a.items[2].type == kObjectTypeDictionary
+        && !api_dict_to_keydict(&mark_opts, KeyDict_set_extmark_get_field,
+                                            a.items[2].data.dictionary, err)) {
+      break;
+    }
+    Decoration decor = DECORATION_INIT;
+    bool ephemeral = false;
+    if (!extmark_parse(buf, a.items[0].data.integer, a.items[1].data.integer, &mark_opts,
+                       &items[count], &decor, &ephemeral, err)) {
+      clear_virttext(&decor.virt_text);
+      break;
+    }
+    if (ephemeral) {
+      clear_virttext(&decor.virt_text);
+      api_set_error(err, kErrorTypeValidation, "ephemeral is not supported");
+      break;
+    }
+    items[count].decor = extmark_decor_alloc(&decor);
+  }
+
+  if (ERROR_SET(err)) {
+    for (size_t i = 0; i < count; i++) {
+      decor_free(items[i].decor);
+    }
+  } else {
+    extmark_set_many(buf, (uint64_t)ns_id, items, count, clear);
+    for (size_t i = 0; i < count; i++) {
+      ADD(rv, INTEGER_OBJ((Integer)items[i].mark_id));
+    }
+  }
+  xfree(items);
+  return rv;
+}
+
 /// Removes an extmark.
 ///
 /// @param buffer Buffer handle, or 0 for current buffer
@@ -851,6 +992,11 @@ void nvim_buf_clear_namespace(Buffer buffer, Integer ns_id, Integer line_start,
 ///             - on_line: called for each buffer line being redrawn. (The
 ///                 interaction with fold lines is subject to change)
 ///                 ["win", winid, bufnr, row]
+///                 Return "cache" to keep using the ephemeral extmarks set
+///                 for the row while it stays in the window, instead of
+///                 calling on_line again. They are discarded when the line
+///                 is changed, or |nvim__buf_redraw_range()| is called for
+///                 it. Only extmarks which do not go past the row are kept.
 ///             - on_end: called at the end of a redraw cycle
 ///                 ["end", tick]
 void nvim_set_decoration_provider(Integer ns_id, DictionaryOf(LuaRef) opts, Error *err)
@@ -859,6 +1005,7 @@ void nvim_set_decoration_provider(Integer ns_id, DictionaryOf(LuaRef) opts, Erro
   DecorProvider *p = get_decor_provider((NS)ns_id, true);
   assert(p != NULL);
   decor_provider_clear(p);
+  decor_cache_clear_ns((NS)ns_id);
 
   // regardless of what happens, it seems good idea to redraw
   redraw_all_later(NOT_VALID);  // TODO(bfredl): too soon?
@@ -19,10 +19,12 @@
 #include "nvim/ascii.h"
 #include "nvim/buffer.h"
 #include "nvim/buffer_defs.h"
+#include "nvim/channel.h"
 #include "nvim/context.h"
 #include "nvim/decoration.h"
 #include "nvim/edit.h"
 #include "nvim/eval.h"
+#include "nvim/eval/gc.h"
 #include "nvim/eval/typval.h"
 #include "nvim/eval/userfunc.h"
 #include "nvim/ex_cmds2.h"
@@ -49,6 +51,7 @@
 #include "nvim/syntax.h"
 #include "nvim/types.h"
 #include "nvim/ui.h"
+#include "nvim/undo.h"
 #include "nvim/vim.h"
 #include "nvim/viml/parser/expressions.h"
 #include "nvim/viml/parser/parser.h"
@@ -1927,7 +1930,20 @@ Dictionary nvim__stats(void)
   Dictionary rv = ARRAY_DICT_INIT;
   PUT(rv, "fsync", INTEGER_OBJ(g_stats.fsync));
   PUT(rv, "redraw", INTEGER_OBJ(g_stats.redraw));
+  PUT(rv, "memfile_hit", INTEGER_OBJ(g_stats.memfile_hit));
+  PUT(rv, "memfile_miss", INTEGER_OBJ(g_stats.memfile_miss));
+  PUT(rv, "ml_cache_hit", INTEGER_OBJ(g_stats.ml_cache_hit));
+  PUT(rv, "ml_cache_miss", INTEGER_OBJ(g_stats.ml_cache_miss));
+  PUT(rv, "undo_spill", INTEGER_OBJ(g_stats.undo_spill));
+  PUT(rv, "undo_unspill", INTEGER_OBJ(g_stats.undo_unspill));
   PUT(rv, "lua_refcount", INTEGER_OBJ(nlua_refcount));
+  // Bytes of memory used by Vimscript lists and dictionaries, the Lua heap
+  // and RPC buffers.
+  PUT(rv, "eval_bytes", INTEGER_OBJ((Integer)gc_mem_size()));
+  PUT(rv, "lua_bytes", INTEGER_OBJ((Integer)nlua_mem_size()));
+  PUT(rv, "rpc_bytes", INTEGER_OBJ((Integer)channel_rpc_mem_size()));
+  // Bytes of undo text kept in memory for all buffers, see 'undomaxmemtot'.
+  PUT(rv, "undo_bytes", INTEGER_OBJ((Integer)u_mem_total_size()));
   return rv;
 }
 
@@ -34,6 +34,7 @@
 #include "nvim/channel.h"
 #include "nvim/charset.h"
 #include "nvim/cursor.h"
+#include "nvim/decoration.h"
 #include "nvim/diff.h"
 #include "nvim/digraph.h"
 #include "nvim/eval.h"
@@ -459,6 +460,15 @@ bool close_buffer(win_T *win, buf_T *buf, int action, bool abort_if_last)
   bufref_T bufref;
   set_bufref(&bufref, buf);
 
+  // Finish writing the buffer in the background before unloading it, the
+  // BufWritePost autocommands may change it.
+  buf_write_wait(buf);
+  if (!bufref_valid(&bufref)) {
+    // Autocommands deleted the buffer.
+    emsg(_(e_auabort));
+    return false;
+  }
+
   // When the buffer is no longer in a window, trigger BufWinLeave
   if (buf->b_nwindows == 1) {
     buf->b_locked++;
@@ -517,6 +527,11 @@ bool close_buffer(win_T *win, buf_T *buf, int action, bool abort_if_last)
     diff_buf_delete(buf);   // Clear 'diff' for hidden buffer.
   }
 
+  // A hidden buffer is not used much, let its text take less memory.
+  if (!unload_buf && buf->b_nwindows == 0) {
+    ml_compress(buf);
+  }
+
   // Return when a window is displaying the buffer or when it's not
   // unloaded.
   if (buf->b_nwindows > 0 || !unload_buf) {
@@ -666,6 +681,10 @@ void buf_freeall(buf_T *buf, int flags)
   win_T *the_curwin = curwin;
   tabpage_T *the_curtab = curtab;
 
+  // Callers already waited for a write in the background, when it is still
+  // going on autocommands cannot be triggered here.
+  buf_write_wait_noautocmd(buf);
+
   // Make sure the buffer isn't closed by autocommands.
   buf->b_locked++;
 
@@ -719,13 +738,17 @@ void buf_freeall(buf_T *buf, int flags)
     reset_synblock(curwin);
   }
 
-  // No folds in an empty buffer.
+  // No folds or cached decorations in an empty buffer.
   FOR_ALL_TAB_WINDOWS(tp, win) {
     if (win->w_buffer == buf) {
       clearFolding(win);
+      decor_cache_clear(win);
     }
   }
 
+  if ((flags & BFA_WIPE) == 0 && !exiting) {
+    syn_stack_save(buf);            // keep syntax states for reloading
+  }
   ml_close(buf, true);              // close and delete the memline/memfile
   buf->b_ml.ml_line_count = 0;      // no lines in buffer
   if ((flags & BFA_KEEP_UNDO) == 0) {
@@ -746,6 +769,7 @@ static void free_buffer(buf_T *buf)
   buf_free_count++;
   // b:changedtick uses an item in buf_T.
   free_buffer_stuff(buf, kBffClearWinInfo);
+  syn_stack_saved_free(buf);
   if (buf->b_vars->dv_refcount > DO_NOT_FREE_CNT) {
     tv_dict_add(buf->b_vars,
                 tv_dict_item_copy((dictitem_T *)(&buf->changedtick_di)));
@@ -415,6 +415,13 @@ typedef struct {
   long match;                   // nr of times matched
 } syn_time_T;
 
+/// The first bytes and the lengths that occur in a table of syntax keywords.
+/// Used to reject most words in a line without looking them up.
+typedef struct {
+  uint64_t kf_first[256 / 64];          // bit set for each first byte
+  uint64_t kf_len[128 / 64];            // bit set for each keyword length
+} keywfilter_T;
+
 /*
  * These are items normally related to a buffer.  But when using ":ownsyntax"
  * a window may have its own instance.
@@ -422,6 +429,8 @@ typedef struct {
 typedef struct {
   hashtab_T b_keywtab;                  // syntax keywords hash table
   hashtab_T b_keywtab_ic;               // idem, ignore case
+  keywfilter_T b_keywfilter;            // filter for b_keywtab
+  keywfilter_T b_keywfilter_ic;         // filter for b_keywtab_ic
   int b_syn_error;                      // TRUE when error occurred in HL
   bool b_syn_slow;                      // true when 'redrawtime' reached
   int b_syn_ic;                         // ignore case for :syn cmds
@@ -641,6 +650,9 @@ struct file_buffer {
   long b_u_seq_cur;             // hu_seq of header below which we are now
   time_t b_u_time_cur;          // uh_time of header below which we are now
   long b_u_save_nr_cur;         // file write nr after which we are now
+  undofile_T b_u_file;          // undo file last written or read
+  size_t b_u_mem;               // memory used by entries of synced headers
+  undospill_T b_u_spill;        // entries moved out of memory
 
   /*
    * variables for "U" command in undo.c
@@ -852,8 +864,10 @@ struct file_buffer {
   synblock_T b_s;               // Info related to syntax highlighting.  w_s
                                 // normally points to this, but some windows
                                 // may use a different synblock_T.
+  synsaved_T *b_sst_saved;      // syntax states of b_s kept while unloaded
 
-  sign_entry_T *b_signlist;     // list of placed signs
+  kvec_t(sign_entry_T *) b_signlist;  // placed signs, sorted by line
+                                      // number and priority
   int b_signcols;               // last calculated number of sign columns
   bool b_signcols_valid;        // calculated sign columns is valid
 
@@ -1339,6 +1353,9 @@ struct window_S {
   int w_lines_valid;                // number of valid entries
   wline_T *w_lines;
 
+  DecorCache w_decor_cache;         // decorations cached for lines, see
+                                    // decor_cache_replay()
+
   garray_T w_folds;                 // array of nested folds
   bool w_fold_manual;               // when true: some folds are opened/closed
                                     // manually
@@ -9,6 +9,7 @@
 #include "nvim/change.h"
 #include "nvim/charset.h"
 #include "nvim/cursor.h"
+#include "nvim/decoration.h"
 #include "nvim/diff.h"
 #include "nvim/edit.h"
 #include "nvim/eval.h"
@@ -281,6 +282,7 @@ static void changed_common(linenr_T lnum, colnr_T col, linenr_T lnume, long xtra
           }
         }
       }
+      decor_cache_changed(wp, lnum, lnume, xtra);
 
       // Take care of side effects for setting w_topline when folds have
       // changed.  Esp. when the buffer was changed in another window.
@@ -909,6 +909,32 @@ Dictionary channel_info(uint64_t id)
   return info;
 }
 
+/// @return  The number of bytes of memory used for RPC messages: the read
+///          buffers, unpackers and data waiting to be written.
+size_t channel_rpc_mem_size(void)
+{
+  size_t size = 0;
+  Channel *channel;
+  map_foreach_value(&channels, channel, {
+    if (!channel->is_rpc) {
+      continue;
+    }
+    if (channel->rpc.unpacker) {
+      size += channel->rpc.unpacker->used + channel->rpc.unpacker->free;
+    }
+    if (channel->streamtype == kChannelStreamInternal
+        || channel->streamtype == kChannelStreamStderr) {
+      continue;
+    }
+    Stream *out = channel_outstream(channel);
+    if (out->buffer) {
+      size += rbuffer_capacity(out->buffer);
+    }
+    size += channel_instream(channel)->curmem;
+  });
+  return size;
+}
+
 Array channel_all_info(void)
 {
   Channel *channel;
@@ -15,6 +15,12 @@
 
 static PMap(uint64_t) hl_decors;
 
+// ephemeral decorations set for the line being captured by
+// decor_cache_start()
+static DecorRanges decor_captured = KV_INITIAL_VALUE;
+static int decor_capture_row = -1;  // -1 when not capturing
+static bool decor_capture_ok = false;  // all of them can be cached
+
 /// Add highlighting to a buffer, bounded by two cursor positions,
 /// with an offset.
 ///
@@ -129,6 +135,30 @@ void clear_virttext(VirtText *text)
   *text = (VirtText)KV_INITIAL_VALUE;
 }
 
+/// @return  The number of bytes of memory used by "decor", zero when it is
+///          shared.
+size_t decor_mem_size(Decoration *decor)
+{
+  if (!decor || decor->shared) {
+    return 0;
+  }
+  size_t size = sizeof(Decoration) + virttext_mem_size(&decor->virt_text)
+                + kv_max(decor->virt_lines) * sizeof(struct virt_line);
+  for (size_t i = 0; i < kv_size(decor->virt_lines); i++) {
+    size += virttext_mem_size(&kv_A(decor->virt_lines, i).line);
+  }
+  return size;
+}
+
+static size_t virttext_mem_size(VirtText *text)
+{
+  size_t size = kv_max(*text) * sizeof(VirtTextChunk);
+  for (size_t i = 0; i < kv_size(*text); i++) {
+    size += strlen(kv_A(*text, i).text) + 1;
+  }
+  return size;
+}
+
 Decoration *decor_find_virttext(buf_T *buf, int row, uint64_t ns_id)
 {
   MarkTreeIter itr[1] = { 0 };
@@ -174,53 +204,29 @@ bool decor_redraw_start(buf_T *buf, int top_row, DecorState *state)
   if (!state->itr->node) {
     return false;
   }
-  marktree_itr_rewind(buf->b_marktree, state->itr);
-  while (true) {
-    mtmark_t mark = marktree_itr_current(state->itr);
-    if (mark.row < 0) {  // || mark.row > end_row
-      break;
-    }
-    if ((mark.row < top_row && mark.id&MARKTREE_END_FLAG)
-        || marktree_decor_level(mark.id) < kDecorLevelVisible) {
-      goto next_mark;
+
+  // The ranges which start above the window and end in it. The marks from
+  // "top_row" on are handled by decor_redraw_col() as they are reached.
+  mtoverlap_t overlap = KV_INITIAL_VALUE;
+  marktree_overlap(buf->b_marktree, top_row, 0, &overlap);
+  for (size_t i = 0; i < kv_size(overlap); i++) {
+    mtmark_t mark = kv_A(overlap, i);
+    if (marktree_decor_level(mark.id) < kDecorLevelVisible) {
+      continue;
     }
 
-    uint64_t start_id = mark.id & ~MARKTREE_END_FLAG;
     ExtmarkItem *item = map_ref(uint64_t, ExtmarkItem)(buf->b_extmark_index,
-                                                       start_id, false);
+                                                       mark.id, false);
     if (!item || !item->decor) {
-      goto next_mark;
-    }
-    Decoration *decor = item->decor;
-
-    mtpos_t altpos = marktree_lookup(buf->b_marktree,
-                                     mark.id^MARKTREE_END_FLAG, NULL);
-
-    if ((!(mark.id&MARKTREE_END_FLAG) && altpos.row < top_row
-         && !kv_size(decor->virt_text))
-        || ((mark.id&MARKTREE_END_FLAG) && altpos.row >= top_row)) {
-      goto next_mark;
-    }
-
-    if (mark.id&MARKTREE_END_FLAG) {
-      decor_add(state, altpos.row, altpos.col, mark.row, mark.col,
-                decor, false);
-    } else {
-      if (altpos.row == -1) {
-        altpos.row = mark.row;
-        altpos.col = mark.col;
-      }
-      decor_add(state, mark.row, mark.col, altpos.row, altpos.col,
-                decor, false);
+      continue;
     }
 
-next_mark:
-    if (marktree_itr_node_done(state->itr)) {
-      marktree_itr_next(buf->b_marktree, state->itr);
-      break;
-    }
-    marktree_itr_next(buf->b_marktree, state->itr);
+    mtpos_t endpos = marktree_lookup(buf->b_marktree,
+                                     mark.id|MARKTREE_END_FLAG, NULL);
+    decor_add(state, mark.row, mark.col, endpos.row, endpos.col,
+              item->decor, false);
   }
+  kv_destroy(overlap);
 
   return true;  // TODO(bfredl): check if available in the region
 }
@@ -379,9 +385,211 @@ void decor_add_ephemeral(int start_row, int start_col, int end_row, int end_col,
     end_row = start_row;
     end_col = start_col;
   }
+  if (decor_capture_row >= 0) {
+    decor_capture(start_row, start_col, end_row, end_col, decor);
+  }
   decor_add(&decor_state, start_row, start_col, end_row, end_col, decor, true);
 }
 
+static VirtText virttext_copy(VirtText *text)
+{
+  VirtText copy = VIRTTEXT_EMPTY;
+  for (size_t i = 0; i < kv_size(*text); i++) {
+    VirtTextChunk chunk = kv_A(*text, i);
+    kv_push(copy, ((VirtTextChunk){ .text = xstrdup(chunk.text),
+                                    .hl_id = chunk.hl_id }));
+  }
+  return copy;
+}
+
+static void decor_capture(int start_row, int start_col, int end_row, int end_col,
+                          Decoration *decor)
+{
+  int row = decor_capture_row;
+  if (start_row != row || end_row > row + 1 || (end_row == row + 1 && end_col > 0)
+      || kv_size(decor->virt_lines)) {
+    // Only a decoration within the line is valid as long as the line is.
+    decor_capture_ok = false;
+    return;
+  }
+  Decoration copy = *decor;
+  copy.virt_text = virttext_copy(&decor->virt_text);
+  copy.virt_lines = (VirtLines)KV_INITIAL_VALUE;
+  kv_push(decor_captured, ((DecorRange){ .start_row = 0, .start_col = start_col,
+                                         .end_row = end_row - row, .end_col = end_col,
+                                         .decor = copy, .attr_id = 0,
+                                         .virt_text_owned = true, .win_col = -1 }));
+}
+
+static void decor_cache_items_free(DecorCacheLine *line)
+{
+  for (size_t i = 0; i < kv_size(line->items); i++) {
+    clear_virttext(&kv_A(line->items, i).decor.virt_text);
+  }
+  kv_destroy(line->items);
+}
+
+/// @return  index of the first cached line at or after line "lnum" of "ns_id"
+static size_t decor_cache_find(DecorCache *cache, NS ns_id, linenr_T lnum)
+{
+  size_t lo = 0;
+  size_t hi = kv_size(cache->lines);
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    DecorCacheLine *line = &kv_A(cache->lines, mid);
+    if (line->lnum < lnum || (line->lnum == lnum && line->ns_id < ns_id)) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+/// Add the decorations cached for line "lnum" of "ns_id" in window "wp", as
+/// if the on_line callback of the provider had set them again.
+///
+/// @return  false when nothing is cached for the line, the callback must be
+///          invoked.
+bool decor_cache_replay(win_T *wp, NS ns_id, linenr_T lnum)
+{
+  DecorCache *cache = &wp->w_decor_cache;
+  if (cache->buf != wp->w_buffer->handle) {
+    decor_cache_clear(wp);
+    cache->buf = wp->w_buffer->handle;
+    return false;
+  }
+  size_t i = decor_cache_find(cache, ns_id, lnum);
+  if (i == kv_size(cache->lines) || kv_A(cache->lines, i).lnum != lnum
+      || kv_A(cache->lines, i).ns_id != ns_id) {
+    return false;
+  }
+  DecorCacheLine *line = &kv_A(cache->lines, i);
+  int row = (int)lnum - 1;
+  for (size_t j = 0; j < kv_size(line->items); j++) {
+    DecorRange item = kv_A(line->items, j);
+    Decoration decor = item.decor;
+    decor.virt_text = virttext_copy(&item.decor.virt_text);
+    decor_add(&decor_state, row, item.start_col, row + item.end_row, item.end_col, &decor, true);
+  }
+  return true;
+}
+
+/// Start collecting the ephemeral decorations set for line "lnum" by an
+/// on_line callback.
+void decor_cache_start(linenr_T lnum)
+{
+  decor_capture_row = (int)lnum - 1;
+  decor_capture_ok = true;
+}
+
+/// Stop collecting the decorations of line "lnum", and cache them for
+/// window "wp" when the callback of "ns_id" asked for that.
+void decor_cache_finish(win_T *wp, NS ns_id, linenr_T lnum, bool cache_line)
+{
+  decor_capture_row = -1;
+  DecorCache *cache = &wp->w_decor_cache;
+  if (!cache_line || !decor_capture_ok || cache->buf != wp->w_buffer->handle) {
+    DecorCacheLine line = { .items = decor_captured };
+    decor_cache_items_free(&line);
+    decor_captured = (DecorRanges)KV_INITIAL_VALUE;
+    return;
+  }
+
+  size_t i = decor_cache_find(cache, ns_id, lnum);
+  if (i < kv_size(cache->lines) && kv_A(cache->lines, i).lnum == lnum
+      && kv_A(cache->lines, i).ns_id == ns_id) {
+    decor_cache_items_free(&kv_A(cache->lines, i));
+  } else {
+    (void)kv_pushp(cache->lines);
+    memmove(&kv_A(cache->lines, i + 1), &kv_A(cache->lines, i),
+            (kv_size(cache->lines) - i - 1) * sizeof(DecorCacheLine));
+  }
+  kv_A(cache->lines, i) = (DecorCacheLine){ .ns_id = ns_id, .lnum = lnum,
+                                            .items = decor_captured };
+  decor_captured = (DecorRanges)KV_INITIAL_VALUE;
+}
+
+/// Forget the decorations cached for the lines "lnum" up to "lnume" (not
+/// included) in window "wp", and move the ones below by "xtra" lines.
+void decor_cache_changed(win_T *wp, linenr_T lnum, linenr_T lnume, long xtra)
+{
+  DecorCache *cache = &wp->w_decor_cache;
+  size_t j = 0;
+  for (size_t i = 0; i < kv_size(cache->lines); i++) {
+    DecorCacheLine line = kv_A(cache->lines, i);
+    if (line.lnum >= lnum && line.lnum < lnume) {
+      decor_cache_items_free(&line);
+      continue;
+    }
+    if (line.lnum >= lnume) {
+      line.lnum += (linenr_T)xtra;
+    }
+    kv_A(cache->lines, j++) = line;
+  }
+  kv_size(cache->lines) = j;
+}
+
+/// Forget the decorations cached for the lines "lnum" up to "lnume" (not
+/// included) of "buf", in all windows.
+void decor_cache_invalidate(buf_T *buf, linenr_T lnum, linenr_T lnume)
+{
+  FOR_ALL_TAB_WINDOWS(tp, wp) {
+    if (wp->w_buffer == buf) {
+      decor_cache_changed(wp, lnum, lnume, 0);
+    }
+  }
+}
+
+/// Forget the decorations cached for the lines outside of "top" to "bot" in
+/// window "wp".
+void decor_cache_prune(win_T *wp, linenr_T top, linenr_T bot)
+{
+  DecorCache *cache = &wp->w_decor_cache;
+  if (cache->buf != wp->w_buffer->handle) {
+    // The window shows another buffer now.  Changes to the cached one are
+    // not applied to the cache while it is not in this window.
+    decor_cache_clear(wp);
+    cache->buf = wp->w_buffer->handle;
+    return;
+  }
+  decor_cache_changed(wp, 1, top, 0);
+  decor_cache_changed(wp, bot + 1, MAXLNUM, 0);
+}
+
+/// Forget the decorations cached for provider "ns_id" in all windows.
+void decor_cache_clear_ns(NS ns_id)
+{
+  FOR_ALL_TAB_WINDOWS(tp, wp) {
+    DecorCache *cache = &wp->w_decor_cache;
+    size_t j = 0;
+    for (size_t i = 0; i < kv_size(cache->lines); i++) {
+      DecorCacheLine line = kv_A(cache->lines, i);
+      if (line.ns_id == ns_id) {
+        decor_cache_items_free(&line);
+      } else {
+        kv_A(cache->lines, j++) = line;
+      }
+    }
+    kv_size(cache->lines) = j;
+  }
+}
+
+void decor_cache_clear(win_T *wp)
+{
+  DecorCache *cache = &wp->w_decor_cache;
+  for (size_t i = 0; i < kv_size(cache->lines); i++) {
+    decor_cache_items_free(&kv_A(cache->lines, i));
+  }
+  kv_size(cache->lines) = 0;
+}
+
+void decor_cache_free(win_T *wp)
+{
+  decor_cache_clear(wp);
+  kv_destroy(wp->w_decor_cache.lines);
+}
+
 
 DecorProvider *get_decor_provider(NS ns_id, bool force)
 {
@@ -63,6 +63,14 @@ typedef struct {
   int win_col;
 } DecorRange;
 
+typedef kvec_t(DecorRange) DecorRanges;
+
+struct decor_cache_line {
+  NS ns_id;
+  linenr_T lnum;
+  DecorRanges items;  // rows relative to the line
+};
+
 typedef struct {
   MarkTreeIter itr[1];
   kvec_t(DecorRange) active;
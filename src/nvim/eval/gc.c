@@ -3,6 +3,7 @@
 
 #include "nvim/eval/gc.h"
 #include "nvim/eval/typval.h"
+#include "nvim/vim.h"
 
 #ifdef INCLUDE_GENERATED_DECLARATIONS
 # include "eval/gc.c.generated.h"
@@ -12,3 +13,42 @@
 dict_T *gc_first_dict = NULL;
 /// Head of list of all lists
 list_T *gc_first_list = NULL;
+
+/// Estimate the number of bytes of memory used by all lists and dictionaries,
+/// including the strings and blobs in them.
+size_t gc_mem_size(void)
+{
+  size_t size = 0;
+  for (list_T *l = gc_first_list; l != NULL; l = l->lv_used_next) {
+    size += sizeof(list_T);
+    TV_LIST_ITER_CONST(l, li, {
+      size += sizeof(listitem_T) + gc_tv_mem_size(TV_LIST_ITEM_TV(li));
+    });
+  }
+  for (dict_T *d = gc_first_dict; d != NULL; d = d->dv_used_next) {
+    size += sizeof(dict_T);
+    if (d->dv_hashtab.ht_array != d->dv_hashtab.ht_smallarray) {
+      size += (d->dv_hashtab.ht_mask + 1) * sizeof(hashitem_T);
+    }
+    TV_DICT_ITER(d, di, {
+      size += sizeof(dictitem_T) + STRLEN(di->di_key)
+              + gc_tv_mem_size(&di->di_tv);
+    });
+  }
+  return size;
+}
+
+/// @return  Bytes allocated for the value of "tv" itself, not counting lists
+///          and dictionaries.
+static size_t gc_tv_mem_size(const typval_T *tv)
+{
+  switch (tv->v_type) {
+  case VAR_STRING:
+    return tv->vval.v_string == NULL ? 0 : STRLEN(tv->vval.v_string) + 1;
+  case VAR_BLOB:
+    return tv->vval.v_blob == NULL
+           ? 0 : sizeof(blob_T) + (size_t)tv->vval.v_blob->bv_ga.ga_maxlen;
+  default:
+    return 0;
+  }
+}
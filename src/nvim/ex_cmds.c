@@ -2309,6 +2309,10 @@ int do_ecmd(int fnum, char_u *ffname, char_u *sfname, exarg_T *eap, linenr_T new
     command = eap->do_ecmd_cmd;
   }
 
+  // Finish writing the current buffer in the background before it may be
+  // unloaded, the BufWritePost autocommands may change it.
+  buf_write_wait(curbuf);
+
   set_bufref(&old_curbuf, curbuf);
 
   if (fnum != 0) {
@@ -3474,6 +3478,8 @@ static buf_T *do_sub(exarg_T *eap, proftime_T timeout, bool do_buf_event, handle
   bool preview = (State & CMDPREVIEW);
 
   bool did_save = false;
+  // The marks in a line are moved once for all substitutions in it.
+  ExtmarkSpliceBatch splice_batch = EXTMARK_SPLICE_BATCH_INIT;
 
   if (!global_busy) {
     sub_nsubs = 0;
@@ -3804,6 +3810,8 @@ static buf_T *do_sub(exarg_T *eap, proftime_T timeout, bool do_buf_event, handle
         if (subflags.do_ask && !preview) {
           int typed = 0;
 
+          extmark_splice_batch_flush(&splice_batch);
+
           // change State to CONFIRM, so that the mouse works
           // properly
           int save_State = State;
@@ -4049,6 +4057,10 @@ static buf_T *do_sub(exarg_T *eap, proftime_T timeout, bool do_buf_event, handle
           // Save flags for recursion.  They can change for e.g.
           // :s/^/\=execute("s#^##gn")
           subflags_T subflags_save = subflags;
+          if (sub[0] == '\\' && sub[1] == '=') {
+            // the expression may look at the marks
+            extmark_splice_batch_flush(&splice_batch);
+          }
           // get length of substitution part
           sublen = vim_regsub_multi(&regmatch,
                                     sub_firstlnum - regmatch.startpos[0].lnum,
@@ -4164,9 +4176,9 @@ static buf_T *do_sub(exarg_T *eap, proftime_T timeout, bool do_buf_event, handle
             u_save_cursor();
             did_save = true;
           }
-          extmark_splice(curbuf, lnum_start-1, start_col,
-                         end.lnum-start.lnum, matchcols, replaced_bytes,
-                         lnum-lnum_start, subcols, sublen-1, kExtmarkUndo);
+          extmark_splice_batch_add(&splice_batch, curbuf, lnum_start-1, start_col,
+                                   end.lnum-start.lnum, matchcols, replaced_bytes,
+                                   lnum-lnum_start, subcols, sublen-1, kExtmarkUndo);
         }
 
 
@@ -4323,6 +4335,8 @@ skip:
     }
   }
 
+  extmark_splice_batch_flush(&splice_batch);
+  kv_destroy(splice_batch.edits);
   curbuf->deleted_bytes2 = 0;
 
   if (first_line != 0) {
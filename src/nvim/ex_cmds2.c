@@ -512,6 +512,9 @@ bool check_changed(buf_T *buf, int flags)
 {
   int forceit = (flags & CCGD_FORCEIT);
   bufref_T bufref;
+
+  // 'modified' is reset when a write in the background is done.
+  buf_write_wait(buf);
   set_bufref(&bufref, buf);
 
   if (!forceit
@@ -674,6 +677,8 @@ bool check_changed_any(bool hidden, bool unload)
   size_t bufcount = 0;
   int *bufnrs;
 
+  buf_write_wait(NULL);
+
   // Make a list of all buffers, with the most important ones first.
   FOR_ALL_BUFFERS(buf) {
     bufcount++;
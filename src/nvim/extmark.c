@@ -44,6 +44,11 @@
 #include "nvim/undo.h"
 #include "nvim/vim.h"
 
+// The marks of a namespace are found through its map of mark ids, instead
+// of by going over all the marks in a range, when the range is expected to
+// have NS_INDEX_RATIO times more marks than the namespace.
+#define NS_INDEX_RATIO 8
+
 #ifdef INCLUDE_GENERATED_DECLARATIONS
 # include "extmark.c.generated.h"
 #endif
@@ -68,13 +73,7 @@ uint64_t extmark_set(buf_T *buf, uint64_t ns_id, uint64_t *idp, int row, colnr_T
   uint64_t mark = 0;
   uint64_t id = idp ? *idp : 0;
 
-  uint8_t decor_level = kDecorLevelNone;  // no decor
-  if (decor) {
-    decor_level = kDecorLevelVisible;  // decor affects redraw
-    if (kv_size(decor->virt_lines)) {
-      decor_level = kDecorLevelVirtLine;  // decor affects horizontal size
-    }
-  }
+  uint8_t decor_level = extmark_decor_level(decor);
 
   if (id == 0) {
     id = ns->free_id++;
@@ -136,6 +135,109 @@ revised:
   return mark;
 }
 
+static uint8_t extmark_decor_level(Decoration *decor)
+{
+  uint8_t decor_level = kDecorLevelNone;  // no decor
+  if (decor) {
+    decor_level = kDecorLevelVisible;  // decor affects redraw
+    if (kv_size(decor->virt_lines)) {
+      decor_level = kDecorLevelVirtLine;  // decor affects horizontal size
+    }
+  }
+  return decor_level;
+}
+
+/// Create or update "count" extmarks
+///
+/// Does the same as extmark_set() with kExtmarkNoUndo for each mark, but the
+/// new marks are put in the tree together with marktree_batch_flush().
+///
+/// @param clear  first delete all other marks of the namespace
+void extmark_set_many(buf_T *buf, uint64_t ns_id, ExtmarkPut *marks, size_t count, bool clear)
+{
+  ExtmarkNs *ns = buf_ns_ref(buf, ns_id, true);
+  assert(ns != NULL);
+  bool rebuild = false;
+
+  if (clear && map_size(ns->map)) {
+    // Forget the old marks, they are dropped from the tree when it is built
+    // again by marktree_batch_flush().
+    uint64_t mark;
+    map_foreach_value(ns->map, mark, {
+      ExtmarkItem item = map_del(uint64_t, ExtmarkItem)(buf->b_extmark_index, mark);
+      if (item.decor) {
+        int row = marktree_lookup(buf->b_marktree, mark, NULL).row;
+        int row2 = row;
+        if (mark & MARKTREE_PAIRED_FLAG) {
+          row2 = marktree_lookup(buf->b_marktree, mark|MARKTREE_END_FLAG, NULL).row;
+        }
+        decor_remove(buf, row, row2, item.decor);
+      }
+    });
+    map_clear(uint64_t, uint64_t)(ns->map);
+    rebuild = true;
+  }
+
+  mtbatch_t batch = KV_INITIAL_VALUE;
+  for (size_t i = 0; i < count; i++) {
+    ExtmarkPut *m = &marks[i];
+    uint64_t id = m->mark_id;
+
+    if (id == 0) {
+      id = ns->free_id++;
+    } else {
+      uint64_t old_mark = map_get(uint64_t, uint64_t)(ns->map, id);
+      if (old_mark) {
+        if (!pmap_get(uint64_t)(buf->b_marktree->id2node, old_mark)) {
+          // The same id was used before in this batch.
+          extmark_batch_flush(buf, &batch, rebuild);
+          rebuild = false;
+        }
+        extmark_del(buf, ns_id, id);
+      } else {
+        ns->free_id = MAX(ns->free_id, id+1);
+      }
+    }
+
+    uint8_t decor_level = extmark_decor_level(m->decor);
+    uint64_t mark;
+    if (m->end_row > -1) {
+      mark = marktree_batch_put_pair(buf->b_marktree, &batch, m->row, m->col, m->right_gravity,
+                                     m->end_row, m->end_col, m->end_right_gravity, decor_level);
+    } else {
+      mark = marktree_batch_put(buf->b_marktree, &batch, m->row, m->col, m->right_gravity,
+                                decor_level);
+    }
+
+    map_put(uint64_t, ExtmarkItem)(buf->b_extmark_index, mark,
+                                   (ExtmarkItem){ ns_id, id, m->decor });
+    map_put(uint64_t, uint64_t)(ns->map, id, mark);
+
+    if (m->decor) {
+      if (kv_size(m->decor->virt_lines)) {
+        buf->b_virt_line_blocks++;
+      }
+      decor_redraw(buf, m->row, m->end_row > -1 ? m->end_row : m->row, m->decor);
+    }
+    m->mark_id = id;
+  }
+
+  extmark_batch_flush(buf, &batch, rebuild);
+  kv_destroy(batch);
+}
+
+static void extmark_batch_flush(buf_T *buf, mtbatch_t *batch, bool drop_unknown)
+{
+  marktree_batch_flush(buf->b_marktree, batch, drop_unknown ? extmark_is_known : NULL, buf);
+}
+
+// Marks that are not in the index anymore are dropped from the tree.
+static bool extmark_is_known(uint64_t id, void *data)
+{
+  buf_T *buf = data;
+  return map_has(uint64_t, ExtmarkItem)(buf->b_extmark_index, id & ~MARKTREE_END_FLAG);
+}
+
 static bool extmark_setraw(buf_T *buf, uint64_t mark, int row, colnr_T col)
 {
   MarkTreeIter itr[1] = { 0 };
@@ -209,8 +311,9 @@ bool extmark_clear(buf_T *buf, uint64_t ns_id, int l_row, colnr_T l_col, int u_r
       return false;
     }
 
-    // TODO(bfredl): if map_size(ns->map) << buf->b_marktree.n_nodes
-    // it could be faster to iterate over the map instead
+    if (extmark_use_ns_index(buf, ns, l_row, u_row)) {
+      return extmark_clear_ns(buf, ns, l_row, l_col, u_row, u_col);
+    }
   }
 
   // the value is either zero or the lnum (row+1) if highlight was present.
@@ -290,49 +393,215 @@ bool extmark_clear(buf_T *buf, uint64_t ns_id, int l_row, colnr_T l_col, int u_r
 // will be searched to the start, or end
 // dir can be set to control the order of the array
 // amount = amount of marks to find or -1 for all
+// overlap = also find the marks which start before the range and end in it
 ExtmarkInfoArray extmark_get(buf_T *buf, uint64_t ns_id, int l_row, colnr_T l_col, int u_row,
-                             colnr_T u_col, int64_t amount, bool reverse)
+                             colnr_T u_col, int64_t amount, bool reverse, bool overlap)
 {
   ExtmarkInfoArray array = KV_INITIAL_VALUE;
-  MarkTreeIter itr[1];
-  // Find all the marks
-  marktree_itr_get_ext(buf->b_marktree, (mtpos_t){ l_row, l_col },
-                       itr, reverse, false, NULL);
-  int order = reverse ? -1 : 1;
-  while ((int64_t)kv_size(array) < amount) {
-    mtmark_t mark = marktree_itr_current(itr);
-    mtpos_t endpos = { -1, -1 };
-    if (mark.row < 0
-        || (mark.row - u_row) * order > 0
-        || (mark.row == u_row && (mark.col - u_col) * order > 0)) {
-      break;
+  mtoverlap_t before = KV_INITIAL_VALUE;
+  if (overlap) {
+    if (reverse) {
+      marktree_overlap(buf->b_marktree, u_row, u_col, &before);
+    } else {
+      marktree_overlap(buf->b_marktree, l_row, l_col, &before);
+      extmark_get_overlap(buf, ns_id, &before, amount, false, &array);
+    }
+  }
+
+  ExtmarkNs *ns = buf_ns_ref(buf, ns_id, false);
+  if (ns == NULL) {
+    // no marks in this buffer
+  } else if (extmark_use_ns_index(buf, ns, MIN(l_row, u_row), MAX(l_row, u_row))) {
+    extmark_get_ns(buf, ns, (mtpos_t){ l_row, l_col }, (mtpos_t){ u_row, u_col },
+                   amount, reverse, &array);
+  } else {
+    MarkTreeIter itr[1];
+    // Find all the marks
+    marktree_itr_get_ext(buf->b_marktree, (mtpos_t){ l_row, l_col },
+                         itr, reverse, false, NULL);
+    int order = reverse ? -1 : 1;
+    while ((int64_t)kv_size(array) < amount) {
+      mtmark_t mark = marktree_itr_current(itr);
+      mtpos_t endpos = { -1, -1 };
+      if (mark.row < 0
+          || (mark.row - u_row) * order > 0
+          || (mark.row == u_row && (mark.col - u_col) * order > 0)) {
+        break;
+      }
+      if (mark.id & MARKTREE_END_FLAG) {
+        goto next_mark;
+      } else if (mark.id & MARKTREE_PAIRED_FLAG) {
+        endpos = marktree_lookup(buf->b_marktree, mark.id | MARKTREE_END_FLAG,
+                                 NULL);
+      }
+
+
+      ExtmarkItem item = map_get(uint64_t, ExtmarkItem)(buf->b_extmark_index,
+                                                        mark.id);
+      if (item.ns_id == ns_id) {
+        kv_push(array, ((ExtmarkInfo) { .ns_id = item.ns_id,
+                                        .mark_id = item.mark_id,
+                                        .row = mark.row, .col = mark.col,
+                                        .end_row = endpos.row,
+                                        .end_col = endpos.col,
+                                        .decor = item.decor }));
+      }
+next_mark:
+      if (reverse) {
+        marktree_itr_prev(buf->b_marktree, itr);
+      } else {
+        marktree_itr_next(buf->b_marktree, itr);
+      }
+    }
+  }
+
+  if (reverse) {
+    extmark_get_overlap(buf, ns_id, &before, amount, true, &array);
+  }
+  kv_destroy(before);
+  return array;
+}
+
+// Whether the marks of "ns" in rows "l_row" to "u_row" should be found through
+// ns->map. Assumes the marks are spread evenly over the lines of the buffer.
+static bool extmark_use_ns_index(buf_T *buf, ExtmarkNs *ns, int l_row, int u_row)
+{
+  int64_t lines = MAX(buf->b_ml.ml_line_count, 1);
+  int64_t rows = MIN((int64_t)u_row - l_row + 1, lines);
+  int64_t range_keys = (int64_t)buf->b_marktree->n_keys * rows / lines;
+  return (int64_t)map_size(ns->map) * NS_INDEX_RATIO < range_keys;
+}
+
+// Whether (row, col) is between "l" and "u", inclusive.
+static bool extmark_in_range(int row, colnr_T col, mtpos_t l, mtpos_t u)
+{
+  return (row > l.row || (row == l.row && col >= l.col))
+         && (row < u.row || (row == u.row && col <= u.col));
+}
+
+// extmark_clear() for one namespace, which only looks at the marks of "ns".
+static bool extmark_clear_ns(buf_T *buf, ExtmarkNs *ns, int l_row, colnr_T l_col, int u_row,
+                             colnr_T u_col)
+{
+  mtpos_t l = { l_row, l_col }, u = { u_row, u_col };
+  static kvec_t(uint64_t) found;
+  uint64_t mark;
+  map_foreach_value(ns->map, mark, {
+    mtpos_t pos = marktree_lookup(buf->b_marktree, mark, NULL);
+    mtpos_t endpos = pos;
+    if (mark & MARKTREE_PAIRED_FLAG) {
+      endpos = marktree_lookup(buf->b_marktree, mark|MARKTREE_END_FLAG, NULL);
+    }
+    if (extmark_in_range(pos.row, pos.col, l, u)
+        || extmark_in_range(endpos.row, endpos.col, l, u)) {
+      kv_push(found, mark);
+    }
+  });
+
+  MarkTreeIter itr[1] = { 0 };
+  for (size_t i = 0; i < kv_size(found); i++) {
+    mark = kv_A(found, i);
+    ExtmarkItem item = map_del(uint64_t, ExtmarkItem)(buf->b_extmark_index, mark);
+    map_del(uint64_t, uint64_t)(ns->map, item.mark_id);
+    int row = marktree_lookup(buf->b_marktree, mark, itr).row;
+    marktree_del_itr(buf->b_marktree, itr, false);
+    int row2 = row;
+    if (mark & MARKTREE_PAIRED_FLAG) {
+      row2 = marktree_lookup(buf->b_marktree, mark|MARKTREE_END_FLAG, itr).row;
+      if (itr->node) {
+        marktree_del_itr(buf->b_marktree, itr, false);
+      }
+    }
+    if (item.decor) {
+      decor_remove(buf, row, row2, item.decor);
     }
-    if (mark.id & MARKTREE_END_FLAG) {
-      goto next_mark;
-    } else if (mark.id & MARKTREE_PAIRED_FLAG) {
-      endpos = marktree_lookup(buf->b_marktree, mark.id | MARKTREE_END_FLAG,
-                               NULL);
+  }
+
+  bool marks_cleared = kv_size(found) > 0;
+  kv_size(found) = 0;
+  return marks_cleared;
+}
+
+typedef struct {
+  mtmark_t mark;
+  ExtmarkInfo info;
+} ExtmarkFound;
+
+// Sort marks like the marktree does: the left gravity marks at a position
+// come before the right gravity ones.
+static int extmark_found_cmp(const void *a, const void *b)
+{
+  const mtmark_t *x = &((const ExtmarkFound *)a)->mark;
+  const mtmark_t *y = &((const ExtmarkFound *)b)->mark;
+  if (x->row != y->row) {
+    return x->row < y->row ? -1 : 1;
+  } else if (x->col != y->col) {
+    return x->col < y->col ? -1 : 1;
+  } else if (x->right_gravity != y->right_gravity) {
+    return x->right_gravity ? 1 : -1;
+  } else if (x->id != y->id) {
+    return x->id < y->id ? -1 : 1;
+  }
+  return 0;
+}
+
+// extmark_get() which only looks at the marks of "ns". The marks which start
+// between "from" and "to" are sorted in the order they have in the marktree.
+static void extmark_get_ns(buf_T *buf, ExtmarkNs *ns, mtpos_t from, mtpos_t to, int64_t amount,
+                           bool reverse, ExtmarkInfoArray *array)
+{
+  mtpos_t l = reverse ? to : from, u = reverse ? from : to;
+  kvec_t(ExtmarkFound) found = KV_INITIAL_VALUE;
+  MarkTreeIter itr[1] = { 0 };
+  uint64_t mark_id, mark;
+  map_foreach(ns->map, mark_id, mark, {
+    marktree_lookup(buf->b_marktree, mark, itr);
+    mtmark_t m = marktree_itr_current(itr);
+    if (!extmark_in_range(m.row, m.col, l, u)) {
+      continue;
     }
+    mtpos_t endpos = ((mark & MARKTREE_PAIRED_FLAG)
+                      ? marktree_lookup(buf->b_marktree, mark|MARKTREE_END_FLAG, NULL)
+                      : (mtpos_t){ -1, -1 });
+    ExtmarkItem item = map_get(uint64_t, ExtmarkItem)(buf->b_extmark_index, mark);
+    kv_push(found, ((ExtmarkFound) {
+      .mark = m,
+      .info = { .ns_id = item.ns_id, .mark_id = mark_id,
+                .row = m.row, .col = m.col,
+                .end_row = endpos.row, .end_col = endpos.col,
+                .decor = item.decor } }));
+  });
 
+  size_t n = kv_size(found);
+  qsort(found.items, n, sizeof(ExtmarkFound), extmark_found_cmp);
+  for (size_t i = 0; i < n && (int64_t)kv_size(*array) < amount; i++) {
+    kv_push(*array, kv_A(found, reverse ? n - 1 - i : i).info);
+  }
+  kv_destroy(found);
+}
 
+// Add the pairs found by marktree_overlap() which are in namespace "ns_id"
+// to "array", until it has "amount" marks.
+static void extmark_get_overlap(buf_T *buf, uint64_t ns_id, mtoverlap_t *overlap, int64_t amount,
+                                bool reverse, ExtmarkInfoArray *array)
+{
+  size_t n = kv_size(*overlap);
+  for (size_t i = 0; i < n && (int64_t)kv_size(*array) < amount; i++) {
+    mtmark_t mark = kv_A(*overlap, reverse ? n - 1 - i : i);
     ExtmarkItem item = map_get(uint64_t, ExtmarkItem)(buf->b_extmark_index,
                                                       mark.id);
-    if (item.ns_id == ns_id) {
-      kv_push(array, ((ExtmarkInfo) { .ns_id = item.ns_id,
-                                      .mark_id = item.mark_id,
-                                      .row = mark.row, .col = mark.col,
-                                      .end_row = endpos.row,
-                                      .end_col = endpos.col,
-                                      .decor = item.decor }));
-    }
-next_mark:
-    if (reverse) {
-      marktree_itr_prev(buf->b_marktree, itr);
-    } else {
-      marktree_itr_next(buf->b_marktree, itr);
+    if (item.ns_id != ns_id) {
+      continue;
     }
+    mtpos_t endpos = marktree_lookup(buf->b_marktree, mark.id | MARKTREE_END_FLAG,
+                                     NULL);
+    kv_push(*array, ((ExtmarkInfo) { .ns_id = item.ns_id,
+                                     .mark_id = item.mark_id,
+                                     .row = mark.row, .col = mark.col,
+                                     .end_row = endpos.row,
+                                     .end_col = endpos.col,
+                                     .decor = item.decor }));
   }
-  return array;
 }
 
 // Lookup an extmark by id
@@ -399,6 +668,26 @@ void extmark_free_all(buf_T *buf)
   map_init(uint64_t, ExtmarkItem, buf->b_extmark_index);
 }
 
+/// Get the number of bytes of memory used for the extmarks of "buf" in
+/// "marks" and for their decorations in "decor".
+void extmark_mem_size(buf_T *buf, size_t *marks, size_t *decor)
+{
+  ExtmarkNs ns;
+  ExtmarkItem item;
+
+  *marks = marktree_mem_size(buf->b_marktree)
+           + map_mem_size(buf->b_extmark_ns, uint64_t, ExtmarkNs)
+           + map_mem_size(buf->b_extmark_index, uint64_t, ExtmarkItem);
+  map_foreach_value(buf->b_extmark_ns, ns, {
+    *marks += map_mem_size(ns.map, uint64_t, uint64_t);
+  });
+
+  *decor = 0;
+  map_foreach_value(buf->b_extmark_index, item, {
+    *decor += decor_mem_size(item.decor);
+  });
+}
+
 
 // Save info for undo/redo of set marks
 static void u_extmark_set(buf_T *buf, uint64_t mark, int row, colnr_T col)
@@ -565,7 +854,14 @@ void extmark_splice(buf_T *buf, int start_row, colnr_T start_col, int old_row, c
                     bcount_t old_byte, int new_row, colnr_T new_col, bcount_t new_byte,
                     ExtmarkOp undo)
 {
-  long offset = ml_find_line_or_offset(buf, start_row + 1, NULL, true);
+  extmark_splice_impl(buf, start_row, start_col, extmark_line_offset(buf, start_row) + start_col,
+                      old_row, old_col, old_byte, new_row, new_col, new_byte,
+                      undo);
+}
+
+static bcount_t extmark_line_offset(buf_T *buf, int row)
+{
+  long offset = ml_find_line_or_offset(buf, row + 1, NULL, true);
 
   // On empty buffers, when editing the first line, the line is buffered,
   // causing offset to be < 0. While the buffer is not actually empty, the
@@ -576,9 +872,113 @@ void extmark_splice(buf_T *buf, int start_row, colnr_T start_col, int old_row, c
   if (offset < 0 && buf->b_ml.ml_chunksize == NULL) {
     offset = 0;
   }
-  extmark_splice_impl(buf, start_row, start_col, offset + start_col,
-                      old_row, old_col, old_byte, new_row, new_col, new_byte,
-                      undo);
+  return offset;
+}
+
+/// Like extmark_splice(), but the marks are only moved for the changes within
+/// a line by extmark_splice_batch_flush(), all at once. The changes in a line
+/// must come from left to right, with "start_col" in the line as changed by
+/// the changes before it. Buffer updates are still sent for each change.
+///
+/// A change in another line or buffer, or one spanning lines, flushes
+/// "batch" first.
+void extmark_splice_batch_add(ExtmarkSpliceBatch *batch, buf_T *buf, int start_row,
+                              colnr_T start_col, int old_row, colnr_T old_col, bcount_t old_byte,
+                              int new_row, colnr_T new_col, bcount_t new_byte, ExtmarkOp undo)
+{
+  if (batch->row >= 0) {
+    mtedit_t last = kv_last(batch->edits);
+    if (buf != batch->buf || start_row != batch->row || undo != batch->undo
+        || start_col - batch->delta < last.col + last.old_len) {
+      extmark_splice_batch_flush(batch);
+    }
+  }
+  if (old_row != 0 || new_row != 0) {
+    extmark_splice_batch_flush(batch);
+    extmark_splice(buf, start_row, start_col, old_row, old_col, old_byte,
+                   new_row, new_col, new_byte, undo);
+    return;
+  }
+
+  buf->deleted_bytes2 = 0;
+  buf_updates_send_splice(buf, start_row, start_col,
+                          extmark_line_offset(buf, start_row) + start_col,
+                          0, old_col, old_byte, 0, new_col, new_byte);
+  if (old_col == 0 && new_col == 0) {
+    return;
+  }
+
+  batch->buf = buf;
+  batch->row = start_row;
+  batch->undo = undo;
+  kv_push(batch->edits, ((mtedit_t){ .col = start_col - batch->delta,
+                                     .old_len = old_col, .new_len = new_col }));
+  batch->delta += new_col - old_col;
+}
+
+/// Move the marks for the changes collected in "batch".
+///
+/// For undo, the marks in the changed part of the line are saved before and
+/// after, around a single splice of that part.
+void extmark_splice_batch_flush(ExtmarkSpliceBatch *batch)
+{
+  if (batch->row < 0) {
+    return;
+  }
+  buf_T *buf = batch->buf;
+  int row = batch->row;
+  mtedit_t first = kv_A(batch->edits, 0);
+  mtedit_t last = kv_last(batch->edits);
+  colnr_T start_col = first.col;
+  colnr_T old_col = last.col + last.old_len - start_col;
+  colnr_T new_col = old_col + batch->delta;
+
+  u_header_T *uhp = NULL;
+  size_t saved = 0;
+  if (batch->undo == kExtmarkUndo) {
+    uhp = u_force_get_undo_header(buf);
+    if (uhp) {
+      saved = kv_size(uhp->uh_extmark);
+      u_extmark_copy(buf, row, start_col, row, start_col + old_col);
+    }
+  }
+
+  marktree_splice_cols(buf->b_marktree, row, batch->edits.items, kv_size(batch->edits));
+
+  if (uhp) {
+    size_t copied = kv_size(uhp->uh_extmark);
+    ExtmarkSplice splice;
+    splice.start_row = row;
+    splice.start_col = start_col;
+    splice.start_byte = extmark_line_offset(buf, row) + start_col;
+    splice.old_row = 0;
+    splice.old_col = old_col;
+    splice.old_byte = old_col;
+    splice.new_row = 0;
+    splice.new_col = new_col;
+    splice.new_byte = new_col;
+    kv_push(uhp->uh_extmark,
+            ((ExtmarkUndoObject){ .type = kExtmarkSplice,
+                                  .data.splice = splice }));
+
+    // The splice alone puts every mark in the changed part at one of its
+    // ends, redo needs the positions in between as well.
+    for (size_t i = saved; i < copied; i++) {
+      ExtmarkSavePos pos = kv_A(uhp->uh_extmark, i).data.savepos;
+      mtpos_t new_pos = marktree_lookup(buf->b_marktree, pos.mark, NULL);
+      pos.old_row = -1;
+      pos.old_col = -1;
+      pos.row = new_pos.row;
+      pos.col = new_pos.col;
+      kv_push(uhp->uh_extmark,
+              ((ExtmarkUndoObject){ .type = kExtmarkSavePos,
+                                    .data.savepos = pos }));
+    }
+  }
+
+  kv_size(batch->edits) = 0;
+  batch->row = -1;
+  batch->delta = 0;
 }
 
 void extmark_splice_impl(buf_T *buf, int start_row, colnr_T start_col, bcount_t start_byte,
@@ -20,10 +20,35 @@ typedef struct {
 
 typedef kvec_t(ExtmarkInfo) ExtmarkInfoArray;
 
+// extmark to be created by extmark_set_many()
+typedef struct {
+  uint64_t mark_id;  // zero for a new id, set to the id used
+  int row;
+  colnr_T col;
+  int end_row;
+  colnr_T end_col;
+  Decoration *decor;
+  bool right_gravity;
+  bool end_right_gravity;
+} ExtmarkPut;
+
 // TODO(bfredl): good enough name for now.
 typedef ptrdiff_t bcount_t;
 
 
+// changes within one line, applied to the marks by
+// extmark_splice_batch_flush()
+typedef struct {
+  buf_T *buf;
+  int row;  // -1 when there are no changes
+  ExtmarkOp undo;
+  colnr_T delta;  // length added to the line by the changes
+  kvec_t(mtedit_t) edits;
+} ExtmarkSpliceBatch;
+
+#define EXTMARK_SPLICE_BATCH_INIT { .buf = NULL, .row = -1, .undo = kExtmarkNOOP, \
+                                    .delta = 0, .edits = KV_INITIAL_VALUE }
+
 // delete the columns between mincol and endcol
 typedef struct {
   int start_row;
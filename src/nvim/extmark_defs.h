@@ -21,6 +21,15 @@ typedef struct {
   Decoration *decor;
 } ExtmarkItem;
 
+// decorations which a decoration provider set for a line, see decoration.h
+typedef struct decor_cache_line DecorCacheLine;
+
+// cached decorations of the lines in a window
+typedef struct {
+  handle_T buf;  // buffer the lines are from
+  kvec_t(DecorCacheLine) lines;  // sorted by line number and namespace
+} DecorCache;
+
 typedef struct undo_object ExtmarkUndoObject;
 typedef kvec_t(ExtmarkUndoObject) extmark_undo_vec_t;
 
@@ -31,6 +31,7 @@
 #include "nvim/hashtab.h"
 #include "nvim/iconv.h"
 #include "nvim/input.h"
+#include "nvim/main.h"
 #include "nvim/mbyte.h"
 #include "nvim/memfile.h"
 #include "nvim/memline.h"
@@ -49,7 +50,6 @@
 #include "nvim/regexp.h"
 #include "nvim/screen.h"
 #include "nvim/search.h"
-#include "nvim/sha256.h"
 #include "nvim/shada.h"
 #include "nvim/state.h"
 #include "nvim/strings.h"
@@ -60,7 +60,7 @@
 #include "nvim/vim.h"
 #include "nvim/window.h"
 
-#define BUFSIZE         8192    // size of normal write buffer
+#define BUFSIZE         65536   // size of normal write buffer
 #define SMBUFSIZE       256     // size of emergency write buffer
 
 // For compatibility with libuv < 1.20.0 (tested on 1.18.0)
@@ -110,11 +110,45 @@ struct bw_info {
 #endif
 };
 
+#ifdef UNIX
+/// A ":write" that is finished by a worker thread, see buf_write_async().
+typedef struct {
+  uv_thread_t thread;
+  size_t seq;                    ///< number to recognize the job by
+  struct bw_info info;           ///< owns the buffers and iconv descriptor
+  int bufsize;                   ///< size of info.bw_buf
+  char_u *text;                  ///< the lines, each one NUL terminated
+  linenr_T line_count;
+  int fileformat;
+  bool last_eol;                 ///< write end-of-line after the last line
+  bool fsync;                    ///< 'fsync' was set
+  bool undofile;                 ///< compute hash_ctx for the undo file
+  undo_hash_T hash_ctx;
+
+  // Set by the worker thread.
+  long nchars;                   ///< number of bytes written
+  bool failed;
+  const char *errmsg;            ///< error from fsync() or close() or NULL
+  int error;                     ///< libuv error code for "errmsg"
+
+  // Used when finishing on the main thread.
+  handle_T bufnr;
+  varnumber_T changedtick;       ///< b:changedtick when the lines were copied
+  char_u *fname;
+  char_u *backup;
+  bool backup_copy;
+  bool newfile;
+  bool converted;
+  bool notconverted;
+} bufwrite_T;
+#endif
+
 #ifdef INCLUDE_GENERATED_DECLARATIONS
 # include "fileio.c.generated.h"
 #endif
 
 static char *e_auchangedbuf = N_("E812: Autocommands changed buffer or buffer name");
+static char *e_closefail = N_("E512: Close failed: %s");
 
 void filemess(buf_T *buf, char_u *name, char_u *s, int attr)
 {
@@ -151,7 +185,8 @@ void filemess(buf_T *buf, char_u *name, char_u *s, int attr)
 ///
 /// 1. We allocate blocks with try_malloc, as big as possible.
 /// 2. Each block is filled with characters from the file with a single read().
-/// 3. The lines are inserted in the buffer with ml_append().
+/// 3. The lines are inserted in the buffer with ml_append_lines(), all the
+///    lines found in a block at once.
 ///
 /// (caller must check that fname != NULL, unless READ_STDIN is used)
 ///
@@ -192,13 +227,17 @@ int readfile(char_u *fname, char_u *sfname, linenr_T from, linenr_T lines_to_ski
   char_u *buffer = NULL;           // read buffer
   char_u *new_buffer = NULL;       // init to shut up gcc
   char_u *line_start = NULL;       // init to shut up gcc
+  char_u **line_ptrs = NULL;       // lines found in the read buffer
+  colnr_T *line_lens = NULL;       // length of each line in "line_ptrs"
+  int line_ptrs_size = 0;          // allocated items in "line_ptrs"
   int wasempty;                         // buffer was empty before reading
   colnr_T len;
   long size = 0;
   uint8_t *p = NULL;
   off_T filesize = 0;
   bool skip_read = false;
-  context_sha256_T sha_ctx;
+  bool lazy = false;                    // mapped the file, see 'lazyloadsize'
+  undo_hash_T hash_ctx;
   int read_undo_file = false;
   int split = 0;  // number of split lines
   linenr_T linecnt;
@@ -902,7 +941,29 @@ retry:
                       && !read_stdin
                       && !read_buffer);
     if (read_undo_file) {
-      sha256_start(&sha_ctx);
+      u_hash_start(&hash_ctx);
+    }
+  }
+
+  // A large file that needs no conversion may be mapped into memory instead
+  // of being read, see 'lazyloadsize'.
+  if (p_lls > 0 && newfile && wasempty && from == 0
+      && lines_to_skip == 0 && lines_to_read == MAXLNUM
+      && !filtering && !read_stdin && !read_buffer && !read_fifo
+      && !recoverymode && !read_undo_file && !converted && tmpname == NULL
+      && fileformat != EOL_MAC) {
+    bool no_eol = false;
+    off_T lazy_size = readfile_lazy(fd, fenc, try_unix, try_dos, try_mac,
+                                    &fileformat, &ff_error, &no_eol);
+    if (lazy_size >= 0) {
+      lazy = true;
+      filesize = lazy_size;
+      linerest = 0;
+      if (no_eol) {
+        curbuf->b_p_eol = false;
+        read_no_eol_lnum = curbuf->b_ml.ml_line_count;
+      }
+      goto failed;
     }
   }
 
@@ -1413,7 +1474,10 @@ retry:
           if (todo <= 0) {
             break;
           }
-          if (*p >= 0x80) {
+          if (*p < 0x80) {
+            // skip over ASCII quickly
+            p += utf_ascii_len(p, (size_t)todo) - 1;
+          } else {
             // A length of 1 means it's an illegal byte.  Accept
             // an incomplete character at the end though, the next
             // read() will get the next bytes, we'll check it
@@ -1495,62 +1559,7 @@ rewind_retry:
        * when reading the first part of a file: guess EOL type
        */
       if (fileformat == EOL_UNKNOWN) {
-        // First try finding a NL, for Dos and Unix
-        if (try_dos || try_unix) {
-          // Reset the carriage return counter.
-          if (try_mac) {
-            try_mac = 1;
-          }
-
-          for (p = ptr; p < ptr + size; ++p) {
-            if (*p == NL) {
-              if (!try_unix
-                  || (try_dos && p > ptr && p[-1] == CAR)) {
-                fileformat = EOL_DOS;
-              } else {
-                fileformat = EOL_UNIX;
-              }
-              break;
-            } else if (*p == CAR && try_mac) {
-              try_mac++;
-            }
-          }
-
-          // Don't give in to EOL_UNIX if EOL_MAC is more likely
-          if (fileformat == EOL_UNIX && try_mac) {
-            // Need to reset the counters when retrying fenc.
-            try_mac = 1;
-            try_unix = 1;
-            for (; p >= ptr && *p != CAR; p--) {
-            }
-            if (p >= ptr) {
-              for (p = ptr; p < ptr + size; ++p) {
-                if (*p == NL) {
-                  try_unix++;
-                } else if (*p == CAR) {
-                  try_mac++;
-                }
-              }
-              if (try_mac > try_unix) {
-                fileformat = EOL_MAC;
-              }
-            }
-          } else if (fileformat == EOL_UNKNOWN && try_mac == 1) {
-            // Looking for CR but found no end-of-line markers at all:
-            // use the default format.
-            fileformat = default_fileformat();
-          }
-        }
-
-        // No NL found: may use Mac format
-        if (fileformat == EOL_UNKNOWN && try_mac) {
-          fileformat = EOL_MAC;
-        }
-
-        // Still nothing found?  Use first format in 'ffs'
-        if (fileformat == EOL_UNKNOWN) {
-          fileformat = default_fileformat();
-        }
+        fileformat = readfile_detect_ff(ptr, size, try_unix, try_dos, try_mac);
 
         // May set 'p_ff' if editing a new file.
         if (set_options) {
@@ -1583,7 +1592,7 @@ rewind_retry:
               break;
             }
             if (read_undo_file) {
-              sha256_update(&sha_ctx, line_start, len);
+              u_hash_update(&hash_ctx, line_start, (size_t)len);
             }
             ++lnum;
             if (--read_count == 0) {
@@ -1598,59 +1607,71 @@ rewind_retry:
         }
       }
     } else {
-      --ptr;
-      while (++ptr, --size >= 0) {
-        if ((c = *ptr) != NUL && c != NL) {        // catch most common case
+      // The lines found are collected and appended all at once.
+      char_u *const end = ptr + size;
+      int nlines = 0;
+      while (ptr < end) {
+        ptr = readfile_find_eol(ptr, end);
+        if (ptr == end) {
+          break;
+        }
+        if (*ptr == NUL) {
+          *ptr++ = NL;          // NULs are replaced by newlines!
           continue;
         }
-        if (c == NUL) {
-          *ptr = NL;            // NULs are replaced by newlines!
-        } else {
-          if (skip_count == 0) {
-            *ptr = NUL;                         // end of line
-            len = (colnr_T)(ptr - line_start + 1);
-            if (fileformat == EOL_DOS) {
-              if (ptr > line_start && ptr[-1] == CAR) {
-                // remove CR before NL
-                ptr[-1] = NUL;
-                len--;
-              } else if (ff_error != EOL_DOS) {
-                // Reading in Dos format, but no CR-LF found!
-                // When 'fileformats' includes "unix", delete all
-                // the lines read so far and start all over again.
-                // Otherwise give an error message later.
-                if (try_unix
-                    && !read_stdin
-                    && (read_buffer
-                        || vim_lseek(fd, (off_T)0L, SEEK_SET) == 0)) {
-                  fileformat = EOL_UNIX;
-                  if (set_options) {
-                    set_fileformat(EOL_UNIX, OPT_LOCAL);
-                  }
-                  file_rewind = true;
-                  keep_fileformat = true;
-                  goto retry;
+        if (skip_count == 0) {
+          *ptr = NUL;                           // end of line
+          len = (colnr_T)(ptr - line_start + 1);
+          if (fileformat == EOL_DOS) {
+            if (ptr > line_start && ptr[-1] == CAR) {
+              // remove CR before NL
+              ptr[-1] = NUL;
+              len--;
+            } else if (ff_error != EOL_DOS) {
+              // Reading in Dos format, but no CR-LF found!
+              // When 'fileformats' includes "unix", delete all
+              // the lines read so far and start all over again.
+              // Otherwise give an error message later.
+              if (try_unix
+                  && !read_stdin
+                  && (read_buffer
+                      || vim_lseek(fd, (off_T)0L, SEEK_SET) == 0)) {
+                fileformat = EOL_UNIX;
+                if (set_options) {
+                  set_fileformat(EOL_UNIX, OPT_LOCAL);
                 }
-                ff_error = EOL_DOS;
+                file_rewind = true;
+                keep_fileformat = true;
+                goto retry;
               }
+              ff_error = EOL_DOS;
             }
-            if (ml_append(lnum, line_start, len, newfile) == FAIL) {
-              error = true;
-              break;
-            }
-            if (read_undo_file) {
-              sha256_update(&sha_ctx, line_start, len);
-            }
-            ++lnum;
-            if (--read_count == 0) {
-              error = true;                         // break loop
-              line_start = ptr;                 // nothing left to write
-              break;
-            }
-          } else {
-            --skip_count;
           }
-          line_start = ptr + 1;
+          if (nlines == line_ptrs_size) {
+            line_ptrs_size = line_ptrs_size == 0 ? 1024 : 2 * line_ptrs_size;
+            line_ptrs = xrealloc(line_ptrs, (size_t)line_ptrs_size * sizeof(*line_ptrs));
+            line_lens = xrealloc(line_lens, (size_t)line_ptrs_size * sizeof(*line_lens));
+          }
+          line_ptrs[nlines] = line_start;
+          line_lens[nlines++] = len;
+          if (read_undo_file) {
+            u_hash_update(&hash_ctx, line_start, (size_t)len);
+          }
+          if (--read_count == 0) {
+            error = true;                       // break loop
+            line_start = ptr;                   // nothing left to write
+            break;
+          }
+        } else {
+          --skip_count;
+        }
+        line_start = ++ptr;
+      }
+      if (nlines > 0) {
+        if (ml_append_lines(lnum, line_ptrs, line_lens, nlines, newfile) == FAIL) {
+          error = true;
+        } else {
+          lnum += nlines;
         }
       }
     }
@@ -1686,7 +1707,7 @@ failed:
       error = true;
     } else {
       if (read_undo_file) {
-        sha256_update(&sha_ctx, line_start, len);
+        u_hash_update(&hash_ctx, line_start, (size_t)len);
       }
       read_no_eol_lnum = ++lnum;
     }
@@ -1714,6 +1735,8 @@ failed:
     (void)os_set_cloexec(fd);
   }
   xfree(buffer);
+  xfree(line_ptrs);
+  xfree(line_lens);
 
   if (read_stdin) {
     close(0);
@@ -1740,8 +1763,11 @@ failed:
    */
   if (!recoverymode) {
     // need to delete the last line, which comes from the empty buffer
+    // (already gone when the file was mapped)
     if (newfile && wasempty && !(curbuf->b_ml.ml_flags & ML_EMPTY)) {
-      ml_delete(curbuf->b_ml.ml_line_count, false);
+      if (!lazy) {
+        ml_delete(curbuf->b_ml.ml_line_count, false);
+      }
       linecnt--;
     }
     curbuf->deleted_bytes = 0;
@@ -1923,7 +1949,7 @@ failed:
   if (read_undo_file) {
     char_u hash[UNDO_HASH_SIZE];
 
-    sha256_finish(&sha_ctx, hash);
+    u_hash_finish(&hash_ctx, hash);
     u_read_undo(NULL, hash, fname);
   }
 
@@ -1973,6 +1999,169 @@ failed:
   return OK;
 }
 
+/// Find the first NL or NUL between "ptr" and "end", for readfile().
+/// Lines are usually much longer than a word, thus check a word at a time:
+/// (x - 0x01..01) & ~x & 0x80..80 is non-zero when a byte in x is zero.
+///
+/// @return  pointer to the NL or NUL, "end" when there is none.
+static char_u *readfile_find_eol(char_u *ptr, char_u *const end)
+  FUNC_ATTR_NONNULL_ALL FUNC_ATTR_NONNULL_RET FUNC_ATTR_PURE
+{
+  const uint64_t ones = 0x0101010101010101ULL;
+  const uint64_t highs = 0x8080808080808080ULL;
+  uint64_t word;
+
+  for (; end - ptr >= (ptrdiff_t)sizeof(word); ptr += sizeof(word)) {
+    memcpy(&word, ptr, sizeof(word));
+    const uint64_t nl = word ^ (ones * NL);
+    if (((word - ones) & ~word & highs) || ((nl - ones) & ~nl & highs)) {
+      break;
+    }
+  }
+  while (ptr < end && *ptr != NUL && *ptr != NL) {
+    ptr++;
+  }
+  return ptr;
+}
+
+/// Guess the end-of-line format of a file from the first "size" bytes of it,
+/// for readfile().
+///
+/// @param try_unix  'fileformats' includes "unix"
+/// @param try_dos  'fileformats' includes "dos"
+/// @param try_mac  'fileformats' includes "mac"
+///
+/// @return  EOL_UNIX, EOL_DOS or EOL_MAC
+static int readfile_detect_ff(const char_u *ptr, long size, int try_unix, int try_dos,
+                              int try_mac)
+{
+  int fileformat = EOL_UNKNOWN;
+  const char_u *p;
+
+  // First try finding a NL, for Dos and Unix
+  if (try_dos || try_unix) {
+    // Reset the carriage return counter.
+    if (try_mac) {
+      try_mac = 1;
+    }
+
+    for (p = ptr; p < ptr + size; ++p) {
+      if (*p == NL) {
+        if (!try_unix
+            || (try_dos && p > ptr && p[-1] == CAR)) {
+          fileformat = EOL_DOS;
+        } else {
+          fileformat = EOL_UNIX;
+        }
+        break;
+      } else if (*p == CAR && try_mac) {
+        try_mac++;
+      }
+    }
+
+    // Don't give in to EOL_UNIX if EOL_MAC is more likely
+    if (fileformat == EOL_UNIX && try_mac) {
+      try_mac = 1;
+      try_unix = 1;
+      for (; p >= ptr && *p != CAR; p--) {
+      }
+      if (p >= ptr) {
+        for (p = ptr; p < ptr + size; ++p) {
+          if (*p == NL) {
+            try_unix++;
+          } else if (*p == CAR) {
+            try_mac++;
+          }
+        }
+        if (try_mac > try_unix) {
+          fileformat = EOL_MAC;
+        }
+      }
+    } else if (fileformat == EOL_UNKNOWN && try_mac == 1) {
+      // Looking for CR but found no end-of-line markers at all:
+      // use the default format.
+      fileformat = default_fileformat();
+    }
+  }
+
+  // No NL found: may use Mac format
+  if (fileformat == EOL_UNKNOWN && try_mac) {
+    fileformat = EOL_MAC;
+  }
+
+  // Still nothing found?  Use first format in 'ffs'
+  if (fileformat == EOL_UNKNOWN) {
+    fileformat = default_fileformat();
+  }
+
+  return fileformat;
+}
+
+/// Try to load the file "fd" lazily into the empty current buffer, mapping it
+/// into memory instead of reading it, see 'lazyloadsize'.  Only for a file
+/// that needs no conversion.
+///
+/// @param fenc  encoding of the file
+/// @param[in,out] fileformatp  format of the file, EOL_UNKNOWN to detect it
+/// @param[out] ff_errorp  set to EOL_DOS when a line does not end in CR-NL in
+///                        Dos format
+/// @param[out] no_eolp  set when the last line does not have an end-of-line
+///
+/// @return  size of the file, -1 when it was not loaded lazily.
+static off_T readfile_lazy(int fd, const char_u *fenc, int try_unix, int try_dos, int try_mac,
+                           int *fileformatp, int *ff_errorp, bool *no_eolp)
+{
+  FileInfo file_info;
+  if (!os_fileinfo_fd(fd, &file_info)) {
+    return -1;
+  }
+  uint64_t size = os_fileinfo_size(&file_info);
+  if (size == 0 || size / 1024 < (uint64_t)p_lls || size > SIZE_MAX) {
+    return -1;
+  }
+
+  const char *map = os_mmap(fd, (size_t)size);
+  if (map == NULL) {
+    return -1;
+  }
+
+  // Skip a UTF-8 BOM, like when reading the file.
+  size_t start = 0;
+  if (!curbuf->b_p_bin && (*fenc == 'u' || *fenc == NUL)
+      && size >= 3 && memcmp(map, "\xef\xbb\xbf", 3) == 0) {
+    start = 3;
+  }
+
+  int fileformat = *fileformatp;
+  if (fileformat == EOL_UNKNOWN) {
+    fileformat = readfile_detect_ff((char_u *)map + start, (long)MIN(size - start, 0x10000),
+                                    try_unix, try_dos, try_mac);
+  }
+
+  // Illegal bytes are only found when the lines are loaded, checking the
+  // whole file here would make opening it as slow as reading it.
+  bool ff_error = false;
+  if ((fileformat == EOL_UNIX || fileformat == EOL_DOS)
+      && ml_open_lazy(curbuf, fd, map, (size_t)size, start, &fileformat, try_unix,
+                      &ff_error, no_eolp) == OK) {
+    if (fileformat != *fileformatp) {
+      set_fileformat(fileformat, OPT_LOCAL);
+      *fileformatp = fileformat;
+    }
+    if (ff_error) {
+      *ff_errorp = EOL_DOS;
+    }
+    if (start > 0) {
+      curbuf->b_p_bomb = true;
+      curbuf->b_start_bomb = true;
+    }
+    return (off_T)size;
+  }
+
+  os_munmap(map, (size_t)size);
+  return -1;
+}
+
 #ifdef OPEN_CHR_FILES
 /// Returns true if the file name argument is of the form "/dev/fd/\d\+",
 /// which is the name of files used for process substitution output by
@@ -2197,9 +2386,7 @@ int buf_write(buf_T *buf, char_u *fname, char_u *sfname, linenr_T start, linenr_
   int dobackup;
   char_u *ffname;
   char_u *wfname = NULL;       // name of file to write to
-  char_u *s;
   char_u *ptr;
-  char_u c;
   int len;
   linenr_T lnum;
   long nchars;
@@ -2223,6 +2410,8 @@ int buf_write(buf_T *buf, char_u *fname, char_u *sfname, linenr_T start, linenr_
   int msg_save = msg_scroll;
   int overwriting;                          // TRUE if writing over original
   int no_eol = false;                       // no end-of-line written
+  bool last_eol;                            // end-of-line after last line
+  bool async = false;                       // finished by buf_write_async()
   int device = false;                       // writing to a device
   int prev_got_int = got_int;
   int checking_conversion;
@@ -2250,7 +2439,7 @@ int buf_write(buf_T *buf, char_u *fname, char_u *sfname, linenr_T start, linenr_
                                            backup or new file */
 #endif
   int write_undo_file = FALSE;
-  context_sha256_T sha_ctx;
+  undo_hash_T hash_ctx;
   unsigned int bkc = get_bkc_value(buf);
 
   if (fname == NULL || *fname == NUL) {  // safety check
@@ -2263,6 +2452,9 @@ int buf_write(buf_T *buf, char_u *fname, char_u *sfname, linenr_T start, linenr_
     return FAIL;
   }
 
+  // Only one write can be going on in the background.
+  buf_write_wait(NULL);
+
   /*
    * Disallow writing from .exrc and .vimrc in current directory for
    * security reasons.
@@ -3151,6 +3343,11 @@ nobackup:
       // quotum for number of files).
       // Appending will fail if the file does not exist and forceit is
       // FALSE.
+      // A buffer that was loaded lazily needs all its lines before the file
+      // it was mapped from is truncated.
+      if (!append) {
+        ml_lazy_detach_file((char *)wfname);
+      }
       while ((fd = os_open((char *)wfname,
                            O_WRONLY |
                            (append ?
@@ -3266,7 +3463,7 @@ restore_backup:
                        && !filtering && reset_changed && !checking_conversion);
     if (write_undo_file) {
       // Prepare for computing the hash value of the text.
-      sha256_start(&sha_ctx);
+      u_hash_start(&hash_ctx);
     }
 
     write_info.bw_len = bufsize;
@@ -3274,72 +3471,69 @@ restore_backup:
     write_info.bw_flags = wb_flags;
 #endif
     fileformat = get_fileformat_force(buf, eap);
-    s = buffer;
+    // The last line gets no line break when it did not have one.
+    last_eol = !((write_bin || !buf->b_p_fixeol)
+                 && (end == buf->b_no_eol_lnum
+                     || (end == buf->b_ml.ml_line_count && !buf->b_p_eol)));
     len = 0;
+
+#ifdef UNIX
+    // For ":write" of the whole buffer to its own file the lines are
+    // converted and written by another thread, see buf_write_async().
+    if (!checking_conversion && p_asw && eap != NULL
+        && (eap->cmdidx == CMD_write || eap->cmdidx == CMD_update)
+        && whole && overwriting && reset_changed && !append && !filtering
+        && !device && *p_pm == NUL && wfname == fname && buffer != smallbuf) {
+      buf_write_set_owner(buf, fd, wfname, &file_info_old, perm,
+                          backup != NULL && !backup_copy);
+      if (made_writable) {
+        perm &= ~0200;              // reset 'w' bit for security reasons
+      }
+      if (perm >= 0) {  // Set perm. of new file same as old file.
+        (void)os_setperm((const char *)wfname, perm);
+      }
+# ifdef HAVE_ACL
+      if (!backup_copy) {
+        mch_set_acl(wfname, acl);
+      }
+# endif
+      if (buf_write_async(buf, fname, &write_info, bufsize, fileformat, last_eol,
+                          backup, backup_copy, newfile, converted, notconverted,
+                          write_undo_file ? &hash_ctx : NULL)) {
+        // The job owns these now.
+        buffer = NULL;
+        backup = NULL;
+        write_info.bw_conv_buf = NULL;
+# ifdef HAVE_ICONV
+        write_info.bw_iconv_fd = (iconv_t)-1;
+# endif
+        write_undo_file = false;
+        async = true;
+        no_wait_return--;
+        goto nofail;
+      }
+      // Could not start the thread, write the lines here.
+    }
+#endif
+
     for (lnum = start; lnum <= end; lnum++) {
-      // The next while loop is done once for each character written.
-      // Keep it fast!
-      ptr = ml_get_buf(buf, lnum, false) - 1;
+      ptr = ml_get_buf(buf, lnum, false);
       if (write_undo_file) {
-        sha256_update(&sha_ctx, ptr + 1, (uint32_t)(STRLEN(ptr + 1) + 1));
+        u_hash_update(&hash_ctx, ptr, STRLEN(ptr) + 1);
       }
-      while ((c = *++ptr) != NUL) {
-        if (c == NL) {
-          *s = NUL;                       // replace newlines with NULs
-        } else if (c == CAR && fileformat == EOL_MAC) {
-          *s = NL;                        // Mac: replace CRs with NLs
-        } else {
-          *s = c;
-        }
-        s++;
-        if (++len != bufsize) {
-          continue;
-        }
-        if (buf_write_bytes(&write_info) == FAIL) {
-          end = 0;                        // write error: break loop
-          break;
-        }
-        nchars += bufsize;
-        s = buffer;
-        len = 0;
-        write_info.bw_start_lnum = lnum;
+      const bool eol = lnum < end || last_eol;
+      const long prev_nchars = nchars;
+      if (buf_write_line(&write_info, bufsize, ptr, lnum, eol, fileformat,
+                         &len, &nchars) == FAIL) {
+        end = 0;                          // write error: break loop
       }
       // write failed or last line has no EOL: stop here
-      if (end == 0
-          || (lnum == end
-              && (write_bin || !buf->b_p_fixeol)
-              && (lnum == buf->b_no_eol_lnum
-                  || (lnum == buf->b_ml.ml_line_count && !buf->b_p_eol)))) {
+      if (end == 0 || !eol) {
         lnum++;                           // written the line, count it
         no_eol = true;
         break;
       }
-      if (fileformat == EOL_UNIX) {
-        *s++ = NL;
-      } else {
-        *s++ = CAR;                       // EOL_MAC or EOL_DOS: write CR
-        if (fileformat == EOL_DOS) {      // write CR-NL
-          if (++len == bufsize) {
-            if (buf_write_bytes(&write_info) == FAIL) {
-              end = 0;                    // write error: break loop
-              break;
-            }
-            nchars += bufsize;
-            s = buffer;
-            len = 0;
-          }
-          *s++ = NL;
-        }
-      }
-      if (++len == bufsize) {
-        if (buf_write_bytes(&write_info) == FAIL) {
-          end = 0;  // Write error: break loop.
-          break;
-        }
-        nchars += bufsize;
-        s = buffer;
-        len = 0;
-
+      if (nchars != prev_nchars) {
         os_breakcheck();
         if (got_int) {
           end = 0;  // Interrupted, break loop.
@@ -3384,29 +3578,12 @@ restore_backup:
     }
 
 #ifdef UNIX
-    // When creating a new file, set its owner/group to that of the original
-    // file.  Get the new device and inode number.
-    if (backup != NULL && !backup_copy) {
-      // don't change the owner when it's already OK, some systems remove
-      // permission or ACL stuff
-      FileInfo file_info;
-      if (!os_fileinfo((char *)wfname, &file_info)
-          || file_info.stat.st_uid != file_info_old.stat.st_uid
-          || file_info.stat.st_gid != file_info_old.stat.st_gid) {
-        os_fchown(fd, file_info_old.stat.st_uid, file_info_old.stat.st_gid);
-        if (perm >= 0) {  // Set permission again, may have changed.
-          (void)os_setperm((const char *)wfname, perm);
-        }
-      }
-      buf_set_file_id(buf);
-    } else if (!buf->file_id_valid) {
-      // Set the file_id when creating a new file.
-      buf_set_file_id(buf);
-    }
+    buf_write_set_owner(buf, fd, wfname, &file_info_old, perm,
+                        backup != NULL && !backup_copy);
 #endif
 
     if ((error = os_close(fd)) != 0) {
-      SET_ERRMSG_ARG(_("E512: Close failed: %s"), error);
+      SET_ERRMSG_ARG(_(e_closefail), error);
       end = 0;
     }
 
@@ -3500,47 +3677,8 @@ restore_backup:
   fname = sfname;           // use shortname now, for the messages
 #endif
   if (!filtering) {
-    add_quoted_fname((char *)IObuff, IOSIZE, buf, (const char *)fname);
-    c = false;
-    if (write_info.bw_conv_error) {
-      STRCAT(IObuff, _(" CONVERSION ERROR"));
-      c = TRUE;
-      if (write_info.bw_conv_error_lnum != 0) {
-        vim_snprintf_add((char *)IObuff, IOSIZE, _(" in line %" PRId64 ";"),
-                         (int64_t)write_info.bw_conv_error_lnum);
-      }
-    } else if (notconverted) {
-      STRCAT(IObuff, _("[NOT converted]"));
-      c = TRUE;
-    } else if (converted) {
-      STRCAT(IObuff, _("[converted]"));
-      c = TRUE;
-    }
-    if (device) {
-      STRCAT(IObuff, _("[Device]"));
-      c = TRUE;
-    } else if (newfile) {
-      STRCAT(IObuff, new_file_message());
-      c = true;
-    }
-    if (no_eol) {
-      msg_add_eol();
-      c = TRUE;
-    }
-    // may add [unix/dos/mac]
-    if (msg_add_fileformat(fileformat)) {
-      c = TRUE;
-    }
-    msg_add_lines(c, (long)lnum, nchars);       // add line/char count
-    if (!shortmess(SHM_WRITE)) {
-      if (append) {
-        STRCAT(IObuff, shortmess(SHM_WRI) ? _(" [a]") : _(" appended"));
-      } else {
-        STRCAT(IObuff, shortmess(SHM_WRI) ? _(" [w]") : _(" written"));
-      }
-    }
-
-    set_keep_msg(msg_trunc_attr((char *)IObuff, false, 0), 0);
+    buf_write_msg(buf, (const char *)fname, &write_info, notconverted, converted,
+                  device, newfile, no_eol, fileformat, lnum, nchars, append);
   }
 
   /* When written everything correctly: reset 'modified'.  Unless not
@@ -3548,15 +3686,7 @@ restore_backup:
   if (reset_changed && whole && !append
       && !write_info.bw_conv_error
       && (overwriting || vim_strchr(p_cpo, CPO_PLUS) != NULL)) {
-    unchanged(buf, true, false);
-    const varnumber_T changedtick = buf_get_changedtick(buf);
-    if (buf->b_last_changedtick + 1 == changedtick) {
-      // b:changedtick may be incremented in unchanged() but that
-      // should not trigger a TextChanged event.
-      buf->b_last_changedtick = changedtick;
-    }
-    u_unchanged(buf);
-    u_update_save_nr(buf);
+    buf_write_unchanged(buf);
   }
 
   /*
@@ -3636,8 +3766,11 @@ fail:
   --no_wait_return;             // may wait for return now
 nofail:
 
-  // Done saving, we accept changed buffer warnings again
-  buf->b_saving = false;
+  // Done saving, we accept changed buffer warnings again.  An asynchronous
+  // write does this when it is finished.
+  if (!async) {
+    buf->b_saving = false;
+  }
 
   xfree(backup);
   if (buffer != smallbuf) {
@@ -3702,11 +3835,11 @@ nofail:
   if (retval == OK && write_undo_file) {
     char_u hash[UNDO_HASH_SIZE];
 
-    sha256_finish(&sha_ctx, hash);
+    u_hash_finish(&hash_ctx, hash);
     u_write_undo(NULL, FALSE, buf, hash);
   }
 
-  if (!should_abort(retval)) {
+  if (!should_abort(retval) && !async) {
     aco_save_T aco;
 
     curbuf->b_no_eol_lnum = 0;      // in case it was set by the previous read
@@ -3747,6 +3880,99 @@ nofail:
 #undef SET_ERRMSG_NUM
 }
 
+#ifdef UNIX
+/// When creating a new file, set its owner/group to that of the original
+/// file.  Get the new device and inode number.
+///
+/// @param renamed  the original file was renamed to the backup, "wfname"
+///                 was created
+static void buf_write_set_owner(buf_T *buf, int fd, const char_u *wfname,
+                                const FileInfo *file_info_old, long perm, bool renamed)
+{
+  if (renamed) {
+    // don't change the owner when it's already OK, some systems remove
+    // permission or ACL stuff
+    FileInfo file_info;
+    if (!os_fileinfo((const char *)wfname, &file_info)
+        || file_info.stat.st_uid != file_info_old->stat.st_uid
+        || file_info.stat.st_gid != file_info_old->stat.st_gid) {
+      os_fchown(fd, file_info_old->stat.st_uid, file_info_old->stat.st_gid);
+      if (perm >= 0) {  // Set permission again, may have changed.
+        (void)os_setperm((const char *)wfname, perm);
+      }
+    }
+    buf_set_file_id(buf);
+  } else if (!buf->file_id_valid) {
+    // Set the file_id when creating a new file.
+    buf_set_file_id(buf);
+  }
+}
+#endif
+
+/// Give the message for "lnum" lines and "nchars" characters of "buf" that
+/// were written to "fname".
+static void buf_write_msg(buf_T *buf, const char *fname, const struct bw_info *ip,
+                          bool notconverted, bool converted, bool device, bool newfile,
+                          bool no_eol, int fileformat, linenr_T lnum, long nchars, bool append)
+{
+  bool c = false;
+
+  add_quoted_fname((char *)IObuff, IOSIZE, buf, fname);
+  if (ip->bw_conv_error) {
+    STRCAT(IObuff, _(" CONVERSION ERROR"));
+    c = true;
+    if (ip->bw_conv_error_lnum != 0) {
+      vim_snprintf_add((char *)IObuff, IOSIZE, _(" in line %" PRId64 ";"),
+                       (int64_t)ip->bw_conv_error_lnum);
+    }
+  } else if (notconverted) {
+    STRCAT(IObuff, _("[NOT converted]"));
+    c = true;
+  } else if (converted) {
+    STRCAT(IObuff, _("[converted]"));
+    c = true;
+  }
+  if (device) {
+    STRCAT(IObuff, _("[Device]"));
+    c = true;
+  } else if (newfile) {
+    STRCAT(IObuff, new_file_message());
+    c = true;
+  }
+  if (no_eol) {
+    msg_add_eol();
+    c = true;
+  }
+  // may add [unix/dos/mac]
+  if (msg_add_fileformat(fileformat)) {
+    c = true;
+  }
+  msg_add_lines(c, (long)lnum, nchars);       // add line/char count
+  if (!shortmess(SHM_WRITE)) {
+    if (append) {
+      STRCAT(IObuff, shortmess(SHM_WRI) ? _(" [a]") : _(" appended"));
+    } else {
+      STRCAT(IObuff, shortmess(SHM_WRI) ? _(" [w]") : _(" written"));
+    }
+  }
+
+  set_keep_msg(msg_trunc_attr((char *)IObuff, false, 0), 0);
+}
+
+/// Reset 'modified' of "buf" after all of it was written.
+static void buf_write_unchanged(buf_T *buf)
+{
+  unchanged(buf, true, false);
+  const varnumber_T changedtick = buf_get_changedtick(buf);
+  if (buf->b_last_changedtick + 1 == changedtick) {
+    // b:changedtick may be incremented in unchanged() but that
+    // should not trigger a TextChanged event.
+    buf->b_last_changedtick = changedtick;
+  }
+  u_unchanged(buf);
+  u_update_save_nr(buf);
+}
+
 /*
  * Set the name of the current buffer.  Use when the buffer doesn't have a
  * name and a ":r" or ":w" command with a file name is used.
@@ -4104,6 +4330,352 @@ static int buf_write_bytes(struct bw_info *ip)
   return (wlen < len) ? FAIL : OK;
 }
 
+/// Copy line "line" to the write buffer of "ip", followed by an end-of-line
+/// for "fileformat" when "eol" is true.  Each time the buffer is full it is
+/// written with buf_write_bytes(), "ip->bw_len" must be "bufsize".
+///
+/// @param[in,out]  lenp    number of bytes in the write buffer
+/// @param[in,out]  nchars  incremented by the number of bytes written
+///
+/// @return  FAIL for a write error, OK otherwise.
+static int buf_write_line(struct bw_info *ip, int bufsize, const char_u *line, linenr_T lnum,
+                          bool eol, int fileformat, int *lenp, long *nchars)
+{
+  char_u *s = ip->bw_buf + *lenp;
+  int len = *lenp;
+  char_u c;
+
+  // The next while loop is done once for each character written.
+  // Keep it fast!
+  while ((c = *line++) != NUL) {
+    if (c == NL) {
+      *s = NUL;                       // replace newlines with NULs
+    } else if (c == CAR && fileformat == EOL_MAC) {
+      *s = NL;                        // Mac: replace CRs with NLs
+    } else {
+      *s = c;
+    }
+    s++;
+    if (++len != bufsize) {
+      continue;
+    }
+    if (buf_write_bytes(ip) == FAIL) {
+      return FAIL;
+    }
+    *nchars += bufsize;
+    s = ip->bw_buf;
+    len = 0;
+    ip->bw_start_lnum = lnum;
+  }
+  if (eol) {
+    if (fileformat == EOL_UNIX) {
+      *s++ = NL;
+    } else {
+      *s++ = CAR;                     // EOL_MAC or EOL_DOS: write CR
+      if (fileformat == EOL_DOS) {    // write CR-NL
+        if (++len == bufsize) {
+          if (buf_write_bytes(ip) == FAIL) {
+            return FAIL;
+          }
+          *nchars += bufsize;
+          s = ip->bw_buf;
+          len = 0;
+        }
+        *s++ = NL;
+      }
+    }
+    if (++len == bufsize) {
+      if (buf_write_bytes(ip) == FAIL) {
+        return FAIL;
+      }
+      *nchars += bufsize;
+      len = 0;
+    }
+  }
+  *lenp = len;
+  return OK;
+}
+
+#ifdef UNIX
+
+//
+// Writing a buffer in the background.
+//
+// With 'asyncwrite' set ":write" does everything that can fail early, such
+// as making the backup and opening the file, on the main thread.  Then the
+// lines are copied and a worker thread converts and writes them, syncs and
+// closes the file.  Meanwhile the buffer can be edited.  When the worker is
+// done buf_write_async_finish() runs on the main loop to give the message,
+// reset 'modified' when there were no changes in between and trigger
+// BufWritePost.  One such write can be in progress at a time, anything that
+// conflicts with it uses buf_write_wait() first.
+//
+
+static bufwrite_T *bw_job = NULL;  ///< write in progress or NULL
+static size_t bw_job_seq = 0;      ///< last used bufwrite_T.seq
+
+/// Continue writing "buf" to "fname" in a worker thread.  "ip" is prepared
+/// for writing the lines, "ip->bw_buf" of size "bufsize" and the conversion
+/// state are taken over.  The "backup" file is taken over as well.
+///
+/// @param hash_ctx  when not NULL, compute the hash for the undo file with it
+///
+/// @return  false when the thread could not be started, nothing was taken
+///          over then.
+static bool buf_write_async(buf_T *buf, char_u *fname, const struct bw_info *ip, int bufsize,
+                            int fileformat, bool last_eol, char_u *backup, bool backup_copy,
+                            bool newfile, bool converted, bool notconverted,
+                            const undo_hash_T *hash_ctx)
+{
+  bufwrite_T *job = xcalloc(1, sizeof(bufwrite_T));
+  job->seq = ++bw_job_seq;
+  job->info = *ip;
+  job->bufsize = bufsize;
+  job->line_count = buf->b_ml.ml_line_count;
+  job->fileformat = fileformat;
+  job->last_eol = last_eol;
+  job->fsync = p_fs;
+  job->undofile = hash_ctx != NULL;
+  if (hash_ctx != NULL) {
+    job->hash_ctx = *hash_ctx;
+  }
+  job->bufnr = buf->handle;
+  job->changedtick = buf_get_changedtick(buf);
+  job->fname = vim_strsave(fname);
+  job->backup = backup;
+  job->backup_copy = backup_copy;
+  job->newfile = newfile;
+  job->converted = converted;
+  job->notconverted = notconverted;
+
+  // Copy the lines, this is much faster than converting them.
+  size_t size = 0;
+  size_t cap = (size_t)bufsize;
+  job->text = xmalloc(cap);
+  for (linenr_T lnum = 1; lnum <= job->line_count; lnum++) {
+    const char_u *line = ml_get_buf(buf, lnum, false);
+    const size_t len = STRLEN(line) + 1;
+    if (size + len > cap) {
+      while (size + len > cap) {
+        cap *= 2;
+      }
+      job->text = xrealloc(job->text, cap);
+    }
+    memcpy(job->text + size, line, len);
+    size += len;
+  }
+
+  bw_job = job;
+  if (uv_thread_create(&job->thread, buf_write_thread, job) != 0) {
+    bw_job = NULL;
+    xfree(job->text);
+    xfree(job->fname);
+    xfree(job);
+    return false;
+  }
+  return true;
+}
+
+/// The worker thread of buf_write_async().
+static void buf_write_thread(void *arg)
+{
+  bufwrite_T *job = arg;
+  struct bw_info *ip = &job->info;
+  const char_u *line = job->text;
+  int len = 0;
+
+  for (linenr_T lnum = 1; lnum <= job->line_count; lnum++) {
+    const size_t n = STRLEN(line);
+    if (job->undofile) {
+      u_hash_update(&job->hash_ctx, line, n + 1);
+    }
+    if (buf_write_line(ip, job->bufsize, line, lnum,
+                       lnum < job->line_count || job->last_eol,
+                       job->fileformat, &len, &job->nchars) == FAIL) {
+      job->failed = true;
+      break;
+    }
+    line += n + 1;
+  }
+  if (!job->failed && len > 0) {
+    ip->bw_len = len;
+    if (buf_write_bytes(ip) == FAIL) {
+      job->failed = true;
+    }
+    job->nchars += len;
+  }
+
+  if (!job->failed && job->fsync) {
+    while (fsync(ip->bw_fd) != 0) {
+      if (errno != EINTR) {
+        // fsync not supported on this storage.
+        if (errno != ENOTSUP) {
+          job->errmsg = e_fsync;
+          job->error = -errno;
+          job->failed = true;
+        }
+        break;
+      }
+    }
+  }
+  if (close(ip->bw_fd) != 0 && !job->failed) {
+    job->errmsg = e_closefail;
+    job->error = -errno;
+    job->failed = true;
+  }
+
+  loop_schedule_deferred(&main_loop,
+                         event_create(buf_write_async_event, 1, (void *)(uintptr_t)job->seq));
+}
+
+static void buf_write_async_event(void **argv)
+{
+  if (bw_job != NULL && bw_job->seq == (size_t)(uintptr_t)argv[0]) {
+    buf_write_async_finish(true);
+  }
+}
+
+/// Finish the write that was started with buf_write_async(), after waiting
+/// for the worker thread.
+///
+/// @param autocmds  trigger BufWritePost
+static void buf_write_async_finish(bool autocmds)
+{
+  bufwrite_T *job = bw_job;
+  bw_job = NULL;
+  uv_thread_join(&job->thread);
+
+  // The buffer is not freed before the write is done, but be careful.
+  buf_T *buf = handle_get_buffer(job->bufnr);
+  if (buf != NULL) {
+    buf_write_async_done(job, buf, autocmds);
+  }
+
+  xfree(job->text);
+  xfree(job->info.bw_buf);
+  xfree(job->info.bw_conv_buf);
+# ifdef HAVE_ICONV
+  if (job->info.bw_iconv_fd != (iconv_t)-1) {
+    iconv_close(job->info.bw_iconv_fd);
+  }
+# endif
+  xfree(job->fname);
+  xfree(job->backup);
+  xfree(job);
+}
+
+/// Report the result of writing "buf" in the background and do what
+/// buf_write() does after writing.
+static void buf_write_async_done(bufwrite_T *job, buf_T *buf, bool autocmds)
+{
+  if (job->failed) {
+    add_quoted_fname((char *)IObuff, IOSIZE - 100, buf, (const char *)job->fname);
+    if (job->errmsg != NULL) {
+      semsg(_(job->errmsg), os_strerror(job->error));
+    } else if (job->info.bw_conv_error) {
+      semsg("%s%s", IObuff, _("E513: write error, conversion failed "
+                              "(make 'fenc' empty to override)"));
+    } else {
+      semsg("%s%s", IObuff, _("E514: write error (file system full?)"));
+    }
+
+    // Put the backup in place of the new file, which is probably corrupt.
+    bool restored = false;
+    if (job->backup != NULL) {
+      if (job->backup_copy) {
+        restored = os_copy((char *)job->backup, (char *)job->fname,
+                           UV_FS_COPYFILE_FICLONE) == 0;
+      } else {
+        restored = vim_rename(job->backup, job->fname) == 0;
+      }
+    }
+    if (!restored) {
+      const int attr = HL_ATTR(HLF_E);  // Set highlight for error messages.
+      msg_puts_attr(_("\nWARNING: Original file may be lost or damaged\n"),
+                    attr | MSG_HIST);
+      msg_puts_attr(_("don't quit the editor until the file is successfully written!"),
+                    attr | MSG_HIST);
+
+      // Update the timestamp to avoid an "overwrite changed file"
+      // prompt when writing again.
+      FileInfo file_info;
+      if (os_fileinfo((char *)job->fname, &file_info)) {
+        buf_store_file_info(buf, &file_info);
+        buf->b_mtime_read = buf->b_mtime;
+      }
+    }
+    buf->b_saving = false;
+    return;
+  }
+
+  buf_write_msg(buf, (const char *)job->fname, &job->info, job->notconverted,
+                job->converted, false, job->newfile, !job->last_eol, job->fileformat,
+                job->line_count, job->nchars, false);
+
+  // Only reset 'modified' when the buffer was not changed while writing.
+  const bool changed = buf_get_changedtick(buf) != job->changedtick;
+  if (!changed && !job->info.bw_conv_error) {
+    buf_write_unchanged(buf);
+  }
+  ml_timestamp(buf);
+  buf->b_flags &= ~BF_WRITE_MASK;
+  buf->b_saving = false;
+
+  if (!p_bk && job->backup != NULL
+      && !job->info.bw_conv_error
+      && os_remove((char *)job->backup) != 0) {
+    emsg(_("E207: Can't delete backup file"));
+  }
+
+  if (job->undofile && changed) {
+    // The undo information is for the text as it is now, it does not match
+    // the file.  'modified' is still set, the next write writes it.
+    msg_puts_attr(_("\nUndo file not written, the buffer changed while writing"),
+                  HL_ATTR(HLF_W) | MSG_HIST);
+  } else if (job->undofile) {
+    char_u hash[UNDO_HASH_SIZE];
+
+    u_hash_finish(&job->hash_ctx, hash);
+    u_write_undo(NULL, false, buf, hash);
+  }
+
+  buf->b_no_eol_lnum = 0;  // in case it was set by the previous read
+  if (autocmds) {
+    aco_save_T aco;
+    aucmd_prepbuf(&aco, buf);
+    apply_autocmds(EVENT_BUFWRITEPOST, job->fname, job->fname, false, curbuf);
+    aucmd_restbuf(&aco);
+  }
+}
+
+
+#endif
+
+/// Wait for a write started with 'asyncwrite' to finish, if it is writing
+/// "buf".  When "buf" is NULL wait for any buffer.  Must be done before
+/// using the buffer or its file in a way that conflicts with the write.
+/// BufWritePost is triggered, which may change or delete any buffer.
+void buf_write_wait(buf_T *buf)
+{
+#ifdef UNIX
+  if (bw_job != NULL && (buf == NULL || bw_job->bufnr == buf->handle)) {
+    buf_write_async_finish(true);
+  }
+#endif
+}
+
+/// Like buf_write_wait(), but without triggering BufWritePost.  For when
+/// "buf" is being freed or exiting, autocommands must not run then.  Callers
+/// are expected to use buf_write_wait() before that, this is a safety net.
+void buf_write_wait_noautocmd(buf_T *buf)
+{
+#ifdef UNIX
+  if (bw_job != NULL && (buf == NULL || bw_job->bufnr == buf->handle)) {
+    buf_write_async_finish(false);
+  }
+#endif
+}
+
 /// Convert a Unicode character to bytes.
 ///
 /// @param c character to convert
@@ -76,7 +76,13 @@
 EXTERN struct nvim_stats_s {
   int64_t fsync;
   int64_t redraw;
-} g_stats INIT(= { 0, 0 });
+  int64_t memfile_hit;
+  int64_t memfile_miss;
+  int64_t ml_cache_hit;
+  int64_t ml_cache_miss;
+  int64_t undo_spill;
+  int64_t undo_unspill;
+} g_stats INIT(= { 0, 0, 0, 0, 0, 0, 0, 0 });
 
 // Values for "starting".
 #define NO_SCREEN       2       // no screen updating yet
@@ -468,7 +474,10 @@ EXTERN buf_T *curbuf INIT(= NULL);    // currently active buffer
 
 // Iterate through all the signs placed in a buffer
 #define FOR_ALL_SIGNS_IN_BUF(buf, sign) \
-  for (sign = buf->b_signlist; sign != NULL; sign = sign->se_next)   // NOLINT
+  for (size_t sign##_idx = 0; \
+       sign##_idx < kv_size((buf)->b_signlist) \
+       && ((sign) = kv_A((buf)->b_signlist, sign##_idx), true); \
+       sign##_idx++)  // NOLINT
 
 
 // List of files being edited (global argument list).  curwin->w_alist points
@@ -488,6 +488,16 @@ void nlua_init(void)
   global_lstate = lstate;
 }
 
+/// @return  The number of bytes of memory used by the Lua heap.
+size_t nlua_mem_size(void)
+{
+  if (!global_lstate) {
+    return 0;
+  }
+  return (size_t)lua_gc(global_lstate, LUA_GCCOUNT, 0) * 1024
+         + (size_t)lua_gc(global_lstate, LUA_GCCOUNTB, 0);
+}
+
 
 void nlua_free_all_mem(void)
 {
@@ -14,10 +14,17 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <uv.h>
+
 #include "nvim/api/private/helpers.h"
 #include "nvim/buffer.h"
+#include "nvim/event/loop.h"
+#include "nvim/lib/kvec.h"
+#include "nvim/lua/executor.h"
 #include "nvim/lua/treesitter.h"
+#include "nvim/main.h"
 #include "nvim/memline.h"
+#include "nvim/message.h"
 #include "tree_sitter/api.h"
 
 #define TS_META_PARSER "treesitter_parser"
@@ -33,6 +40,22 @@ typedef struct {
   int max_match_id;
 } TSLua_cursor;
 
+/// A parse running on a worker thread, see parser_parse_async().
+typedef struct {
+  TSParser *parser;             ///< own parser, the caller's may be used meanwhile
+  TSTree *old_tree;             ///< copy of the old tree or NULL
+  char *text;                   ///< copy of the buffer text
+  size_t len;                   ///< length of "text"
+  handle_T bufnr;
+  varnumber_T changedtick;      ///< changedtick of the buffer when copied
+  LuaRef cb;                    ///< called with the result on the main loop
+  TSTree *new_tree;             ///< result, NULL when parsing failed
+  TSRange *changed;             ///< ranges changed since "old_tree"
+  uint32_t n_changed;
+  uv_thread_t thread;
+  bool joined;                  ///< "thread" was joined by tslua_parse_wait()
+} TSLua_parse_job;
+
 #ifdef INCLUDE_GENERATED_DECLARATIONS
 # include "lua/treesitter.c.generated.h"
 #endif
@@ -41,6 +64,7 @@ static struct luaL_Reg parser_meta[] = {
   { "__gc", parser_gc },
   { "__tostring", parser_tostring },
   { "parse", parser_parse },
+  { "_parse_async", parser_parse_async },
   { "set_included_ranges", parser_set_ranges },
   { "included_ranges", parser_get_ranges },
   { NULL, NULL }
@@ -106,6 +130,12 @@ static struct luaL_Reg treecursor_meta[] = {
 
 static PMap(cstr_t) langs = MAP_INIT;
 
+/// the lua_State that the callbacks of parser_parse_async() are invoked in
+static lua_State *tslua_state = NULL;
+
+/// parses started by parser_parse_async() that were not handed back yet
+static kvec_t(TSLua_parse_job *) parse_jobs = KV_INITIAL_VALUE;
+
 static void build_meta(lua_State *L, const char *tname, const luaL_Reg *meta)
 {
   if (luaL_newmetatable(L, tname)) {  // [meta]
@@ -122,6 +152,8 @@ static void build_meta(lua_State *L, const char *tname, const luaL_Reg *meta)
 /// all global state is stored in the regirstry of the lua_State
 void tslua_init(lua_State *L)
 {
+  tslua_state = L;
+
   // type metatables
   build_meta(L, TS_META_PARSER, parser_meta);
   build_meta(L, TS_META_TREE, tree_meta);
@@ -399,6 +431,158 @@ static int parser_parse(lua_State *L)
   return 2;
 }
 
+/// parser:_parse_async(old_tree, bufnr, callback)
+///
+/// Like parser:parse() for a buffer, but the text of the buffer is copied and
+/// parsed on a worker thread.  "callback" is invoked on the main loop with the
+/// new tree and the changed ranges, or with nil when the buffer was changed
+/// meanwhile (the result would be stale) or parsing failed.
+static int parser_parse_async(lua_State *L)
+{
+  TSParser **p = parser_check(L, 1);
+  if (!p || !(*p)) {
+    return 0;
+  }
+
+  TSTree *old_tree = NULL;
+  if (!lua_isnil(L, 2)) {
+    TSTree **tmp = tree_check(L, 2);
+    old_tree = tmp ? *tmp : NULL;
+  }
+
+  long bufnr = luaL_checkinteger(L, 3);
+  buf_T *buf = handle_get_buffer((handle_T)bufnr);
+  if (!buf) {
+    return luaL_error(L, "invalid buffer handle: %d", bufnr);
+  }
+  luaL_checktype(L, 4, LUA_TFUNCTION);
+
+  TSLua_parse_job *job = xcalloc(1, sizeof(*job));
+  job->parser = ts_parser_new();
+  ts_parser_set_language(job->parser, ts_parser_language(*p));
+  uint32_t n_ranges;
+  const TSRange *ranges = ts_parser_included_ranges(*p, &n_ranges);
+  ts_parser_set_included_ranges(job->parser, ranges, n_ranges);
+  // A copy of a tree can be used on another thread.
+  job->old_tree = old_tree ? ts_tree_copy(old_tree) : NULL;
+  job->bufnr = buf->handle;
+  job->changedtick = buf_get_changedtick(buf);
+  job->cb = nlua_ref(L, 4);
+
+  // Copy the text the way input_cb() reads it: every line ends in "\n",
+  // embedded "\n" are NUL.
+  size_t cap = 1024;
+  job->text = xmalloc(cap);
+  for (linenr_T lnum = 1; lnum <= buf->b_ml.ml_line_count; lnum++) {
+    const char_u *line = ml_get_buf(buf, lnum, false);
+    const size_t len = STRLEN(line);
+    if (job->len + len + 1 > cap) {
+      while (job->len + len + 1 > cap) {
+        cap *= 2;
+      }
+      job->text = xrealloc(job->text, cap);
+    }
+    memcpy(job->text + job->len, line, len);
+    memchrsub(job->text + job->len, '\n', '\0', len);
+    job->len += len;
+    job->text[job->len++] = '\n';
+  }
+
+  if (uv_thread_create(&job->thread, parse_thread, job) != 0) {
+    nlua_unref(L, job->cb);
+    parse_job_free(job);
+    return luaL_error(L, "Could not start a thread for parsing.");
+  }
+  kv_push(parse_jobs, job);
+  return 0;
+}
+
+/// The worker thread of parser_parse_async().
+static void parse_thread(void *arg)
+{
+  TSLua_parse_job *job = arg;
+
+  job->new_tree = ts_parser_parse_string(job->parser, job->old_tree, job->text,
+                                         (uint32_t)job->len);
+  if (job->new_tree && job->old_tree) {
+    job->changed = ts_tree_get_changed_ranges(job->old_tree, job->new_tree,
+                                              &job->n_changed);
+  }
+
+  loop_schedule_deferred(&main_loop, event_create(parse_async_event, 1, job));
+}
+
+/// Hands the result of parser_parse_async() to its callback.
+static void parse_async_event(void **argv)
+{
+  TSLua_parse_job *job = argv[0];
+  lua_State *L = tslua_state;
+  if (!job->joined) {
+    uv_thread_join(&job->thread);
+  }
+  for (size_t i = 0; i < kv_size(parse_jobs); i++) {
+    if (kv_A(parse_jobs, i) == job) {
+      kv_A(parse_jobs, i) = kv_last(parse_jobs);
+      (void)kv_pop(parse_jobs);
+      break;
+    }
+  }
+
+  if (exiting) {
+    nlua_unref(L, job->cb);
+    parse_job_free(job);
+    return;
+  }
+
+  nlua_pushref(L, job->cb);  // [cb]
+  nlua_unref(L, job->cb);
+  buf_T *buf = handle_get_buffer(job->bufnr);
+  if (job->new_tree && buf
+      && buf_get_changedtick(buf) == job->changedtick) {
+    // Ownership of the new tree goes to the lua GC.
+    push_tree(L, job->new_tree, false);  // [cb, tree]
+    push_ranges(L, job->changed, job->n_changed);  // [cb, tree, ranges]
+    job->new_tree = NULL;
+  } else {
+    lua_pushnil(L);  // [cb, nil]
+    lua_pushnil(L);  // [cb, nil, nil]
+  }
+  if (lua_pcall(L, 2, 0, 0)) {
+    semsg(_("Error executing tree-sitter parse callback: %s"), lua_tostring(L, -1));
+    lua_pop(L, 1);
+  }
+
+  parse_job_free(job);
+}
+
+static void parse_job_free(TSLua_parse_job *job)
+{
+  if (job->new_tree) {
+    ts_tree_delete(job->new_tree);
+  }
+  if (job->old_tree) {
+    ts_tree_delete(job->old_tree);
+  }
+  ts_parser_delete(job->parser);
+  xfree(job->changed);
+  xfree(job->text);
+  xfree(job);
+}
+
+/// Wait for the parses started with parser:_parse_async() to finish.  Must
+/// be done before exiting, a worker must not use the main loop after it was
+/// closed.  Their callbacks are not invoked anymore then.
+void tslua_parse_wait(void)
+{
+  for (size_t i = 0; i < kv_size(parse_jobs); i++) {
+    TSLua_parse_job *job = kv_A(parse_jobs, i);
+    if (!job->joined) {
+      uv_thread_join(&job->thread);
+      job->joined = true;
+    }
+  }
+}
+
 static int tree_copy(lua_State *L)
 {
   TSTree **tree = tree_check(L, 1);
@@ -0,0 +1,228 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check
+// it. PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+/// @file lz4.c
+///
+/// Compression in the LZ4 block format: a sequence of literals followed by a
+/// match, repeated, the last sequence only has literals.
+///
+/// Each sequence starts with a token byte: the high four bits are the number
+/// of literals, the low four bits the match length minus LZ4_MINMATCH. The
+/// value 15 means more length bytes follow, which are added up until one is
+/// not 255. After the literals comes the match offset as two bytes, least
+/// significant first.
+///
+/// Only the block format is used, there is no frame header or checksum: the
+/// caller knows the size of the uncompressed data. The compressor is the
+/// simple greedy one, it is fast and does well enough on text.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "nvim/lz4.h"
+
+/// Minimal length of a match.
+#define LZ4_MINMATCH 4
+/// The last match must start at least this many bytes before the end.
+#define LZ4_MFLIMIT 12
+/// The last bytes are always literals.
+#define LZ4_LASTLITERALS 5
+/// Largest distance to a match.
+#define LZ4_MAX_OFFSET 65535
+/// Number of bits for the hash table index.
+#define LZ4_HASH_LOG 10
+
+#ifdef INCLUDE_GENERATED_DECLARATIONS
+# include "lz4.c.generated.h"
+#endif
+
+static inline uint32_t lz4_read32(const uint8_t *p)
+{
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline unsigned lz4_hash(uint32_t v)
+{
+  return (v * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+/// Store the part of "len" that did not fit in the token.
+static uint8_t *lz4_put_len(uint8_t *op, size_t len)
+{
+  for (len -= 15; len >= 255; len -= 255) {
+    *op++ = 255;
+  }
+  *op++ = (uint8_t)len;
+  return op;
+}
+
+/// Get the length bytes that follow a token.
+///
+/// @return  false when running into "iend".
+static bool lz4_get_len(const uint8_t **ipp, const uint8_t *iend, size_t *len)
+{
+  const uint8_t *ip = *ipp;
+  uint8_t b;
+  do {
+    if (ip >= iend) {
+      return false;
+    }
+    b = *ip++;
+    *len += b;
+  } while (b == 255);
+  *ipp = ip;
+  return true;
+}
+
+/// Compress "srclen" bytes at "src" into "dst".
+///
+/// @param dstcap  Size of "dst". Can be smaller than "srclen" to only get a
+///                result that saves memory.
+///
+/// @return  Number of bytes used in "dst", zero if it does not fit.
+size_t lz4_compress(const void *src, size_t srclen, void *dst, size_t dstcap)
+{
+  const uint8_t *const base = src;
+  const uint8_t *const iend = base + srclen;
+  const uint8_t *ip = base;
+  const uint8_t *anchor = base;
+  uint8_t *const obase = dst;
+  uint8_t *op = obase;
+  const uint8_t *const oend = obase + dstcap;
+
+  if (srclen > LZ4_MFLIMIT) {
+    const uint8_t *const mflimit = iend - LZ4_MFLIMIT;
+    const uint8_t *const matchlimit = iend - LZ4_LASTLITERALS;
+    uint32_t table[1 << LZ4_HASH_LOG];
+    memset(table, 0, sizeof(table));
+
+    while (ip < mflimit) {
+      uint32_t seq = lz4_read32(ip);
+      unsigned h = lz4_hash(seq);
+      const uint8_t *ref = base + table[h];
+      table[h] = (uint32_t)(ip - base);
+      if (ref >= ip || ip - ref > LZ4_MAX_OFFSET || lz4_read32(ref) != seq) {
+        ip++;
+        continue;
+      }
+
+      // Extend the match backwards over literals, then forwards.
+      while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+        ip--;
+        ref--;
+      }
+      const uint8_t *mp = ip + LZ4_MINMATCH;
+      const uint8_t *rp = ref + LZ4_MINMATCH;
+      while (mp < matchlimit && *mp == *rp) {
+        mp++;
+        rp++;
+      }
+
+      size_t litlen = (size_t)(ip - anchor);
+      size_t matchlen = (size_t)(mp - ip) - LZ4_MINMATCH;
+      if ((size_t)(oend - op) < 1 + litlen / 255 + 1 + litlen + 2
+          + matchlen / 255 + 1) {
+        return 0;
+      }
+      uint8_t *token = op++;
+      if (litlen >= 15) {
+        *token = 15 << 4;
+        op = lz4_put_len(op, litlen);
+      } else {
+        *token = (uint8_t)(litlen << 4);
+      }
+      memcpy(op, anchor, litlen);
+      op += litlen;
+      size_t offset = (size_t)(ip - ref);
+      *op++ = (uint8_t)offset;
+      *op++ = (uint8_t)(offset >> 8);
+      if (matchlen >= 15) {
+        *token |= 15;
+        op = lz4_put_len(op, matchlen);
+      } else {
+        *token |= (uint8_t)matchlen;
+      }
+
+      ip = mp;
+      anchor = ip;
+    }
+  }
+
+  // The rest are literals.
+  size_t litlen = (size_t)(iend - anchor);
+  if ((size_t)(oend - op) < 1 + litlen / 255 + 1 + litlen) {
+    return 0;
+  }
+  if (litlen >= 15) {
+    *op++ = 15 << 4;
+    op = lz4_put_len(op, litlen);
+  } else {
+    *op++ = (uint8_t)(litlen << 4);
+  }
+  memcpy(op, anchor, litlen);
+  op += litlen;
+  return (size_t)(op - obase);
+}
+
+/// Decompress "srclen" bytes at "src", produced by lz4_compress(), into
+/// "dst". Never writes outside of "dst", also not for corrupted data.
+///
+/// @param dstlen  Size of "dst", must be the size of the uncompressed data.
+///
+/// @return  false when the data is invalid or does not fill "dst" exactly.
+bool lz4_decompress(const void *src, size_t srclen, void *dst, size_t dstlen)
+{
+  const uint8_t *ip = src;
+  const uint8_t *const iend = ip + srclen;
+  uint8_t *const obase = dst;
+  uint8_t *op = obase;
+  uint8_t *const oend = obase + dstlen;
+
+  while (ip < iend) {
+    unsigned token = *ip++;
+
+    size_t len = token >> 4;
+    if (len == 15 && !lz4_get_len(&ip, iend, &len)) {
+      return false;
+    }
+    if ((size_t)(iend - ip) < len || (size_t)(oend - op) < len) {
+      return false;
+    }
+    memcpy(op, ip, len);
+    op += len;
+    ip += len;
+    if (ip == iend) {  // the last sequence has no match
+      break;
+    }
+
+    if (iend - ip < 2) {
+      return false;
+    }
+    size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > (size_t)(op - obase)) {
+      return false;
+    }
+    len = token & 15;
+    if (len == 15 && !lz4_get_len(&ip, iend, &len)) {
+      return false;
+    }
+    len += LZ4_MINMATCH;
+    if ((size_t)(oend - op) < len) {
+      return false;
+    }
+    const uint8_t *match = op - offset;
+    if (offset >= len) {
+      memcpy(op, match, len);
+      op += len;
+    } else {
+      // Overlapping: repeats the last "offset" bytes.
+      while (len-- > 0) {
+        *op++ = *match++;
+      }
+    }
+  }
+  return op == oend;
+}
@@ -0,0 +1,10 @@
+#ifndef NVIM_LZ4_H
+#define NVIM_LZ4_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef INCLUDE_GENERATED_DECLARATIONS
+# include "lz4.h.generated.h"
+#endif
+#endif  // NVIM_LZ4_H
@@ -27,6 +27,7 @@
 #include "nvim/iconv.h"
 #include "nvim/if_cscope.h"
 #include "nvim/lua/executor.h"
+#include "nvim/lua/treesitter.h"
 #include "nvim/main.h"
 #include "nvim/vim.h"
 #ifdef HAVE_LOCALE_H
@@ -554,6 +555,12 @@ int main(int argc, char **argv)
 void os_exit(int r)
   FUNC_ATTR_NORETURN
 {
+  // A file that is still being written must be complete before exiting.
+  // getout() already waited when autocommands can still be triggered.
+  buf_write_wait_noautocmd(NULL);
+  // Parsing threads must not schedule their result on a closed main loop.
+  tslua_parse_wait();
+
   exiting = true;
 
   ui_flush();
@@ -600,6 +607,9 @@ void getout(int exitval)
   if (v_dying <= 1) {
     const tabpage_T *next_tp;
 
+    // Finish writing in the background, BufWritePost comes before leaving.
+    buf_write_wait(NULL);
+
     // Trigger BufWinLeave for all windows, but only once per buffer.
     for (const tabpage_T *tp = first_tabpage; tp != NULL; tp = next_tp) {
       next_tp = tp->tp_next;
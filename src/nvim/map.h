@@ -70,6 +70,11 @@ MAP_DECLS(ColorKey, ColorItem)
 #define map_clear(T, U) map_##T##_##U##_clear
 
 #define map_size(map) ((map)->table.size)
+/// Bytes allocated for the hash table of "map", keys of type "K" and values
+/// of type "V". Does not include what keys or values point to.
+#define map_mem_size(map, K, V) \
+  ((size_t)(map)->table.n_buckets * (sizeof(K) + sizeof(V)) \
+   + (size_t)(map)->table.n_buckets / 4)
 
 #define pmap_destroy(T) map_destroy(T, ptr_t)
 #define pmap_get(T) map_get(T, ptr_t)
@@ -7,13 +7,19 @@
 // marker tree data structure of the Atom editor, regarding efficient updates
 // to text changes.
 //
-// Marks are inserted using marktree_put. Text changes are processed using
+// Marks are inserted using marktree_put. Many marks can be inserted at once
+// with marktree_batch_put and marktree_batch_flush, which builds the tree
+// again from the bottom up when that is cheaper. Text changes are processed using
 // marktree_splice. All read and delete operations use the iterator.
 // use marktree_itr_get to put an iterator at a given position or
 // marktree_lookup to lookup a mark by its id (iterator optional in this case).
 // Use marktree_itr_current and marktree_itr_next/prev to read marks in a loop.
 // marktree_del_itr deletes the current mark of the iterator and implicitly
-// moves the iterator to the next mark.
+// moves the iterator to the next mark. marktree_overlap finds the pairs
+// which start before a position and end after it, without looking at the
+// marks before that position: every node knows how far the pairs starting in
+// it reach. This is recomputed lazily for the nodes changed since the last
+// query.
 //
 // Work is ongoing to fully support ranges (mark pairs).
 
@@ -64,6 +70,10 @@
 #define END_FLAG MARKTREE_END_FLAG
 #define ID_INCR (((uint64_t)1) << 2)
 
+// A batch of marks with at least 1/MT_REBUILD_RATIO of the number of keys
+// in the tree is merged into it by building the tree again.
+#define MT_REBUILD_RATIO 16
+
 #define rawkey(itr) (itr->node->key[itr->i])
 
 static bool pos_leq(mtpos_t a, mtpos_t b)
@@ -122,6 +132,11 @@ static int key_cmp(mtkey_t a, mtkey_t b)
   return mt_generic_cmp(a.id, b.id);
 }
 
+static int key_cmp_ptr(const void *a, const void *b)
+{
+  return key_cmp(*(const mtkey_t *)a, *(const mtkey_t *)b);
+}
+
 static inline int marktree_getp_aux(const mtnode_t *x, mtkey_t k, int *r)
 {
   int tr, *rr, begin = 0, end = x->n;
@@ -151,6 +166,25 @@ static inline void refkey(MarkTree *b, mtnode_t *x, int i)
   pmap_put(uint64_t)(b->id2node, ANTIGRAVITY(x->key[i].id), x);
 }
 
+// The max_end of "x" must be recomputed, and so must the one of its parents.
+static inline void mt_dirty(mtnode_t *x)
+{
+  while (x && !x->dirty) {
+    x->dirty = true;
+    x = x->parent;
+  }
+}
+
+// The key with "id" in "x" was added, removed or moved. When it is part of a
+// pair, the node with the start of the pair needs a new max_end as well.
+static inline void mt_dirty_key(MarkTree *b, mtnode_t *x, uint64_t id)
+{
+  mt_dirty(x);
+  if (id & PAIRED) {
+    mt_dirty(pmap_get(uint64_t)(b->id2node, ANTIGRAVITY(id) ^ END_FLAG));
+  }
+}
+
 // put functions
 
 // x must be an internal node, which is not full
@@ -191,6 +225,8 @@ static inline void split_node(MarkTree *b, mtnode_t *x, const int i)
   if (i > 0) {
     unrelative(x->key[i-1].pos, &x->key[i].pos);
   }
+  mt_dirty(y);
+  mt_dirty(z);
 }
 
 // x must not be a full node (even if there might be internal space)
@@ -221,11 +257,16 @@ static inline void marktree_putp_aux(MarkTree *b, mtnode_t *x, mtkey_t k)
   }
 }
 
-uint64_t marktree_put(MarkTree *b, int row, int col, bool right_gravity, uint8_t decor_level)
+static uint64_t marktree_new_id(MarkTree *b, bool paired, uint8_t decor_level)
 {
-  uint64_t id = (b->next_id+=ID_INCR);
+  uint64_t id = (b->next_id+=ID_INCR)|(paired?PAIRED:0);
   assert(decor_level < DECOR_LEVELS);
-  id = id | ((uint64_t)decor_level << DECOR_OFFSET);
+  return id | ((uint64_t)decor_level << DECOR_OFFSET);
+}
+
+uint64_t marktree_put(MarkTree *b, int row, int col, bool right_gravity, uint8_t decor_level)
+{
+  uint64_t id = marktree_new_id(b, false, decor_level);
   uint64_t keyid = id;
   if (right_gravity) {
     // order all right gravity keys after the left ones, for effortless
@@ -239,9 +280,7 @@ uint64_t marktree_put(MarkTree *b, int row, int col, bool right_gravity, uint8_t
 uint64_t marktree_put_pair(MarkTree *b, int start_row, int start_col, bool start_right, int end_row,
                            int end_col, bool end_right, uint8_t decor_level)
 {
-  uint64_t id = (b->next_id+=ID_INCR)|PAIRED;
-  assert(decor_level < DECOR_LEVELS);
-  id = id | ((uint64_t)decor_level << DECOR_OFFSET);
+  uint64_t id = marktree_new_id(b, true, decor_level);
   uint64_t start_id = id|(start_right?RIGHT_GRAVITY:0);
   uint64_t end_id = id|END_FLAG|(end_right?RIGHT_GRAVITY:0);
   marktree_put_key(b, start_row, start_col, start_id);
@@ -249,6 +288,149 @@ uint64_t marktree_put_pair(MarkTree *b, int start_row, int start_col, bool start
   return id;
 }
 
+/// Like marktree_put, but the mark is only added to "batch". It is put in
+/// the tree by marktree_batch_flush.
+uint64_t marktree_batch_put(MarkTree *b, mtbatch_t *batch, int row, int col, bool right_gravity,
+                            uint8_t decor_level)
+{
+  uint64_t id = marktree_new_id(b, false, decor_level);
+  kv_push(*batch, ((mtkey_t){ .pos = { row, col },
+                              .id = id|(right_gravity?RIGHT_GRAVITY:0) }));
+  return id;
+}
+
+/// Like marktree_put_pair, but the marks are only added to "batch".
+uint64_t marktree_batch_put_pair(MarkTree *b, mtbatch_t *batch, int start_row, int start_col,
+                                 bool start_right, int end_row, int end_col, bool end_right,
+                                 uint8_t decor_level)
+{
+  uint64_t id = marktree_new_id(b, true, decor_level);
+  kv_push(*batch, ((mtkey_t){ .pos = { start_row, start_col },
+                              .id = id|(start_right?RIGHT_GRAVITY:0) }));
+  kv_push(*batch, ((mtkey_t){ .pos = { end_row, end_col },
+                              .id = id|END_FLAG|(end_right?RIGHT_GRAVITY:0) }));
+  return id;
+}
+
+/// Put the marks of "batch" in the tree and empty "batch".
+///
+/// A small batch is inserted one key at a time. Otherwise the keys of the
+/// tree and the sorted batch are merged and the tree is built again from the
+/// bottom up, which takes linear time.
+///
+/// @param keep  OPTIONAL. Forces building the tree again, and then only the
+///              existing marks for which it returns true are kept.
+void marktree_batch_flush(MarkTree *b, mtbatch_t *batch, mtkeep_fn keep, void *data)
+{
+  size_t n = kv_size(*batch);
+  qsort(batch->items, n, sizeof(mtkey_t), key_cmp_ptr);
+
+  if (keep == NULL && n * MT_REBUILD_RATIO < b->n_keys) {
+    for (size_t i = 0; i < n; i++) {
+      mtkey_t k = kv_A(*batch, i);
+      marktree_put_key(b, k.pos.row, k.pos.col, k.id);
+    }
+    kv_size(*batch) = 0;
+    return;
+  }
+
+  mtkey_t *keys = xmalloc((b->n_keys + n) * sizeof(mtkey_t));
+  size_t count = 0;
+  size_t j = 0;
+  MarkTreeIter itr[1] = { 0 };
+  for (bool more = marktree_itr_first(b, itr); more && itr->node;
+       more = marktree_itr_next(b, itr)) {
+    mtkey_t k = { .pos = marktree_itr_pos(itr), .id = rawkey(itr).id };
+    if (keep && !keep(ANTIGRAVITY(k.id), data)) {
+      pmap_del(uint64_t)(b->id2node, ANTIGRAVITY(k.id));
+      continue;
+    }
+    while (j < n && key_cmp(kv_A(*batch, j), k) < 0) {
+      keys[count++] = kv_A(*batch, j++);
+    }
+    keys[count++] = k;
+  }
+  while (j < n) {
+    keys[count++] = kv_A(*batch, j++);
+  }
+
+  if (b->root) {
+    marktree_free_node(b->root);
+    b->root = NULL;
+  }
+  b->n_nodes = 0;
+  b->n_keys = count;
+  if (count > 0) {
+    int level = 0;
+    while (mt_max_keys(level) < count) {
+      level++;
+    }
+    b->root = marktree_build(b, keys, count, level, (mtpos_t){ 0, 0 }, NULL);
+  }
+  xfree(keys);
+  kv_size(*batch) = 0;
+}
+
+/// @return  The largest number of keys in a subtree of height "level".
+static size_t mt_max_keys(int level)
+{
+  size_t n = 2 * T - 1;
+  for (int i = 0; i < level; i++) {
+    n = (2 * T - 1) + 2 * T * n;
+  }
+  return n;
+}
+
+// Build a subtree of height "level" with the "n" sorted keys at "keys",
+// which have absolute positions. A non-root subtree must get at least
+// the smallest number of keys such a subtree can have, the children then
+// get enough keys too.
+static mtnode_t *marktree_build(MarkTree *b, mtkey_t *keys, size_t n, int level, mtpos_t base,
+                                mtnode_t *parent)
+{
+  mtnode_t *x = xcalloc(1, (level || !parent) ? ILEN : sizeof(mtnode_t));
+  b->n_nodes++;
+  x->level = level;
+  x->parent = parent;
+  x->dirty = true;
+
+  if (level == 0) {
+    assert(n <= 2 * T - 1);
+    for (size_t i = 0; i < n; i++) {
+      x->key[i] = keys[i];
+      relative(base, &x->key[i].pos);
+      refkey(b, x, (int)i);
+    }
+    x->n = (int32_t)n;
+    return x;
+  }
+
+  // Use as few children as possible, but a non-root node needs at least T.
+  size_t child_max = mt_max_keys(level - 1);
+  size_t c = (n + 1 + child_max) / (child_max + 1);
+  c = MAX(c, parent ? T : 2);
+  assert(c <= 2 * T);
+  size_t q = (n - (c - 1)) / c;
+  size_t r = (n - (c - 1)) % c;
+
+  size_t k = 0;
+  mtpos_t child_base = base;
+  for (size_t i = 0; i < c; i++) {
+    size_t cnt = q + (i < r ? 1 : 0);
+    x->ptr[i] = marktree_build(b, keys + k, cnt, level - 1, child_base, x);
+    k += cnt;
+    if (i < c - 1) {
+      child_base = keys[k].pos;
+      x->key[i] = keys[k];
+      relative(base, &x->key[i].pos);
+      refkey(b, x, (int)i);
+      k++;
+    }
+  }
+  x->n = (int32_t)(c - 1);
+  return x;
+}
+
 void marktree_put_key(MarkTree *b, int row, int col, uint64_t id)
 {
   mtkey_t k = { .pos = { .row = row, .col = col }, .id = id };
@@ -264,12 +446,14 @@ void marktree_put_key(MarkTree *b, int row, int col, uint64_t id)
     b->n_nodes++;
     s = (mtnode_t *)xcalloc(1, ILEN);
     b->root = s; s->level = r->level+1; s->n = 0;
+    s->dirty = true;
     s->ptr[0] = r;
     r->parent = s;
     split_node(b, s, 0);
     r = s;
   }
   marktree_putp_aux(b, r, k);
+  mt_dirty_key(b, pmap_get(uint64_t)(b->id2node, ANTIGRAVITY(id)), id);
 }
 
 /// INITIATING DELETION PROTOCOL:
@@ -320,6 +504,7 @@ void marktree_del_itr(MarkTree *b, MarkTreeIter *itr, bool rev)
   mtnode_t *x = itr->node;
   assert(x->level == 0);
   mtkey_t intkey = x->key[itr->i];
+  mt_dirty_key(b, x, id);
   if (x->n > itr->i+1) {
     memmove(&x->key[itr->i], &x->key[itr->i+1],
             sizeof(mtkey_t) * (size_t)(x->n - itr->i-1));
@@ -350,6 +535,7 @@ void marktree_del_itr(MarkTree *b, MarkTreeIter *itr, bool rev)
     mtkey_t deleted = cur->key[curi];
     cur->key[curi] = intkey;
     refkey(b, cur, curi);
+    mt_dirty(cur);
     relative(intkey.pos, &deleted.pos);
     mtnode_t *y = cur->ptr[curi+1];
     if (deleted.pos.row || deleted.pos.col) {
@@ -357,6 +543,7 @@ void marktree_del_itr(MarkTree *b, MarkTreeIter *itr, bool rev)
         for (int k = 0; k < y->n; k++) {
           unrelative(deleted.pos, &y->key[k].pos);
         }
+        mt_dirty(y);
         y = y->level ? y->ptr[0] : NULL;
       }
     }
@@ -483,6 +670,7 @@ static mtnode_t *merge_node(MarkTree *b, mtnode_t *p, int i)
   p->n--;
   xfree(y);
   b->n_nodes--;
+  mt_dirty(x);
   return x;
 }
 
@@ -512,6 +700,8 @@ static void pivot_right(MarkTree *b, mtnode_t *p, int i)
   for (int k = 1; k < y->n; k++) {
     unrelative(y->key[0].pos, &y->key[k].pos);
   }
+  mt_dirty(x);
+  mt_dirty(y);
 }
 
 static void pivot_left(MarkTree *b, mtnode_t *p, int i)
@@ -542,6 +732,8 @@ static void pivot_left(MarkTree *b, mtnode_t *p, int i)
   }
   x->n++;
   y->n--;
+  mt_dirty(x);
+  mt_dirty(y);
 }
 
 /// frees all mem, resets tree to valid empty state
@@ -559,6 +751,28 @@ void marktree_clear(MarkTree *b)
   b->n_nodes = 0;
 }
 
+/// @return  The number of bytes of memory used by the tree "b".
+size_t marktree_mem_size(MarkTree *b)
+{
+  size_t size = map_mem_size(b->id2node, uint64_t, ptr_t);
+  if (b->root) {
+    size += marktree_node_mem_size(b->root);
+  }
+  return size;
+}
+
+static size_t marktree_node_mem_size(mtnode_t *x)
+{
+  if (!x->level) {
+    return sizeof(mtnode_t);
+  }
+  size_t size = ILEN;
+  for (int i = 0; i < x->n+1; i++) {
+    size += marktree_node_mem_size(x->ptr[i]);
+  }
+  return size;
+}
+
 void marktree_free_node(mtnode_t *x)
 {
   if (x->level) {
@@ -858,6 +1072,14 @@ bool marktree_splice(MarkTree *b, int start_line, int start_col, int old_extent_
     // den e FÄRDIG
     return false;
   }
+
+  // When lines are inserted or deleted, the pairs which start at or before
+  // "start" and end after it get longer or shorter. The keys which are
+  // changed below mark their own nodes dirty.
+  mtoverlap_t overlap = KV_INITIAL_VALUE;
+  if (new_extent.row != old_extent.row) {
+    marktree_overlap(b, start.row, start.col + 1, &overlap);
+  }
   mtpos_t delta = { new_extent.row - old_extent.row,
                     new_extent.col-old_extent.col };
 
@@ -904,6 +1126,7 @@ continue_same_node:
           swap_id(&rawkey(itr).id, &rawkey(enditr).id);
           refkey(b, itr->node, itr->i);
           refkey(b, enditr->node, enditr->i);
+          mt_dirty_key(b, enditr->node, rawkey(enditr).id);
         } else {
           past_right = true;  // NOLINT
           (void)past_right;
@@ -917,6 +1140,7 @@ continue_same_node:
       }
 
       moved = true;
+      mt_dirty_key(b, itr->node, rawkey(itr).id);
       if (itr->node->level) {
         oldbase[itr->lvl+1] = rawkey(itr).pos;
         unrelative(oldbase[itr->lvl], &oldbase[itr->lvl+1]);
@@ -950,6 +1174,7 @@ past_continue_same_node:
       mtpos_t oldpos = rawkey(itr).pos;
       rawkey(itr).pos = loc_new;
       moved = true;
+      mt_dirty_key(b, itr->node, rawkey(itr).id);
       if (itr->node->level) {
         oldbase[itr->lvl+1] = oldpos;
         unrelative(oldbase[itr->lvl], &oldbase[itr->lvl+1]);
@@ -986,6 +1211,7 @@ past_continue_same_node:
     if (delta.row) {
       rawkey(itr).pos.row += delta.row;
       moved = true;
+      mt_dirty_key(b, itr->node, rawkey(itr).id);
     }
     relative(itr->pos, &rawkey(itr).pos);
     if (done) {
@@ -993,6 +1219,82 @@ past_continue_same_node:
     }
     marktree_itr_next_skip(b, itr, true, NULL);
   }
+
+  for (size_t i = 0; i < kv_size(overlap); i++) {
+    mt_dirty(pmap_get(uint64_t)(b->id2node, kv_A(overlap, i).id));
+  }
+  kv_destroy(overlap);
+  return moved;
+}
+
+/// Does what calling marktree_splice() for each of the "n" changes in row
+/// "row" does, in one pass over the marks in that row. The changes are
+/// sorted by column and do not overlap.
+///
+/// @return  true when a mark was moved.
+bool marktree_splice_cols(MarkTree *b, int row, const mtedit_t *edits, size_t n)
+{
+  if (n == 0) {
+    return false;
+  }
+  mtpos_t first = { row, edits[0].col };
+  MarkTreeIter itr[1] = { 0 };
+  static kvec_t(mtkey_t) keys = KV_INITIAL_VALUE;
+  kv_size(keys) = 0;
+  for (marktree_itr_get_ext(b, first, itr, false, true, NULL); itr->node;
+       marktree_itr_next(b, itr)) {
+    mtpos_t pos = marktree_itr_pos(itr);
+    if (pos.row != row) {
+      break;
+    }
+    kv_push(keys, ((mtkey_t){ .pos = pos, .id = rawkey(itr).id }));
+  }
+
+  // A mark inside a change goes to its start, or to its end if the mark has
+  // right gravity. A right gravity mark put at the end of a change is also
+  // inside the next change when they touch, as with separate splices.
+  bool moved = false;
+  size_t e = 0;  // first change that does not end before the mark
+  int delta = 0;  // length added by the changes before "e"
+  for (size_t i = 0; i < kv_size(keys); i++) {
+    mtkey_t *k = &kv_A(keys, i);
+    int col = k->pos.col;
+    while (e < n && edits[e].col + edits[e].old_len < col) {
+      delta += edits[e].new_len - edits[e].old_len;
+      e++;
+    }
+    int new_col = col + delta;
+    if (e < n && edits[e].col <= col) {
+      size_t last = e;
+      int d = delta;
+      if (IS_RIGHT(k->id)) {
+        while (last + 1 < n
+               && edits[last + 1].col == edits[last].col + edits[last].old_len) {
+          d += edits[last].new_len - edits[last].old_len;
+          last++;
+        }
+      }
+      new_col = edits[last].col + d + (IS_RIGHT(k->id) ? edits[last].new_len : 0);
+    }
+    moved |= (new_col != col);
+    k->pos.col = new_col;
+  }
+
+  // Marks inside a change can swap order. Put them back sorted, in the same
+  // places in the tree: the tree is still in order.
+  qsort(keys.items, kv_size(keys), sizeof(mtkey_t), key_cmp_ptr);
+  marktree_itr_get_ext(b, first, itr, false, true, NULL);
+  for (size_t i = 0; i < kv_size(keys); i++) {
+    mtkey_t k = kv_A(keys, i);
+    if (rawkey(itr).id != k.id) {
+      rawkey(itr).id = k.id;
+      refkey(b, itr->node, itr->i);
+      mt_dirty(itr->node);
+    }
+    relative(itr->pos, &k.pos);
+    rawkey(itr).pos = k.pos;
+    marktree_itr_next(b, itr);
+  }
   return moved;
 }
 
@@ -1029,6 +1331,95 @@ void marktree_move_region(MarkTree *b, int start_row, colnr_T start_col, int ext
   kv_destroy(saved);
 }
 
+/// Find the pairs which start before (row, col) and end at or after it.
+/// The starts of these pairs are added to "overlap", sorted by position.
+///
+/// Only the nodes which have such a pair are visited, so this takes time in
+/// proportion to the number of pairs found, not to the number of marks before
+/// (row, col).
+void marktree_overlap(MarkTree *b, int row, int col, mtoverlap_t *overlap)
+{
+  if (!b->root) {
+    return;
+  }
+  mtpos_t base = { 0, 0 };
+  if (b->root->dirty) {
+    mt_fix_max_end(b, b->root, base);
+  }
+  overlap_node(b, b->root, base, (mtpos_t){ row, col }, overlap);
+}
+
+static void overlap_node(MarkTree *b, mtnode_t *x, mtpos_t base, mtpos_t pos,
+                         mtoverlap_t *overlap)
+{
+  if (x->max_end == INT32_MIN || base.row + x->max_end < pos.row) {
+    return;
+  }
+  for (int i = 0; i < x->n + (x->level ? 1 : 0); i++) {
+    if (x->level) {
+      mtpos_t child_base = base;
+      if (i > 0) {
+        child_base = x->key[i-1].pos;
+        unrelative(base, &child_base);
+      }
+      if (pos_leq(pos, child_base)) {
+        break;
+      }
+      overlap_node(b, x->ptr[i], child_base, pos, overlap);
+    }
+    if (i == x->n) {
+      break;
+    }
+    mtkey_t k = x->key[i];
+    unrelative(base, &k.pos);
+    if (pos_leq(pos, k.pos)) {
+      break;
+    }
+    if ((k.id & PAIRED) && !(k.id & END_FLAG)) {
+      mtpos_t end = marktree_lookup(b, ANTIGRAVITY(k.id)|END_FLAG, NULL);
+      if (end.row >= 0 && pos_leq(pos, end)) {
+        kv_push(*overlap, ((mtmark_t){ .row = k.pos.row, .col = k.pos.col,
+                                       .id = ANTIGRAVITY(k.id),
+                                       .right_gravity = k.id & RIGHT_GRAVITY }));
+      }
+    }
+  }
+}
+
+// Compute the max_end of the dirty node "x", whose positions are relative
+// to "base", and of its dirty children.
+static void mt_fix_max_end(MarkTree *b, mtnode_t *x, mtpos_t base)
+{
+  int32_t max_end = INT32_MIN;
+  for (int i = 0; i < x->n; i++) {
+    uint64_t id = x->key[i].id;
+    if ((id & PAIRED) && !(id & END_FLAG)) {
+      mtpos_t end = marktree_lookup(b, ANTIGRAVITY(id)|END_FLAG, NULL);
+      if (end.row >= 0) {
+        max_end = MAX(max_end, end.row - base.row);
+      }
+    }
+  }
+  if (x->level) {
+    for (int i = 0; i < x->n + 1; i++) {
+      mtnode_t *y = x->ptr[i];
+      mtpos_t child_base = base;
+      if (i > 0) {
+        child_base = x->key[i-1].pos;
+        unrelative(base, &child_base);
+      }
+      if (y->dirty) {
+        mt_fix_max_end(b, y, child_base);
+      }
+      if (y->max_end != INT32_MIN) {
+        max_end = MAX(max_end, y->max_end + child_base.row - base.row);
+      }
+    }
+  }
+  x->max_end = max_end;
+  x->dirty = false;
+}
+
 /// @param itr OPTIONAL. set itr to pos.
 mtpos_t marktree_lookup(MarkTree *b, uint64_t id, MarkTreeIter *itr)
 {
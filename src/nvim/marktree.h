@@ -4,6 +4,7 @@
 #include <stdint.h>
 
 #include "nvim/garray.h"
+#include "nvim/lib/kvec.h"
 #include "nvim/map.h"
 #include "nvim/pos.h"
 
@@ -46,9 +47,32 @@ typedef struct {
   uint64_t id;
 } mtkey_t;
 
+// Marks to be put in the tree together, see marktree_batch_flush().
+typedef kvec_t(mtkey_t) mtbatch_t;
+
+// Decides whether the mark with id "id" stays in the tree when the tree is
+// rebuilt by marktree_batch_flush().
+typedef bool (*mtkeep_fn)(uint64_t id, void *data);
+
+// Marks found by marktree_overlap().
+typedef kvec_t(mtmark_t) mtoverlap_t;
+
+// A change within a line for marktree_splice_cols().
+typedef struct {
+  int32_t col;  // start column, before any of the changes in the line
+  int32_t old_len;
+  int32_t new_len;
+} mtedit_t;
+
 struct mtnode_s {
   int32_t n;
   int32_t level;
+  // Largest row of the end of a pair which starts in this subtree, relative
+  // to the row the positions of the node are relative to. INT32_MIN when no
+  // pair starts here. Only valid when "dirty" is false, a dirty node also has
+  // dirty parents.
+  int32_t max_end;
+  bool dirty;
   // TODO(bfredl): we could consider having a only-sometimes-valid
   // index into parent for faster "cached" lookup.
   mtnode_t *parent;
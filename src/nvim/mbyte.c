@@ -884,6 +884,48 @@ int utf_ptr2len_len(const char_u *p, int size)
   return len;
 }
 
+/// Return the number of ASCII bytes at the start of the "len" bytes at "p".
+/// Checks eight bytes at a time, text is mostly ASCII.
+size_t utf_ascii_len(const char_u *p, size_t len)
+  FUNC_ATTR_PURE FUNC_ATTR_WARN_UNUSED_RESULT FUNC_ATTR_NONNULL_ALL
+{
+  size_t i = 0;
+  uint64_t word;
+
+  for (; len - i >= sizeof(word); i += sizeof(word)) {
+    memcpy(&word, p + i, sizeof(word));
+    if (word & 0x8080808080808080ULL) {
+      break;
+    }
+  }
+  while (i < len && p[i] < 0x80) {
+    i++;
+  }
+  return i;
+}
+
+/// Check whether the "len" bytes at "p" are valid UTF-8, the way reading a
+/// file checks it.  NUL bytes are accepted.
+bool utf_valid_bytes(const char_u *p, size_t len)
+  FUNC_ATTR_PURE FUNC_ATTR_WARN_UNUSED_RESULT
+{
+  const char_u *const end = p + len;
+
+  while (p < end) {
+    p += utf_ascii_len(p, (size_t)(end - p));
+    if (p >= end) {
+      break;
+    }
+    size_t todo = (size_t)(end - p);
+    int l = utf_ptr2len_len(p, todo > INT_MAX ? INT_MAX : (int)todo);
+    if (l == 1 || (size_t)l > todo) {
+      return false;
+    }
+    p += l;
+  }
+  return true;
+}
+
 /// Return the number of bytes occupied by a UTF-8 character in a string
 ///
 /// This includes following composing characters.
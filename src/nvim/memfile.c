@@ -30,11 +30,17 @@
 /// mf_open_file()    open a swap file for an existing memfile
 /// mf_close()        close (and delete) a memfile
 /// mf_new()          create a new block in a memfile and lock it
+/// mf_reserve()      reserve negative block numbers for blocks created later
+/// mf_new_reserved() create a block with a reserved number and lock it
 /// mf_get()          get an existing block and lock it
 /// mf_put()          unlock a block, may be marked for writing
 /// mf_free()         remove a block
 /// mf_sync()         sync changed parts of memfile to disk
+/// mf_bg_wait()      wait for blocks written in the background
 /// mf_release_all()  release as much memory as possible
+/// mf_release_clean() release blocks that can be created again
+/// mf_compress()     compress blocks that are not used for a while
+/// mf_mem_size()     memory used for blocks in memory
 /// mf_trans_del()    may translate negative to positive block number
 /// mf_fullname()     make file name full path (use before first :cd)
 
@@ -44,10 +50,16 @@
 #include <limits.h>
 #include <stdbool.h>
 #include <string.h>
+#ifdef HAVE_PWRITEV
+# include <sys/uio.h>
+# include <uv.h>
+#endif
 
 #include "nvim/ascii.h"
 #include "nvim/assert.h"
 #include "nvim/fileio.h"
+#include "nvim/lib/kvec.h"
+#include "nvim/lz4.h"
 #include "nvim/memfile.h"
 #include "nvim/memline.h"
 #include "nvim/memory.h"
@@ -58,8 +70,23 @@
 #include "nvim/path.h"
 #include "nvim/vim.h"
 
-#define MEMFILE_PAGE_SIZE 4096       /// default page size
-
+#ifdef HAVE_PWRITEV
+/// Maximum number of blocks written with one pwritev() call.
+# define MF_BG_IOV_MAX 64
+
+/// A queued write, or fsync() when "data" is NULL.
+typedef struct {
+  memfile_T *mfp;
+  int fd;
+  off_T offset;
+  char *data;                   ///< copy of the block, owned by the queue
+  size_t size;
+  uint64_t seq;                 ///< sequence number, increasing
+  bool failed;                  ///< set by the writer thread
+} mfwrite_T;
+
+typedef kvec_t(mfwrite_T) mfwritevec_T;
+#endif
 
 #ifdef INCLUDE_GENERATED_DECLARATIONS
 # include "memfile.c.generated.h"
@@ -96,10 +123,13 @@ memfile_T *mf_open(char_u *fname, int flags)
   mfp->mf_free_first = NULL;         // free list is empty
   mfp->mf_used_first = NULL;         // used list is empty
   mfp->mf_used_last = NULL;
+  mfp->mf_clock_hand = NULL;
   mfp->mf_dirty = false;
+  mfp->mf_bg_seq = 0;
+  mfp->mf_bg_error = false;
   mf_hash_init(&mfp->mf_hash);
   mf_hash_init(&mfp->mf_trans);
-  mfp->mf_page_size = MEMFILE_PAGE_SIZE;
+  mfp->mf_page_size = (unsigned)p_sbs;
 
   // Try to set the page size equal to device's block size. Speeds up I/O a lot.
   FileInfo file_info;
@@ -167,6 +197,7 @@ void mf_close(memfile_T *mfp, bool del_file)
   if (mfp == NULL) {                    // safety check
     return;
   }
+  (void)mf_bg_wait(mfp);
   if (mfp->mf_fd >= 0 && close(mfp->mf_fd) < 0) {
     emsg(_(e_swapclose));
   }
@@ -205,6 +236,7 @@ void mf_close_file(buf_T *buf, bool getlines)
     }
   }
 
+  (void)mf_bg_wait(mfp);
   if (close(mfp->mf_fd) < 0) {           // close the file
     emsg(_(e_swapclose));
   }
@@ -261,7 +293,7 @@ bhdr_T *mf_new(memfile_T *mfp, bool negative, unsigned page_count)
       mfp->mf_blocknr_max += page_count;
     }
   }
-  hp->bh_flags = BH_LOCKED | BH_DIRTY;    // new block is always dirty
+  hp->bh_flags = BH_LOCKED | BH_DIRTY | BH_REFERENCED;  // new block is always dirty
   mfp->mf_dirty = true;
   hp->bh_page_count = page_count;
   mf_ins_used(mfp, hp);
@@ -274,6 +306,43 @@ bhdr_T *mf_new(memfile_T *mfp, bool negative, unsigned page_count)
   return hp;
 }
 
+/// Reserve "count" negative block numbers, for blocks that are only created
+/// when they are needed, using mf_new_reserved().
+///
+/// The reserved numbers are counted as negative blocks, like the numbers
+/// handed out by mf_new().
+///
+/// @return  The first reserved number, the others follow it downwards.
+blocknr_T mf_reserve(memfile_T *mfp, blocknr_T count)
+{
+  blocknr_T first = mfp->mf_blocknr_min;
+  mfp->mf_blocknr_min -= count;
+  mfp->mf_neg_count += count;
+  return first;
+}
+
+/// Create the block with number "nr", which was reserved with mf_reserve(),
+/// and lock it.
+///
+/// Unlike a block returned by mf_new() it is not dirty: the caller fills it
+/// with data that can be produced again, thus it does not need to be written
+/// to the swap file until it is changed.
+bhdr_T *mf_new_reserved(memfile_T *mfp, blocknr_T nr, unsigned page_count)
+{
+  assert(nr < 0 && nr > mfp->mf_blocknr_min && mf_find_hash(mfp, nr) == NULL);
+  bhdr_T *hp = mf_alloc_bhdr(mfp, page_count);
+  hp->bh_bnum = nr;
+  hp->bh_flags = BH_LOCKED | BH_REFERENCED;
+  hp->bh_page_count = page_count;
+  mf_ins_used(mfp, hp);
+  mf_ins_hash(mfp, hp);
+
+  // Init the data to all zero, like mf_new() does.
+  (void)memset(hp->bh_data, 0, mfp->mf_page_size * page_count);
+
+  return hp;
+}
+
 // Get existing block "nr" with "page_count" pages.
 //
 // Caller should first check a negative nr with mf_trans_del().
@@ -288,30 +357,38 @@ bhdr_T *mf_get(memfile_T *mfp, blocknr_T nr, unsigned page_count)
 
   // see if it is in the cache
   bhdr_T *hp = mf_find_hash(mfp, nr);
-  if (hp == NULL) {                             // not in the hash list
-    if (nr < 0 || nr >= mfp->mf_infile_count) {  // can't be in the file
-      return NULL;
+  if (hp != NULL) {
+    g_stats.memfile_hit++;
+    if (hp->bh_flags & BH_COMPRESSED) {
+      void *data = xmalloc(mfp->mf_page_size * hp->bh_page_count);
+      mf_decompress(mfp, hp, data);
+      xfree(hp->bh_data);
+      hp->bh_data = data;
+      hp->bh_flags &= ~BH_COMPRESSED;
     }
+    hp->bh_flags |= BH_LOCKED | BH_REFERENCED;
+    return hp;
+  }
 
-    // could check here if the block is in the free list
+  g_stats.memfile_miss++;
+  if (nr < 0 || nr >= mfp->mf_infile_count) {  // can't be in the file
+    return NULL;
+  }
 
-    hp = mf_alloc_bhdr(mfp, page_count);
+  // could check here if the block is in the free list
 
-    hp->bh_bnum = nr;
-    hp->bh_flags = 0;
-    hp->bh_page_count = page_count;
-    if (mf_read(mfp, hp) == FAIL) {             // cannot read the block
-      mf_free_bhdr(hp);
-      return NULL;
-    }
-  } else {
-    mf_rem_used(mfp, hp);       // remove from list, insert in front below
-    mf_rem_hash(mfp, hp);
+  hp = mf_alloc_bhdr(mfp, page_count);
+
+  hp->bh_bnum = nr;
+  hp->bh_flags = BH_LOCKED | BH_REFERENCED;
+  hp->bh_page_count = page_count;
+  if (mf_read(mfp, hp) == FAIL) {               // cannot read the block
+    mf_free_bhdr(hp);
+    return NULL;
   }
 
-  hp->bh_flags |= BH_LOCKED;
   mf_ins_used(mfp, hp);         // put in front of used list
-  mf_ins_hash(mfp, hp);         // put in front of hash list
+  mf_ins_hash(mfp, hp);
 
   return hp;
 }
@@ -342,7 +419,7 @@ void mf_put(memfile_T *mfp, bhdr_T *hp, bool dirty, bool infile)
 void mf_free(memfile_T *mfp, bhdr_T *hp)
 {
   xfree(hp->bh_data);           // free data
-  mf_rem_hash(mfp, hp);         // get *hp out of the hash list
+  mf_rem_hash(mfp, hp);         // get *hp out of the hash table
   mf_rem_used(mfp, hp);         // get *hp out of the used list
   if (hp->bh_bnum < 0) {
     xfree(hp);                  // don't want negative numbers in free list
@@ -361,6 +438,8 @@ void mf_free(memfile_T *mfp, bhdr_T *hp)
 ///               MFS_FLUSH  Make sure buffers are flushed to disk, so they will
 ///                          survive a system crash.
 ///               MFS_ZERO   Only write block 0.
+///               MFS_BG     Queue the blocks for writing in the background,
+///                          also the flush. Write errors are reported later.
 ///
 /// @return FAIL  If failure. Possible causes:
 ///               - No file (nothing to do).
@@ -375,6 +454,15 @@ int mf_sync(memfile_T *mfp, int flags)
     return FAIL;
   }
 
+  bool bg = false;
+#ifdef HAVE_PWRITEV
+  bg = (flags & MFS_BG);
+  if (bg) {
+    // Report an error from writing in the background before.
+    mf_bg_check(mfp, false);
+  }
+#endif
+
   // Only a CTRL-C while writing will break us here, not one typed previously.
   got_int = false;
 
@@ -392,18 +480,21 @@ int mf_sync(memfile_T *mfp, int flags)
       if ((flags & MFS_ZERO) && hp->bh_bnum != 0) {
         continue;
       }
-      if (mf_write(mfp, hp) == FAIL) {
+      if (mf_write(mfp, hp, bg) == FAIL) {
         if (status == FAIL) {   // double error: quit syncing
           break;
         }
         status = FAIL;
       }
-      if (flags & MFS_STOP) {   // Stop when char available now.
-        if (os_char_avail()) {
-          break;
+      // Queueing a copy of the block is quick, no need to stop then.
+      if (!bg) {
+        if (flags & MFS_STOP) {   // Stop when char available now.
+          if (os_char_avail()) {
+            break;
+          }
+        } else {
+          os_breakcheck();
         }
-      } else {
-        os_breakcheck();
       }
       if (got_int) {
         break;
@@ -418,7 +509,13 @@ int mf_sync(memfile_T *mfp, int flags)
   }
 
   if (flags & MFS_FLUSH) {
-    if (os_fsync(mfp->mf_fd)) {
+    bool queued = false;
+#ifdef HAVE_PWRITEV
+    queued = bg && mf_bg_queue(mfp, 0, NULL, 0);
+#endif
+    if (queued) {
+      g_stats.fsync++;
+    } else if (mf_bg_wait(mfp) == FAIL || os_fsync(mfp->mf_fd)) {
       status = FAIL;
     }
   }
@@ -440,19 +537,19 @@ void mf_set_dirty(memfile_T *mfp)
   mfp->mf_dirty = true;
 }
 
-/// Insert block in front of memfile's hash list.
+/// Insert block in memfile's hash table.
 static void mf_ins_hash(memfile_T *mfp, bhdr_T *hp)
 {
   mf_hash_add_item(&mfp->mf_hash, (mf_hashitem_T *)hp);
 }
 
-/// Remove block from memfile's hash list.
+/// Remove block from memfile's hash table.
 static void mf_rem_hash(memfile_T *mfp, bhdr_T *hp)
 {
   mf_hash_rem_item(&mfp->mf_hash, (mf_hashitem_T *)hp);
 }
 
-/// Lookup block with number "nr" in memfile's hash list.
+/// Lookup block with number "nr" in memfile's hash table.
 static bhdr_T *mf_find_hash(memfile_T *mfp, blocknr_T nr)
 {
   return (bhdr_T *)mf_hash_find(&mfp->mf_hash, nr);
@@ -474,6 +571,9 @@ static void mf_ins_used(memfile_T *mfp, bhdr_T *hp)
 /// Remove block from memfile's used list.
 static void mf_rem_used(memfile_T *mfp, bhdr_T *hp)
 {
+  if (mfp->mf_clock_hand == hp) {
+    mfp->mf_clock_hand = hp->bh_prev;
+  }
   if (hp->bh_next == NULL) {               // last block in used list
     mfp->mf_used_last = hp->bh_prev;
   } else {
@@ -504,18 +604,18 @@ bool mf_release_all(void)
       }
 
       // Flush as many blocks as possible, only if there is a swapfile.
-      if (mfp->mf_fd >= 0) {
-        for (bhdr_T *hp = mfp->mf_used_last; hp != NULL;) {
+      // A clean block may only have been queued for writing, it can't be
+      // freed before it is on disk.
+      if (mfp->mf_fd >= 0 && mf_bg_wait(mfp) == OK) {
+        for (bhdr_T *hp = mfp->mf_used_last, *prevp; hp != NULL; hp = prevp) {
+          prevp = hp->bh_prev;
           if (!(hp->bh_flags & BH_LOCKED)
               && (!(hp->bh_flags & BH_DIRTY)
-                  || mf_write(mfp, hp) != FAIL)) {
+                  || mf_write(mfp, hp, false) != FAIL)) {
             mf_rem_used(mfp, hp);
             mf_rem_hash(mfp, hp);
             mf_free_bhdr(hp);
-            hp = mfp->mf_used_last;    // restart, list was changed
             retval = true;
-          } else {
-            hp = hp->bh_prev;
           }
         }
       }
@@ -524,6 +624,142 @@ bool mf_release_all(void)
   return retval;
 }
 
+/// Release clean blocks with a negative number that are not locked, until
+/// not more than "keep" of them are left. The CLOCK algorithm decides which
+/// ones: blocks that were used since the clock hand last passed them are
+/// kept this time around.
+///
+/// Such blocks have never been changed and can only come from
+/// mf_new_reserved(), the caller of which can create them again. Their
+/// numbers stay reserved.
+///
+/// @return  The number of these blocks still in memory.
+size_t mf_release_clean(memfile_T *mfp, size_t keep)
+{
+  size_t count = 0;
+  size_t used = 0;
+  for (bhdr_T *hp = mfp->mf_used_first; hp != NULL; hp = hp->bh_next) {
+    if (mf_is_clean_neg(hp)) {
+      count++;
+    }
+    used++;
+  }
+
+  // Going around twice clears all the referenced flags.
+  for (size_t todo = 2 * used; count > keep && todo > 0; todo--) {
+    bhdr_T *hp = mf_clock_next(mfp);
+    if (!mf_is_clean_neg(hp)) {
+      continue;
+    }
+    if (hp->bh_flags & BH_REFERENCED) {
+      hp->bh_flags &= ~BH_REFERENCED;
+      continue;
+    }
+    mf_rem_used(mfp, hp);
+    mf_rem_hash(mfp, hp);
+    mf_free_bhdr(hp);
+    count--;
+  }
+  return count;
+}
+
+/// Compress the blocks of "mfp" that are in memory and not locked, to take
+/// less memory while they are not needed, e.g. for a hidden buffer.
+/// A block is only kept compressed when that saves at least a quarter of its
+/// size. mf_get() uncompresses a block again.
+///
+/// Block 0 and blocks that mf_release_clean() may release are skipped.
+///
+/// @return  The number of bytes saved.
+size_t mf_compress(memfile_T *mfp)
+{
+  size_t saved = 0;
+  for (bhdr_T *hp = mfp->mf_used_first; hp != NULL; hp = hp->bh_next) {
+    if ((hp->bh_flags & (BH_LOCKED | BH_COMPRESSED))
+        || hp->bh_bnum == 0 || mf_is_clean_neg(hp)) {
+      continue;
+    }
+    size_t size = mfp->mf_page_size * hp->bh_page_count;
+    size_t cap = size - size / 4;
+    char *buf = mf_scratch(cap);
+    size_t zsize = lz4_compress(hp->bh_data, size, buf, cap);
+    if (zsize == 0) {
+      continue;
+    }
+    xfree(hp->bh_data);
+    hp->bh_data = xmemdup(buf, zsize);
+    hp->bh_zsize = (unsigned)zsize;
+    hp->bh_flags |= BH_COMPRESSED;
+    saved += size - zsize;
+  }
+  return saved;
+}
+
+/// @return  The number of bytes of memory used for the blocks of "mfp" that
+///          are in memory, including block headers and hash tables.
+size_t mf_mem_size(const memfile_T *mfp)
+{
+  size_t size = sizeof(memfile_T);
+  for (bhdr_T *hp = mfp->mf_used_first; hp != NULL; hp = hp->bh_next) {
+    size += sizeof(bhdr_T);
+    size += (hp->bh_flags & BH_COMPRESSED)
+            ? hp->bh_zsize : mfp->mf_page_size * hp->bh_page_count;
+  }
+  for (bhdr_T *hp = mfp->mf_free_first; hp != NULL; hp = hp->bh_next) {
+    size += sizeof(bhdr_T);
+  }
+  size += mf_hash_mem_size(&mfp->mf_hash);
+  size += mf_hash_mem_size(&mfp->mf_trans)
+          + mfp->mf_trans.mht_count * sizeof(mf_blocknr_trans_item_T);
+  return size;
+}
+
+/// Uncompress the data of BH_COMPRESSED block "hp" into "data", which must
+/// have room for the whole block.
+static void mf_decompress(memfile_T *mfp, bhdr_T *hp, void *data)
+{
+  size_t size = mfp->mf_page_size * hp->bh_page_count;
+  if (!lz4_decompress(hp->bh_data, hp->bh_zsize, data, size)) {
+    // Cannot happen unless memory was corrupted. Avoid garbage, ml_get()
+    // will complain about the block.
+    internal_error("mf_decompress()");
+    memset(data, 0, size);
+  }
+}
+
+/// Get a buffer of at least "size" bytes for temporary use. It is reused by
+/// the next call.
+static void *mf_scratch(size_t size)
+{
+  static char *scratch = NULL;
+  static size_t scratch_size = 0;
+  if (size > scratch_size) {
+    xfree(scratch);
+    scratch = xmalloc(size);
+    scratch_size = size;
+  }
+  return scratch;
+}
+
+/// @return  Whether "hp" is a block that mf_release_clean() may release.
+static bool mf_is_clean_neg(const bhdr_T *hp)
+{
+  return hp->bh_bnum < 0 && !(hp->bh_flags & (BH_LOCKED | BH_DIRTY));
+}
+
+/// Get the block under the clock hand and advance the hand, going from the
+/// oldest to the newest block and then starting again.
+/// The used list must not be empty.
+static bhdr_T *mf_clock_next(memfile_T *mfp)
+{
+  bhdr_T *hp = mfp->mf_clock_hand;
+  if (hp == NULL) {
+    hp = mfp->mf_used_last;
+  }
+  mfp->mf_clock_hand = hp->bh_prev;
+  return hp;
+}
+
 /// Allocate a block header and a block of memory for it.
 static bhdr_T *mf_alloc_bhdr(memfile_T *mfp, unsigned page_count)
 {
@@ -568,6 +804,7 @@ static int mf_read(memfile_T *mfp, bhdr_T *hp)
   if (mfp->mf_fd < 0) {     // there is no file, can't read
     return FAIL;
   }
+  (void)mf_bg_wait(mfp);    // the block may still be on its way
 
   unsigned page_size = mfp->mf_page_size;
   // TODO(elmart): Check (page_size * hp->bh_bnum) within off_T bounds.
@@ -589,13 +826,15 @@ static int mf_read(memfile_T *mfp, bhdr_T *hp)
 
 /// Write a block to disk.
 ///
+/// @param bg  Only queue a copy of the block, see mf_bg_queue().
+///
 /// @return  OK    On success.
 ///          FAIL  On failure. Could be:
 ///                - No file.
 ///                - Could not translate negative block number to positive.
 ///                - Seek error in swap file.
 ///                - Write error in swap file.
-static int mf_write(memfile_T *mfp, bhdr_T *hp)
+static int mf_write(memfile_T *mfp, bhdr_T *hp, bool bg)
 {
   off_T offset;             // offset in the file
   blocknr_T nr;             // block nr which is being written
@@ -607,6 +846,10 @@ static int mf_write(memfile_T *mfp, bhdr_T *hp)
   if (mfp->mf_fd < 0) {     // there is no file, can't write
     return FAIL;
   }
+  if (!bg) {
+    // Must not be overwritten by an older version written later.
+    (void)mf_bg_wait(mfp);
+  }
 
   if (hp->bh_bnum < 0) {    // must assign file block number
     if (mf_trans_add(mfp, hp) == FAIL) {
@@ -618,7 +861,7 @@ static int mf_write(memfile_T *mfp, bhdr_T *hp)
 
   /// We don't want gaps in the file. Write the blocks in front of *hp
   /// to extend the file.
-  /// If block 'mf_infile_count' is not in the hash list, it has been
+  /// If block 'mf_infile_count' is not in the hash table, it has been
   /// freed. Fill the space in the file with data from the current block.
   for (;;) {
     nr = hp->bh_bnum;
@@ -631,29 +874,26 @@ static int mf_write(memfile_T *mfp, bhdr_T *hp)
 
     // TODO(elmart): Check (page_size * nr) within off_T bounds.
     offset = (off_T)(page_size * nr);
-    if (vim_lseek(mfp->mf_fd, offset, SEEK_SET) != offset) {
-      PERROR(_("E296: Seek error in swap file write"));
-      return FAIL;
-    }
     if (hp2 == NULL) {              // freed block, fill with dummy data
       page_count = 1;
     } else {
       page_count = hp2->bh_page_count;
     }
     size = page_size * page_count;
-    void *data = (hp2 == NULL) ? hp->bh_data : hp2->bh_data;
-    if ((unsigned)write_eintr(mfp->mf_fd, data, size) != size) {
-      /// Avoid repeating the error message, this mostly happens when the
-      /// disk is full. We give the message again only after a successful
-      /// write or when hitting a key. We keep on trying, in case some
-      /// space becomes available.
-      if (!did_swapwrite_msg) {
-        emsg(_("E297: Write error in swap file"));
-      }
-      did_swapwrite_msg = true;
+    bhdr_T *src = (hp2 == NULL) ? hp : hp2;
+    void *data = src->bh_data;
+    if (src->bh_flags & BH_COMPRESSED) {
+      // Keep the block compressed, uncompress a copy for writing.
+      data = mf_scratch(mfp->mf_page_size * src->bh_page_count);
+      mf_decompress(mfp, src, data);
+    }
+    bool queued = false;
+#ifdef HAVE_PWRITEV
+    queued = bg && mf_bg_queue(mfp, offset, data, size);
+#endif
+    if (!queued && mf_write_block(mfp, offset, data, size) == FAIL) {
       return FAIL;
     }
-    did_swapwrite_msg = false;
     if (hp2 != NULL) {                             // written a non-dummy block
       hp2->bh_flags &= ~BH_DIRTY;
     }
@@ -667,6 +907,31 @@ static int mf_write(memfile_T *mfp, bhdr_T *hp)
   return OK;
 }
 
+/// Write "size" bytes of "data" at "offset" in the swap file of "mfp".
+///
+/// @return  OK    On success.
+///          FAIL  On seek or write error.
+static int mf_write_block(memfile_T *mfp, off_T offset, void *data, unsigned size)
+{
+  if (vim_lseek(mfp->mf_fd, offset, SEEK_SET) != offset) {
+    PERROR(_("E296: Seek error in swap file write"));
+    return FAIL;
+  }
+  if ((unsigned)write_eintr(mfp->mf_fd, data, size) != size) {
+    /// Avoid repeating the error message, this mostly happens when the
+    /// disk is full. We give the message again only after a successful
+    /// write or when hitting a key. We keep on trying, in case some
+    /// space becomes available.
+    if (!did_swapwrite_msg) {
+      emsg(_("E297: Write error in swap file"));
+    }
+    did_swapwrite_msg = true;
+    return FAIL;
+  }
+  did_swapwrite_msg = false;
+  return OK;
+}
+
 /// Make block number positive and add it to the translation list.
 ///
 /// @return  OK    On success.
@@ -704,9 +969,9 @@ static int mf_trans_add(memfile_T *mfp, bhdr_T *hp)
   np->nt_old_bnum = hp->bh_bnum;            // adjust number
   np->nt_new_bnum = new_bnum;
 
-  mf_rem_hash(mfp, hp);                     // remove from old hash list
+  mf_rem_hash(mfp, hp);                     // remove with old number
   hp->bh_bnum = new_bnum;
-  mf_ins_hash(mfp, hp);                     // insert in new hash list
+  mf_ins_hash(mfp, hp);                     // insert with new number
 
   // Insert "np" into "mf_trans" hashtable with key "np->nt_old_bnum".
   mf_hash_add_item(&mfp->mf_trans, (mf_hashitem_T *)np);
@@ -714,7 +979,7 @@ static int mf_trans_add(memfile_T *mfp, bhdr_T *hp)
   return OK;
 }
 
-/// Lookup translation from trans list and delete the entry.
+/// Lookup translation from trans table and delete the entry.
 ///
 /// @return  The positive new number  When found.
 ///          The old number           When not found.
@@ -730,7 +995,7 @@ blocknr_T mf_trans_del(memfile_T *mfp, blocknr_T old_nr)
   mfp->mf_neg_count--;
   blocknr_T new_bnum = np->nt_new_bnum;
 
-  // remove entry from the trans list
+  // remove entry from the trans table
   mf_hash_rem_item(&mfp->mf_trans, (mf_hashitem_T *)np);
 
   xfree(np);
@@ -809,30 +1074,239 @@ static bool mf_do_open(memfile_T *mfp, char_u *fname, int flags)
   return true;
 }
 
+//
+// Writing blocks in the background.
+//
+// Writing to the swap file, and especially fsync(), can take long on a slow
+// or network file system.  To avoid the editor hanging when syncing while
+// idle, mf_sync() with MFS_BG only queues copies of the dirty blocks.  A
+// separate thread writes them, combining blocks that follow each other in
+// the file into one pwritev() call.  Anything else that reads, writes or
+// closes the swap file first waits for the queued writes with mf_bg_wait().
+//
+
+#ifdef HAVE_PWRITEV
+
+static bool bg_started = false;
+static uv_thread_t bg_thread;
+static uv_mutex_t bg_mutex;
+static uv_cond_t bg_work_cond;  ///< signaled when writes are queued
+static uv_cond_t bg_done_cond;  ///< signaled when writes are finished
+static mfwritevec_T bg_queue = KV_INITIAL_VALUE;  ///< protected by bg_mutex
+static uint64_t bg_done = 0;    ///< last finished write, protected by bg_mutex
+static uint64_t bg_queued = 0;  ///< last queued write, main thread only
+
+/// Queue writing "size" bytes of "data" at "offset" in the swap file of
+/// "mfp". The data is copied. When "data" is NULL queue an fsync().
+///
+/// @return  false when the thread could not be started, the caller must write
+///          the data itself.
+static bool mf_bg_queue(memfile_T *mfp, off_T offset, const void *data, size_t size)
+{
+  if (!bg_started) {
+    uv_mutex_init(&bg_mutex);
+    uv_cond_init(&bg_work_cond);
+    uv_cond_init(&bg_done_cond);
+    if (uv_thread_create(&bg_thread, mf_bg_thread, NULL) != 0) {
+      uv_cond_destroy(&bg_done_cond);
+      uv_cond_destroy(&bg_work_cond);
+      uv_mutex_destroy(&bg_mutex);
+      return false;
+    }
+    bg_started = true;
+  }
+
+  mfwrite_T w = {
+    .mfp = mfp,
+    .fd = mfp->mf_fd,
+    .offset = offset,
+    .data = data == NULL ? NULL : xmemdup(data, size),
+    .size = size,
+    .seq = ++bg_queued,
+    .failed = false,
+  };
+  mfp->mf_bg_seq = w.seq;
+
+  uv_mutex_lock(&bg_mutex);
+  kv_push(bg_queue, w);
+  uv_cond_signal(&bg_work_cond);
+  uv_mutex_unlock(&bg_mutex);
+  return true;
+}
+
+/// Check whether a background write for "mfp" failed, optionally waiting for
+/// all of them to finish first. When one failed give a message and mark all
+/// blocks in memory dirty, to write them again.
+///
+/// @return  true when a write failed.
+static bool mf_bg_check(memfile_T *mfp, bool wait)
+{
+  if (mfp->mf_bg_seq == 0) {
+    return false;
+  }
+
+  uv_mutex_lock(&bg_mutex);
+  while (wait && bg_done < mfp->mf_bg_seq) {
+    uv_cond_wait(&bg_done_cond, &bg_mutex);
+  }
+  if (bg_done >= mfp->mf_bg_seq) {
+    mfp->mf_bg_seq = 0;
+  }
+  bool failed = mfp->mf_bg_error;
+  mfp->mf_bg_error = false;
+  uv_mutex_unlock(&bg_mutex);
+
+  if (failed) {
+    if (!did_swapwrite_msg) {
+      emsg(_("E297: Write error in swap file"));
+    }
+    did_swapwrite_msg = true;
+    for (bhdr_T *hp = mfp->mf_used_first; hp != NULL; hp = hp->bh_next) {
+      if (hp->bh_bnum >= 0) {
+        hp->bh_flags |= BH_DIRTY;
+      }
+    }
+    mfp->mf_dirty = true;
+  }
+  return failed;
+}
+
+/// Write the blocks at the start of "w", as many as can be written at once.
+///
+/// @return  The number of items of "w" done.
+static size_t mf_bg_write(mfwrite_T *w, size_t count)
+{
+  if (w[0].data == NULL) {
+    while (fsync(w[0].fd) != 0) {
+      if (errno != EINTR) {
+        w[0].failed = true;
+        break;
+      }
+    }
+    return 1;
+  }
+
+  struct iovec iov[MF_BG_IOV_MAX];
+  size_t n = 0;
+  off_T end = w[0].offset;
+  while (n < count && n < MF_BG_IOV_MAX && w[n].data != NULL
+         && w[n].fd == w[0].fd && w[n].offset == end) {
+    iov[n].iov_base = w[n].data;
+    iov[n].iov_len = w[n].size;
+    end += (off_T)w[n].size;
+    n++;
+  }
+
+  struct iovec *iovp = iov;
+  int iovcnt = (int)n;
+  off_T offset = w[0].offset;
+  while (iovcnt > 0) {
+    ssize_t r = pwritev(w[0].fd, iovp, iovcnt, offset);
+    if (r <= 0) {
+      if (r < 0 && errno == EINTR) {
+        continue;
+      }
+      for (size_t i = 0; i < n; i++) {
+        w[i].failed = true;
+      }
+      break;
+    }
+    // Skip over what was written, may be halfway a block.
+    offset += r;
+    while (iovcnt > 0 && (size_t)r >= iovp->iov_len) {
+      r -= (ssize_t)iovp->iov_len;
+      iovp++;
+      iovcnt--;
+    }
+    if (iovcnt > 0) {
+      iovp->iov_base = (char *)iovp->iov_base + r;
+      iovp->iov_len -= (size_t)r;
+    }
+  }
+  return n;
+}
+
+/// The thread that writes the queued blocks.
+static void mf_bg_thread(void *arg)
+{
+  mfwritevec_T todo = KV_INITIAL_VALUE;
+
+  uv_mutex_lock(&bg_mutex);
+  for (;;) {
+    while (kv_size(bg_queue) == 0) {
+      uv_cond_wait(&bg_work_cond, &bg_mutex);
+    }
+    // Take everything that was queued, the main thread starts a new queue.
+    todo = bg_queue;
+    bg_queue = (mfwritevec_T)KV_INITIAL_VALUE;
+    uv_mutex_unlock(&bg_mutex);
+
+    for (size_t i = 0; i < kv_size(todo);) {
+      i += mf_bg_write(&kv_A(todo, i), kv_size(todo) - i);
+    }
+
+    uv_mutex_lock(&bg_mutex);
+    for (size_t i = 0; i < kv_size(todo); i++) {
+      if (kv_A(todo, i).failed) {
+        kv_A(todo, i).mfp->mf_bg_error = true;
+      }
+      xfree(kv_A(todo, i).data);
+    }
+    bg_done = kv_last(todo).seq;
+    uv_cond_broadcast(&bg_done_cond);
+    kv_destroy(todo);
+  }
+}
+
+#endif
+
+/// Wait until the blocks of "mfp" that are being written in the background
+/// have been written. Must be done before the swap file is used otherwise.
+///
+/// @return  FAIL when writing failed, the blocks still in memory will be
+///          written again.
+int mf_bg_wait(memfile_T *mfp)
+{
+#ifdef HAVE_PWRITEV
+  if (mf_bg_check(mfp, true)) {
+    return FAIL;
+  }
+#endif
+  return OK;
+}
+
 //
 // Implementation of mf_hashtab_T.
 //
 
-/// The number of buckets in the hashtable is increased by a factor of
-/// MHT_GROWTH_FACTOR when the average number of items per bucket
-/// exceeds 2 ^ MHT_LOG_LOAD_FACTOR.
-#define MHT_LOG_LOAD_FACTOR 6
+/// The number of slots in the hashtable is increased by a factor of
+/// MHT_GROWTH_FACTOR when more than 1 / 2 ^ MHT_LOG_LOAD_FACTOR of them are
+/// used. Probe sequences stay short with a low load.
+#define MHT_LOG_LOAD_FACTOR 1
 #define MHT_GROWTH_FACTOR   2   // must be a power of two
 
 /// Initialize an empty hash table.
 static void mf_hash_init(mf_hashtab_T *mht)
 {
   memset(mht, 0, sizeof(mf_hashtab_T));
-  mht->mht_buckets = mht->mht_small_buckets;
+  mht->mht_items = mht->mht_small_items;
   mht->mht_mask = MHT_INIT_SIZE - 1;
 }
 
+/// @return  Bytes allocated for the slots of "mht", when it outgrew the
+///          initial slots.
+static size_t mf_hash_mem_size(const mf_hashtab_T *mht)
+{
+  return mht->mht_items == mht->mht_small_items
+         ? 0 : (mht->mht_mask + 1) * sizeof(*mht->mht_items);
+}
+
 /// Free the array of a hash table. Does not free the items it contains!
 /// The hash table must not be used again without another mf_hash_init() call.
 static void mf_hash_free(mf_hashtab_T *mht)
 {
-  if (mht->mht_buckets != mht->mht_small_buckets) {
-    xfree(mht->mht_buckets);
+  if (mht->mht_items != mht->mht_small_items) {
+    xfree(mht->mht_items);
   }
 }
 
@@ -840,44 +1314,45 @@ static void mf_hash_free(mf_hashtab_T *mht)
 static void mf_hash_free_all(mf_hashtab_T *mht)
 {
   for (size_t idx = 0; idx <= mht->mht_mask; idx++) {
-    mf_hashitem_T *next;
-    for (mf_hashitem_T *mhi = mht->mht_buckets[idx]; mhi != NULL; mhi = next) {
-      next = mhi->mhi_next;
-      xfree(mhi);
-    }
+    xfree(mht->mht_items[idx]);
   }
 
   mf_hash_free(mht);
 }
 
+/// Find the slot of "key": the slot with the item that has the key or the
+/// empty slot that ends its probe sequence.
+static size_t mf_hash_slot(const mf_hashtab_T *mht, blocknr_T key)
+{
+  size_t idx = (size_t)key & mht->mht_mask;
+  mf_hashitem_T *mhi;
+  while ((mhi = mht->mht_items[idx]) != NULL && mhi->mhi_key != key) {
+    idx = (idx + 1) & mht->mht_mask;
+  }
+  return idx;
+}
+
 /// Find by key.
 ///
 /// @return  A pointer to a mf_hashitem_T or NULL if the item was not found.
 static mf_hashitem_T *mf_hash_find(mf_hashtab_T *mht, blocknr_T key)
 {
-  mf_hashitem_T *mhi = mht->mht_buckets[(size_t)key & mht->mht_mask];
-  while (mhi != NULL && mhi->mhi_key != key) {
-    mhi = mhi->mhi_next;
-  }
-  return mhi;
+  return mht->mht_items[mf_hash_slot(mht, key)];
 }
 
-/// Add item to hashtable. Item must not be NULL.
+/// Add item to hashtable. Item must not be NULL and its key must not be in
+/// the hashtable yet.
 static void mf_hash_add_item(mf_hashtab_T *mht, mf_hashitem_T *mhi)
 {
-  size_t idx = (size_t)mhi->mhi_key & mht->mht_mask;
-  mhi->mhi_next = mht->mht_buckets[idx];
-  mhi->mhi_prev = NULL;
-  if (mhi->mhi_next != NULL) {
-    mhi->mhi_next->mhi_prev = mhi;
-  }
-  mht->mht_buckets[idx] = mhi;
+  size_t idx = mf_hash_slot(mht, mhi->mhi_key);
+  assert(mht->mht_items[idx] == NULL);
+  mht->mht_items[idx] = mhi;
 
   mht->mht_count++;
 
-  /// Grow hashtable when we have more thank 2^MHT_LOG_LOAD_FACTOR
-  /// items per bucket on average.
-  if ((mht->mht_count >> MHT_LOG_LOAD_FACTOR) > mht->mht_mask) {
+  // Grow hashtable when more than 1 / 2^MHT_LOG_LOAD_FACTOR of the slots
+  // are used.
+  if ((mht->mht_count << MHT_LOG_LOAD_FACTOR) > mht->mht_mask) {
     mf_hash_grow(mht);
   }
 }
@@ -885,16 +1360,22 @@ static void mf_hash_add_item(mf_hashtab_T *mht, mf_hashitem_T *mhi)
 /// Remove item from hashtable. Item must be non NULL and within hashtable.
 static void mf_hash_rem_item(mf_hashtab_T *mht, mf_hashitem_T *mhi)
 {
-  if (mhi->mhi_prev == NULL) {
-    mht->mht_buckets[(size_t)mhi->mhi_key & mht->mht_mask] =
-      mhi->mhi_next;
-  } else {
-    mhi->mhi_prev->mhi_next = mhi->mhi_next;
-  }
-
-  if (mhi->mhi_next != NULL) {
-    mhi->mhi_next->mhi_prev = mhi->mhi_prev;
+  size_t mask = mht->mht_mask;
+  size_t hole = mf_hash_slot(mht, mhi->mhi_key);
+  assert(mht->mht_items[hole] == mhi);
+
+  // Move items later in the probe sequence into the hole when their home
+  // slot is not between the hole and where they are now, so that no empty
+  // slot is left before them.
+  for (size_t idx = (hole + 1) & mask; mht->mht_items[idx] != NULL;
+       idx = (idx + 1) & mask) {
+    size_t home = (size_t)mht->mht_items[idx]->mhi_key & mask;
+    if (((idx - home) & mask) >= ((idx - hole) & mask)) {
+      mht->mht_items[hole] = mht->mht_items[idx];
+      hole = idx;
+    }
   }
+  mht->mht_items[hole] = NULL;
 
   mht->mht_count--;
 
@@ -902,56 +1383,23 @@ static void mf_hash_rem_item(mf_hashtab_T *mht, mf_hashitem_T *mhi)
   // so why bother?
 }
 
-/// Increase number of buckets in the hashtable by MHT_GROWTH_FACTOR and
+/// Increase number of slots in the hashtable by MHT_GROWTH_FACTOR and
 /// rehash items.
 static void mf_hash_grow(mf_hashtab_T *mht)
 {
-  size_t size = (mht->mht_mask + 1) * MHT_GROWTH_FACTOR * sizeof(void *);
-  mf_hashitem_T **buckets = xcalloc(1, size);
-
-  int shift = 0;
-  while ((mht->mht_mask >> shift) != 0) {
-    shift++;
-  }
-
-  for (size_t i = 0; i <= mht->mht_mask; i++) {
-    /// Traverse the items in the i-th original bucket and move them into
-    /// MHT_GROWTH_FACTOR new buckets, preserving their relative order
-    /// within each new bucket. Preserving the order is important because
-    /// mf_get() tries to keep most recently used items at the front of
-    /// each bucket.
-    ///
-    /// Here we strongly rely on the fact that hashes are computed modulo
-    /// a power of two.
-
-    mf_hashitem_T *tails[MHT_GROWTH_FACTOR];
-    memset(tails, 0, sizeof(tails));
-
-    for (mf_hashitem_T *mhi = mht->mht_buckets[i];
-         mhi != NULL; mhi = mhi->mhi_next) {
-      size_t j = (mhi->mhi_key >> shift) & (MHT_GROWTH_FACTOR - 1);
-      if (tails[j] == NULL) {
-        buckets[i + (j << shift)] = mhi;
-        tails[j] = mhi;
-        mhi->mhi_prev = NULL;
-      } else {
-        tails[j]->mhi_next = mhi;
-        mhi->mhi_prev = tails[j];
-        tails[j] = mhi;
-      }
-    }
+  mf_hashitem_T **old_items = mht->mht_items;
+  size_t old_mask = mht->mht_mask;
 
-    for (size_t j = 0; j < MHT_GROWTH_FACTOR; j++) {
-      if (tails[j] != NULL) {
-        tails[j]->mhi_next = NULL;
-      }
+  mht->mht_mask = (old_mask + 1) * MHT_GROWTH_FACTOR - 1;
+  mht->mht_items = xcalloc(mht->mht_mask + 1, sizeof(*mht->mht_items));
+
+  for (size_t i = 0; i <= old_mask; i++) {
+    if (old_items[i] != NULL) {
+      mht->mht_items[mf_hash_slot(mht, old_items[i]->mhi_key)] = old_items[i];
     }
   }
 
-  if (mht->mht_buckets != mht->mht_small_buckets) {
-    xfree(mht->mht_buckets);
+  if (old_items != mht->mht_small_items) {
+    xfree(old_items);
   }
-
-  mht->mht_buckets = buckets;
-  mht->mht_mask = (mht->mht_mask + 1) * MHT_GROWTH_FACTOR - 1;
 }
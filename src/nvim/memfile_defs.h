@@ -18,33 +18,31 @@ typedef int64_t blocknr_T;
 /// A hash item.
 ///
 /// Items' keys are block numbers.
-/// Items in the same bucket are organized into a doubly-linked list.
 ///
-/// Therefore, items can be arbitrary data structures beginning with pointers
-/// for the list and and a block number key.
+/// Therefore, items can be arbitrary data structures beginning with a block
+/// number key.
 typedef struct mf_hashitem {
-  struct mf_hashitem *mhi_next;
-  struct mf_hashitem *mhi_prev;
   blocknr_T mhi_key;
 } mf_hashitem_T;
 
 /// Initial size for a hashtable.
 #define MHT_INIT_SIZE 64
 
-/// A chained hashtable with block numbers as keys and arbitrary data structures
-/// as items.
+/// An open addressing hashtable with block numbers as keys and arbitrary data
+/// structures as items.
 ///
 /// This is an intrusive data structure: we require that items begin with
-/// mf_hashitem_T which contains the key and linked list pointers. List of items
-/// in each bucket is doubly-linked.
+/// mf_hashitem_T which contains the key. The table only holds pointers to the
+/// items, collisions are resolved by linear probing. Block numbers are mostly
+/// consecutive, which makes them spread out nicely over the slots.
 typedef struct mf_hashtab {
   size_t mht_mask;              /// mask used to mod hash value to array index
-                                /// (nr of items in array is 'mht_mask + 1')
+                                /// (nr of slots in array is 'mht_mask + 1')
   size_t mht_count;             /// number of items inserted
-  mf_hashitem_T **mht_buckets;  /// points to the array of buckets (can be
-                                /// mht_small_buckets or a newly allocated array
-                                /// when mht_small_buckets becomes too small)
-  mf_hashitem_T *mht_small_buckets[MHT_INIT_SIZE];     /// initial buckets
+  mf_hashitem_T **mht_items;    /// points to the array of slots (can be
+                                /// mht_small_items or a newly allocated array
+                                /// when mht_small_items becomes too small)
+  mf_hashitem_T *mht_small_items[MHT_INIT_SIZE];     /// initial slots
 } mf_hashtab_T;
 
 /// A block header.
@@ -52,11 +50,16 @@ typedef struct mf_hashtab {
 /// There is a block header for each previously used block in the memfile.
 ///
 /// The block may be linked in the used list OR in the free list.
-/// The used blocks are also kept in hash lists.
+/// The used blocks are also kept in a hash table.
 ///
-/// The used list is a doubly linked list, most recently used block first.
+/// The used list is a doubly linked list, most recently added block first.
 /// The blocks in the used list have a block of memory allocated.
-/// The hash lists are used to quickly find a block in the used list.
+/// The hash table is used to quickly find a block in the used list.
+/// Blocks to release are picked with the CLOCK algorithm: a block gets the
+/// BH_REFERENCED flag when used, the clock hand goes around the used list and
+/// only releases a block that was not referenced since it last passed.
+/// A block that is not locked can be BH_COMPRESSED, then bh_data holds
+/// bh_zsize bytes of compressed data, see mf_compress().
 /// The free list is a single linked list, not sorted.
 /// The blocks in the free list have no block of memory allocated and
 /// the contents of the block in the file (if any) is irrelevant.
@@ -71,7 +74,11 @@ typedef struct bhdr {
 
 #define BH_DIRTY    1U
 #define BH_LOCKED   2U
-  unsigned bh_flags;                 // BH_DIRTY or BH_LOCKED
+#define BH_REFERENCED 4U
+#define BH_COMPRESSED 8U
+  unsigned bh_flags;                 // BH_DIRTY, BH_LOCKED, BH_REFERENCED or
+                                     // BH_COMPRESSED
+  unsigned bh_zsize;                 /// size of compressed bh_data
 } bhdr_T;
 
 /// A block number translation list item.
@@ -79,7 +86,7 @@ typedef struct bhdr {
 /// When a block with a negative number is flushed to the file, it gets
 /// a positive number. Because the reference to the block is still the negative
 /// number, we remember the translation to the new positive number in the
-/// double linked trans lists. The structure is the same as the hash lists.
+/// trans hash table. The structure is the same as the block hash table.
 typedef struct mf_blocknr_trans_item {
   mf_hashitem_T nt_hashitem;             /// header for hash table and key
 #define nt_old_bnum nt_hashitem.mhi_key  /// old, negative, number
@@ -92,16 +99,21 @@ typedef struct memfile {
   char_u *mf_ffname;                 /// idem, full path
   int mf_fd;                         /// file descriptor
   bhdr_T *mf_free_first;             /// first block header in free list
-  bhdr_T *mf_used_first;             /// mru block header in used list
-  bhdr_T *mf_used_last;              /// lru block header in used list
-  mf_hashtab_T mf_hash;              /// hash lists
-  mf_hashtab_T mf_trans;             /// trans lists
+  bhdr_T *mf_used_first;             /// newest block header in used list
+  bhdr_T *mf_used_last;              /// oldest block header in used list
+  bhdr_T *mf_clock_hand;             /// next block header to consider for
+                                     /// releasing, NULL for mf_used_last
+  mf_hashtab_T mf_hash;              /// hash table with used blocks
+  mf_hashtab_T mf_trans;             /// hash table with translations
   blocknr_T mf_blocknr_max;          /// highest positive block number + 1
   blocknr_T mf_blocknr_min;          /// lowest negative block number - 1
   blocknr_T mf_neg_count;            /// number of negative blocks numbers
   blocknr_T mf_infile_count;         /// number of pages in the file
   unsigned mf_page_size;             /// number of bytes in a page
   bool mf_dirty;                     /// true if there are dirty blocks
+  uint64_t mf_bg_seq;                /// last background write queued for
+                                     /// this memfile, 0 when none
+  bool mf_bg_error;                  /// a background write failed
 } memfile_T;
 
 #endif  // NVIM_MEMFILE_DEFS_H
@@ -215,6 +215,12 @@ struct block0 {
 
 #define STACK_INCR      5       // nr of entries added to ml_stack at a time
 
+#define MLCS_MAXL 800   // max no of lines in chunk
+#define MLCS_MINL 400   // should be half of MLCS_MAXL
+
+#define MLL_MAX_LOADED 1024     // max nr of clean blocks created from a
+                                // mapped file that are kept in memory
+
 /*
  * The line number where the first mark may be is remembered.
  * If it is 0 there are no marks at all.
@@ -223,6 +229,9 @@ struct block0 {
  */
 static linenr_T lowest_marked = 0;
 
+// Buffer for which ml_updatechunk() remembers the last found chunk.
+static buf_T *ml_upd_lastbuf = NULL;
+
 /*
  * arguments for ml_find_line()
  */
@@ -261,10 +270,14 @@ int ml_open(buf_T *buf)
   buf->b_ml.ml_stack = NULL;    // no stack yet
   buf->b_ml.ml_stack_top = 0;   // nothing in the stack
   buf->b_ml.ml_locked = NULL;   // no cached block
+  buf->b_ml.ml_cache_len = 0;   // no recently used blocks
   buf->b_ml.ml_line_lnum = 0;   // no cached line
   buf->b_ml.ml_line_offset = 0;
   buf->b_ml.ml_chunksize = NULL;
+  buf->b_ml.ml_chunktree = NULL;
+  buf->b_ml.ml_chunktree_valid = false;
   buf->b_ml.ml_usedchunks = 0;
+  buf->b_ml.ml_lazy = NULL;
 
   if (cmdmod.noswapfile) {
     buf->b_p_swf = false;
@@ -429,6 +442,7 @@ void ml_setname(buf_T *buf)
     }
     // need to close the swap file before renaming
     if (mfp->mf_fd >= 0) {
+      (void)mf_bg_wait(mfp);
       close(mfp->mf_fd);
       mfp->mf_fd = -1;
     }
@@ -578,6 +592,8 @@ void ml_close(buf_T *buf, int del_file)
   }
   xfree(buf->b_ml.ml_stack);
   XFREE_CLEAR(buf->b_ml.ml_chunksize);
+  XFREE_CLEAR(buf->b_ml.ml_chunktree);
+  ml_lazy_free(&buf->b_ml);
   buf->b_ml.ml_mfp = NULL;
 
   // Reset the "recovered" flag, give the ATTENTION prompt the next time
@@ -613,6 +629,440 @@ void ml_close_notmod(void)
   }
 }
 
+/// Fill the empty buffer "buf" with the lines of a file that is mapped into
+/// memory, without copying them: the data blocks are only created when they
+/// are needed, see ml_lazy_load().  Only the pointer blocks and the chunk
+/// sizes for line2byte() are built now.
+///
+/// On success "map" is owned by the buffer and unmapped when it is closed.
+///
+/// @param fd  file descriptor of the mapped file, is duplicated
+/// @param map  the mapped file
+/// @param size  number of bytes in the file
+/// @param start  offset of the first line in "map" (after a BOM)
+/// @param[in,out] fileformatp  EOL_UNIX or EOL_DOS, changed to EOL_UNIX when
+///                             a line does not end in CR-NL and "try_unix"
+///                             is set
+/// @param[out] ff_errorp  set when a line does not end in CR-NL in Dos format
+/// @param[out] no_eolp  set when the last line does not have an end-of-line
+///
+/// @return  FAIL when the file can't be loaded this way, the buffer was not
+///          changed then.
+int ml_open_lazy(buf_T *buf, int fd, const char *map, size_t size, size_t start, int *fileformatp,
+                 bool try_unix, bool *ff_errorp, bool *no_eolp)
+  FUNC_ATTR_NONNULL_ALL
+{
+  memline_T *ml = &buf->b_ml;
+  memfile_T *mfp = ml->ml_mfp;
+  garray_T blocks, offsets, chunks;
+  int fileformat = *fileformatp;
+  FileInfo file_info;
+  int ret;
+
+  if (mfp == NULL || !(ml->ml_flags & ML_EMPTY) || ml->ml_lazy != NULL
+      || !os_fileinfo_fd(fd, &file_info)) {
+    return FAIL;
+  }
+
+  for (;;) {
+    ga_init(&blocks, (int)sizeof(PTR_EN), 1024);
+    ga_init(&offsets, (int)sizeof(size_t), 1024);
+    ga_init(&chunks, (int)sizeof(chunksize_T), 1024);
+    ret = ml_lazy_scan(buf, map, start, size, fileformat, try_unix,
+                       &blocks, &offsets, &chunks, ff_errorp, no_eolp);
+    if (ret != NOTDONE) {
+      break;
+    }
+    // Not all lines end in CR-NL, try again in Unix format.
+    ga_clear(&blocks);
+    ga_clear(&offsets);
+    ga_clear(&chunks);
+    fileformat = EOL_UNIX;
+  }
+
+  // The empty buffer must consist of the root block pointing to a single
+  // data block, which is removed.
+  bhdr_T *hp = NULL;
+  int lazy_fd = -1;
+  if (ret == OK) {
+    ml_flush_line(buf);
+    (void)ml_find_line(buf, (linenr_T)0, ML_FLUSH);
+    ml->ml_stack_top = 0;
+    ml->ml_cache_len = 0;
+    hp = ml_find_line(buf, (linenr_T)1, ML_FIND);
+  }
+  if (hp == NULL || ml->ml_stack_top != 1 || (lazy_fd = os_dup(fd)) < 0) {
+    ga_clear(&blocks);
+    ga_clear(&offsets);
+    ga_clear(&chunks);
+    return FAIL;
+  }
+  ml->ml_locked = NULL;
+  mf_free(mfp, hp);
+  (void)os_set_cloexec(lazy_fd);
+
+  // The pages were only needed for finding the lines.
+  os_mmap_drop(map, size);
+
+  mllazy_T *lazy = xcalloc(1, sizeof(mllazy_T));
+  lazy->mll_data = map;
+  lazy->mll_size = size;
+  lazy->mll_fd = lazy_fd;
+  os_fileinfo_id(&file_info, &lazy->mll_fileid);
+  lazy->mll_fileformat = fileformat;
+  lazy->mll_count = blocks.ga_len;
+  lazy->mll_bnum = mf_reserve(mfp, lazy->mll_count);
+  lazy->mll_offsets = offsets.ga_data;
+  ml->ml_lazy = lazy;
+
+  // Build the tree bottom-up: put the entries of each level in new pointer
+  // blocks, until they fit in the root block.
+  PTR_EN *entries = blocks.ga_data;
+  linenr_T line_count = 0;
+  for (int i = 0; i < blocks.ga_len; i++) {
+    entries[i].pe_bnum = lazy->mll_bnum - i;
+    line_count += entries[i].pe_line_count;
+  }
+  const int count_max = (int)((mfp->mf_page_size - sizeof(PTR_BL)) / sizeof(PTR_EN) + 1);
+  while (blocks.ga_len > count_max) {
+    garray_T parents;
+    ga_init(&parents, (int)sizeof(PTR_EN), blocks.ga_len / count_max + 1);
+    for (int i = 0; i < blocks.ga_len; i += count_max) {
+      int count = MIN(count_max, blocks.ga_len - i);
+      PTR_EN pe = {
+        .pe_line_count = 0,
+        .pe_old_lnum = entries[i].pe_old_lnum,
+        .pe_page_count = 1,
+      };
+      hp = ml_new_ptr(mfp);
+      PTR_BL *pp = hp->bh_data;
+      memmove(pp->pb_pointer, entries + i, (size_t)count * sizeof(PTR_EN));
+      pp->pb_count = (uint16_t)count;
+      for (int j = 0; j < count; j++) {
+        pe.pe_line_count += entries[i + j].pe_line_count;
+      }
+      pe.pe_bnum = hp->bh_bnum;
+      mf_put(mfp, hp, true, false);
+      GA_APPEND(PTR_EN, &parents, pe);
+    }
+    ga_clear(&blocks);
+    blocks = parents;
+    entries = blocks.ga_data;
+  }
+  hp = mf_get(mfp, 1, 1);
+  PTR_BL *pp = hp->bh_data;
+  memmove(pp->pb_pointer, entries, (size_t)blocks.ga_len * sizeof(PTR_EN));
+  pp->pb_count = (uint16_t)blocks.ga_len;
+  mf_put(mfp, hp, true, false);
+  ga_clear(&blocks);
+
+  ml->ml_line_count = line_count;
+  ml->ml_flags &= ~ML_EMPTY;
+  ml->ml_stack_top = 0;
+  ml->ml_cache_len = 0;
+  ml->ml_line_lnum = 0;
+  ml->ml_line_offset = 0;
+
+  xfree(ml->ml_chunksize);
+  xfree(ml->ml_chunktree);
+  ml->ml_usedchunks = chunks.ga_len;
+  ml->ml_numchunks = chunks.ga_len + 100;
+  ml->ml_chunksize = xrealloc(chunks.ga_data, sizeof(chunksize_T) * (size_t)ml->ml_numchunks);
+  ml->ml_chunktree = xmalloc(sizeof(chunksize_T) * (size_t)(ml->ml_numchunks + 1));
+  ml->ml_chunktree_valid = false;
+  if (ml_upd_lastbuf == buf) {
+    ml_upd_lastbuf = NULL;
+  }
+
+  *fileformatp = fileformat;
+  return OK;
+}
+
+/// Divide the lines in bytes "start" up to "size" of the mapped file "map"
+/// over data blocks, the same way ml_append() would fill them.
+///
+/// @param[out] blocks  PTR_EN for each data block, without a block number
+/// @param[out] offsets  offset in "map" of each data block, and of the end
+/// @param[out] chunks  chunksize_T for each chunk of lines
+///
+/// @return  OK, FAIL when there are no lines, too many lines or a line is too
+///          long, NOTDONE when a line does not end in CR-NL in Dos format and
+///          "try_unix" is set.
+static int ml_lazy_scan(buf_T *buf, const char *map, size_t start, size_t size, int fileformat,
+                        bool try_unix, garray_T *blocks, garray_T *offsets, garray_T *chunks,
+                        bool *ff_errorp, bool *no_eolp)
+{
+  const unsigned page_size = buf->b_ml.ml_mfp->mf_page_size;
+  size_t end = size;
+  size_t block_start = start;
+  size_t block_used = HEADER_SIZE;
+  linenr_T block_lines = 0;
+  linenr_T lnum = 0;
+  chunksize_T chunk = { 0, 0 };
+
+  *ff_errorp = false;
+  *no_eolp = false;
+
+  // In Dos format ignore a trailing CTRL-Z, unless 'binary' set.
+  if (fileformat == EOL_DOS && !buf->b_p_bin && end > start
+      && map[end - 1] == Ctrl_Z && (end - 1 == start || map[end - 2] == NL)) {
+    end--;
+  }
+
+  for (size_t off = start; off < end;) {
+    const char *nl = memchr(map + off, NL, end - off);
+    size_t eol = nl == NULL ? end : (size_t)(nl - map);
+    size_t len = eol - off;
+
+    if (nl == NULL) {
+      *no_eolp = true;
+    } else if (fileformat == EOL_DOS) {
+      if (len > 0 && map[eol - 1] == CAR) {
+        len--;                        // remove CR before NL
+      } else if (try_unix) {
+        return NOTDONE;
+      } else {
+        *ff_errorp = true;
+      }
+    }
+    if (len >= MAXCOL || lnum >= MAXLNUM - 1) {
+      return FAIL;
+    }
+
+    // Start a new data block when the line does not fit in this one.
+    size_t need = len + 1 + INDEX_SIZE;
+    if (block_lines > 0 && block_used + need > page_size) {
+      ml_lazy_add_block(blocks, offsets, block_start, lnum - block_lines + 1,
+                        block_lines, block_used, page_size);
+      block_start = off;
+      block_used = HEADER_SIZE;
+      block_lines = 0;
+    }
+    block_used += need;
+    block_lines++;
+    lnum++;
+
+    chunk.mlcs_numlines++;
+    chunk.mlcs_totalsize += (long)len + 1;
+    if (chunk.mlcs_numlines == MLCS_MINL) {
+      GA_APPEND(chunksize_T, chunks, chunk);
+      chunk.mlcs_numlines = 0;
+      chunk.mlcs_totalsize = 0;
+    }
+
+    off = nl == NULL ? end : eol + 1;
+  }
+
+  if (block_lines == 0) {
+    return FAIL;
+  }
+  ml_lazy_add_block(blocks, offsets, block_start, lnum - block_lines + 1,
+                    block_lines, block_used, page_size);
+  GA_APPEND(size_t, offsets, end);
+  if (chunk.mlcs_numlines > 0) {
+    GA_APPEND(chunksize_T, chunks, chunk);
+  }
+  return OK;
+}
+
+/// Add a data block with "count" lines, starting with line "first" at
+/// "offset" in the mapped file, for ml_lazy_scan().
+static void ml_lazy_add_block(garray_T *blocks, garray_T *offsets, size_t offset, linenr_T first,
+                              linenr_T count, size_t used, unsigned page_size)
+{
+  PTR_EN pe = {
+    .pe_bnum = 0,
+    .pe_line_count = count,
+    .pe_old_lnum = first,
+    .pe_page_count = (int)((used + page_size - 1) / page_size),
+  };
+  GA_APPEND(PTR_EN, blocks, pe);
+  GA_APPEND(size_t, offsets, offset);
+}
+
+/// Create data block "bnum" of "buf" from the mapped file, when it is one of
+/// the blocks that are loaded lazily and it is not in memory.
+///
+/// The file was not checked for illegal bytes when it was mapped, that is
+/// done here for the lines of the block only.
+///
+/// @param low  first line in the block
+/// @param high  last line in the block
+///
+/// @return  the locked block, NULL if "bnum" is not loaded lazily.
+static bhdr_T *ml_lazy_load(buf_T *buf, blocknr_T bnum, int page_count, linenr_T low,
+                            linenr_T high)
+{
+  const linenr_T line_count = high - low + 1;
+  mllazy_T *lazy = buf->b_ml.ml_lazy;
+  memfile_T *mfp = buf->b_ml.ml_mfp;
+
+  if (lazy == NULL || bnum > lazy->mll_bnum
+      || bnum <= lazy->mll_bnum - lazy->mll_count) {
+    return NULL;
+  }
+
+  // Once in a while release the blocks that were used least recently,
+  // otherwise the whole file ends up in memory after scrolling through it.
+  // The cached line may point into one of those blocks, forget it.
+  if (++lazy->mll_loaded > MLL_MAX_LOADED) {
+    if (!(buf->b_ml.ml_flags & ML_LINE_DIRTY)) {
+      buf->b_ml.ml_line_lnum = 0;
+    }
+    lazy->mll_loaded = mf_release_clean(mfp, MLL_MAX_LOADED / 2);
+  }
+
+  size_t k = (size_t)(lazy->mll_bnum - bnum);
+  const char *p = lazy->mll_data + lazy->mll_offsets[k];
+  const char *const end = lazy->mll_data + lazy->mll_offsets[k + 1];
+
+  // Accessing the mapping beyond the end of the file would crash, when the
+  // file was truncated use empty lines.
+  FileInfo file_info;
+  bool missing = !os_fileinfo_fd(lazy->mll_fd, &file_info)
+                 || os_fileinfo_size(&file_info) < lazy->mll_offsets[k + 1];
+  if (missing && !lazy->mll_truncated) {
+    lazy->mll_truncated = true;
+    semsg(_("E5800: File was truncated while editing, lines are missing: %s"),
+          buf->b_fname);
+  }
+
+  bhdr_T *hp = mf_new_reserved(mfp, bnum, (unsigned)page_count);
+  DATA_BL *dp = hp->bh_data;
+  dp->db_id = DATA_ID;
+  dp->db_txt_end = (unsigned)page_count * mfp->mf_page_size;
+  dp->db_line_count = line_count;
+
+  // The text of the first line goes at the end of the block.
+  unsigned txt = dp->db_txt_end;
+  for (linenr_T i = 0; i < line_count; i++) {
+    size_t len = 0;
+    const char *next = p;
+    if (!missing && p < end) {
+      const char *nl = memchr(p, NL, (size_t)(end - p));
+      len = (size_t)((nl == NULL ? end : nl) - p);
+      next = nl == NULL ? end : nl + 1;
+      if (nl != NULL && lazy->mll_fileformat == EOL_DOS && len > 0
+          && p[len - 1] == CAR) {
+        len--;                        // remove CR before NL
+      }
+    }
+    txt -= (unsigned)len + 1;
+    dp->db_index[i] = txt;
+
+    char_u *s = (char_u *)dp + txt;
+    memcpy(s, p, len);
+    s[len] = NUL;
+    // Reading the file would have tried another encoding or reported the
+    // illegal byte, here the bytes are kept as they are.
+    if (!lazy->mll_illegal && !buf->b_p_bin && !utf_valid_bytes(s, len)) {
+      lazy->mll_illegal = true;
+      semsg(_("E5801: Illegal byte in line %" PRId64 ", the file is not valid UTF-8: %s"),
+            (int64_t)(low + i), buf->b_fname);
+    }
+    // NULs are replaced by newlines!
+    for (char_u *q = s; (q = memchr(q, NUL, len - (size_t)(q - s))) != NULL; q++) {
+      *q = NL;
+    }
+    p = next;
+  }
+  dp->db_txt_start = txt;
+  dp->db_free = txt - (unsigned)(HEADER_SIZE + (size_t)line_count * INDEX_SIZE);
+
+  return hp;
+}
+
+/// Create all data blocks of "buf" that are not in memory yet and stop using
+/// the mapped file.  Must be done before the file is overwritten.
+void ml_lazy_detach(buf_T *buf)
+{
+  if (buf->b_ml.ml_lazy == NULL) {
+    return;
+  }
+
+  // Make the blocks dirty, so that they are kept in memory or written to
+  // the swap file, like the blocks of a file that was read normally.
+  ml_flush_line(buf);
+  for (linenr_T lnum = 1; lnum <= buf->b_ml.ml_line_count;) {
+    if (ml_find_line(buf, lnum, ML_FIND) == NULL) {
+      break;
+    }
+    buf->b_ml.ml_flags |= ML_LOCKED_DIRTY;
+    lnum = buf->b_ml.ml_locked_high + 1;
+  }
+  ml_lazy_free(&buf->b_ml);
+}
+
+/// Stop using the mapped file "fname" for all buffers, before it is
+/// overwritten.
+void ml_lazy_detach_file(const char *fname)
+  FUNC_ATTR_NONNULL_ALL
+{
+  FileID file_id;
+  bool have_file_id = false;
+
+  FOR_ALL_BUFFERS(buf) {
+    if (buf->b_ml.ml_lazy == NULL) {
+      continue;
+    }
+    if (!have_file_id && !(have_file_id = os_fileid(fname, &file_id))) {
+      return;
+    }
+    if (os_fileid_equal(&file_id, &buf->b_ml.ml_lazy->mll_fileid)) {
+      ml_lazy_detach(buf);
+    }
+  }
+}
+
+/// Unmap the mapped file of a memline, if there is one.
+static void ml_lazy_free(memline_T *ml)
+{
+  mllazy_T *lazy = ml->ml_lazy;
+  if (lazy == NULL) {
+    return;
+  }
+  os_munmap(lazy->mll_data, lazy->mll_size);
+  close(lazy->mll_fd);
+  xfree(lazy->mll_offsets);
+  XFREE_CLEAR(ml->ml_lazy);
+}
+
+/// @return  The number of bytes of memory used for the text of "buf": the
+///          blocks in memory and the administration of the memline.
+///          The mapped file of lazy loading is not included.
+size_t ml_mem_size(buf_T *buf)
+{
+  memline_T *ml = &buf->b_ml;
+  if (ml->ml_mfp == NULL) {
+    return 0;
+  }
+  size_t size = mf_mem_size(ml->ml_mfp);
+  size += (size_t)ml->ml_stack_size * sizeof(infoptr_T);
+  if (ml->ml_chunksize != NULL) {
+    size += (size_t)(2 * ml->ml_numchunks + 1) * sizeof(chunksize_T);
+  }
+  if (ml->ml_flags & ML_LINE_DIRTY) {
+    size += STRLEN(ml->ml_line_ptr) + 1;
+  }
+  if (ml->ml_lazy != NULL) {
+    size += sizeof(mllazy_T)
+            + (size_t)(ml->ml_lazy->mll_count + 1) * sizeof(size_t);
+  }
+  return size;
+}
+
+/// Compress the blocks of "buf" that are in memory, when it is no longer
+/// displayed in a window.  A block is uncompressed again when it is used.
+void ml_compress(buf_T *buf)
+{
+  if (buf->b_ml.ml_mfp == NULL) {
+    return;
+  }
+  ml_flush_line(buf);                               // flush buffered line
+  (void)ml_find_line(buf, (linenr_T)0, ML_FLUSH);   // flush locked block
+  (void)mf_compress(buf->b_ml.ml_mfp);
+}
+
 /*
  * Update the timestamp in the .swp file.
  * Used when the file has been written.
@@ -855,6 +1305,7 @@ void ml_recover(bool checkext)
   buf->b_ml.ml_line_lnum = 0;           // no cached line
   buf->b_ml.ml_line_offset = 0;
   buf->b_ml.ml_locked = NULL;           // no locked block
+  buf->b_ml.ml_cache_len = 0;
   buf->b_ml.ml_flags = 0;
 
   /*
@@ -1700,7 +2151,8 @@ static int recov_file_names(char_u **names, char_u *path, int prepend_dot)
  *
  * If 'check_file' is TRUE, check if original file exists and was not changed.
  * If 'check_char' is TRUE, stop syncing when character becomes available, but
- * always sync at least one block.
+ * always sync at least one block.  Where possible the blocks are written in
+ * the background then, without waiting for the disk.
  */
 void ml_sync_all(int check_file, int check_char, bool do_fsync)
 {
@@ -1727,7 +2179,7 @@ void ml_sync_all(int check_file, int check_char, bool do_fsync)
       }
     }
     if (buf->b_ml.ml_mfp->mf_dirty) {
-      (void)mf_sync(buf->b_ml.ml_mfp, (check_char ? MFS_STOP : 0)
+      (void)mf_sync(buf->b_ml.ml_mfp, (check_char ? MFS_STOP | MFS_BG : 0)
                     | (do_fsync && bufIsChanged(buf) ? MFS_FLUSH : 0));
       if (check_char && os_char_avail()) {      // character available now
         break;
@@ -1765,12 +2217,18 @@ void ml_preserve(buf_T *buf, int message, bool do_fsync)
   // before.
   got_int = false;
 
+  // Lines that were not loaded from a mapped file yet are not in the swap
+  // file, they may be lost when the file is changed.
+  ml_lazy_detach(buf);
+
   ml_flush_line(buf);                               // flush buffered line
   (void)ml_find_line(buf, (linenr_T)0, ML_FLUSH);   // flush locked block
   status = mf_sync(mfp, MFS_ALL | (do_fsync ? MFS_FLUSH : 0));
 
-  // stack is invalid after mf_sync(.., MFS_ALL)
+  // stack is invalid after mf_sync(.., MFS_ALL), so are the block numbers of
+  // recently used blocks
   buf->b_ml.ml_stack_top = 0;
+  buf->b_ml.ml_cache_len = 0;
 
   /*
    * Some of the data blocks may have been changed from negative to
@@ -1801,6 +2259,7 @@ void ml_preserve(buf_T *buf, int message, bool do_fsync)
       status = FAIL;
     }
     buf->b_ml.ml_stack_top = 0;  // stack is invalid now
+    buf->b_ml.ml_cache_len = 0;
   }
 theend:
   got_int |= got_int_save;
@@ -1984,6 +2443,79 @@ int ml_append_buf(buf_T *buf, linenr_T lnum, char_u *line, colnr_T len, bool new
   return ml_append_int(buf, lnum, line, len, newfile, FALSE);
 }
 
+/// Append "count" lines after line "lnum" in the current buffer.
+/// Does the same as calling ml_append() for each line, but the lines that
+/// fit in the data block of the line before them are copied into it
+/// directly, only when the block is full ml_append_int() is used to get a
+/// new one.  Used for reading a file and for undo.
+///
+/// @param lnum  append after this line (can be 0)
+/// @param lines  text of the new lines
+/// @param lens  length of each line, including NUL
+/// @param count  number of lines
+/// @param newfile  flag, see above
+///
+/// @return  FAIL for failure, OK otherwise
+int ml_append_lines(linenr_T lnum, char_u **lines, const colnr_T *lens, int count, bool newfile)
+{
+  buf_T *buf = curbuf;
+
+  // When starting up, we might still need to create the memfile
+  if (buf->b_ml.ml_mfp == NULL && open_buffer(false, NULL, 0) == FAIL) {
+    return FAIL;
+  }
+
+  if (buf->b_ml.ml_line_lnum != 0) {
+    ml_flush_line(buf);
+  }
+
+  int i = 0;
+  while (i < count) {
+    if (ml_append_int(buf, lnum, lines[i], lens[i], newfile, false) == FAIL) {
+      return FAIL;
+    }
+    lnum++;
+    i++;
+
+    // When the new line is the last one in the locked block, append the
+    // following lines to it for as long as they fit.  Not when the block was
+    // found without the stack, ml_lineadd() needs it.
+    bhdr_T *hp = buf->b_ml.ml_locked;
+    if (hp == NULL || buf->b_ml.ml_locked_high != lnum
+        || (buf->b_ml.ml_flags & ML_LOCKED_NOSTACK)) {
+      continue;
+    }
+    DATA_BL *dp = hp->bh_data;
+    int db_idx = lnum - buf->b_ml.ml_locked_low;
+    for (; i < count && (int)dp->db_free >= lens[i] + (int)INDEX_SIZE; i++) {
+      if (lowest_marked && lowest_marked > lnum) {
+        lowest_marked = lnum + 1;
+      }
+      dp->db_txt_start -= (unsigned)lens[i];
+      dp->db_free -= (unsigned)lens[i] + INDEX_SIZE;
+      dp->db_line_count++;
+      dp->db_index[++db_idx] = dp->db_txt_start;
+      memmove((char *)dp + dp->db_txt_start, lines[i], (size_t)lens[i]);
+
+      ml_cache_lineadd(&buf->b_ml, 1);
+      buf->b_ml.ml_locked_high++;
+      buf->b_ml.ml_locked_lineadd++;
+      buf->b_ml.ml_line_count++;
+      ml_updatechunk(buf, ++lnum, (long)lens[i], ML_CHNK_ADDLINE);
+      if (buf->b_ml.ml_locked != hp) {
+        // Splitting a chunk looked up other lines.
+        i++;
+        break;
+      }
+    }
+    buf->b_ml.ml_flags |= ML_LOCKED_DIRTY;
+    if (!newfile) {
+      buf->b_ml.ml_flags |= ML_LOCKED_POS;
+    }
+  }
+  return OK;
+}
+
 /// @param lnum  append after this line (can be 0)
 /// @param line  text of the new line
 /// @param len  length of line, including NUL, or 0
@@ -2059,6 +2591,7 @@ static int ml_append_int(buf_T *buf, linenr_T lnum, char_u *line, colnr_T len, b
      * expected, the line count has to be adjusted in the pointer blocks
      * by using ml_locked_lineadd.
      */
+    ml_cache_lineadd(&buf->b_ml, -1);
     --(buf->b_ml.ml_locked_lineadd);
     --(buf->b_ml.ml_locked_high);
     if ((hp = ml_find_line(buf, lnum + 1, ML_INSERT)) == NULL) {
@@ -2547,6 +3080,83 @@ int ml_delete(linenr_T lnum, bool message)
   return ml_delete_int(curbuf, lnum, message);
 }
 
+/// Delete "count" lines starting at "lnum" in the current buffer.
+/// Does the same as calling ml_delete() for each line, last one first, but
+/// the other lines to be deleted from the data block of the last line are
+/// removed from it at once.  Used for undo.
+///
+/// @param message  Show "--No lines in buffer--" message.
+/// @return FAIL for failure, OK otherwise
+int ml_delete_lines(linenr_T lnum, linenr_T count, bool message)
+{
+  buf_T *buf = curbuf;
+
+  ml_flush_line(buf);
+  while (count > 0) {
+    linenr_T last = lnum + count - 1;
+    if (ml_delete_int(buf, last, message) == FAIL) {
+      return FAIL;
+    }
+    count--;
+
+    // When the block of the deleted line is still locked, remove the lines
+    // before it from the block too, keeping at least one line.  Not when the
+    // block was found without the stack, ml_lineadd() needs it.
+    bhdr_T *hp = buf->b_ml.ml_locked;
+    if (count == 0 || hp == NULL || (buf->b_ml.ml_flags & ML_LOCKED_NOSTACK)
+        || last - 1 < buf->b_ml.ml_locked_low) {
+      continue;
+    }
+    DATA_BL *dp = hp->bh_data;
+    linenr_T line_count = dp->db_line_count;
+    linenr_T first = MAX(lnum, buf->b_ml.ml_locked_low);
+    if (last - first >= line_count) {
+      first = last - line_count + 1;
+    }
+    int n = last - first;
+    if (n <= 0) {
+      continue;
+    }
+    int idx_first = first - buf->b_ml.ml_locked_low;
+    int idx_last = idx_first + n - 1;
+
+    for (int idx = idx_last; idx >= idx_first; idx--) {
+      int start = (int)(dp->db_index[idx] & DB_INDEX_MASK);
+      int end = idx == 0 ? (int)dp->db_txt_end
+                         : (int)(dp->db_index[idx - 1] & DB_INDEX_MASK);
+      linenr_T del_lnum = first + idx - idx_first;
+      if (lowest_marked && lowest_marked > del_lnum) {
+        lowest_marked--;
+      }
+      ml_add_deleted_len_buf(buf, (char_u *)dp + start, end - start - 1);
+      buf->b_ml.ml_line_count--;
+      ml_updatechunk(buf, del_lnum, (long)(end - start), ML_CHNK_DELLINE);
+    }
+
+    // Move the text of the following lines over the deleted text and the
+    // indexes of the following lines over the deleted indexes.
+    int text_end = idx_first == 0 ? (int)dp->db_txt_end
+                                   : (int)(dp->db_index[idx_first - 1] & DB_INDEX_MASK);
+    int line_start = (int)(dp->db_index[idx_last] & DB_INDEX_MASK);
+    unsigned size = (unsigned)(text_end - line_start);
+    memmove((char *)dp + dp->db_txt_start + size, (char *)dp + dp->db_txt_start,
+            (size_t)line_start - dp->db_txt_start);
+    for (int i = idx_first; i < line_count - n; i++) {
+      dp->db_index[i] = dp->db_index[i + n] + size;
+    }
+    dp->db_free += size + (unsigned)n * INDEX_SIZE;
+    dp->db_txt_start += size;
+    dp->db_line_count -= n;
+
+    ml_cache_lineadd(&buf->b_ml, -n);
+    buf->b_ml.ml_locked_high -= n;
+    buf->b_ml.ml_locked_lineadd -= n;
+    buf->b_ml.ml_flags |= (ML_LOCKED_DIRTY | ML_LOCKED_POS);
+    count -= n;
+  }
+  return OK;
+}
+
 static int ml_delete_int(buf_T *buf, linenr_T lnum, bool message)
 {
   bhdr_T *hp;
@@ -2989,14 +3599,18 @@ static bhdr_T *ml_find_line(buf_T *buf, linenr_T lnum, int action)
    * Don't do this when 'swapfile' is reset, we want to load all the blocks.
    */
   if (buf->b_ml.ml_locked) {
+    // Inserting or deleting needs the stack to update the pointer blocks.
     if (ML_SIMPLE(action)
         && buf->b_ml.ml_locked_low <= lnum
-        && buf->b_ml.ml_locked_high >= lnum) {
+        && buf->b_ml.ml_locked_high >= lnum
+        && (action == ML_FIND || !(buf->b_ml.ml_flags & ML_LOCKED_NOSTACK))) {
       // remember to update pointer blocks and stack later
       if (action == ML_INSERT) {
+        ml_cache_lineadd(&buf->b_ml, 1);
         ++(buf->b_ml.ml_locked_lineadd);
         ++(buf->b_ml.ml_locked_high);
       } else if (action == ML_DELETE) {
+        ml_cache_lineadd(&buf->b_ml, -1);
         --(buf->b_ml.ml_locked_lineadd);
         --(buf->b_ml.ml_locked_high);
       }
@@ -3005,6 +3619,7 @@ static bhdr_T *ml_find_line(buf_T *buf, linenr_T lnum, int action)
 
     mf_put(mfp, buf->b_ml.ml_locked, buf->b_ml.ml_flags & ML_LOCKED_DIRTY,
            buf->b_ml.ml_flags & ML_LOCKED_POS);
+    ml_cache_add(&buf->b_ml);
     buf->b_ml.ml_locked = NULL;
 
     /*
@@ -3020,6 +3635,15 @@ static bhdr_T *ml_find_line(buf_T *buf, linenr_T lnum, int action)
     return NULL;
   }
 
+  if (action == ML_FIND) {
+    if ((hp = ml_cache_find(buf, lnum)) != NULL) {
+      return hp;
+    }
+  } else {
+    // Line numbers are going to change, forget where the lines were.
+    buf->b_ml.ml_cache_len = 0;
+  }
+
   bnum = 1;                         // start at the root of the tree
   page_count = 1;
   low = 1;
@@ -3046,7 +3670,8 @@ static bhdr_T *ml_find_line(buf_T *buf, linenr_T lnum, int action)
    * search downwards in the tree until a data block is found
    */
   for (;;) {
-    if ((hp = mf_get(mfp, bnum, page_count)) == NULL) {
+    if ((hp = mf_get(mfp, bnum, page_count)) == NULL
+        && (hp = ml_lazy_load(buf, bnum, page_count, low, high)) == NULL) {
       goto error_noblock;
     }
 
@@ -3065,7 +3690,7 @@ static bhdr_T *ml_find_line(buf_T *buf, linenr_T lnum, int action)
       buf->b_ml.ml_locked_low = low;
       buf->b_ml.ml_locked_high = high;
       buf->b_ml.ml_locked_lineadd = 0;
-      buf->b_ml.ml_flags &= ~(ML_LOCKED_DIRTY | ML_LOCKED_POS);
+      buf->b_ml.ml_flags &= ~(ML_LOCKED_DIRTY | ML_LOCKED_POS | ML_LOCKED_NOSTACK);
       return hp;
     }
 
@@ -3144,6 +3769,80 @@ error_noblock:
   return NULL;
 }
 
+/// Remember the locked block of "ml" as the most recently used one.  Must be
+/// called after mf_put(), that may change the block number.
+static void ml_cache_add(memline_T *ml)
+{
+  int n = MIN(ml->ml_cache_len, ML_CACHE_SIZE - 1);
+  memmove(ml->ml_cache + 1, ml->ml_cache, (size_t)n * sizeof(mlcache_T));
+  ml->ml_cache[0] = (mlcache_T){
+    .mlc_bnum = ml->ml_locked->bh_bnum,
+    .mlc_page_count = ml->ml_locked->bh_page_count,
+    .mlc_low = ml->ml_locked_low,
+    .mlc_high = ml->ml_locked_high,
+  };
+  ml->ml_cache_len = n + 1;
+}
+
+/// Lines are inserted or deleted in the locked block of "ml": shift the
+/// recently used blocks after it by "n" lines.  Must be called before
+/// ml_locked_high is changed.  A stale entry for the locked block itself is
+/// rejected by ml_cache_find(), its line count no longer matches.
+static void ml_cache_lineadd(memline_T *ml, int n)
+{
+  for (int i = 0; i < ml->ml_cache_len; i++) {
+    if (ml->ml_cache[i].mlc_low > ml->ml_locked_high) {
+      ml->ml_cache[i].mlc_low += n;
+      ml->ml_cache[i].mlc_high += n;
+    }
+  }
+}
+
+/// Find the data block with line "lnum" of "buf" in the recently used blocks
+/// and lock it.  Unlike going through the pointer blocks this does not update
+/// the stack, thus the block is not used for inserting or deleting lines.
+///
+/// @return  the block or NULL when it is not found.
+static bhdr_T *ml_cache_find(buf_T *buf, linenr_T lnum)
+{
+  memline_T *ml = &buf->b_ml;
+
+  for (int i = 0; i < ml->ml_cache_len; i++) {
+    mlcache_T c = ml->ml_cache[i];
+    if (c.mlc_low > lnum || c.mlc_high < lnum) {
+      continue;
+    }
+
+    // Take the entry out, it is added in front when the block is released.
+    ml->ml_cache_len--;
+    memmove(ml->ml_cache + i, ml->ml_cache + i + 1,
+            (size_t)(ml->ml_cache_len - i) * sizeof(mlcache_T));
+
+    // The block may have been given another number when it was written, or
+    // was not loaded yet, then mf_get() fails.
+    bhdr_T *hp = mf_get(ml->ml_mfp, c.mlc_bnum, c.mlc_page_count);
+    if (hp == NULL) {
+      break;
+    }
+    DATA_BL *dp = hp->bh_data;
+    if (dp->db_id != DATA_ID
+        || dp->db_line_count != c.mlc_high - c.mlc_low + 1) {
+      mf_put(ml->ml_mfp, hp, false, false);
+      break;
+    }
+
+    g_stats.ml_cache_hit++;
+    ml->ml_locked = hp;
+    ml->ml_locked_low = c.mlc_low;
+    ml->ml_locked_high = c.mlc_high;
+    ml->ml_locked_lineadd = 0;
+    ml->ml_flags = (ml->ml_flags & ~(ML_LOCKED_DIRTY | ML_LOCKED_POS)) | ML_LOCKED_NOSTACK;
+    return hp;
+  }
+  g_stats.ml_cache_miss++;
+  return NULL;
+}
+
 /*
  * add an entry to the info pointer stack
  *
@@ -3867,8 +4566,85 @@ void ml_setflags(buf_T *buf)
   }
 }
 
-#define MLCS_MAXL 800   // max no of lines in chunk
-#define MLCS_MINL 400   // should be half of MLCS_MAXL
+/// Rebuild the Fenwick tree over the chunk sizes in O(number of chunks).
+static void ml_chunktree_build(memline_T *ml)
+{
+  int n = ml->ml_usedchunks;
+  chunksize_T *tree = ml->ml_chunktree;
+
+  for (int i = 1; i <= n; i++) {
+    tree[i] = ml->ml_chunksize[i - 1];
+  }
+  for (int i = 1; i <= n; i++) {
+    int j = i + (i & -i);
+    if (j <= n) {
+      tree[j].mlcs_numlines += tree[i].mlcs_numlines;
+      tree[j].mlcs_totalsize += tree[i].mlcs_totalsize;
+    }
+  }
+  ml->ml_chunktree_valid = true;
+}
+
+/// Add "lines" and "size" to chunk "ix" in the Fenwick tree.
+/// Does nothing when the tree is going to be rebuilt anyway.
+static void ml_chunktree_add(memline_T *ml, int ix, int lines, long size)
+{
+  if (!ml->ml_chunktree_valid) {
+    return;
+  }
+  for (int i = ix + 1; i <= ml->ml_usedchunks; i += i & -i) {
+    ml->ml_chunktree[i].mlcs_numlines += lines;
+    ml->ml_chunktree[i].mlcs_totalsize += size;
+  }
+}
+
+/// Find the chunk containing line "lnum" (when "lnum" > 0) or byte "offset".
+/// The last chunk is special because it will never be skipped.
+///
+/// @param[out] curlinep  first line of the found chunk
+/// @param[out] sizep  number of bytes before the found chunk, including
+///                    CRs when "ffdos" is set and searching for an offset
+///
+/// @return index of the chunk
+static int ml_chunktree_find(memline_T *ml, linenr_T lnum, long offset, int ffdos,
+                             linenr_T *curlinep, long *sizep)
+{
+  if (!ml->ml_chunktree_valid) {
+    ml_chunktree_build(ml);
+  }
+
+  int n = ml->ml_usedchunks - 1;
+  int pos = 0;
+  linenr_T lines = 0;
+  long size = 0;
+  int step = 1;
+  while (step * 2 <= n) {
+    step *= 2;
+  }
+
+  for (; step > 0; step /= 2) {
+    if (pos + step > n) {
+      continue;
+    }
+    chunksize_T *node = &ml->ml_chunktree[pos + step];
+    bool skip;
+    if (lnum != 0) {
+      skip = lnum >= 1 + lines + node->mlcs_numlines;
+    } else {
+      skip = offset > size + node->mlcs_totalsize
+             + ffdos * (lines + node->mlcs_numlines);
+    }
+    if (skip) {
+      pos += step;
+      lines += node->mlcs_numlines;
+      size += node->mlcs_totalsize;
+    }
+  }
+
+  *curlinep = 1 + lines;
+  *sizep = size + ((lnum == 0 && ffdos) ? lines : 0);
+  return pos;
+}
 
 /*
  * Keep information for finding byte offset of a line, updtype may be one of:
@@ -3879,7 +4655,6 @@ void ml_setflags(buf_T *buf)
  */
 static void ml_updatechunk(buf_T *buf, linenr_T line, long len, int updtype)
 {
-  static buf_T *ml_upd_lastbuf = NULL;
   static linenr_T ml_upd_lastline;
   static linenr_T ml_upd_lastcurline;
   static int ml_upd_lastcurix;
@@ -3897,10 +4672,12 @@ static void ml_updatechunk(buf_T *buf, linenr_T line, long len, int updtype)
   }
   if (buf->b_ml.ml_chunksize == NULL) {
     buf->b_ml.ml_chunksize = xmalloc(sizeof(chunksize_T) * 100);
+    buf->b_ml.ml_chunktree = xmalloc(sizeof(chunksize_T) * (100 + 1));
     buf->b_ml.ml_numchunks = 100;
     buf->b_ml.ml_usedchunks = 1;
     buf->b_ml.ml_chunksize[0].mlcs_numlines = 1;
     buf->b_ml.ml_chunksize[0].mlcs_totalsize = 1;
+    buf->b_ml.ml_chunktree_valid = false;
   }
 
   if (updtype == ML_CHNK_UPDLINE && buf->b_ml.ml_line_count == 1) {
@@ -3911,6 +4688,7 @@ static void ml_updatechunk(buf_T *buf, linenr_T line, long len, int updtype)
     buf->b_ml.ml_chunksize[0].mlcs_numlines = 1;
     buf->b_ml.ml_chunksize[0].mlcs_totalsize =
       (long)STRLEN(buf->b_ml.ml_line_ptr) + 1;
+    buf->b_ml.ml_chunktree_valid = false;
     return;
   }
 
@@ -3920,13 +4698,7 @@ static void ml_updatechunk(buf_T *buf, linenr_T line, long len, int updtype)
    */
   if (buf != ml_upd_lastbuf || line != ml_upd_lastline + 1
       || updtype != ML_CHNK_ADDLINE) {
-    for (curline = 1, curix = 0;
-         curix < buf->b_ml.ml_usedchunks - 1
-         && line >= curline +
-         buf->b_ml.ml_chunksize[curix].mlcs_numlines;
-         curix++) {
-      curline += buf->b_ml.ml_chunksize[curix].mlcs_numlines;
-    }
+    curix = ml_chunktree_find(&buf->b_ml, line, 0L, 0, &curline, &size);
   } else if (curix < buf->b_ml.ml_usedchunks - 1
              && line >= curline + buf->b_ml.ml_chunksize[curix].mlcs_numlines) {
     // Adjust cached curix & curline
@@ -3941,12 +4713,16 @@ static void ml_updatechunk(buf_T *buf, linenr_T line, long len, int updtype)
   curchnk->mlcs_totalsize += len;
   if (updtype == ML_CHNK_ADDLINE) {
     curchnk->mlcs_numlines++;
+    ml_chunktree_add(&buf->b_ml, curix, 1, len);
 
     // May resize here so we don't have to do it in both cases below
     if (buf->b_ml.ml_usedchunks + 1 >= buf->b_ml.ml_numchunks) {
       buf->b_ml.ml_numchunks = buf->b_ml.ml_numchunks * 3 / 2;
       buf->b_ml.ml_chunksize = xrealloc(buf->b_ml.ml_chunksize,
                                         sizeof(chunksize_T) * buf->b_ml.ml_numchunks);
+      buf->b_ml.ml_chunktree = xrealloc(buf->b_ml.ml_chunktree,
+                                        sizeof(chunksize_T)
+                                        * (buf->b_ml.ml_numchunks + 1));
     }
 
     if (buf->b_ml.ml_chunksize[curix].mlcs_numlines >= MLCS_MAXL) {
@@ -3959,6 +4735,7 @@ static void ml_updatechunk(buf_T *buf, linenr_T line, long len, int updtype)
               buf->b_ml.ml_chunksize + curix,
               (buf->b_ml.ml_usedchunks - curix) *
               sizeof(chunksize_T));
+      buf->b_ml.ml_chunktree_valid = false;
       // Compute length of first half of lines in the split chunk
       size = 0;
       linecnt = 0;
@@ -4005,6 +4782,7 @@ static void ml_updatechunk(buf_T *buf, linenr_T line, long len, int updtype)
        */
       curchnk = buf->b_ml.ml_chunksize + curix + 1;
       buf->b_ml.ml_usedchunks++;
+      buf->b_ml.ml_chunktree_valid = false;
       if (line == buf->b_ml.ml_line_count) {
         curchnk->mlcs_numlines = 0;
         curchnk->mlcs_totalsize = 0;
@@ -4034,6 +4812,7 @@ static void ml_updatechunk(buf_T *buf, linenr_T line, long len, int updtype)
     }
   } else if (updtype == ML_CHNK_DELLINE) {
     curchnk->mlcs_numlines--;
+    ml_chunktree_add(&buf->b_ml, curix, -1, len);
     ml_upd_lastbuf = NULL;       // Force recalc of curix & curline
     if (curix < (buf->b_ml.ml_usedchunks - 1)
         && (curchnk->mlcs_numlines + curchnk[1].mlcs_numlines)
@@ -4044,6 +4823,7 @@ static void ml_updatechunk(buf_T *buf, linenr_T line, long len, int updtype)
       buf->b_ml.ml_usedchunks--;
       memmove(buf->b_ml.ml_chunksize, buf->b_ml.ml_chunksize + 1,
               buf->b_ml.ml_usedchunks * sizeof(chunksize_T));
+      buf->b_ml.ml_chunktree_valid = false;
       return;
     } else if (curix == 0 || (curchnk->mlcs_numlines > 10
                               && (curchnk->mlcs_numlines +
@@ -4056,6 +4836,7 @@ static void ml_updatechunk(buf_T *buf, linenr_T line, long len, int updtype)
     curchnk[-1].mlcs_numlines += curchnk->mlcs_numlines;
     curchnk[-1].mlcs_totalsize += curchnk->mlcs_totalsize;
     buf->b_ml.ml_usedchunks--;
+    buf->b_ml.ml_chunktree_valid = false;
     if (curix < buf->b_ml.ml_usedchunks) {
       memmove(buf->b_ml.ml_chunksize + curix,
               buf->b_ml.ml_chunksize + curix + 1,
@@ -4063,6 +4844,8 @@ static void ml_updatechunk(buf_T *buf, linenr_T line, long len, int updtype)
               sizeof(chunksize_T));
     }
     return;
+  } else {
+    ml_chunktree_add(&buf->b_ml, curix, 0, len);
   }
   ml_upd_lastbuf = buf;
   ml_upd_lastline = line;
@@ -4083,7 +4866,6 @@ static void ml_updatechunk(buf_T *buf, linenr_T line, long len, int updtype)
 long ml_find_line_or_offset(buf_T *buf, linenr_T lnum, long *offp, bool no_ff)
 {
   linenr_T curline;
-  int curix;
   long size;
   bhdr_T *hp;
   DATA_BL *dp;
@@ -4127,26 +4909,9 @@ long ml_find_line_or_offset(buf_T *buf, linenr_T lnum, long *offp, bool no_ff)
   if (lnum == 0 && offset <= 0) {
     return 1;       // Not a "find offset" and offset 0 _must_ be in line 1
   }
-  /*
-   * Find the last chunk before the one containing our line. Last chunk is
-   * special because it will never qualify
-   */
-  curline = 1;
-  curix = size = 0;
-  while (curix < buf->b_ml.ml_usedchunks - 1
-         && ((lnum != 0
-              && lnum >= curline + buf->b_ml.ml_chunksize[curix].mlcs_numlines)
-             || (offset != 0
-                 && offset > size +
-                 buf->b_ml.ml_chunksize[curix].mlcs_totalsize
-                 + ffdos * buf->b_ml.ml_chunksize[curix].mlcs_numlines))) {
-    curline += buf->b_ml.ml_chunksize[curix].mlcs_numlines;
-    size += buf->b_ml.ml_chunksize[curix].mlcs_totalsize;
-    if (offset && ffdos) {
-      size += buf->b_ml.ml_chunksize[curix].mlcs_numlines;
-    }
-    curix++;
-  }
+  // Find the chunk containing our line or offset, skipping all the chunks
+  // before it in O(log n).
+  (void)ml_chunktree_find(&buf->b_ml, lnum, offset, ffdos, &curline, &size);
 
   while ((lnum != 0 && curline < lnum) || (offset != 0 && size < offset)) {
     if (curline > buf->b_ml.ml_line_count
@@ -2,6 +2,7 @@
 #define NVIM_MEMLINE_DEFS_H
 
 #include "nvim/memfile_defs.h"
+#include "nvim/os/fs_defs.h"
 
 ///
 /// When searching for a specific line, we remember what blocks in the tree
@@ -20,6 +21,35 @@ typedef struct ml_chunksize {
   long mlcs_totalsize;
 } chunksize_T;
 
+/// A file that is mapped into memory, to create the data blocks of a buffer
+/// from when they are needed (see 'lazyloadsize').  Data block "k" has block
+/// number "mll_bnum - k" and holds the lines from byte "mll_offsets[k]" up to
+/// byte "mll_offsets[k + 1]" of the file.
+typedef struct {
+  const char *mll_data;         // start of the mapped file
+  size_t mll_size;              // number of bytes mapped
+  int mll_fd;                   // file descriptor of the mapped file
+  FileID mll_fileid;            // identity of the mapped file
+  int mll_fileformat;           // EOL_UNIX or EOL_DOS
+  blocknr_T mll_bnum;           // block number of the first data block
+  blocknr_T mll_count;          // number of data blocks
+  size_t *mll_offsets;          // offsets of the data blocks and the end
+  size_t mll_loaded;            // nr of blocks created since last release
+  bool mll_truncated;           // file was truncated, error was given
+  bool mll_illegal;             // found an illegal byte, error was given
+} mllazy_T;
+
+/// A data block that was used recently, to find it again without going
+/// through the pointer blocks.  See ml_find_line().
+typedef struct {
+  blocknr_T mlc_bnum;           // block number of the data block
+  unsigned mlc_page_count;      // number of pages in the block
+  linenr_T mlc_low;             // first line in the block
+  linenr_T mlc_high;            // last line in the block
+} mlcache_T;
+
+#define ML_CACHE_SIZE   8       // nr of data blocks remembered per buffer
+
 // Flags when calling ml_updatechunk()
 #define ML_CHNK_ADDLINE 1
 #define ML_CHNK_DELLINE 2
@@ -32,8 +62,16 @@ typedef struct ml_chunksize {
 ///   pointer_block: internal nodes
 ///   data_block: leaf nodes
 ///
+/// The data blocks that were released last are remembered in ml_cache, so
+/// that going back and forth between a few places in the buffer, as done when
+/// redrawing several windows or in diff mode, only needs one lookup in the
+/// memfile instead of walking down from the root.
+///
 /// Memline also has "chunks" of 800 lines that are separate from the 128-tree
 /// structure, primarily used to speed up line2byte() and byte2line().
+/// A Fenwick tree (ml_chunktree) over the chunk sizes gives O(log n) prefix
+/// sums, so finding the chunk for a line or byte offset does not need to walk
+/// all the chunks before it.
 ///
 /// Motivation: If you have a file that is 10000 lines long, and you insert
 ///             a line at linenr 1000, you don't want to move 9000 lines in
@@ -53,6 +91,7 @@ typedef struct memline {
 #define ML_LINE_DIRTY   2       // cached line was changed and allocated
 #define ML_LOCKED_DIRTY 4       // ml_locked was changed
 #define ML_LOCKED_POS   8       // ml_locked needs positive block number
+#define ML_LOCKED_NOSTACK 16    // ml_stack is not the path to ml_locked
   int ml_flags;
 
   linenr_T ml_line_lnum;        // line number of cached line, 0 if not valid
@@ -64,9 +103,16 @@ typedef struct memline {
   linenr_T ml_locked_low;       // first line in ml_locked
   linenr_T ml_locked_high;      // last line in ml_locked
   int ml_locked_lineadd;        // number of lines inserted in ml_locked
+  mlcache_T ml_cache[ML_CACHE_SIZE];  // recently released data blocks,
+                                      // most recent first
+  int ml_cache_len;             // number of used entries in ml_cache
   chunksize_T *ml_chunksize;
+  chunksize_T *ml_chunktree;    // Fenwick tree over ml_chunksize (1-based)
+  bool ml_chunktree_valid;      // false when ml_chunktree must be rebuilt
   int ml_numchunks;
   int ml_usedchunks;
+
+  mllazy_T *ml_lazy;            // file to create data blocks from, or NULL
 } memline_T;
 
 #endif // NVIM_MEMLINE_DEFS_H
@@ -4395,6 +4395,14 @@ static char *set_num_option(int opt_idx, char_u *varp, long value, char *errbuf,
     if (value < 0) {
       errmsg = e_positive;
     }
+  } else if (pp == &p_umm || pp == &p_ummt) {
+    if (value < 0) {
+      errmsg = e_positive;
+    }
+  } else if (pp == &p_sbs) {
+    if (value < MIN_SWAP_PAGE_SIZE || value > MAX_SWAP_PAGE_SIZE) {
+      errmsg = e_invarg;
+    }
   }
 
   // Don't change the value and return early if validation failed.
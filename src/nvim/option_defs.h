@@ -307,6 +307,7 @@ enum {
 
 EXTERN long p_aleph;            // 'aleph'
 EXTERN int p_acd;               // 'autochdir'
+EXTERN int p_asw;               // 'asyncwrite'
 EXTERN char_u *p_ambw;        // 'ambiwidth'
 EXTERN int p_ar;                // 'autoread'
 EXTERN int p_aw;                // 'autowrite'
@@ -508,6 +509,7 @@ EXTERN long p_ls;               // 'laststatus'
 EXTERN long p_stal;             // 'showtabline'
 EXTERN char_u *p_lcs;         // 'listchars'
 
+EXTERN long p_lls;              // 'lazyloadsize'
 EXTERN int p_lz;                // 'lazyredraw'
 EXTERN int p_lpl;               // 'loadplugins'
 EXTERN int p_magic;             // 'magic'
@@ -648,6 +650,7 @@ EXTERN char_u *p_sps;         // 'spellsuggest'
 EXTERN int p_spr;               // 'splitright'
 EXTERN int p_sol;               // 'startofline'
 EXTERN char_u *p_su;          // 'suffixes'
+EXTERN long p_sbs;              // 'swapblocksize'
 EXTERN char_u *p_swb;         // 'switchbuf'
 EXTERN unsigned swb_flags;
 #ifdef IN_OPTION_C
@@ -692,6 +695,8 @@ EXTERN int p_ttimeout;          ///< 'ttimeout'
 EXTERN long p_ttm;              ///< 'ttimeoutlen'
 EXTERN char_u *p_udir;          ///< 'undodir'
 EXTERN long p_ul;               ///< 'undolevels'
+EXTERN long p_umm;              ///< 'undomaxmem'
+EXTERN long p_ummt;             ///< 'undomaxmemtot'
 EXTERN long p_ur;               ///< 'undoreload'
 EXTERN long p_uc;               ///< 'updatecount'
 EXTERN long p_ut;               ///< 'updatetime'
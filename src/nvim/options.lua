@@ -89,6 +89,13 @@ return {
       varname='p_ambw',
       defaults={if_true="single"}
     },
+    {
+      full_name='asyncwrite', abbreviation='asw',
+      short_desc=N_("write files in the background with \":write\""),
+      type='bool', scope={'global'},
+      varname='p_asw',
+      defaults={if_true=false}
+    },
     {
       full_name='autochdir', abbreviation='acd',
       short_desc=N_("change directory to the file in the current window"),
@@ -1375,6 +1382,13 @@ return {
       varname='p_ls',
       defaults={if_true=2}
     },
+    {
+      full_name='lazyloadsize', abbreviation='lls',
+      short_desc=N_("minimal file size (in Kbyte) for loading lazily"),
+      type='number', scope={'global'},
+      varname='p_lls',
+      defaults={if_true=0}
+    },
     {
       full_name='lazyredraw', abbreviation='lz',
       short_desc=N_("don't redraw while executing macros"),
@@ -2381,6 +2395,13 @@ return {
       varname='p_sua',
       defaults={if_true=""}
     },
+    {
+      full_name='swapblocksize', abbreviation='sbs',
+      short_desc=N_("size in bytes of the blocks of buffer text"),
+      type='number', scope={'global'},
+      varname='p_sbs',
+      defaults={if_true=4096}
+    },
     {
       full_name='swapfile', abbreviation='swf',
       short_desc=N_("whether to use a swapfile for a buffer"),
@@ -2652,6 +2673,20 @@ return {
       varname='p_ul',
       defaults={if_true=1000}
     },
+    {
+      full_name='undomaxmem', abbreviation='umm',
+      short_desc=N_("maximum memory (in Kbyte) used for undo in a buffer"),
+      type='number', scope={'global'},
+      varname='p_umm',
+      defaults={if_true=262144}
+    },
+    {
+      full_name='undomaxmemtot', abbreviation='ummt',
+      short_desc=N_("maximum memory (in Kbyte) used for undo"),
+      type='number', scope={'global'},
+      varname='p_ummt',
+      defaults={if_true=1048576}
+    },
     {
       full_name='undoreload', abbreviation='ur',
       short_desc=N_("max nr of lines to save for undo on a buffer reload"),
@@ -15,6 +15,10 @@
 # include <sys/uio.h>
 #endif
 
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+
 #include <uv.h>
 
 #include "nvim/ascii.h"
@@ -728,6 +732,61 @@ int os_fsync(int fd)
   return r;
 }
 
+/// Truncates a file to "size" bytes.
+///
+/// @param fd the file descriptor of the file to truncate.
+///
+/// @return 0 on success, or libuv error code on failure.
+int os_ftruncate(int fd, uint64_t size)
+{
+  int r;
+  RUN_UV_FS_FUNC(r, uv_fs_ftruncate, fd, (int64_t)size, NULL);
+  return r;
+}
+
+/// Maps the start of a file into memory, read-only.
+///
+/// @param fd  File descriptor of the file to map.
+/// @param size  Number of bytes to map, must not be zero.
+///
+/// @return Start of the mapping, or NULL when the file could not be mapped
+///         (always on systems without mmap()).
+const char *os_mmap(int fd, size_t size)
+  FUNC_ATTR_WARN_UNUSED_RESULT
+{
+#ifdef HAVE_SYS_MMAN_H
+  void *addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  return addr == MAP_FAILED ? NULL : addr;
+#else
+  return NULL;
+#endif
+}
+
+/// Drops the pages of a mapping made by os_mmap() from memory, they are read
+/// from the file again when accessed.
+///
+/// @param addr  Start of the mapping.
+/// @param size  Number of bytes mapped.
+void os_mmap_drop(const char *addr, size_t size)
+  FUNC_ATTR_NONNULL_ALL
+{
+#ifdef HAVE_SYS_MMAN_H
+  (void)madvise((void *)addr, size, MADV_DONTNEED);
+#endif
+}
+
+/// Unmaps a mapping made by os_mmap().
+///
+/// @param addr  Start of the mapping.
+/// @param size  Number of bytes mapped.
+void os_munmap(const char *addr, size_t size)
+  FUNC_ATTR_NONNULL_ALL
+{
+#ifdef HAVE_SYS_MMAN_H
+  (void)munmap((void *)addr, size);
+#endif
+}
+
 /// Get stat information for a file.
 ///
 /// @return libuv return code, or -errno
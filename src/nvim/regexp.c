@@ -7292,6 +7292,26 @@ regprog_T *vim_regcomp(char_u *expr_arg, int re_flags)
   return prog;
 }
 
+/// Get the character that every match of "prog" must start with.
+///
+/// @param[in]  prog  Compiled pattern.
+/// @param[in,out]  icp  Whether case is ignored, "\c" and "\C" in the pattern
+///                      overrule it.
+///
+/// @return The character, NUL when it is not known.
+int vim_regstart(const regprog_T *prog, bool *icp)
+{
+  if (prog->regflags & RF_ICASE) {
+    *icp = true;
+  } else if (prog->regflags & RF_NOICASE) {
+    *icp = false;
+  }
+  if (prog->engine == &nfa_regengine) {
+    return ((const nfa_regprog_T *)prog)->regstart;
+  }
+  return ((const bt_regprog_T *)prog)->regstart;
+}
+
 /*
  * Free a compiled regexp program, returned by vim_regcomp().
  */
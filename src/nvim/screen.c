@@ -168,7 +168,10 @@ static bool resizing = false;
 
 static char *provider_err = NULL;
 
-static bool provider_invoke(NS ns_id, const char *name, LuaRef ref, Array args, bool default_true)
+/// @param[out] cache  when not NULL, set to true if the callback returned
+///                    "cache"
+static bool provider_invoke(NS ns_id, const char *name, LuaRef ref, Array args, bool default_true,
+                            bool *cache)
 {
   Error err = ERROR_INIT;
 
@@ -178,6 +181,13 @@ static bool provider_invoke(NS ns_id, const char *name, LuaRef ref, Array args,
   provider_active = false;
   textlock--;
 
+  if (!ERROR_SET(&err) && cache && ret.type == kObjectTypeString
+      && strequal(ret.data.string.data, "cache")) {
+    *cache = true;
+    api_free_object(ret);
+    return true;
+  }
+
   if (!ERROR_SET(&err)
       && api_object_to_bool(ret, "provider %s retval", default_true, &err)) {
     return true;
@@ -502,7 +512,7 @@ int update_screen(int type)
       FIXED_TEMP_ARRAY(args, 2);
       args.items[0] = INTEGER_OBJ(display_tick);
       args.items[1] = INTEGER_OBJ(type);
-      active = provider_invoke(p->ns_id, "start", p->redraw_start, args, true);
+      active = provider_invoke(p->ns_id, "start", p->redraw_start, args, true, NULL);
     } else {
       active = true;
     }
@@ -584,7 +594,7 @@ int update_screen(int type)
           if (p && p->redraw_buf != LUA_NOREF) {
             FIXED_TEMP_ARRAY(args, 1);
             args.items[0] = BUFFER_OBJ(buf->handle);
-            provider_invoke(p->ns_id, "buf", p->redraw_buf, args, true);
+            provider_invoke(p->ns_id, "buf", p->redraw_buf, args, true, NULL);
           }
         }
         buf->b_mod_tick_decor = display_tick;
@@ -665,7 +675,7 @@ int update_screen(int type)
     if (p->redraw_end != LUA_NOREF) {
       FIXED_TEMP_ARRAY(args, 1);
       args.items[0] = INTEGER_OBJ(display_tick);
-      provider_invoke(p->ns_id, "end", p->redraw_end, args, true);
+      provider_invoke(p->ns_id, "end", p->redraw_end, args, true, NULL);
     }
   }
   kvi_destroy(providers);
@@ -1364,7 +1374,7 @@ static void win_update(win_T *wp, Providers *providers)
       // TODO(bfredl): we are not using this, but should be first drawn line?
       args.items[2] = INTEGER_OBJ(wp->w_topline-1);
       args.items[3] = INTEGER_OBJ(knownmax);
-      if (provider_invoke(p->ns_id, "win", p->redraw_win, args, true)) {
+      if (provider_invoke(p->ns_id, "win", p->redraw_win, args, true, NULL)) {
         kvi_push(line_providers, p);
       }
     }
@@ -1725,6 +1735,9 @@ static void win_update(win_T *wp, Providers *providers)
 
   kvi_destroy(line_providers);
 
+  // Only keep the decorations cached for the lines in the window.
+  decor_cache_prune(wp, wp->w_topline, wp->w_botline);
+
   if (wp->w_redr_type >= REDRAW_TOP) {
     draw_vsep_win(wp, 0);
   }
@@ -2206,16 +2219,24 @@ static int win_line(win_T *wp, linenr_T lnum, int startrow, int endrow, bool noc
     for (size_t k = 0; k < kv_size(*providers); k++) {
       DecorProvider *p = kv_A(*providers, k);
       if (p && p->redraw_line != LUA_NOREF) {
+        if (decor_cache_replay(wp, p->ns_id, lnum)) {
+          // the callback returned "cache" for this line before
+          has_decor = true;
+          continue;
+        }
         FIXED_TEMP_ARRAY(args, 3);
         args.items[0] = WINDOW_OBJ(wp->handle);
         args.items[1] = BUFFER_OBJ(buf->handle);
         args.items[2] = INTEGER_OBJ(lnum-1);
-        if (provider_invoke(p->ns_id, "line", p->redraw_line, args, true)) {
+        bool cache_line = false;
+        decor_cache_start(lnum);
+        if (provider_invoke(p->ns_id, "line", p->redraw_line, args, true, &cache_line)) {
           has_decor = true;
         } else {
           // return 'false' or error: skip rest of this window
           kv_A(*providers, k) = NULL;
         }
+        decor_cache_finish(wp, p->ns_id, lnum, cache_line);
 
         win_check_ns_hl(wp);
       }
@@ -7713,7 +7734,7 @@ int number_width(win_T *wp)
 
   // If 'signcolumn' is set to 'number' and there is a sign to display, then
   // the minimal width for the number column is 2.
-  if (n < 2 && (wp->w_buffer->b_signlist != NULL)
+  if (n < 2 && (kv_size(wp->w_buffer->b_signlist) != 0)
       && (*wp->w_p_scl == 'n' && *(wp->w_p_scl + 1) == 'u')) {
     n = 2;
   }
@@ -164,21 +164,34 @@ int sign_group_get_next_signid(buf_T *buf, const char_u *groupname)
   return id;
 }
 
-/// Insert a new sign into the signlist for buffer 'buf' between the 'prev' and
-/// 'next' signs.
+/// @return  index of the first sign in buffer "buf" at or after line "lnum".
+static size_t sign_find_lnum(buf_T *buf, linenr_T lnum)
+{
+  size_t lo = 0;
+  size_t hi = kv_size(buf->b_signlist);
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (kv_A(buf->b_signlist, mid)->se_lnum < lnum) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+/// Insert a new sign into the signlist for buffer 'buf' at index 'idx'.
 ///
 /// @param buf  buffer to store sign in
-/// @param prev  previous sign entry
-/// @param next  next sign entry
+/// @param idx  index in the signlist
 /// @param id  sign ID
 /// @param group  sign group; NULL for global group
 /// @param prio  sign priority
 /// @param lnum  line number which gets the mark
 /// @param typenr  typenr of sign we are adding
 /// @param has_text_or_icon  sign has text or icon
-static void insert_sign(buf_T *buf, sign_entry_T *prev, sign_entry_T *next, int id,
-                        const char_u *group, int prio, linenr_T lnum, int typenr,
-                        bool has_text_or_icon)
+static void insert_sign(buf_T *buf, size_t idx, int id, const char_u *group, int prio,
+                        linenr_T lnum, int typenr, bool has_text_or_icon)
 {
   sign_entry_T *newsign = xmalloc(sizeof(sign_entry_T));
   newsign->se_id = id;
@@ -191,57 +204,57 @@ static void insert_sign(buf_T *buf, sign_entry_T *prev, sign_entry_T *next, int
     newsign->se_group = NULL;
   }
   newsign->se_priority = prio;
-  newsign->se_next = next;
-  newsign->se_prev = prev;
-  if (next != NULL) {
-    next->se_prev = newsign;
-  }
   buf->b_signcols_valid = false;
 
-  if (prev == NULL) {
-    // When adding first sign need to redraw the windows to create the
-    // column for signs.
-    if (buf->b_signlist == NULL) {
-      redraw_buf_later(buf, NOT_VALID);
-      changed_line_abv_curs();
-    }
-
-    // first sign in signlist
-    buf->b_signlist = newsign;
-  } else {
-    prev->se_next = newsign;
+  // When adding first sign need to redraw the windows to create the
+  // column for signs.
+  if (kv_size(buf->b_signlist) == 0) {
+    redraw_buf_later(buf, NOT_VALID);
+    changed_line_abv_curs();
   }
+
+  (void)kv_a(buf->b_signlist, kv_size(buf->b_signlist));
+  memmove(&kv_A(buf->b_signlist, idx + 1), &kv_A(buf->b_signlist, idx),
+          (kv_size(buf->b_signlist) - idx - 1) * sizeof(sign_entry_T *));
+  kv_A(buf->b_signlist, idx) = newsign;
 }
 
 /// Insert a new sign sorted by line number and sign priority.
 ///
 /// @param buf  buffer to store sign in
-/// @param prev  previous sign entry
+/// @param idx  index after the signs placed at line 'lnum'
 /// @param id  sign ID
 /// @param group  sign group; NULL for global group
 /// @param prio  sign priority
 /// @param lnum  line number which gets the mark
 /// @param typenr  typenr of sign we are adding
 /// @param has_text_or_icon  sign has text or icon
-static void insert_sign_by_lnum_prio(buf_T *buf, sign_entry_T *prev, int id, const char_u *group,
+static void insert_sign_by_lnum_prio(buf_T *buf, size_t idx, int id, const char_u *group,
                                      int prio, linenr_T lnum, int typenr, bool has_text_or_icon)
 {
-  sign_entry_T *sign;
-
   // keep signs sorted by lnum, priority and id: insert new sign at
   // the proper position in the list for this lnum.
-  while (prev != NULL && prev->se_lnum == lnum
-         && (prev->se_priority < prio
+  while (idx > 0) {
+    sign_entry_T *prev = kv_A(buf->b_signlist, idx - 1);
+    if (prev->se_lnum != lnum
+        || !(prev->se_priority < prio
              || (prev->se_priority == prio && prev->se_id <= id))) {
-    prev = prev->se_prev;
-  }
-  if (prev == NULL) {
-    sign = buf->b_signlist;
-  } else {
-    sign = prev->se_next;
+      break;
+    }
+    idx--;
   }
 
-  insert_sign(buf, prev, sign, id, group, prio, lnum, typenr, has_text_or_icon);
+  insert_sign(buf, idx, id, group, prio, lnum, typenr, has_text_or_icon);
+}
+
+/// Remove the sign at index 'idx' from the signlist of 'buf' and free it.
+static void sign_entry_free(buf_T *buf, size_t idx)
+{
+  sign_entry_T *sign = kv_A(buf->b_signlist, idx);
+  if (sign->se_group != NULL) {
+    sign_group_unref(sign->se_group->sg_name);
+  }
+  xfree(sign);
 }
 
 /// Get the name of a sign by its typenr.
@@ -278,72 +291,36 @@ dict_T *sign_get_info(sign_entry_T *sign)
 static void sign_sort_by_prio_on_line(buf_T *buf, sign_entry_T *sign)
   FUNC_ATTR_NONNULL_ALL
 {
-  // If there is only one sign in the buffer or only one sign on the line or
-  // the sign is already sorted by priority, then return.
-  if ((sign->se_prev == NULL
-       || sign->se_prev->se_lnum != sign->se_lnum
-       || sign->se_prev->se_priority > sign->se_priority)
-      && (sign->se_next == NULL
-          || sign->se_next->se_lnum != sign->se_lnum
-          || sign->se_next->se_priority < sign->se_priority)) {
-    return;
-  }
-
-  // One or more signs on the same line as 'sign'
-  // Find a sign after which 'sign' should be inserted
-
-  // First search backward for a sign with higher priority on the same line
-  sign_entry_T *p = sign;
-  while (p->se_prev != NULL
-         && p->se_prev->se_lnum == sign->se_lnum
-         && p->se_prev->se_priority <= sign->se_priority) {
-    p = p->se_prev;
-  }
-  if (p == sign) {
-    // Sign not found. Search forward for a sign with priority just before
-    // 'sign'.
-    p = sign->se_next;
-    while (p->se_next != NULL
-           && p->se_next->se_lnum == sign->se_lnum
-           && p->se_next->se_priority > sign->se_priority) {
-      p = p->se_next;
+  size_t first = sign_find_lnum(buf, sign->se_lnum);
+  size_t end = first;
+  size_t idx = 0;
+  while (end < kv_size(buf->b_signlist)
+         && kv_A(buf->b_signlist, end)->se_lnum == sign->se_lnum) {
+    if (kv_A(buf->b_signlist, end) == sign) {
+      idx = end;
     }
+    end++;
   }
 
-  // Remove 'sign' from the list
-  if (buf->b_signlist == sign) {
-    buf->b_signlist = sign->se_next;
-  }
-  if (sign->se_prev != NULL) {
-    sign->se_prev->se_next = sign->se_next;
-  }
-  if (sign->se_next != NULL) {
-    sign->se_next->se_prev = sign->se_prev;
+  // If there is only one sign on the line or the sign is already sorted by
+  // priority, then return.
+  if ((idx == first || kv_A(buf->b_signlist, idx - 1)->se_priority > sign->se_priority)
+      && (idx + 1 == end || kv_A(buf->b_signlist, idx + 1)->se_priority < sign->se_priority)) {
+    return;
   }
-  sign->se_prev = NULL;
-  sign->se_next = NULL;
 
-  // Re-insert 'sign' at the right place
-  if (p->se_priority <= sign->se_priority) {
-    // 'sign' has a higher priority and should be inserted before 'p'
-    sign->se_prev = p->se_prev;
-    sign->se_next = p;
-    p->se_prev = sign;
-    if (sign->se_prev != NULL) {
-      sign->se_prev->se_next = sign;
-    }
-    if (buf->b_signlist == p) {
-      buf->b_signlist = sign;
-    }
-  } else {
-    // 'sign' has a lower priority and should be inserted after 'p'
-    sign->se_prev = p;
-    sign->se_next = p->se_next;
-    p->se_next = sign;
-    if (sign->se_next != NULL) {
-      sign->se_next->se_prev = sign;
-    }
+  // Remove 'sign' from the list, and insert it again after the signs on the
+  // line with a higher priority.
+  memmove(&kv_A(buf->b_signlist, idx), &kv_A(buf->b_signlist, idx + 1),
+          (end - idx - 1) * sizeof(sign_entry_T *));
+  size_t new_idx = first;
+  while (new_idx < end - 1
+         && kv_A(buf->b_signlist, new_idx)->se_priority > sign->se_priority) {
+    new_idx++;
   }
+  memmove(&kv_A(buf->b_signlist, new_idx + 1), &kv_A(buf->b_signlist, new_idx),
+          (end - 1 - new_idx) * sizeof(sign_entry_T *));
+  kv_A(buf->b_signlist, new_idx) = sign;
 }
 
 
@@ -359,40 +336,22 @@ static void sign_sort_by_prio_on_line(buf_T *buf, sign_entry_T *sign)
 void buf_addsign(buf_T *buf, int id, const char_u *groupname, int prio, linenr_T lnum, int typenr,
                  bool has_text_or_icon)
 {
-  sign_entry_T *sign;    // a sign in the signlist
-  sign_entry_T *prev;    // the previous sign
-
-  prev = NULL;
-  FOR_ALL_SIGNS_IN_BUF(buf, sign) {
-    if (lnum == sign->se_lnum && id == sign->se_id
-        && sign_in_group(sign, groupname)) {
+  size_t idx = sign_find_lnum(buf, lnum);
+  for (; idx < kv_size(buf->b_signlist); idx++) {
+    sign_entry_T *sign = kv_A(buf->b_signlist, idx);
+    if (sign->se_lnum != lnum) {
+      break;
+    }
+    if (id == sign->se_id && sign_in_group(sign, groupname)) {
       // Update an existing sign
       sign->se_typenr = typenr;
       sign->se_priority = prio;
       sign_sort_by_prio_on_line(buf, sign);
       return;
-    } else if (lnum < sign->se_lnum) {
-      insert_sign_by_lnum_prio(buf,
-                               prev,
-                               id,
-                               groupname,
-                               prio,
-                               lnum,
-                               typenr,
-                               has_text_or_icon);
-      return;
     }
-    prev = sign;
   }
 
-  insert_sign_by_lnum_prio(buf,
-                           prev,
-                           id,
-                           groupname,
-                           prio,
-                           lnum,
-                           typenr,
-                           has_text_or_icon);
+  insert_sign_by_lnum_prio(buf, idx, id, groupname, prio, lnum, typenr, has_text_or_icon);
 }
 
 /// For an existing, placed sign "markId" change the type to "typenr".
@@ -475,45 +434,43 @@ static sign_T *find_sign_by_typenr(int typenr)
 /// @return Number of signs of which attrs were found
 int buf_get_signattrs(buf_T *buf, linenr_T lnum, sign_attrs_T sattrs[])
 {
-  sign_entry_T *sign;
   sign_T *sp;
 
   int nr_matches = 0;
 
-  FOR_ALL_SIGNS_IN_BUF(buf, sign) {
+  for (size_t idx = sign_find_lnum(buf, lnum); idx < kv_size(buf->b_signlist); idx++) {
+    sign_entry_T *sign = kv_A(buf->b_signlist, idx);
     if (sign->se_lnum > lnum) {
       // Signs are sorted by line number in the buffer. No need to check
       // for signs after the specified line number 'lnum'.
       break;
     }
 
-    if (sign->se_lnum == lnum) {
-      sign_attrs_T sattr;
-      memset(&sattr, 0, sizeof(sattr));
-      sattr.sat_typenr = sign->se_typenr;
-      sp = find_sign_by_typenr(sign->se_typenr);
-      if (sp != NULL) {
-        sattr.sat_text = sp->sn_text;
-        if (sattr.sat_text != NULL && sp->sn_text_hl != 0) {
-          sattr.sat_texthl = syn_id2attr(sp->sn_text_hl);
-        }
-        if (sp->sn_line_hl != 0) {
-          sattr.sat_linehl = syn_id2attr(sp->sn_line_hl);
-        }
-        if (sp->sn_cul_hl != 0) {
-          sattr.sat_culhl = syn_id2attr(sp->sn_cul_hl);
-        }
-        if (sp->sn_num_hl != 0) {
-          sattr.sat_numhl = syn_id2attr(sp->sn_num_hl);
-        }
+    sign_attrs_T sattr;
+    memset(&sattr, 0, sizeof(sattr));
+    sattr.sat_typenr = sign->se_typenr;
+    sp = find_sign_by_typenr(sign->se_typenr);
+    if (sp != NULL) {
+      sattr.sat_text = sp->sn_text;
+      if (sattr.sat_text != NULL && sp->sn_text_hl != 0) {
+        sattr.sat_texthl = syn_id2attr(sp->sn_text_hl);
       }
-
-      sattrs[nr_matches] = sattr;
-      nr_matches++;
-      if (nr_matches == SIGN_SHOW_MAX) {
-        break;
+      if (sp->sn_line_hl != 0) {
+        sattr.sat_linehl = syn_id2attr(sp->sn_line_hl);
+      }
+      if (sp->sn_cul_hl != 0) {
+        sattr.sat_culhl = syn_id2attr(sp->sn_cul_hl);
+      }
+      if (sp->sn_num_hl != 0) {
+        sattr.sat_numhl = syn_id2attr(sp->sn_num_hl);
       }
     }
+
+    sattrs[nr_matches] = sattr;
+    nr_matches++;
+    if (nr_matches == SIGN_SHOW_MAX) {
+      break;
+    }
   }
   return nr_matches;
 }
@@ -534,28 +491,22 @@ int buf_get_signattrs(buf_T *buf, linenr_T lnum, sign_attrs_T sattrs[])
 /// then returns the line number of the last sign deleted.
 linenr_T buf_delsign(buf_T *buf, linenr_T atlnum, int id, char_u *group)
 {
-  sign_entry_T **lastp;  // pointer to pointer to current sign
-  sign_entry_T *sign;    // a sign in a b_signlist
-  sign_entry_T *next;    // the next sign in a b_signlist
-  linenr_T lnum;       // line number whose sign was deleted
+  linenr_T lnum = 0;  // line number whose sign was deleted
 
   buf->b_signcols_valid = false;
-  lastp = &buf->b_signlist;
-  lnum = 0;
-  for (sign = buf->b_signlist; sign != NULL; sign = next) {
-    next = sign->se_next;
+  size_t n = kv_size(buf->b_signlist);
+  size_t idx = atlnum == 0 ? 0 : sign_find_lnum(buf, atlnum);
+  size_t kept = idx;
+  for (; idx < n; idx++) {
+    sign_entry_T *sign = kv_A(buf->b_signlist, idx);
+    if (atlnum != 0 && sign->se_lnum > atlnum) {
+      break;
+    }
     if ((id == 0 || sign->se_id == id)
         && (atlnum == 0 || sign->se_lnum == atlnum)
         && sign_in_group(sign, group)) {
-      *lastp = next;
-      if (next != NULL) {
-        next->se_prev = sign->se_prev;
-      }
       lnum = sign->se_lnum;
-      if (sign->se_group != NULL) {
-        sign_group_unref(sign->se_group->sg_name);
-      }
-      xfree(sign);
+      sign_entry_free(buf, idx);
       redraw_buf_line_later(buf, lnum);
       // Check whether only one sign needs to be deleted
       // If deleting a sign with a specific identifier in a particular
@@ -564,16 +515,20 @@ linenr_T buf_delsign(buf_T *buf, linenr_T atlnum, int id, char_u *group)
       if (group == NULL
           || (*group != '*' && id != 0)
           || (*group == '*' && atlnum != 0)) {
+        idx++;
         break;
       }
     } else {
-      lastp = &sign->se_next;
+      kv_A(buf->b_signlist, kept++) = sign;
     }
   }
+  memmove(&kv_A(buf->b_signlist, kept), &kv_A(buf->b_signlist, idx),
+          (n - idx) * sizeof(sign_entry_T *));
+  kv_size(buf->b_signlist) = kept + (n - idx);
 
   // When deleting the last sign the cursor position may change, because the
   // sign columns no longer shows.  And the 'signcolumn' may be hidden.
-  if (buf->b_signlist == NULL) {
+  if (kv_size(buf->b_signlist) == 0) {
     redraw_buf_later(buf, NOT_VALID);
     changed_line_abv_curs();
   }
@@ -610,9 +565,8 @@ int buf_findsign(buf_T *buf, int id, char_u *group)
 /// @param groupname  sign group name
 static sign_entry_T *buf_getsign_at_line(buf_T *buf, linenr_T lnum, char_u *groupname)
 {
-  sign_entry_T *sign;    // a sign in the signlist
-
-  FOR_ALL_SIGNS_IN_BUF(buf, sign) {
+  for (size_t idx = sign_find_lnum(buf, lnum); idx < kv_size(buf->b_signlist); idx++) {
+    sign_entry_T *sign = kv_A(buf->b_signlist, idx);
     if (sign->se_lnum > lnum) {
       // Signs are sorted by line number in the buffer. No need to check
       // for signs after the specified line number 'lnum'.
@@ -647,32 +601,25 @@ int buf_findsign_id(buf_T *buf, linenr_T lnum, char_u *groupname)
 /// Delete signs in buffer "buf".
 void buf_delete_signs(buf_T *buf, char_u *group)
 {
-  sign_entry_T *sign;
-  sign_entry_T **lastp;  // pointer to pointer to current sign
-  sign_entry_T *next;
-
   // When deleting the last sign need to redraw the windows to remove the
   // sign column. Not when curwin is NULL (this means we're exiting).
-  if (buf->b_signlist != NULL && curwin != NULL) {
+  if (kv_size(buf->b_signlist) != 0 && curwin != NULL) {
     changed_line_abv_curs();
   }
 
-  lastp = &buf->b_signlist;
-  for (sign = buf->b_signlist; sign != NULL; sign = next) {
-    next = sign->se_next;
+  size_t kept = 0;
+  for (size_t idx = 0; idx < kv_size(buf->b_signlist); idx++) {
+    sign_entry_T *sign = kv_A(buf->b_signlist, idx);
     if (sign_in_group(sign, group)) {
-      *lastp = next;
-      if (next != NULL) {
-        next->se_prev = sign->se_prev;
-      }
-      if (sign->se_group != NULL) {
-        sign_group_unref(sign->se_group->sg_name);
-      }
-      xfree(sign);
+      sign_entry_free(buf, idx);
     } else {
-      lastp = &sign->se_next;
+      kv_A(buf->b_signlist, kept++) = sign;
     }
   }
+  kv_size(buf->b_signlist) = kept;
+  if (kept == 0) {
+    kv_destroy(buf->b_signlist);
+  }
   buf->b_signcols_valid = false;
 }
 
@@ -692,7 +639,7 @@ void sign_list_placed(buf_T *rbuf, char_u *sign_group)
     buf = rbuf;
   }
   while (buf != NULL && !got_int) {
-    if (buf->b_signlist != NULL) {
+    if (kv_size(buf->b_signlist) != 0) {
       vim_snprintf(lbuf, MSG_BUF_LEN, _("Signs for %s:"), buf->b_fname);
       msg_puts_attr(lbuf, HL_ATTR(HLF_D));
       msg_putchar('\n');
@@ -724,32 +671,42 @@ void sign_list_placed(buf_T *rbuf, char_u *sign_group)
   }
 }
 
+static int sign_entry_cmp(const void *a, const void *b)
+{
+  const sign_entry_T *s1 = *(sign_entry_T *const *)a;
+  const sign_entry_T *s2 = *(sign_entry_T *const *)b;
+  if (s1->se_lnum != s2->se_lnum) {
+    return s1->se_lnum < s2->se_lnum ? -1 : 1;
+  }
+  if (s1->se_priority != s2->se_priority) {
+    return s1->se_priority > s2->se_priority ? -1 : 1;
+  }
+  if (s1->se_id != s2->se_id) {
+    return s1->se_id > s2->se_id ? -1 : 1;
+  }
+  return 0;
+}
+
 /// Adjust a placed sign for inserted/deleted lines.
 void sign_mark_adjust(linenr_T line1, linenr_T line2, long amount, long amount_after)
 {
-  sign_entry_T *sign;           // a sign in a b_signlist
-  sign_entry_T *next;           // the next sign in a b_signlist
-  sign_entry_T *last = NULL;    // pointer to pointer to current sign
-  sign_entry_T **lastp = NULL;  // pointer to pointer to current sign
   linenr_T new_lnum;            // new line number to assign to sign
   int is_fixed = 0;
   int signcol = win_signcol_configured(curwin, &is_fixed);
 
   curbuf->b_signcols_valid = false;
-  lastp = &curbuf->b_signlist;
 
-  for (sign = curbuf->b_signlist; sign != NULL; sign = next) {
-    next = sign->se_next;
+  // The signs above "line1" do not change.
+  size_t kept = sign_find_lnum(curbuf, line1);
+  bool sorted = true;
+  for (size_t idx = kept; idx < kv_size(curbuf->b_signlist); idx++) {
+    sign_entry_T *sign = kv_A(curbuf->b_signlist, idx);
     new_lnum = sign->se_lnum;
     if (sign->se_lnum >= line1 && sign->se_lnum <= line2) {
       if (amount != MAXLNUM) {
         new_lnum += amount;
       } else if (!is_fixed || signcol >= 2) {
-        *lastp = next;
-        if (next) {
-          next->se_prev = last;
-        }
-        xfree(sign);
+        sign_entry_free(curbuf, idx);
         continue;
       }
     } else if (sign->se_lnum > line2) {
@@ -762,8 +719,22 @@ void sign_mark_adjust(linenr_T line1, linenr_T line2, long amount, long amount_a
       sign->se_lnum = new_lnum;
     }
 
-    last = sign;
-    lastp = &sign->se_next;
+    if (kept > 0) {
+      sign_entry_T *prev = kv_A(curbuf->b_signlist, kept - 1);
+      if (prev->se_lnum > sign->se_lnum
+          || (prev->se_lnum == sign->se_lnum && prev->se_priority < sign->se_priority)) {
+        sorted = false;
+      }
+    }
+    kv_A(curbuf->b_signlist, kept++) = sign;
+  }
+  kv_size(curbuf->b_signlist) = kept;
+
+  // Moving lines and keeping the signs of deleted lines can bring signs out
+  // of order.
+  if (!sorted) {
+    qsort(curbuf->b_signlist.items, kv_size(curbuf->b_signlist), sizeof(sign_entry_T *),
+          sign_entry_cmp);
   }
 }
 
@@ -927,7 +898,7 @@ int sign_define_by_name(char_u *name, char_u *icon, char_u *linehl, char_u *text
     // Signs may already exist, a redraw is needed in windows with a
     // non-empty sign list.
     FOR_ALL_WINDOWS_IN_TAB(wp, curtab) {
-      if (wp->w_buffer->b_signlist != NULL) {
+      if (kv_size(wp->w_buffer->b_signlist) != 0) {
         redraw_buf_later(wp->w_buffer, NOT_VALID);
       }
     }
@@ -1074,7 +1045,7 @@ int sign_place(int *sign_id, const char_u *sign_group, const char_u *sign_name,
 /// Unplace the specified sign
 int sign_unplace(int sign_id, char_u *sign_group, buf_T *buf, linenr_T atlnum)
 {
-  if (buf->b_signlist == NULL) {  // No signs in the buffer
+  if (kv_size(buf->b_signlist) == 0) {  // No signs in the buffer
     return OK;
   }
   if (sign_id == 0) {
@@ -1095,7 +1066,7 @@ int sign_unplace(int sign_id, char_u *sign_group, buf_T *buf, linenr_T atlnum)
   // When all the signs in a buffer are removed, force recomputing the
   // number column width (if enabled) in all the windows displaying the
   // buffer if 'signcolumn' is set to 'number' in that window.
-  if (buf->b_signlist == NULL) {
+  if (kv_size(buf->b_signlist) == 0) {
     may_force_numberwidth_recompute(buf, true);
   }
 
@@ -1260,7 +1231,7 @@ static void sign_unplace_cmd(buf_T *buf, linenr_T lnum, char_u *sign_name, int i
       // :sign unplace * group={group}
       // :sign unplace * group=*
       FOR_ALL_BUFFERS(cbuf) {
-        if (cbuf->b_signlist != NULL) {
+        if (kv_size(cbuf->b_signlist) != 0) {
           buf_delete_signs(cbuf, group);
         }
       }
@@ -1605,7 +1576,7 @@ void sign_get_placed(buf_T *buf, linenr_T lnum, int sign_id, const char_u *sign_
     sign_get_placed_in_buf(buf, lnum, sign_id, sign_group, retlist);
   } else {
     FOR_ALL_BUFFERS(cbuf) {
-      if (cbuf->b_signlist != NULL) {
+      if (kv_size(cbuf->b_signlist) != 0) {
         sign_get_placed_in_buf(cbuf, 0, sign_id, sign_group, retlist);
       }
     }
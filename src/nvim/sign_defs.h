@@ -28,8 +28,6 @@ struct sign_entry {
   bool se_has_text_or_icon;  // has text or icon
   linenr_T se_lnum;             // line number which has this sign
   signgroup_T *se_group;            // sign group
-  sign_entry_T *se_next;             // next entry in a list of signs
-  sign_entry_T *se_prev;             // previous entry -- for easy reordering
 };
 
 /// Sign attributes. Used by the screen refresh routines.
@@ -15,6 +15,7 @@
 #include "nvim/option_defs.h"
 #include "nvim/os/input.h"
 #include "nvim/state.h"
+#include "nvim/syntax.h"
 #include "nvim/ui.h"
 #include "nvim/vim.h"
 
@@ -49,6 +50,10 @@ getkey:
     } else {
       // Flush screen updates before blocking
       ui_flush();
+      // Until something arrives, parse syntax ahead of the window so that
+      // scrolling or jumping further down does not have to catch up first.
+      while (!os_char_avail() && multiqueue_empty(main_loop.events)
+             && syn_parse_ahead(curwin)) {}
       // Call `os_inchar` directly to block for events or user input without
       // consuming anything from `input_buffer`(os/input.c) or calling the
       // mapping engine.
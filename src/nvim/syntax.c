@@ -380,6 +380,8 @@ static garray_T current_state              // current stack of state_items
 static int16_t *current_next_list = NULL;  // when non-zero, nextgroup list
 static int current_next_flags = 0;         // flags for current_next_list
 static int current_line_id = 0;            // unique number for current line
+static uint64_t current_line_bytes[256 / 64];  // bytes in the current line
+static int current_line_bytes_id = -1;     // current_line_id for above
 
 #define CUR_STATE(idx)  ((stateitem_T *)(current_state.ga_data))[idx]
 
@@ -437,6 +439,11 @@ void syntax_start(win_T *wp, linenr_T lnum)
   }
   syn_block->b_sst_lasttick = display_tick;
 
+  // After reloading the buffer, the states from before may still be valid.
+  if (syn_buf->b_sst_saved != NULL && syn_block == &syn_buf->b_s) {
+    syn_stack_restore(syn_buf);
+  }
+
   /*
    * If the state of the end of the previous line is useful, store it.
    */
@@ -571,6 +578,45 @@ void syntax_start(win_T *wp, linenr_T lnum)
   syn_start_line();
 }
 
+/// Parse the syntax of window "wp" ahead of what has been displayed, one step
+/// of SST_AHEAD_LINES lines at a time.  Meant to be called while waiting for
+/// the user: the states saved in b_sst_array[] on the way let a later jump
+/// further into the buffer start from a nearby state, instead of blocking the
+/// redraw until the sync has caught up.  Only done when syncing is expensive,
+/// with "fromstart" or more "minlines" than fit in the window.
+///
+/// @return  true when there is more to parse.
+bool syn_parse_ahead(win_T *wp)
+{
+  synblock_T *block = wp->w_s;
+  buf_T *buf = wp->w_buffer;
+
+  // Saved states are only moved for changes when redrawing, wait for that.
+  if (syn_time_on || got_int || must_redraw != 0 || buf->b_mod_set
+      || block->b_syn_slow || !syntax_present(wp)
+      || block->b_syn_sync_minlines <= wp->w_height_inner) {
+    return false;
+  }
+
+  // Continue from the last saved state that does not depend on a change.
+  linenr_T lnum = MAX(syn_stack_valid_lnum(block), 1);
+  if (lnum >= buf->b_ml.ml_line_count) {
+    return false;
+  }
+
+  linenr_T target = MIN(lnum + SST_AHEAD_LINES, buf->b_ml.ml_line_count);
+  proftime_T tm = profile_setlimit(p_rdt);
+  syn_set_timeout(&tm);
+  syntax_start(wp, target);
+  syn_set_timeout(NULL);
+
+  // Stop when no state could be saved at "target", the next step would
+  // start from the same line again.
+  synstate_T *p = syn_stack_find_entry(target);
+  return p != NULL && p->sst_lnum == target && p->sst_change_lnum == 0
+         && target < buf->b_ml.ml_line_count;
+}
+
 /*
  * We cannot simply discard growarrays full of state_items or buf_states; we
  * have to manually release their extmatch pointers first.
@@ -922,6 +968,49 @@ static void syn_start_line(void)
   next_seqnr = 1;
 }
 
+/// Check if the character that a match of "spp" must start with occurs in
+/// the current line.  Avoids running the pattern over a line where it can't
+/// match, which happens for most items of a large grammar.
+///
+/// @return  false when "spp" can't match in the current line.
+static bool syn_pat_may_start(synpat_T *spp)
+{
+  // With ":syntime on" the report should count every try.
+  if (spp->sp_prog == NULL || syn_time_on) {
+    return true;
+  }
+  bool ic = spp->sp_ic;
+  int c = vim_regstart(spp->sp_prog, &ic);
+  if (c == NUL) {
+    return true;
+  }
+
+  if (current_line_bytes_id != current_line_id) {
+    memset(current_line_bytes, 0, sizeof(current_line_bytes));
+    for (const char_u *p = syn_getcurline(); *p != NUL; p++) {
+      current_line_bytes[*p >> 6] |= 1ULL << (*p & 63);
+    }
+    current_line_bytes_id = current_line_id;
+  }
+
+  if (c >= 0x80) {
+    char_u buf[MB_MAXBYTES + 1];
+    utf_char2bytes(c, buf);
+    // When ignoring case another lead byte may match.
+    return ic || line_has_byte(buf[0]);
+  } else if (ic) {
+    // A non-ASCII character may fold to an ASCII one.
+    return line_has_byte(TOLOWER_ASC(c)) || line_has_byte(TOUPPER_ASC(c))
+           || current_line_bytes[2] != 0 || current_line_bytes[3] != 0;
+  }
+  return line_has_byte(c);
+}
+
+static bool line_has_byte(int b)
+{
+  return current_line_bytes[b >> 6] & (1ULL << (b & 63));
+}
+
 /// Check for items in the stack that need their end updated.
 ///
 /// @param startofline  if true the last item is always updated.
@@ -1051,6 +1140,260 @@ void syn_stack_free_all(synblock_T *block)
   }
 }
 
+/// @return  The line of the last saved state of "block" that does not depend
+///          on a change, zero when there is none.  Parsing does not have to
+///          start above it.
+linenr_T syn_stack_valid_lnum(synblock_T *block)
+{
+  linenr_T lnum = 0;
+  for (synstate_T *p = block->b_sst_first; p != NULL; p = p->sst_next) {
+    if (p->sst_change_lnum != 0) {
+      break;
+    }
+    lnum = p->sst_lnum;
+  }
+  return lnum;
+}
+
+/// @return  The number of bytes of memory used by the syntax state stacks of
+///          "block".
+size_t syn_stack_mem_size(synblock_T *block)
+{
+  if (block->b_sst_array == NULL) {
+    return 0;
+  }
+  size_t size = (size_t)block->b_sst_len * sizeof(synstate_T);
+  for (synstate_T *p = block->b_sst_first; p != NULL; p = p->sst_next) {
+    if (p->sst_stacksize > SST_FIX_STATES) {
+      size += (size_t)p->sst_union.sst_ga.ga_maxlen * sizeof(bufstate_T);
+    }
+  }
+  return size;
+}
+
+#define SYN_HASH_INIT 0xcbf29ce484222325ULL
+
+/// Add "len" bytes at "p" to hash "h" (FNV-1a).
+static uint64_t syn_hash(uint64_t h, const void *const p, const size_t len)
+{
+  const uint8_t *const bytes = p;
+  for (size_t i = 0; i < len; i++) {
+    h = (h ^ bytes[i]) * 0x100000001b3ULL;
+  }
+  return h;
+}
+
+/// Add the group ID list "list" to hash "h".
+static uint64_t syn_hash_id_list(uint64_t h, const int16_t *list)
+{
+  if (list != NULL) {
+    for (; *list != 0; list++) {
+      h = syn_hash(h, list, sizeof(*list));
+    }
+  }
+  return syn_hash(h, "", 1);
+}
+
+/// Add the lines "*lnump" up to "end" of "buf" to hash "h".  "*lnump" is set
+/// to "end".
+static uint64_t syn_hash_lines(uint64_t h, buf_T *buf, linenr_T *lnump, linenr_T end)
+{
+  for (; *lnump < end; (*lnump)++) {
+    const char_u *line = ml_get_buf(buf, *lnump, false);
+    h = syn_hash(h, line, STRLEN(line) + 1);
+  }
+  return h;
+}
+
+/// Compute a fingerprint of the syntax items of buffer "buf", everything that
+/// the saved states depend on.
+static uint64_t syn_fingerprint(buf_T *buf)
+{
+  synblock_T *block = &buf->b_s;
+  uint64_t h = SYN_HASH_INIT;
+
+  for (int i = 0; i < block->b_syn_patterns.ga_len; i++) {
+    synpat_T *spp = &SYN_ITEMS(block)[i];
+    const int fields[] = {
+      spp->sp_type, spp->sp_syncing, spp->sp_syn_match_id, spp->sp_off_flags,
+      spp->sp_flags, spp->sp_cchar, spp->sp_ic, spp->sp_sync_idx,
+      spp->sp_syn.id, spp->sp_syn.inc_tag,
+    };
+    h = syn_hash(h, fields, sizeof(fields));
+    h = syn_hash(h, spp->sp_offsets, sizeof(spp->sp_offsets));
+    h = syn_hash(h, spp->sp_pattern, STRLEN(spp->sp_pattern) + 1);
+    h = syn_hash_id_list(h, spp->sp_cont_list);
+    h = syn_hash_id_list(h, spp->sp_next_list);
+    h = syn_hash_id_list(h, spp->sp_syn.cont_in_list);
+  }
+  for (int i = 0; i < block->b_syn_clusters.ga_len; i++) {
+    h = syn_hash_id_list(h, SYN_CLSTR(block)[i].scl_list);
+  }
+
+  // The order of the keywords in the hashtables depends on how they were
+  // added, sum their hashes.
+  uint64_t keywords = 0;
+  hashtab_T *tables[] = { &block->b_keywtab, &block->b_keywtab_ic };
+  for (size_t t = 0; t < ARRAY_SIZE(tables); t++) {
+    size_t todo = tables[t]->ht_used;
+    for (hashitem_T *hi = tables[t]->ht_array; todo > 0; hi++) {
+      if (HASHITEM_EMPTY(hi)) {
+        continue;
+      }
+      todo--;
+      for (keyentry_T *kp = HI2KE(hi); kp != NULL; kp = kp->ke_next) {
+        const int fields[] = {
+          (int)t, kp->k_syn.id, kp->k_syn.inc_tag, kp->flags, kp->k_char,
+        };
+        uint64_t kh = syn_hash(SYN_HASH_INIT, fields, sizeof(fields));
+        kh = syn_hash(kh, kp->keyword, STRLEN(kp->keyword) + 1);
+        kh = syn_hash_id_list(kh, kp->next_list);
+        keywords += syn_hash_id_list(kh, kp->k_syn.cont_in_list);
+      }
+    }
+  }
+  h = syn_hash(h, &keywords, sizeof(keywords));
+
+  const long sync[] = {
+    block->b_syn_sync_flags, block->b_syn_sync_id, block->b_syn_sync_minlines,
+    block->b_syn_sync_maxlines, block->b_syn_sync_linebreaks,
+    block->b_syn_linecont_ic, block->b_syn_containedin, buf->b_p_smc,
+  };
+  h = syn_hash(h, sync, sizeof(sync));
+  if (block->b_syn_linecont_pat != NULL) {
+    h = syn_hash(h, block->b_syn_linecont_pat, STRLEN(block->b_syn_linecont_pat));
+  }
+  h = syn_hash(h, "", 1);
+  if (block->b_syn_isk != NULL) {
+    h = syn_hash(h, block->b_syn_isk, STRLEN(block->b_syn_isk));
+  }
+  return syn_hash(h, buf->b_p_isk, STRLEN(buf->b_p_isk));
+}
+
+/// @return  the line below the lines that the state at line "lnum" of "buf"
+///          depends on: the lines above it, and with "linebreaks" the lines
+///          that a match may look ahead at.
+static linenr_T syn_state_dep_end(buf_T *buf, linenr_T lnum)
+{
+  const long end = lnum + buf->b_s.b_syn_sync_linebreaks;
+  return (linenr_T)MIN(end, (long)buf->b_ml.ml_line_count + 1);
+}
+
+/// Keep the syntax states of buffer "buf" before it is unloaded, to be used
+/// again by syntax_start() when the same text is loaded with the same syntax
+/// items, e.g. for ":e!".  Saves having to parse the text again to get to the
+/// end of it.  States that refer to the syntax items by pointer are dropped.
+void syn_stack_save(buf_T *buf)
+{
+  synblock_T *block = &buf->b_s;
+
+  syn_stack_saved_free(buf);
+  if (block->b_sst_first == NULL || block->b_syn_error || block->b_syn_slow
+      || buf->b_ml.ml_mfp == NULL) {
+    return;
+  }
+
+  size_t count = 0;
+  for (synstate_T *p = block->b_sst_first; p != NULL; p = p->sst_next) {
+    count++;
+  }
+  synsaved_T *saved = xmalloc(sizeof(*saved));
+  saved->ss_syntax = syn_fingerprint(buf);
+  saved->ss_len = 0;
+  saved->ss_states = xmalloc(count * sizeof(*saved->ss_states));
+  saved->ss_hash = xmalloc(count * sizeof(*saved->ss_hash));
+
+  uint64_t h = SYN_HASH_INIT;
+  linenr_T lnum = 1;
+  for (synstate_T *p = block->b_sst_first; p != NULL; p = p->sst_next) {
+    if (p->sst_change_lnum != 0 || p->sst_next_list != NULL
+        || p->sst_lnum > buf->b_ml.ml_line_count) {
+      continue;
+    }
+    bufstate_T *bp = p->sst_stacksize > SST_FIX_STATES
+                     ? SYN_STATE_P(&p->sst_union.sst_ga)
+                     : p->sst_union.sst_stack;
+    bool has_extmatch = false;
+    for (int i = 0; i < p->sst_stacksize; i++) {
+      has_extmatch |= bp[i].bs_extmatch != NULL;
+    }
+    if (has_extmatch) {
+      continue;
+    }
+
+    synstate_T *sp = &saved->ss_states[saved->ss_len];
+    *sp = *p;
+    sp->sst_next = NULL;
+    if (p->sst_stacksize > SST_FIX_STATES) {
+      ga_init(&sp->sst_union.sst_ga, (int)sizeof(bufstate_T), 1);
+      ga_grow(&sp->sst_union.sst_ga, p->sst_stacksize);
+      memmove(sp->sst_union.sst_ga.ga_data, bp,
+              (size_t)p->sst_stacksize * sizeof(bufstate_T));
+      sp->sst_union.sst_ga.ga_len = p->sst_stacksize;
+    }
+    h = syn_hash_lines(h, buf, &lnum, syn_state_dep_end(buf, p->sst_lnum));
+    saved->ss_hash[saved->ss_len++] = h;
+  }
+  buf->b_sst_saved = saved;
+}
+
+/// Use the states saved by syn_stack_save() for the syntax stack of "buf",
+/// as far as the text and the syntax items did not change.  The saved states
+/// are freed.
+static void syn_stack_restore(buf_T *buf)
+{
+  synsaved_T *saved = buf->b_sst_saved;
+  synblock_T *block = &buf->b_s;
+
+  if (block->b_sst_first == NULL && saved->ss_syntax == syn_fingerprint(buf)) {
+    uint64_t h = SYN_HASH_INIT;
+    linenr_T lnum = 1;
+    synstate_T *last = NULL;
+    for (size_t i = 0; i < saved->ss_len && block->b_sst_freecount > 0; i++) {
+      synstate_T *sp = &saved->ss_states[i];
+      if (sp->sst_lnum > buf->b_ml.ml_line_count) {
+        break;
+      }
+      h = syn_hash_lines(h, buf, &lnum, syn_state_dep_end(buf, sp->sst_lnum));
+      if (h != saved->ss_hash[i]) {
+        break;  // text changed, the following states are not valid
+      }
+
+      synstate_T *p = block->b_sst_firstfree;
+      block->b_sst_firstfree = p->sst_next;
+      block->b_sst_freecount--;
+      *p = *sp;
+      p->sst_next = NULL;
+      p->sst_tick = display_tick;
+      sp->sst_stacksize = 0;  // now owned by "p"
+      if (last == NULL) {
+        block->b_sst_first = p;
+      } else {
+        last->sst_next = p;
+      }
+      last = p;
+    }
+  }
+  syn_stack_saved_free(buf);
+}
+
+/// Free the states saved by syn_stack_save() for "buf".
+void syn_stack_saved_free(buf_T *buf)
+{
+  synsaved_T *saved = buf->b_sst_saved;
+  if (saved == NULL) {
+    return;
+  }
+  for (size_t i = 0; i < saved->ss_len; i++) {
+    if (saved->ss_states[i].sst_stacksize > SST_FIX_STATES) {
+      ga_clear(&saved->ss_states[i].sst_union.sst_ga);
+    }
+  }
+  xfree(saved->ss_states);
+  xfree(saved->ss_hash);
+  XFREE_CLEAR(buf->b_sst_saved);
+}
+
 /*
  * Allocate the syntax state stack for syn_buf when needed.
  * If the number of entries in b_sst_array[] is much too big or a bit too
@@ -1860,6 +2203,11 @@ static int syn_current_attr(const bool syncing, const bool displaying, bool *con
                 && (displaying || !(spp->sp_flags & HL_DISPLAY))
                 && (spp->sp_type == SPTYPE_MATCH
                     || spp->sp_type == SPTYPE_START)
+                // If we already tried matching in this line, and
+                // there isn't a match before next_match_col, skip
+                // this item.
+                && (spp->sp_line_id != current_line_id
+                    || spp->sp_startcol < next_match_col)
                 && (current_next_list != NULL
                            ? in_id_list(NULL, current_next_list,
                                         &spp->sp_syn, 0)
@@ -1868,13 +2216,6 @@ static int syn_current_attr(const bool syncing, const bool displaying, bool *con
                               : in_id_list(cur_si,
                                            cur_si->si_cont_list, &spp->sp_syn,
                                            spp->sp_flags & HL_CONTAINED)))) {
-              // If we already tried matching in this line, and
-              // there isn't a match before next_match_col, skip
-              // this item.
-              if (spp->sp_line_id == current_line_id
-                  && spp->sp_startcol >= next_match_col) {
-                continue;
-              }
               spp->sp_line_id = current_line_id;
 
               colnr_T lc_col = current_col - spp->sp_offsets[SPO_LC_OFF];
@@ -1884,8 +2225,9 @@ static int syn_current_attr(const bool syncing, const bool displaying, bool *con
 
               regmatch.rmm_ic = spp->sp_ic;
               regmatch.regprog = spp->sp_prog;
-              int r = syn_regexec(&regmatch, current_lnum, lc_col,
-                                  IF_SYN_TIME(&spp->sp_time));
+              int r = syn_pat_may_start(spp)
+                      && syn_regexec(&regmatch, current_lnum, lc_col,
+                                     IF_SYN_TIME(&spp->sp_time));
               spp->sp_prog = regmatch.regprog;
               if (!r) {
                 // no match in this line, try another one
@@ -3044,22 +3386,29 @@ static int check_keyword_id(char_u *const line, const int startcol, int *const e
     return 0;
   }
 
-  // Must make a copy of the keyword, so we can add a NUL and make it
-  // lowercase.
-  char_u keyword[MAXKEYWLEN + 1];         // assume max. keyword len is 80
-  STRLCPY(keyword, kwp, kwlen + 1);
-
   keyentry_T *kp = NULL;
 
-  // matching case
-  if (syn_block->b_keywtab.ht_used != 0) {
-    kp = match_keyword(keyword, &syn_block->b_keywtab, cur_si);
+  // matching case: the word can be looked up where it is in the line
+  if (syn_block->b_keywtab.ht_used != 0
+      && keywfilter_has(&syn_block->b_keywfilter, *kwp, kwlen)) {
+    kp = match_keyword(hash_find_len(&syn_block->b_keywtab, (const char *)kwp,
+                                     (size_t)kwlen), cur_si);
   }
 
-  // ignoring case
-  if (kp == NULL && syn_block->b_keywtab_ic.ht_used != 0) {
+  // ignoring case: must make a lowercase copy of the keyword.  The first
+  // byte is only checked when it stays ASCII, folding may change the others.
+  // Fold it like str_foldcase() does, that depends on 'casemap'.
+  const int c = *kwp < 0x80 ? mb_tolower(*kwp) : 0x80;
+  if (kp == NULL && syn_block->b_keywtab_ic.ht_used != 0
+      && (c >= 0x80 || keywfilter_has_first(&syn_block->b_keywfilter_ic, c))) {
+    char_u keyword[MAXKEYWLEN + 1];       // assume max. keyword len is 80
     str_foldcase(kwp, kwlen, keyword, MAXKEYWLEN + 1);
-    kp = match_keyword(keyword, &syn_block->b_keywtab_ic, cur_si);
+    const int len = (int)STRLEN(keyword);
+    if (keywfilter_has(&syn_block->b_keywfilter_ic, *keyword, len)) {
+      kp = match_keyword(hash_find_len(&syn_block->b_keywtab_ic,
+                                       (const char *)keyword, (size_t)len),
+                         cur_si);
+    }
   }
 
   if (kp != NULL) {
@@ -3073,14 +3422,39 @@ static int check_keyword_id(char_u *const line, const int startcol, int *const e
   return 0;
 }
 
+/// Add "keyword" to the filter of its keyword table.
+static void keywfilter_add(keywfilter_T *const kf, const char_u *const keyword)
+{
+  const size_t len = STRLEN(keyword);
+  if (len > MAXKEYWLEN) {
+    return;  // can never match
+  }
+  kf->kf_first[*keyword >> 6] |= 1ULL << (*keyword & 63);
+  kf->kf_len[len >> 6] |= 1ULL << (len & 63);
+}
+
+/// @return  false when no keyword in the table of "kf" starts with byte "c".
+static bool keywfilter_has_first(const keywfilter_T *const kf, const int c)
+{
+  return kf->kf_first[(c >> 6) & 3] & (1ULL << (c & 63));
+}
+
+/// @return  false when no keyword in the table of "kf" starts with byte "c"
+///          and is "len" bytes long.
+static bool keywfilter_has(const keywfilter_T *const kf, const int c, const int len)
+{
+  return keywfilter_has_first(kf, c) && (kf->kf_len[len >> 6] & (1ULL << (len & 63)));
+}
+
 /// Find keywords that match.  There can be several with different
 /// attributes.
 /// When current_next_list is non-zero accept only that group, otherwise:
 ///  Accept a not-contained keyword at toplevel.
 ///  Accept a keyword at other levels only if it is in the contains list.
-static keyentry_T *match_keyword(char_u *keyword, hashtab_T *ht, stateitem_T *cur_si)
+///
+/// @param hi  the hash item of the keyword, possibly empty
+static keyentry_T *match_keyword(hashitem_T *hi, stateitem_T *cur_si)
 {
-  hashitem_T *hi = hash_find(ht, keyword);
   if (!HASHITEM_EMPTY(hi)) {
     for (keyentry_T *kp = HI2KE(hi); kp != NULL; kp = kp->ke_next) {
       if (current_next_list != 0
@@ -3286,6 +3660,8 @@ void syntax_clear(synblock_T *block)
   // free the keywords
   clear_keywtab(&block->b_keywtab);
   clear_keywtab(&block->b_keywtab_ic);
+  memset(&block->b_keywfilter, 0, sizeof(block->b_keywfilter));
+  memset(&block->b_keywfilter_ic, 0, sizeof(block->b_keywfilter_ic));
 
   // free the syntax patterns
   for (int i = block->b_syn_patterns.ga_len; --i >= 0;) {
@@ -4100,6 +4476,9 @@ static void add_keyword(char_u *const name, const int id, const int flags,
   hashtab_T *const ht = (curwin->w_s->b_syn_ic)
       ? &curwin->w_s->b_keywtab_ic
       : &curwin->w_s->b_keywtab;
+  keywfilter_add((curwin->w_s->b_syn_ic)
+                 ? &curwin->w_s->b_keywfilter_ic
+                 : &curwin->w_s->b_keywfilter, kp->keyword);
   hashitem_T *const hi = hash_lookup(ht, (const char *)kp->keyword,
                                      STRLEN(kp->keyword), hash);
 
@@ -7,9 +7,11 @@
 #define SST_MAX_ENTRIES 1000   // maximal size for state stack array
 #define SST_FIX_STATES  7      // size of sst_stack[].
 #define SST_DIST        16     // normal distance between entries
+#define SST_AHEAD_LINES 200    // lines parsed per step of syn_parse_ahead()
 #define SST_INVALID    (synstate_T *)-1        // invalid syn_state pointer
 
 typedef struct syn_state synstate_T;
+typedef struct syn_saved synsaved_T;
 
 #include "nvim/buffer_defs.h"
 #include "nvim/regexp_defs.h"
@@ -66,4 +68,13 @@ struct syn_state {
                                 // may have made the state invalid
 };
 
+/// Syntax states of an unloaded buffer, kept to be used again when the same
+/// text is loaded with the same syntax items.
+struct syn_saved {
+  uint64_t ss_syntax;           // fingerprint of the syntax items
+  size_t ss_len;                // number of entries in ss_states[]
+  synstate_T *ss_states;        // states, sorted by line number
+  uint64_t *ss_hash;            // hash of the lines before each state
+};
+
 #endif // NVIM_SYNTAX_DEFS_H
@@ -75,6 +75,9 @@
 #define UH_MAGIC 0x18dade       // value for uh_magic when in use
 #define UE_MAGIC 0xabc123       // value for ue_magic when in use
 
+// Minimal length of a line for an entry to only keep the changed part.
+#define UE_DELTA_MIN 1024
+
 #include <assert.h>
 #include <fcntl.h>
 #include <inttypes.h>
@@ -95,6 +98,7 @@
 #include "nvim/garray.h"
 #include "nvim/getchar.h"
 #include "nvim/lib/kvec.h"
+#include "nvim/map.h"
 #include "nvim/mark.h"
 #include "nvim/memline.h"
 #include "nvim/memory.h"
@@ -112,6 +116,23 @@
 #include "nvim/types.h"
 #include "nvim/undo.h"
 
+/// State of the undo tree as stored in the undo file.
+typedef struct {
+  char_u us_hash[32];           ///< hash of the text, SHA-256 for older files
+  linenr_T us_line_count;
+  char_u *us_line_ptr;          ///< saved line for "U" command
+  linenr_T us_line_lnum;
+  colnr_T us_line_colnr;
+  int us_old_seq;               ///< uh_seq of b_u_oldhead
+  int us_new_seq;               ///< uh_seq of b_u_newhead
+  int us_cur_seq;               ///< uh_seq of b_u_curhead
+  int us_num_head;
+  int us_seq_last;
+  int us_seq_cur;
+  time_t us_time;
+  long us_save_nr;
+} undostate_T;
+
 #ifdef INCLUDE_GENERATED_DECLARATIONS
 # include "undo.c.generated.h"
 #endif
@@ -127,6 +148,23 @@ static bool undo_undoes = false;
 
 static int lastmark = 0;
 
+static char e_unspill[] = N_("E5011: Cannot read undo text back from the temporary file");
+
+// The spill file is rewritten when it is more than this and more than half
+// of it is no longer used.
+#define SPILL_COMPACT_MIN (64 * 1024)
+
+// Memory used by the entries of synced headers of all buffers.
+static size_t u_mem_total = 0;
+
+/// Remember that "uhp" has to be written to the undo file again.
+static inline void u_header_changed(u_header_T *uhp)
+{
+  if (uhp != NULL) {
+    uhp->uh_dirty = true;
+  }
+}
+
 #if defined(U_DEBUG)
 /*
  * Check the undo structures for being valid.  Print a warning when something
@@ -437,9 +475,11 @@ int u_savecommon(buf_T *buf, linenr_T top, linenr_T bot, linenr_T newbot, int re
 
       if (uhp->uh_alt_prev.ptr != NULL) {
         uhp->uh_alt_prev.ptr->uh_alt_next.ptr = uhp;
+        u_header_changed(uhp->uh_alt_prev.ptr);
       }
 
       old_curhead->uh_alt_prev.ptr = uhp;
+      u_header_changed(old_curhead);
 
       if (buf->b_u_oldhead == old_curhead) {
         buf->b_u_oldhead = uhp;
@@ -450,6 +490,7 @@ int u_savecommon(buf_T *buf, linenr_T top, linenr_T bot, linenr_T newbot, int re
 
     if (buf->b_u_newhead != NULL) {
       buf->b_u_newhead->uh_prev.ptr = uhp;
+      u_header_changed(buf->b_u_newhead);
     }
 
     uhp->uh_seq = ++buf->b_u_seq_last;
@@ -461,6 +502,8 @@ int u_savecommon(buf_T *buf, linenr_T top, linenr_T bot, linenr_T newbot, int re
     uhp->uh_walk = 0;
     uhp->uh_entry = NULL;
     uhp->uh_getbot_entry = NULL;
+    uhp->uh_filesize = 0;
+    uhp->uh_dirty = true;
     uhp->uh_cursor = curwin->w_cursor;          // save cursor pos. for undo
     if (virtual_active() && curwin->w_cursor.coladd > 0) {
       uhp->uh_cursor_vcol = getviscol();
@@ -488,6 +531,7 @@ int u_savecommon(buf_T *buf, linenr_T top, linenr_T bot, linenr_T newbot, int re
     if (get_undolevel(buf) < 0) {  // no undo at all
       return OK;
     }
+    u_header_changed(buf->b_u_newhead);
 
     /*
      * When saving a single line, and it has been saved just before, it
@@ -522,6 +566,8 @@ int u_savecommon(buf_T *buf, linenr_T top, linenr_T bot, linenr_T newbot, int re
 
         // If it's the same line we can skip saving it again.
         if (uep->ue_size == 1 && uep->ue_top == top) {
+          // It is going to change again, need to have the whole line.
+          u_delta_expand(buf, uep);
           if (i > 0) {
             // It's not the last entry: get ue_bot for the last
             // entry now.  Following deleted/inserted lines go to
@@ -617,15 +663,26 @@ int u_savecommon(buf_T *buf, linenr_T top, linenr_T bot, linenr_T newbot, int re
 #define UF_START_MAGIC_LEN     9
 // magic at start of header
 #define UF_HEADER_MAGIC        0x5fd0
+// magic at start of state
+#define UF_STATE_MAGIC         0x5fd1
 // magic after last header
 #define UF_HEADER_END_MAGIC    0xe7aa
 // magic at start of entry
 #define UF_ENTRY_MAGIC         0xf518
+// magic at start of UE_DELTA entry
+#define UF_ENTRY_DELTA_MAGIC   0xf519
 // magic after last entry
 #define UF_ENTRY_END_MAGIC     0x3581
 
 // 2-byte undofile version number
-#define UF_VERSION             3
+#define UF_VERSION             4
+// undofile version of files written at once, with a SHA-256 hash of the text
+#define UF_VERSION_SHA256      3
+#define UF_SHA256_SIZE         32
+
+// An undo file is written from scratch when more than 1/UF_COMPACT_RATIO of
+// it is records that were superseded.
+#define UF_COMPACT_RATIO       2
 
 // extra fields for header
 #define UF_LAST_SAVE_NR        1
@@ -635,20 +692,147 @@ int u_savecommon(buf_T *buf, linenr_T top, linenr_T bot, linenr_T newbot, int re
 
 static char_u e_not_open[] = N_("E828: Cannot open undo file for writing: %s");
 
+// Constants for the hash of the text.  It only has to notice that the file
+// was changed without updating the undo file, which does not need a
+// cryptographic hash.  This one handles 32 bytes per round.
+#define UHASH_P1 UINT64_C(0x9E3779B185EBCA87)
+#define UHASH_P2 UINT64_C(0xC2B2AE3D27D4EB4F)
+#define UHASH_P3 UINT64_C(0x165667B19E3779F9)
+#define UHASH_P4 UINT64_C(0x85EBCA77C2B2AE63)
+#define UHASH_P5 UINT64_C(0x27D4EB2F165667C5)
+
+static inline uint64_t u_hash_rotl(uint64_t x, int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t u_hash_read(const uint8_t *p, size_t len)
+{
+  uint64_t v = 0;
+  for (size_t i = len; i > 0; i--) {
+    v = (v << 8) | p[i - 1];
+  }
+  return v;
+}
+
+static inline uint64_t u_hash_round(uint64_t acc, uint64_t input)
+{
+  acc += input * UHASH_P2;
+  return u_hash_rotl(acc, 31) * UHASH_P1;
+}
+
+/// Start computing the hash of buffer text for the undo file.
+void u_hash_start(undo_hash_T *ctx)
+  FUNC_ATTR_NONNULL_ALL
+{
+  ctx->uh_v[0] = UHASH_P1 + UHASH_P2;
+  ctx->uh_v[1] = UHASH_P2;
+  ctx->uh_v[2] = 0;
+  ctx->uh_v[3] = (uint64_t)0 - UHASH_P1;
+  ctx->uh_total = 0;
+  ctx->uh_buflen = 0;
+}
+
+/// Add "len" bytes at "data" to the hash.  The result only depends on the
+/// concatenation of the data, not on how it is split.
+void u_hash_update(undo_hash_T *ctx, const char_u *data, size_t len)
+  FUNC_ATTR_NONNULL_ALL
+{
+  ctx->uh_total += len;
+  if (ctx->uh_buflen + len < sizeof(ctx->uh_buf)) {
+    memcpy(ctx->uh_buf + ctx->uh_buflen, data, len);
+    ctx->uh_buflen += len;
+    return;
+  }
+  if (ctx->uh_buflen > 0) {
+    size_t n = sizeof(ctx->uh_buf) - ctx->uh_buflen;
+    memcpy(ctx->uh_buf + ctx->uh_buflen, data, n);
+    for (int i = 0; i < 4; i++) {
+      ctx->uh_v[i] = u_hash_round(ctx->uh_v[i], u_hash_read(ctx->uh_buf + i * 8, 8));
+    }
+    data += n;
+    len -= n;
+    ctx->uh_buflen = 0;
+  }
+  for (; len >= 32; data += 32, len -= 32) {
+    for (int i = 0; i < 4; i++) {
+      ctx->uh_v[i] = u_hash_round(ctx->uh_v[i], u_hash_read(data + i * 8, 8));
+    }
+  }
+  memcpy(ctx->uh_buf, data, len);
+  ctx->uh_buflen = len;
+}
+
+/// Finish the hash started with u_hash_start() into hash[UNDO_HASH_SIZE].
+void u_hash_finish(undo_hash_T *ctx, char_u *hash)
+  FUNC_ATTR_NONNULL_ALL
+{
+  uint64_t h;
+  if (ctx->uh_total >= 32) {
+    h = u_hash_rotl(ctx->uh_v[0], 1) + u_hash_rotl(ctx->uh_v[1], 7)
+        + u_hash_rotl(ctx->uh_v[2], 12) + u_hash_rotl(ctx->uh_v[3], 18);
+    for (int i = 0; i < 4; i++) {
+      h ^= u_hash_round(0, ctx->uh_v[i]);
+      h = h * UHASH_P1 + UHASH_P4;
+    }
+  } else {
+    h = UHASH_P5;
+  }
+  h += ctx->uh_total;
+
+  const uint8_t *p = ctx->uh_buf;
+  size_t len = ctx->uh_buflen;
+  for (; len >= 8; p += 8, len -= 8) {
+    h ^= u_hash_round(0, u_hash_read(p, 8));
+    h = u_hash_rotl(h, 27) * UHASH_P1 + UHASH_P4;
+  }
+  if (len >= 4) {
+    h ^= u_hash_read(p, 4) * UHASH_P1;
+    h = u_hash_rotl(h, 23) * UHASH_P2 + UHASH_P3;
+    p += 4;
+    len -= 4;
+  }
+  for (; len > 0; p++, len--) {
+    h ^= *p * UHASH_P5;
+    h = u_hash_rotl(h, 11) * UHASH_P1;
+  }
+  h ^= h >> 33;
+  h *= UHASH_P2;
+  h ^= h >> 29;
+  h *= UHASH_P3;
+  h ^= h >> 32;
+
+  for (int i = 0; i < UNDO_HASH_SIZE; i++) {
+    hash[i] = (char_u)(h >> (8 * (UNDO_HASH_SIZE - 1 - i)));
+  }
+}
+
 /// Compute the hash for a buffer text into hash[UNDO_HASH_SIZE].
 ///
 /// @param[in] buf The buffer used to compute the hash
 /// @param[in] hash Array of size UNDO_HASH_SIZE in which to store the value of
 ///                 the hash
 void u_compute_hash(buf_T *buf, char_u *hash)
+{
+  undo_hash_T ctx;
+
+  u_hash_start(&ctx);
+  for (linenr_T lnum = 1; lnum <= buf->b_ml.ml_line_count; lnum++) {
+    char_u *p = ml_get_buf(buf, lnum, false);
+    u_hash_update(&ctx, p, STRLEN(p) + 1);
+  }
+  u_hash_finish(&ctx, hash);
+}
+
+/// Compute the SHA-256 of a buffer text into hash[UF_SHA256_SIZE], as used
+/// by undo files of version UF_VERSION_SHA256.
+static void u_compute_sha256(buf_T *buf, char_u *hash)
 {
   context_sha256_T ctx;
-  linenr_T lnum;
-  char_u *p;
 
   sha256_start(&ctx);
-  for (lnum = 1; lnum <= buf->b_ml.ml_line_count; lnum++) {
-    p = ml_get_buf(buf, lnum, false);
+  for (linenr_T lnum = 1; lnum <= buf->b_ml.ml_line_count; lnum++) {
+    char_u *p = ml_get_buf(buf, lnum, false);
     sha256_update(&ctx, p, (uint32_t)(STRLEN(p) + 1));
   }
   sha256_finish(&ctx, hash);
@@ -775,27 +959,39 @@ static void u_free_uhp(u_header_T *uhp)
     u_freeentry(uep, uep->ue_size);
     uep = nuep;
   }
+  kv_destroy(uhp->uh_extmark);
   xfree(uhp);
 }
 
 /// Writes the undofile header.
 ///
 /// @param bi   The buffer information
-/// @param hash The hash of the buffer contents
 //
 /// @returns false in case of an error.
-static bool serialize_header(bufinfo_T *bi, char_u *hash)
+static bool serialize_header(bufinfo_T *bi)
   FUNC_ATTR_NONNULL_ALL
 {
-  buf_T *buf = bi->bi_buf;
-  FILE *fp = bi->bi_fp;
-
   // Start writing, first the magic marker and undo info version.
-  if (fwrite(UF_START_MAGIC, UF_START_MAGIC_LEN, 1, fp) != 1) {
+  if (!undo_write(bi, (uint8_t *)UF_START_MAGIC, UF_START_MAGIC_LEN)) {
     return false;
   }
 
-  undo_write_bytes(bi, UF_VERSION, 2);
+  return undo_write_bytes(bi, UF_VERSION, 2);
+}
+
+/// Writes the state of the undo tree.  It goes after the headers, a later
+/// state replaces the one before it.
+///
+/// @param bi   The buffer information
+/// @param hash The hash of the buffer contents
+//
+/// @returns false in case of an error.
+static bool serialize_state(bufinfo_T *bi, char_u *hash)
+  FUNC_ATTR_NONNULL_ALL
+{
+  buf_T *buf = bi->bi_buf;
+
+  undo_write_bytes(bi, (uintmax_t)UF_STATE_MAGIC, 2);
 
   // Write a hash of the buffer text, so that we can verify it is
   // still the same when reading the buffer text.
@@ -831,8 +1027,72 @@ static bool serialize_header(bufinfo_T *bi, char_u *hash)
   undo_write_bytes(bi, (uintmax_t)buf->b_u_save_nr_last, 4);
 
   // Write end marker.
-  undo_write_bytes(bi, 0, 1);
+  return undo_write_bytes(bi, 0, 1);
+}
+
+/// Reads the state of the undo tree, written by serialize_state() or as part
+/// of the header of older undo files.
+///
+/// @param bi        The buffer information
+/// @param hash_len  Size of the hash of the buffer contents
+/// @param st        Where to store the state, "st->us_line_ptr" must be NULL
+///
+/// @returns false in case of an error.
+static bool unserialize_state(bufinfo_T *bi, size_t hash_len, undostate_T *st,
+                              const char *file_name)
+  FUNC_ATTR_NONNULL_ALL
+{
+  if (!undo_read(bi, st->us_hash, hash_len)) {
+    corruption_error("hash", file_name);
+    return false;
+  }
+  st->us_line_count = (linenr_T)undo_read_4c(bi);
+
+  // Read undo data for "U" command.
+  int str_len = undo_read_4c(bi);
+  if (str_len < 0) {
+    return false;
+  }
+  if (str_len > 0) {
+    st->us_line_ptr = undo_read_string(bi, (size_t)str_len);
+  }
+  st->us_line_lnum = (linenr_T)undo_read_4c(bi);
+  st->us_line_colnr = (colnr_T)undo_read_4c(bi);
+  if (st->us_line_lnum < 0 || st->us_line_colnr < 0) {
+    corruption_error("line lnum/col", file_name);
+    return false;
+  }
+
+  // Begin general undo data
+  st->us_old_seq = undo_read_4c(bi);
+  st->us_new_seq = undo_read_4c(bi);
+  st->us_cur_seq = undo_read_4c(bi);
+  st->us_num_head = undo_read_4c(bi);
+  st->us_seq_last = undo_read_4c(bi);
+  st->us_seq_cur = undo_read_4c(bi);
+  st->us_time = undo_read_time(bi);
+
+  // Optional header fields.
+  st->us_save_nr = 0;
+  for (;;) {
+    int len = undo_read_byte(bi);
+
+    if (len == 0 || len == EOF) {
+      break;
+    }
+    int what = undo_read_byte(bi);
+    switch (what) {
+    case UF_LAST_SAVE_NR:
+      st->us_save_nr = undo_read_4c(bi);
+      break;
 
+    default:
+      // field not supported, skip
+      while (--len >= 0) {
+        (void)undo_read_byte(bi);
+      }
+    }
+  }
   return true;
 }
 
@@ -874,13 +1134,9 @@ static bool serialize_uhp(bufinfo_T *bi, u_header_T *uhp)
   undo_write_bytes(bi, 0, 1);
 
   // Write all the entries.
-  for (u_entry_T *uep = uhp->uh_entry; uep; uep = uep->ue_next) {
-    undo_write_bytes(bi, (uintmax_t)UF_ENTRY_MAGIC, 2);
-    if (!serialize_uep(bi, uep)) {
-      return false;
-    }
+  if (!serialize_entries(bi, uhp)) {
+    return false;
   }
-  undo_write_bytes(bi, (uintmax_t)UF_ENTRY_END_MAGIC, 2);
 
   // Write all extmark undo objects
   for (size_t i = 0; i < kv_size(uhp->uh_extmark); i++) {
@@ -893,6 +1149,66 @@ static bool serialize_uhp(bufinfo_T *bi, u_header_T *uhp)
   return true;
 }
 
+/// Writes the entries of an undo header.  When they were moved to the spill
+/// file they are copied from there, it uses the same format.
+///
+/// @returns false in case of an error.
+static bool serialize_entries(bufinfo_T *bi, u_header_T *uhp)
+{
+  if (uhp->uh_spill_len > 0) {
+    FILE *spill_fp = bi->bi_buf->b_u_spill.sp_fp;
+    if (vim_fseek(spill_fp, (off_T)uhp->uh_spill_off, SEEK_SET) != 0) {
+      return false;
+    }
+    uint8_t copybuf[8192];
+    for (size_t todo = uhp->uh_spill_len; todo > 0;) {
+      size_t n = MIN(todo, sizeof(copybuf));
+      if (fread(copybuf, n, 1, spill_fp) != 1 || !undo_write(bi, copybuf, n)) {
+        return false;
+      }
+      todo -= n;
+    }
+    return true;
+  }
+
+  for (u_entry_T *uep = uhp->uh_entry; uep; uep = uep->ue_next) {
+    undo_write_bytes(bi, (uintmax_t)((uep->ue_flags & UE_DELTA)
+                                     ? UF_ENTRY_DELTA_MAGIC : UF_ENTRY_MAGIC), 2);
+    if (!serialize_uep(bi, uep)) {
+      return false;
+    }
+  }
+  return undo_write_bytes(bi, (uintmax_t)UF_ENTRY_END_MAGIC, 2);
+}
+
+/// Reads the entries of an undo header written by serialize_entries().
+/// What was read is in "uhp->uh_entry" also in case of an error.
+///
+/// @returns false in case of an error.
+static bool unserialize_entries(bufinfo_T *bi, u_header_T *uhp, const char *file_name)
+{
+  u_entry_T *last_uep = NULL;
+  int c;
+  while ((c = undo_read_2c(bi)) == UF_ENTRY_MAGIC || c == UF_ENTRY_DELTA_MAGIC) {
+    bool error = false;
+    u_entry_T *uep = unserialize_uep(bi, c == UF_ENTRY_DELTA_MAGIC, &error, file_name);
+    if (last_uep == NULL) {
+      uhp->uh_entry = uep;
+    } else {
+      last_uep->ue_next = uep;
+    }
+    last_uep = uep;
+    if (uep == NULL || error) {
+      return false;
+    }
+  }
+  if (c != UF_ENTRY_END_MAGIC) {
+    corruption_error("entry end", file_name);
+    return false;
+  }
+  return true;
+}
+
 static u_header_T *unserialize_uhp(bufinfo_T *bi, const char *file_name)
 {
   u_header_T *uhp = xmalloc(sizeof(u_header_T));
@@ -948,30 +1264,14 @@ static u_header_T *unserialize_uhp(bufinfo_T *bi, const char *file_name)
   }
 
   // Unserialize the uep list.
-  u_entry_T *last_uep = NULL;
-  int c;
-  while ((c = undo_read_2c(bi)) == UF_ENTRY_MAGIC) {
-    bool error = false;
-    u_entry_T *uep = unserialize_uep(bi, &error, file_name);
-    if (last_uep == NULL) {
-      uhp->uh_entry = uep;
-    } else {
-      last_uep->ue_next = uep;
-    }
-    last_uep = uep;
-    if (uep == NULL || error) {
-      u_free_uhp(uhp);
-      return NULL;
-    }
-  }
-  if (c != UF_ENTRY_END_MAGIC) {
-    corruption_error("entry end", file_name);
+  if (!unserialize_entries(bi, uhp, file_name)) {
     u_free_uhp(uhp);
     return NULL;
   }
 
   // Unserialize all extmark undo information
   ExtmarkUndoObject *extup;
+  int c;
   kv_init(uhp->uh_extmark);
 
   while ((c = undo_read_2c(bi)) == UF_ENTRY_MAGIC) {
@@ -1068,6 +1368,10 @@ static bool serialize_uep(bufinfo_T *bi, u_entry_T *uep)
   undo_write_bytes(bi, (uintmax_t)uep->ue_bot, 4);
   undo_write_bytes(bi, (uintmax_t)uep->ue_lcount, 4);
   undo_write_bytes(bi, (uintmax_t)uep->ue_size, 4);
+  if (uep->ue_flags & UE_DELTA) {
+    undo_write_bytes(bi, (uintmax_t)uep->ue_prefix, 4);
+    undo_write_bytes(bi, (uintmax_t)uep->ue_suffix, 4);
+  }
 
   for (size_t i = 0; i < (size_t)uep->ue_size; i++) {
     size_t len = STRLEN(uep->ue_array[i]);
@@ -1081,7 +1385,8 @@ static bool serialize_uep(bufinfo_T *bi, u_entry_T *uep)
   return true;
 }
 
-static u_entry_T *unserialize_uep(bufinfo_T *bi, bool *error, const char *file_name)
+/// @param delta  Read a UE_DELTA entry.
+static u_entry_T *unserialize_uep(bufinfo_T *bi, bool delta, bool *error, const char *file_name)
 {
   u_entry_T *uep = xmalloc(sizeof(u_entry_T));
   memset(uep, 0, sizeof(u_entry_T));
@@ -1092,6 +1397,17 @@ static u_entry_T *unserialize_uep(bufinfo_T *bi, bool *error, const char *file_n
   uep->ue_bot = undo_read_4c(bi);
   uep->ue_lcount = undo_read_4c(bi);
   uep->ue_size = undo_read_4c(bi);
+  if (delta) {
+    uep->ue_flags = UE_DELTA;
+    uep->ue_prefix = undo_read_4c(bi);
+    uep->ue_suffix = undo_read_4c(bi);
+    if (uep->ue_size != 1 || uep->ue_prefix < 0 || uep->ue_suffix < 0) {
+      corruption_error("delta entry", file_name);
+      *error = true;
+      uep->ue_size = 0;
+      return uep;
+    }
+  }
 
   char_u **array = NULL;
   if (uep->ue_size > 0) {
@@ -1117,6 +1433,9 @@ static u_entry_T *unserialize_uep(bufinfo_T *bi, bool *error, const char *file_n
     }
     array[i] = line;
   }
+  if (uep->ue_size > 1) {
+    u_pack_entry(uep);
+  }
   return uep;
 }
 
@@ -1163,6 +1482,22 @@ static void unserialize_visualinfo(bufinfo_T *bi, visualinfo_T *info)
   info->vi_curswant = undo_read_4c(bi);
 }
 
+/// Check whether the changes to the undo tree of "buf" can be appended to
+/// "file_name": it must be the undo file last written or read for "buf",
+/// unchanged since then and not mostly superseded records.
+static bool u_can_append(buf_T *buf, const char *file_name)
+  FUNC_ATTR_NONNULL_ALL
+{
+  const undofile_T *uf = &buf->b_u_file;
+  FileInfo file_info;
+
+  return uf->uf_size > 0
+         && uf->uf_dead * UF_COMPACT_RATIO <= uf->uf_size
+         && os_fileinfo_link(file_name, &file_info)
+         && os_fileid_equal_fileinfo(&uf->uf_id, &file_info)
+         && os_fileinfo_size(&file_info) == uf->uf_size;
+}
+
 /// Write the undo tree in an undo file.
 ///
 /// @param[in]  name  Name of the undo file or NULL if this function needs to
@@ -1184,6 +1519,10 @@ void u_write_undo(const char *const name, const bool forceit, buf_T *const buf,
   FILE *fp = NULL;
   int perm;
   bool write_ok = false;
+  bool append = false;
+  uint64_t dead = 0;
+  uint64_t state_start = 0;
+  const uint64_t old_size = buf->b_u_file.uf_size;  // valid part when appending
   bufinfo_T bi;
 
   if (name == NULL) {
@@ -1216,9 +1555,14 @@ void u_write_undo(const char *const name, const bool forceit, buf_T *const buf,
   // Strip any sticky and executable bits.
   perm = perm & 0666;
 
+  // Only add the changed headers to the undo file that was written before.
+  if (name == NULL && (buf->b_u_numhead > 0 || buf->b_u_line_ptr != NULL)) {
+    append = u_can_append(buf, file_name);
+  }
+
   // If the undo file already exists, verify that it actually is an undo
   // file, and delete it.
-  if (os_path_exists((char_u *)file_name)) {
+  if (!append && os_path_exists((char_u *)file_name)) {
     if (name == NULL || !forceit) {
       // Check we can read it and it's an undo file.
       fd = os_open(file_name, O_RDONLY, 0);
@@ -1266,15 +1610,22 @@ void u_write_undo(const char *const name, const bool forceit, buf_T *const buf,
     goto theend;
   }
 
-  fd = os_open(file_name, O_CREAT|O_WRONLY|O_EXCL|O_NOFOLLOW, perm);
+  if (append) {
+    fd = os_open(file_name, O_WRONLY|O_APPEND|O_NOFOLLOW, 0);
+  } else {
+    fd = os_open(file_name, O_CREAT|O_WRONLY|O_EXCL|O_NOFOLLOW, perm);
+  }
   if (fd < 0) {
     semsg(_(e_not_open), file_name);
     goto theend;
   }
-  (void)os_setperm(file_name, perm);
+  if (!append) {
+    (void)os_setperm(file_name, perm);
+  }
   if (p_verbose > 0) {
     verbose_enter();
-    smsg(_("Writing undo file: %s"), file_name);
+    smsg(append ? _("Appending to undo file: %s") : _("Writing undo file: %s"),
+         file_name);
     verbose_leave();
   }
 
@@ -1291,7 +1642,7 @@ void u_write_undo(const char *const name, const bool forceit, buf_T *const buf,
    */
   FileInfo file_info_old;
   FileInfo file_info_new;
-  if (buf->b_ffname != NULL
+  if (!append && buf->b_ffname != NULL
       && os_fileinfo((char *)buf->b_ffname, &file_info_old)
       && os_fileinfo(file_name, &file_info_new)
       && file_info_old.stat.st_gid != file_info_new.stat.st_gid
@@ -1300,11 +1651,13 @@ void u_write_undo(const char *const name, const bool forceit, buf_T *const buf,
   }
 #endif
 
-  fp = fdopen(fd, "w");
+  fp = fdopen(fd, append ? "a" : "w");
   if (fp == NULL) {
     semsg(_(e_not_open), file_name);
     close(fd);
-    os_remove(file_name);
+    if (!append) {
+      os_remove(file_name);
+    }
     goto theend;
   }
 
@@ -1316,12 +1669,15 @@ void u_write_undo(const char *const name, const bool forceit, buf_T *const buf,
    */
   bi.bi_buf = buf;
   bi.bi_fp = fp;
-  if (!serialize_header(&bi, hash)) {
+  bi.bi_written = 0;
+  if (!append && !serialize_header(&bi)) {
     goto write_error;
   }
 
   /*
    * Iteratively serialize UHPs and their UEPs from the top down.
+   * When appending only the ones that changed since they were written, the
+   * record for a header replaces the one before it.
    */
   mark = ++lastmark;
   uhp = buf->b_u_oldhead;
@@ -1332,8 +1688,14 @@ void u_write_undo(const char *const name, const bool forceit, buf_T *const buf,
 #ifdef U_DEBUG
       ++headers_written;
 #endif
-      if (!serialize_uhp(&bi, uhp)) {
-        goto write_error;
+      if (!append || uhp->uh_dirty || uhp->uh_filesize == 0) {
+        uint64_t start = bi.bi_written;
+        if (!serialize_uhp(&bi, uhp)) {
+          goto write_error;
+        }
+        dead += uhp->uh_filesize;
+        uhp->uh_filesize = (size_t)(bi.bi_written - start);
+        uhp->uh_dirty = false;
       }
     }
 
@@ -1353,7 +1715,8 @@ void u_write_undo(const char *const name, const bool forceit, buf_T *const buf,
     }
   }
 
-  if (undo_write_bytes(&bi, (uintmax_t)UF_HEADER_END_MAGIC, 2)) {
+  state_start = bi.bi_written;
+  if (serialize_state(&bi, hash) && fflush(fp) == 0) {
     write_ok = true;
   }
 #ifdef U_DEBUG
@@ -1364,8 +1727,31 @@ void u_write_undo(const char *const name, const bool forceit, buf_T *const buf,
 #endif
 
 write_error:
+  if (write_ok) {
+    FileInfo file_info;
+    undofile_T *uf = &buf->b_u_file;
+    if (os_fileinfo_fd(fileno(fp), &file_info)) {
+      os_fileinfo_id(&file_info, &uf->uf_id);
+      uf->uf_size = os_fileinfo_size(&file_info);
+      uf->uf_dead = append ? uf->uf_dead + dead + uf->uf_state : 0;
+      uf->uf_state = bi.bi_written - state_start;
+    } else {
+      uf->uf_size = 0;
+    }
+  } else {
+    // Write it from scratch next time.
+    buf->b_u_file.uf_size = 0;
+  }
   fclose(fp);
   if (!write_ok) {
+    if (append) {
+      // Remove what was appended, the records before it are still valid.
+      fd = os_open(file_name, O_WRONLY|O_NOFOLLOW, 0);
+      if (fd >= 0) {
+        (void)os_ftruncate(fd, old_size);
+        close(fd);
+      }
+    }
     semsg(_("E829: write error in undo file: %s"), file_name);
   }
 
@@ -1394,8 +1780,9 @@ theend:
 void u_read_undo(char *name, const char_u *hash, const char_u *orig_name FUNC_ATTR_UNUSED)
   FUNC_ATTR_NONNULL_ARG(2)
 {
-  u_header_T **uhp_table = NULL;
-  char_u *line_ptr = NULL;
+  PMap(uint64_t) headers = MAP_INIT;
+  undostate_T state = { 0 };
+  long num_read_uhps = 0;
 
   char *file_name;
   if (name == NULL) {
@@ -1443,6 +1830,7 @@ void u_read_undo(char *name, const char_u *hash, const char_u *orig_name FUNC_AT
   bufinfo_T bi;
   bi.bi_buf = curbuf;
   bi.bi_fp = fp;
+  bi.bi_written = 0;
 
   // Read the undo file header.
   char_u magic_buf[UF_START_MAGIC_LEN];
@@ -1452,214 +1840,206 @@ void u_read_undo(char *name, const char_u *hash, const char_u *orig_name FUNC_AT
     goto error;
   }
   int version = get2c(fp);
-  if (version != UF_VERSION) {
+  if (version != UF_VERSION && version != UF_VERSION_SHA256) {
     semsg(_("E824: Incompatible undo file: %s"), file_name);
     goto error;
   }
 
-  char_u read_hash[UNDO_HASH_SIZE];
-  if (!undo_read(&bi, read_hash, UNDO_HASH_SIZE)) {
-    corruption_error("hash", file_name);
-    goto error;
-  }
-  linenr_T line_count = (linenr_T)undo_read_4c(&bi);
-  if (memcmp(hash, read_hash, UNDO_HASH_SIZE) != 0
-      || line_count != curbuf->b_ml.ml_line_count) {
-    if (p_verbose > 0 || name != NULL) {
-      if (name == NULL) {
-        verbose_enter();
-      }
-      give_warning((char_u *)
-                   _("File contents changed, cannot use undo info"), true);
-      if (name == NULL) {
-        verbose_leave();
-      }
+  int c;
+  uint64_t state_size = 0;
+  uint64_t valid_end = 0;      // end of the last complete state record
+  if (version == UF_VERSION_SHA256) {
+    // Older undo file: the state is in the header, then all undo headers
+    // follow.
+    if (!unserialize_state(&bi, UF_SHA256_SIZE, &state, file_name)) {
+      goto error;
     }
-    goto error;
-  }
-
-  // Read undo data for "U" command.
-  int str_len = undo_read_4c(&bi);
-  if (str_len < 0) {
-    goto error;
-  }
-
-  if (str_len > 0) {
-    line_ptr = undo_read_string(&bi, (size_t)str_len);
-  }
-  linenr_T line_lnum = (linenr_T)undo_read_4c(&bi);
-  colnr_T line_colnr = (colnr_T)undo_read_4c(&bi);
-  if (line_lnum < 0 || line_colnr < 0) {
-    corruption_error("line lnum/col", file_name);
-    goto error;
-  }
-
-  // Begin general undo data
-  int old_header_seq = undo_read_4c(&bi);
-  int new_header_seq = undo_read_4c(&bi);
-  int cur_header_seq = undo_read_4c(&bi);
-  int num_head = undo_read_4c(&bi);
-  int seq_last = undo_read_4c(&bi);
-  int seq_cur = undo_read_4c(&bi);
-  time_t seq_time = undo_read_time(&bi);
-
-  // Optional header fields.
-  long last_save_nr = 0;
-  for (;;) {
-    int len = undo_read_byte(&bi);
-
-    if (len == 0 || len == EOF) {
-      break;
+    char_u sha256[UF_SHA256_SIZE];
+    u_compute_sha256(curbuf, sha256);
+    if (memcmp(sha256, state.us_hash, UF_SHA256_SIZE) != 0
+        || state.us_line_count != curbuf->b_ml.ml_line_count) {
+      goto changed;
     }
-    int what = undo_read_byte(&bi);
-    switch (what) {
-    case UF_LAST_SAVE_NR:
-      last_save_nr = undo_read_4c(&bi);
-      break;
 
-    default:
-      // field not supported, skip
-      while (--len >= 0) {
-        (void)undo_read_byte(&bi);
+    while ((c = undo_read_2c(&bi)) == UF_HEADER_MAGIC) {
+      if (num_read_uhps >= state.us_num_head) {
+        corruption_error("num_head too small", file_name);
+        goto error;
       }
-    }
-  }
 
-  // uhp_table will store the freshly created undo headers we allocate
-  // until we insert them into curbuf. The table remains sorted by the
-  // sequence numbers of the headers.
-  // When there are no headers uhp_table is NULL.
-  if (num_head > 0) {
-    if ((size_t)num_head < SIZE_MAX / sizeof(*uhp_table)) {  // -V547
-      uhp_table = xmalloc((size_t)num_head * sizeof(*uhp_table));
+      u_header_T *uhp = unserialize_uhp(&bi, file_name);
+      if (uhp == NULL) {
+        goto error;
+      }
+      u_header_T *old = pmap_put(uint64_t)(&headers, (uint64_t)uhp->uh_seq, uhp);
+      if (old != NULL) {
+        u_free_uhp(old);
+        corruption_error("duplicate uh_seq", file_name);
+        goto error;
+      }
+      num_read_uhps++;
     }
-  }
-
-  long num_read_uhps = 0;
 
-  int c;
-  while ((c = undo_read_2c(&bi)) == UF_HEADER_MAGIC) {
-    if (num_read_uhps >= num_head) {
-      corruption_error("num_head too small", file_name);
+    if (num_read_uhps != state.us_num_head) {
+      corruption_error("num_head", file_name);
       goto error;
     }
-
-    u_header_T *uhp = unserialize_uhp(&bi, file_name);
-    if (uhp == NULL) {
+    if (c != UF_HEADER_END_MAGIC) {
+      corruption_error("end marker", file_name);
       goto error;
     }
-    uhp_table[num_read_uhps++] = uhp;
-  }
-
-  if (num_read_uhps != num_head) {
-    corruption_error("num_head", file_name);
-    goto error;
-  }
-  if (c != UF_HEADER_END_MAGIC) {
-    corruption_error("end marker", file_name);
-    goto error;
-  }
-
-#ifdef U_DEBUG
-  size_t amount = num_head * sizeof(int) + 1;
-  int *uhp_table_used = xmalloc(amount);
-  memset(uhp_table_used, 0, amount);
-# define SET_FLAG(j) ++uhp_table_used[j]
-#else
-# define SET_FLAG(j)
-#endif
-
-  // We have put all of the headers into a table. Now we iterate through the
-  // table and swizzle each sequence number we have stored in uh_*_seq into
-  // a pointer corresponding to the header with that sequence number.
-  short old_idx = -1, new_idx = -1, cur_idx = -1;
-  for (int i = 0; i < num_head; i++) {
-    u_header_T *uhp = uhp_table[i];
-    if (uhp == NULL) {
-      continue;
-    }
-    for (int j = 0; j < num_head; j++) {
-      if (uhp_table[j] != NULL && i != j
-          && uhp_table[i]->uh_seq == uhp_table[j]->uh_seq) {
-        corruption_error("duplicate uh_seq", file_name);
-        goto error;
-      }
-    }
-    for (int j = 0; j < num_head; j++) {
-      if (uhp_table[j] != NULL
-          && uhp_table[j]->uh_seq == uhp->uh_next.seq) {
-        uhp->uh_next.ptr = uhp_table[j];
-        SET_FLAG(j);
+  } else {
+    // Undo headers and states were appended each time the file was written.
+    // The last record for a header and the last state are the valid ones.
+    // Headers only count once the state written after them was read: when
+    // writing was interrupted the file can end in headers without a state or
+    // in a partial record, that part is ignored.
+    kvec_t(u_header_T *) pending = KV_INITIAL_VALUE;
+    bool have_state = false;
+    long pos = ftell(fp);
+    emsg_silent++;
+    while ((c = undo_read_2c(&bi)) != -1) {
+      if (c == UF_HEADER_MAGIC) {
+        u_header_T *uhp = unserialize_uhp(&bi, file_name);
+        if (uhp == NULL || feof(fp)) {
+          if (uhp != NULL) {
+            u_free_uhp(uhp);
+          }
+          break;
+        }
+        uhp->uh_filesize = (size_t)(ftell(fp) - pos);
+        kv_push(pending, uhp);
+      } else if (c == UF_STATE_MAGIC) {
+        undostate_T st = { 0 };
+        if (!unserialize_state(&bi, UNDO_HASH_SIZE, &st, file_name) || feof(fp)) {
+          xfree(st.us_line_ptr);
+          break;
+        }
+        xfree(state.us_line_ptr);
+        state = st;
+        state_size = (uint64_t)(ftell(fp) - pos);
+        for (size_t i = 0; i < kv_size(pending); i++) {
+          u_header_T *uhp = kv_A(pending, i);
+          u_header_T *old = pmap_put(uint64_t)(&headers, (uint64_t)uhp->uh_seq, uhp);
+          if (old != NULL) {
+            u_free_uhp(old);
+          }
+        }
+        kv_size(pending) = 0;
+        have_state = true;
+        valid_end = (uint64_t)ftell(fp);
+      } else {
         break;
       }
+      pos = ftell(fp);
     }
-    for (int j = 0; j < num_head; j++) {
-      if (uhp_table[j] != NULL
-          && uhp_table[j]->uh_seq == uhp->uh_prev.seq) {
-        uhp->uh_prev.ptr = uhp_table[j];
-        SET_FLAG(j);
-        break;
-      }
+    emsg_silent--;
+    for (size_t i = 0; i < kv_size(pending); i++) {
+      u_free_uhp(kv_A(pending, i));
     }
-    for (int j = 0; j < num_head; j++) {
-      if (uhp_table[j] != NULL
-          && uhp_table[j]->uh_seq == uhp->uh_alt_next.seq) {
-        uhp->uh_alt_next.ptr = uhp_table[j];
-        SET_FLAG(j);
-        break;
-      }
+    kv_destroy(pending);
+    if (!have_state) {
+      corruption_error("truncated", file_name);
+      goto error;
+    }
+    if (memcmp(hash, state.us_hash, UNDO_HASH_SIZE) != 0
+        || state.us_line_count != curbuf->b_ml.ml_line_count) {
+      goto changed;
     }
-    for (int j = 0; j < num_head; j++) {
-      if (uhp_table[j] != NULL
-          && uhp_table[j]->uh_seq == uhp->uh_alt_prev.seq) {
-        uhp->uh_alt_prev.ptr = uhp_table[j];
-        SET_FLAG(j);
+  }
+
+  // Swizzle each sequence number we have stored in uh_*_seq into a pointer
+  // corresponding to the header with that sequence number.
+  u_header_T *uhp;
+  map_foreach_value(&headers, uhp, {
+    uhp->uh_next.ptr = pmap_get(uint64_t)(&headers, (uint64_t)uhp->uh_next.seq);
+    uhp->uh_prev.ptr = pmap_get(uint64_t)(&headers, (uint64_t)uhp->uh_prev.seq);
+    uhp->uh_alt_next.ptr = pmap_get(uint64_t)(&headers, (uint64_t)uhp->uh_alt_next.seq);
+    uhp->uh_alt_prev.ptr = pmap_get(uint64_t)(&headers, (uint64_t)uhp->uh_alt_prev.seq);
+  });
+  u_header_T *old_head = pmap_get(uint64_t)(&headers, (uint64_t)state.us_old_seq);
+  u_header_T *new_head = pmap_get(uint64_t)(&headers, (uint64_t)state.us_new_seq);
+  u_header_T *cur_head = pmap_get(uint64_t)(&headers, (uint64_t)state.us_cur_seq);
+
+  // Walk through the tree, like in u_write_undo().  Headers that are not
+  // found were freed after they were appended to the file.
+  int mark = ++lastmark;
+  int num_head = 0;
+  uint64_t live = UF_START_MAGIC_LEN + 2 + state_size;
+  size_t mem = 0;
+  uhp = old_head;
+  while (uhp != NULL) {
+    if (uhp->uh_walk != mark) {
+      uhp->uh_walk = mark;
+      live += uhp->uh_filesize;
+      uhp->uh_mem = u_entries_mem_size(uhp);
+      mem += uhp->uh_mem;
+      if (++num_head > state.us_num_head) {
         break;
       }
     }
-    if (old_header_seq > 0 && old_idx < 0 && uhp->uh_seq == old_header_seq) {
-      assert(i <= SHRT_MAX);
-      old_idx = (short)i;
-      SET_FLAG(i);
-    }
-    if (new_header_seq > 0 && new_idx < 0 && uhp->uh_seq == new_header_seq) {
-      assert(i <= SHRT_MAX);
-      new_idx = (short)i;
-      SET_FLAG(i);
-    }
-    if (cur_header_seq > 0 && cur_idx < 0 && uhp->uh_seq == cur_header_seq) {
-      assert(i <= SHRT_MAX);
-      cur_idx = (short)i;
-      SET_FLAG(i);
+
+    if (uhp->uh_prev.ptr != NULL && uhp->uh_prev.ptr->uh_walk != mark) {
+      uhp = uhp->uh_prev.ptr;
+    } else if (uhp->uh_alt_next.ptr != NULL
+               && uhp->uh_alt_next.ptr->uh_walk != mark) {
+      uhp = uhp->uh_alt_next.ptr;
+    } else if (uhp->uh_next.ptr != NULL && uhp->uh_alt_prev.ptr == NULL
+               && uhp->uh_next.ptr->uh_walk != mark) {
+      uhp = uhp->uh_next.ptr;
+    } else if (uhp->uh_alt_prev.ptr != NULL) {
+      uhp = uhp->uh_alt_prev.ptr;
+    } else {
+      uhp = uhp->uh_next.ptr;
     }
   }
+  if (num_head != state.us_num_head) {
+    corruption_error("num_head", file_name);
+    goto error;
+  }
 
   // Now that we have read the undo info successfully, free the current undo
   // info and use the info from the file.
   u_blockfree(curbuf);
-  curbuf->b_u_oldhead = old_idx < 0 ? NULL : uhp_table[old_idx];
-  curbuf->b_u_newhead = new_idx < 0 ? NULL : uhp_table[new_idx];
-  curbuf->b_u_curhead = cur_idx < 0 ? NULL : uhp_table[cur_idx];
-  curbuf->b_u_line_ptr = line_ptr;
-  curbuf->b_u_line_lnum = line_lnum;
-  curbuf->b_u_line_colnr = line_colnr;
+  curbuf->b_u_oldhead = old_head;
+  curbuf->b_u_newhead = new_head;
+  curbuf->b_u_curhead = cur_head;
+  curbuf->b_u_line_ptr = state.us_line_ptr;
+  curbuf->b_u_line_lnum = state.us_line_lnum;
+  curbuf->b_u_line_colnr = state.us_line_colnr;
   curbuf->b_u_numhead = num_head;
-  curbuf->b_u_seq_last = seq_last;
-  curbuf->b_u_seq_cur = seq_cur;
-  curbuf->b_u_time_cur = seq_time;
-  curbuf->b_u_save_nr_last = last_save_nr;
-  curbuf->b_u_save_nr_cur = last_save_nr;
+  curbuf->b_u_seq_last = state.us_seq_last;
+  curbuf->b_u_seq_cur = state.us_seq_cur;
+  curbuf->b_u_time_cur = state.us_time;
+  curbuf->b_u_save_nr_last = state.us_save_nr;
+  curbuf->b_u_save_nr_cur = state.us_save_nr;
 
   curbuf->b_u_synced = true;
-  xfree(uhp_table);
+  curbuf->b_u_mem = mem;
+  u_mem_total += mem;
+
+  // Later changes to the undo tree can be appended to the file.  Older
+  // files, and files with an incomplete end, are written from scratch.
+  CLEAR_POINTER(&curbuf->b_u_file);
+  FileInfo file_info;
+  if (version == UF_VERSION && os_fileinfo_fd(fileno(fp), &file_info)
+      && os_fileinfo_size(&file_info) == valid_end) {
+    os_fileinfo_id(&file_info, &curbuf->b_u_file.uf_id);
+    curbuf->b_u_file.uf_size = os_fileinfo_size(&file_info);
+    curbuf->b_u_file.uf_dead = curbuf->b_u_file.uf_size > live
+                               ? curbuf->b_u_file.uf_size - live : 0;
+    curbuf->b_u_file.uf_state = state_size;
+  }
+
+  map_foreach_value(&headers, uhp, {
+    if (uhp->uh_walk != mark) {
+      u_free_uhp(uhp);
+    }
+  });
+  map_destroy(uint64_t, ptr_t)(&headers);
+  u_check_mem(curbuf);
 
 #ifdef U_DEBUG
-  for (int i = 0; i < num_head; i++) {
-    if (uhp_table_used[i] == 0) {
-      semsg("uhp_table entry %" PRId64 " not used, leaking memory", (int64_t)i);
-    }
-  }
-  xfree(uhp_table_used);
   u_check(TRUE);
 #endif
 
@@ -1668,17 +2048,25 @@ void u_read_undo(char *name, const char_u *hash, const char_u *orig_name FUNC_AT
   }
   goto theend;
 
-error:
-  xfree(line_ptr);
-  if (uhp_table != NULL) {
-    for (long i = 0; i < num_read_uhps; i++) {
-      if (uhp_table[i] != NULL) {
-        u_free_uhp(uhp_table[i]);
-      }
+changed:
+  if (p_verbose > 0 || name != NULL) {
+    if (name == NULL) {
+      verbose_enter();
+    }
+    give_warning((char_u *)
+                 _("File contents changed, cannot use undo info"), true);
+    if (name == NULL) {
+      verbose_leave();
     }
-    xfree(uhp_table);
   }
 
+error:
+  xfree(state.us_line_ptr);
+  map_foreach_value(&headers, uhp, {
+    u_free_uhp(uhp);
+  });
+  map_destroy(uint64_t, ptr_t)(&headers);
+
 theend:
   if (fp != NULL) {
     fclose(fp);
@@ -1698,7 +2086,11 @@ theend:
 static bool undo_write(bufinfo_T *bi, uint8_t *ptr, size_t len)
   FUNC_ATTR_NONNULL_ARG(1)
 {
-  return fwrite(ptr, len, 1, bi->bi_fp) == 1;
+  if (fwrite(ptr, len, 1, bi->bi_fp) != 1) {
+    return false;
+  }
+  bi->bi_written += len;
+  return true;
 }
 
 /// Writes a number, most significant bit first, in "len" bytes.
@@ -1849,6 +2241,7 @@ bool u_undo_and_forget(int count)
   if (curbuf->b_u_curhead) {
     to_forget->uh_alt_next.ptr = NULL;
     curbuf->b_u_curhead->uh_alt_prev.ptr = to_forget->uh_alt_prev.ptr;
+    u_header_changed(curbuf->b_u_curhead);
     curbuf->b_u_seq_cur = curbuf->b_u_curhead->uh_next.ptr ?
                           curbuf->b_u_curhead->uh_next.ptr->uh_seq : 0;
   } else if (curbuf->b_u_newhead) {
@@ -1856,9 +2249,11 @@ bool u_undo_and_forget(int count)
   }
   if (to_forget->uh_alt_prev.ptr) {
     to_forget->uh_alt_prev.ptr->uh_alt_next.ptr = curbuf->b_u_curhead;
+    u_header_changed(to_forget->uh_alt_prev.ptr);
   }
   if (curbuf->b_u_newhead) {
     curbuf->b_u_newhead->uh_prev.ptr = curbuf->b_u_curhead;
+    u_header_changed(curbuf->b_u_newhead);
   }
   if (curbuf->b_u_seq_last == to_forget->uh_seq) {
     curbuf->b_u_seq_last--;
@@ -1893,6 +2288,7 @@ static void u_doit(int startcount, bool quiet, bool do_buf_event)
     change_warning(curbuf, 0);
 
     if (undo_undoes) {
+      u_header_T *const prev_curhead = curbuf->b_u_curhead;
       if (curbuf->b_u_curhead == NULL) {  // first undo
         curbuf->b_u_curhead = curbuf->b_u_newhead;
       } else if (get_undolevel(curbuf) > 0) {  // multi level undo
@@ -1911,7 +2307,10 @@ static void u_doit(int startcount, bool quiet, bool do_buf_event)
         break;
       }
 
-      u_undoredo(true, do_buf_event);
+      if (!u_undoredo(true, do_buf_event)) {
+        curbuf->b_u_curhead = prev_curhead;
+        break;
+      }
     } else {
       if (curbuf->b_u_curhead == NULL || get_undolevel(curbuf) <= 0) {
         beep_flush();  // nothing to redo
@@ -1922,7 +2321,9 @@ static void u_doit(int startcount, bool quiet, bool do_buf_event)
         break;
       }
 
-      u_undoredo(false, do_buf_event);
+      if (!u_undoredo(false, do_buf_event)) {
+        break;
+      }
 
       // Advance for next redo.  Set "newhead" when at the end of the
       // redoable changes.
@@ -1932,6 +2333,8 @@ static void u_doit(int startcount, bool quiet, bool do_buf_event)
       curbuf->b_u_curhead = curbuf->b_u_curhead->uh_prev.ptr;
     }
   }
+  // Move what was read back from the spill file out of memory again.
+  u_check_mem(curbuf);
   u_undo_end(undo_undoes, false, quiet);
 }
 
@@ -1958,6 +2361,7 @@ void undo_time(long step, bool sec, bool file, bool absolute)
   bool dofile = file;
   bool above = false;
   bool did_undo = true;
+  bool failed = false;          // entries of a header could not be read
 
   // First make sure the current undoable change is synced.
   if (curbuf->b_u_synced == false) {
@@ -2181,15 +2585,20 @@ target_zero:
           || (uhp->uh_seq == target && !above)) {
         break;
       }
+      u_header_T *const prev_curhead = curbuf->b_u_curhead;
       curbuf->b_u_curhead = uhp;
-      u_undoredo(true, true);
+      if (!u_undoredo(true, true)) {
+        curbuf->b_u_curhead = prev_curhead;
+        failed = true;
+        break;
+      }
       if (target > 0) {
         uhp->uh_walk = nomark;          // don't go back down here
       }
     }
 
     // When back to origin, redo is not needed.
-    if (target > 0) {
+    if (target > 0 && !failed) {
       // And now go down the tree (redo), branching off where needed.
       while (!got_int) {
         // Do the change warning now, for the same reason as above.
@@ -2220,11 +2629,15 @@ target_zero:
           }
           if (last->uh_alt_next.ptr != NULL) {
             last->uh_alt_next.ptr->uh_alt_prev.ptr = last->uh_alt_prev.ptr;
+            u_header_changed(last->uh_alt_next.ptr);
           }
           last->uh_alt_prev.ptr->uh_alt_next.ptr = last->uh_alt_next.ptr;
+          u_header_changed(last->uh_alt_prev.ptr);
           last->uh_alt_prev.ptr = NULL;
           last->uh_alt_next.ptr = uhp;
           uhp->uh_alt_prev.ptr = last;
+          u_header_changed(last);
+          u_header_changed(uhp);
 
           if (curbuf->b_u_oldhead == uhp) {
             curbuf->b_u_oldhead = last;
@@ -2232,6 +2645,7 @@ target_zero:
           uhp = last;
           if (uhp->uh_next.ptr != NULL) {
             uhp->uh_next.ptr->uh_prev.ptr = uhp;
+            u_header_changed(uhp->uh_next.ptr);
           }
         }
         curbuf->b_u_curhead = uhp;
@@ -2247,7 +2661,9 @@ target_zero:
           break;
         }
 
-        u_undoredo(false, true);
+        if (!u_undoredo(false, true)) {
+          break;
+        }
 
         // Advance "curhead" to below the header we last used.  If it
         // becomes NULL then we need to set "newhead" to this leaf.
@@ -2270,6 +2686,9 @@ target_zero:
       }
     }
   }
+  // Move what was read back from the spill file out of memory again.  Not
+  // done while walking the tree above, it uses the marks as well.
+  u_check_mem(curbuf);
   u_undo_end(did_undo, absolute, false);
 }
 
@@ -2281,7 +2700,10 @@ target_zero:
 ///
 /// @param undo If `true`, go up the tree. Down if `false`.
 /// @param do_buf_event If `true`, send buffer updates.
-static void u_undoredo(int undo, bool do_buf_event)
+///
+/// @return  false when the entries could not be read back from the spill
+///          file, nothing was changed then.
+static bool u_undoredo(int undo, bool do_buf_event)
 {
   char_u **newarray = NULL;
   linenr_T oldsize;
@@ -2299,6 +2721,12 @@ static void u_undoredo(int undo, bool do_buf_event)
   bool empty_buffer;                        // buffer became empty
   u_header_T *curhead = curbuf->b_u_curhead;
 
+  // The entries are swapped with the text in the buffer.
+  if (!u_unspill(curbuf, curhead)) {
+    return false;
+  }
+  u_header_changed(curhead);
+
   // Don't want autocommands using the undo structures here, they are
   // invalid till the end.
   block_autocmds();
@@ -2334,11 +2762,17 @@ static void u_undoredo(int undo, bool do_buf_event)
       unblock_autocmds();
       iemsg(_("E438: u_undo: line numbers wrong"));
       changed();                // don't want UNCHANGED now
-      return;
+      return true;
     }
 
     oldsize = bot - top - 1;        // number of lines before undo
     newsize = uep->ue_size;         // number of lines after undo
+    if ((uep->ue_flags & UE_DELTA) && oldsize != 1) {
+      unblock_autocmds();
+      iemsg(_("E438: u_undo: line numbers wrong"));
+      changed();                // don't want UNCHANGED now
+      return true;
+    }
 
     if (top < newlnum) {
       /* If the saved cursor is somewhere in this undo block, move it to
@@ -2353,7 +2787,8 @@ static void u_undoredo(int undo, bool do_buf_event)
          * undoing auto-formatting puts the cursor in the previous
          * line. */
         for (i = 0; i < newsize && i < oldsize; ++i) {
-          if (STRCMP(uep->ue_array[i], ml_get(top + 1 + i)) != 0) {
+          if ((uep->ue_flags & UE_DELTA)
+              || STRCMP(uep->ue_array[i], ml_get(top + 1 + i)) != 0) {
             break;
           }
         }
@@ -2369,39 +2804,59 @@ static void u_undoredo(int undo, bool do_buf_event)
 
     empty_buffer = false;
 
-    // delete the lines between top and bot and save them in newarray
-    if (oldsize > 0) {
+    if (uep->ue_flags & UE_DELTA) {
+      // Only the changed part of the line was saved, exchange it with that
+      // part of the line in the buffer.
+      if (!u_delta_swap(uep, top + 1)) {
+        unblock_autocmds();
+        iemsg(_("E438: u_undo: line numbers wrong"));
+        changed();
+        return true;
+      }
+      newarray = uep->ue_array;
+    } else if (oldsize > 0) {
+      // save the lines between top and bot in newarray and delete them
       newarray = xmalloc(sizeof(char_u *) * (size_t)oldsize);
-      // delete backwards, it goes faster in most cases
       for (lnum = bot - 1, i = oldsize; --i >= 0; --lnum) {
-        // what can we do when we run out of memory?
         newarray[i] = u_save_line(lnum);
-        /* remember we deleted the last line in the buffer, and a
-         * dummy empty line will be inserted */
-        if (curbuf->b_ml.ml_line_count == 1) {
-          empty_buffer = true;
-        }
-        ml_delete(lnum, false);
       }
+      // remember we delete the last line in the buffer, and a dummy empty
+      // line will be inserted
+      if (oldsize >= curbuf->b_ml.ml_line_count) {
+        empty_buffer = true;
+      }
+      // whole data blocks at a time, it goes much faster for big changes
+      ml_delete_lines(top + 1, oldsize, false);
     } else {
       newarray = NULL;
     }
 
     // insert the lines in u_array between top and bot
-    if (newsize) {
-      for (lnum = top, i = 0; i < newsize; ++i, ++lnum) {
-        /*
-         * If the file is empty, there is an empty line 1 that we
-         * should get rid of, by replacing it with the new line
-         */
-        if (empty_buffer && lnum == 0) {
-          ml_replace((linenr_T)1, uep->ue_array[i], true);
-        } else {
-          ml_append(lnum, uep->ue_array[i], (colnr_T)0, false);
+    if (newsize && !(uep->ue_flags & UE_DELTA)) {
+      lnum = top;
+      i = 0;
+      // If the file is empty, there is an empty line 1 that we should get
+      // rid of, by replacing it with the new line.
+      if (empty_buffer && lnum == 0) {
+        ml_replace((linenr_T)1, uep->ue_array[0], true);
+        lnum++;
+        i++;
+      }
+      if (i < newsize) {
+        colnr_T *lens = xmalloc(sizeof(colnr_T) * (size_t)newsize);
+        for (long j = i; j < newsize; j++) {
+          lens[j] = (colnr_T)STRLEN(uep->ue_array[j]) + 1;
+        }
+        ml_append_lines(lnum, uep->ue_array + i, lens + i, (int)(newsize - i), false);
+        xfree(lens);
+      }
+      if (!(uep->ue_flags & UE_PACKED)) {
+        for (i = 0; i < newsize; i++) {
+          xfree(uep->ue_array[i]);
         }
-        xfree(uep->ue_array[i]);
       }
       xfree((char_u *)uep->ue_array);
+      uep->ue_flags &= ~UE_PACKED;
     }
 
     // Adjust marks
@@ -2433,6 +2888,7 @@ static void u_undoredo(int undo, bool do_buf_event)
     uep->ue_size = oldsize;
     uep->ue_array = newarray;
     uep->ue_bot = top + newsize + 1;
+    u_compact_entry(curbuf, uep);
 
     /*
      * insert this entry in front of the new entry list
@@ -2466,6 +2922,7 @@ static void u_undoredo(int undo, bool do_buf_event)
 
   curhead->uh_entry = newlist;
   curhead->uh_flags = new_flags;
+  u_account(curbuf, curhead);
   if ((old_flags & UH_EMPTYBUF) && buf_is_empty(curbuf)) {
     curbuf->b_ml.ml_flags |= ML_EMPTY;
   }
@@ -2559,6 +3016,7 @@ static void u_undoredo(int undo, bool do_buf_event)
 #ifdef U_DEBUG
   u_check(FALSE);
 #endif
+  return true;
 }
 
 /// If we deleted or added lines, report the number of less/more lines.
@@ -2680,6 +3138,9 @@ void u_sync(bool force)
   } else {
     u_getbot(curbuf);  // compute ue_bot of previous u_save
     curbuf->b_u_curhead = NULL;
+    // The entries of the last header are final now.
+    u_account(curbuf, curbuf->b_u_newhead);
+    u_check_mem(curbuf);
   }
 }
 
@@ -2788,7 +3249,7 @@ void ex_undojoin(exarg_T *eap)
   }
   if (get_undolevel(curbuf) < 0) {
     return;                 // no entries, nothing to do
-  } else {
+  } else if (u_unspill(curbuf, curbuf->b_u_newhead)) {
     curbuf->b_u_synced = false;  // Append next change to last entry
   }
 }
@@ -2816,9 +3277,12 @@ void u_find_first_changed(void)
   if (curbuf->b_u_curhead != NULL || uhp == NULL) {
     return;      // undid something in an autocmd?
   }
+  if (!u_unspill(curbuf, uhp)) {
+    return;
+  }
   // Check that the last undo block was for the whole file.
   uep = uhp->uh_entry;
-  if (uep->ue_top != 0 || uep->ue_bot != 0) {
+  if (uep->ue_top != 0 || uep->ue_bot != 0 || (uep->ue_flags & UE_DELTA)) {
     return;
   }
 
@@ -2827,6 +3291,7 @@ void u_find_first_changed(void)
     if (STRCMP(ml_get_buf(curbuf, lnum, false), uep->ue_array[lnum - 1]) != 0) {
       clearpos(&(uhp->uh_cursor));
       uhp->uh_cursor.lnum = lnum;
+      u_header_changed(uhp);
       return;
     }
   }
@@ -2834,6 +3299,7 @@ void u_find_first_changed(void)
     // lines added or deleted at the end, put the cursor there
     clearpos(&(uhp->uh_cursor));
     uhp->uh_cursor.lnum = lnum;
+    u_header_changed(uhp);
   }
 }
 
@@ -2855,6 +3321,7 @@ void u_update_save_nr(buf_T *buf)
   }
   if (uhp != NULL) {
     uhp->uh_save_nr = buf->b_u_save_nr_last;
+    u_header_changed(uhp);
   }
 }
 
@@ -2863,7 +3330,10 @@ static void u_unch_branch(u_header_T *uhp)
   u_header_T *uh;
 
   for (uh = uhp; uh != NULL; uh = uh->uh_prev.ptr) {
-    uh->uh_flags |= UH_CHANGED;
+    if (!(uh->uh_flags & UH_CHANGED)) {
+      uh->uh_flags |= UH_CHANGED;
+      u_header_changed(uh);
+    }
     if (uh->uh_alt_next.ptr != NULL) {
       u_unch_branch(uh->uh_alt_next.ptr);           // recursive
     }
@@ -2896,6 +3366,7 @@ static void u_getbot(buf_T *buf)
   if (uep == NULL) {
     return;
   }
+  u_entry_T *const head = uep;
 
   uep = buf->b_u_newhead->uh_getbot_entry;
   if (uep != NULL) {
@@ -2917,6 +3388,10 @@ static void u_getbot(buf_T *buf)
     buf->b_u_newhead->uh_getbot_entry = NULL;
   }
 
+  // The text of the last entry is final now.
+  u_compact_entry(buf, head);
+  u_header_changed(buf->b_u_newhead);
+
   buf->b_u_synced = true;
 }
 
@@ -2935,6 +3410,7 @@ static void u_freeheader(buf_T *buf, u_header_T *uhp, u_header_T **uhpp)
 
   if (uhp->uh_alt_prev.ptr != NULL) {
     uhp->uh_alt_prev.ptr->uh_alt_next.ptr = NULL;
+    u_header_changed(uhp->uh_alt_prev.ptr);
   }
 
   // Update the links in the list to remove the header.
@@ -2942,6 +3418,7 @@ static void u_freeheader(buf_T *buf, u_header_T *uhp, u_header_T **uhpp)
     buf->b_u_oldhead = uhp->uh_prev.ptr;
   } else {
     uhp->uh_next.ptr->uh_prev.ptr = uhp->uh_prev.ptr;
+    u_header_changed(uhp->uh_next.ptr);
   }
 
   if (uhp->uh_prev.ptr == NULL) {
@@ -2950,6 +3427,7 @@ static void u_freeheader(buf_T *buf, u_header_T *uhp, u_header_T **uhpp)
     for (uhap = uhp->uh_prev.ptr; uhap != NULL;
          uhap = uhap->uh_alt_next.ptr) {
       uhap->uh_next.ptr = uhp->uh_next.ptr;
+      u_header_changed(uhap);
     }
   }
 
@@ -2974,6 +3452,7 @@ static void u_freebranch(buf_T *buf, u_header_T *uhp, u_header_T **uhpp)
 
   if (uhp->uh_alt_prev.ptr != NULL) {
     uhp->uh_alt_prev.ptr->uh_alt_next.ptr = NULL;
+    u_header_changed(uhp->uh_alt_prev.ptr);
   }
 
   next = uhp;
@@ -3013,6 +3492,15 @@ static void u_freeentries(buf_T *buf, u_header_T *uhp, u_header_T **uhpp)
 
   kv_destroy(uhp->uh_extmark);
 
+  // Its record in the undo file is not used anymore.
+  buf->b_u_file.uf_dead += uhp->uh_filesize;
+
+  buf->b_u_mem -= uhp->uh_mem;
+  u_mem_total -= uhp->uh_mem;
+  if (uhp->uh_spill_len > 0) {
+    u_spill_forget(buf, uhp);
+  }
+
 #ifdef U_DEBUG
   uhp->uh_magic = 0;
 #endif
@@ -3025,7 +3513,7 @@ static void u_freeentries(buf_T *buf, u_header_T *uhp, u_header_T **uhpp)
  */
 static void u_freeentry(u_entry_T *uep, long n)
 {
-  while (n > 0) {
+  while (!(uep->ue_flags & UE_PACKED) && n > 0) {
     xfree(uep->ue_array[--n]);
   }
   xfree((char_u *)uep->ue_array);
@@ -3035,6 +3523,413 @@ static void u_freeentry(u_entry_T *uep, long n)
   xfree((char_u *)uep);
 }
 
+/// Make undo entry "uep" use less memory, now that its text will not change
+/// anymore: the text that undoing it will replace is in the buffer.
+/// - For a long line only keep the part that is different from the line in
+///   the buffer.
+/// - The lines of a multi-line entry are stored in one allocation.
+static void u_compact_entry(buf_T *buf, u_entry_T *uep)
+{
+  if (uep->ue_flags & (UE_DELTA | UE_PACKED)) {
+    return;
+  }
+  if (uep->ue_size == 1) {
+    u_delta_make(buf, uep);
+  } else if (uep->ue_size > 1) {
+    u_pack_entry(uep);
+  }
+}
+
+/// Turn single line entry "uep" into a UE_DELTA entry, if the line is long
+/// and the change is small compared to it. Must only be called when undoing
+/// "uep" will find line "ue_top + 1" as it is in the buffer now.
+static void u_delta_make(buf_T *buf, u_entry_T *uep)
+{
+  linenr_T bot = uep->ue_bot == 0 ? buf->b_ml.ml_line_count + 1 : uep->ue_bot;
+  if (bot != uep->ue_top + 2) {
+    return;  // not replaced by one line
+  }
+  char_u *old = uep->ue_array[0];
+  size_t oldlen = STRLEN(old);
+  if (oldlen < UE_DELTA_MIN) {
+    return;
+  }
+  char_u *cur = ml_get_buf(buf, uep->ue_top + 1, false);
+  size_t curlen = STRLEN(cur);
+
+  size_t len = MIN(oldlen, curlen);
+  size_t prefix = 0;
+  while (prefix < len && old[prefix] == cur[prefix]) {
+    prefix++;
+  }
+  size_t suffix = 0;
+  while (suffix < len - prefix
+         && old[oldlen - suffix - 1] == cur[curlen - suffix - 1]) {
+    suffix++;
+  }
+  size_t midlen = oldlen - prefix - suffix;
+  if (midlen > oldlen / 2) {
+    return;
+  }
+
+  uep->ue_array[0] = xmemdupz(old + prefix, midlen);
+  xfree(old);
+  uep->ue_prefix = (colnr_T)prefix;
+  uep->ue_suffix = (colnr_T)suffix;
+  uep->ue_flags |= UE_DELTA;
+}
+
+/// Turn UE_DELTA entry "uep" back into one that holds the whole line, using
+/// the line in the buffer.
+static void u_delta_expand(buf_T *buf, u_entry_T *uep)
+{
+  if (!(uep->ue_flags & UE_DELTA)) {
+    return;
+  }
+  char_u *cur = ml_get_buf(buf, uep->ue_top + 1, false);
+  size_t len = STRLEN(cur);
+  if (len >= (size_t)uep->ue_prefix + (size_t)uep->ue_suffix) {
+    uep->ue_array[0] = u_delta_apply(uep, cur, len);
+  } else {
+    iemsg(_("E439: undo list corrupt"));
+  }
+  uep->ue_flags &= ~UE_DELTA;
+}
+
+/// @return  Allocated line: "line" with the part that UE_DELTA entry "uep"
+///          saved put back in. "len" must be at least the prefix and
+///          suffix together.
+static char_u *u_delta_apply(u_entry_T *uep, const char_u *line, size_t len)
+{
+  size_t prefix = (size_t)uep->ue_prefix;
+  size_t suffix = (size_t)uep->ue_suffix;
+  char_u *mid = uep->ue_array[0];
+  size_t midlen = STRLEN(mid);
+  assert(len >= prefix + suffix);
+
+  char_u *res = xmalloc(prefix + midlen + suffix + 1);
+  memcpy(res, line, prefix);
+  memcpy(res + prefix, mid, midlen);
+  memcpy(res + prefix + midlen, line + len - suffix, suffix + 1);
+  xfree(mid);
+  return res;
+}
+
+/// Undo or redo UE_DELTA entry "uep" for line "lnum": put the saved part in
+/// the line and save the part of the line that it replaces in "uep".
+///
+/// @return  false when the line is too short, the entry does not match.
+static bool u_delta_swap(u_entry_T *uep, linenr_T lnum)
+{
+  char_u *line = ml_get(lnum);
+  size_t len = STRLEN(line);
+  if (len < (size_t)uep->ue_prefix + (size_t)uep->ue_suffix) {
+    return false;
+  }
+  char_u *mid = xmemdupz(line + uep->ue_prefix,
+                         len - (size_t)uep->ue_prefix - (size_t)uep->ue_suffix);
+  ml_replace(lnum, u_delta_apply(uep, line, len), false);
+  uep->ue_array[0] = mid;
+  return true;
+}
+
+/// Store the lines of "uep" in the same allocation as ue_array, this saves
+/// the overhead of an allocation for each line.
+static void u_pack_entry(u_entry_T *uep)
+{
+  size_t size = (size_t)uep->ue_size;
+  size_t total = size * sizeof(char_u *);
+  for (size_t i = 0; i < size; i++) {
+    total += STRLEN(uep->ue_array[i]) + 1;
+  }
+
+  char_u **array = xmalloc(total);
+  char_u *p = (char_u *)(array + size);
+  for (size_t i = 0; i < size; i++) {
+    size_t len = STRLEN(uep->ue_array[i]) + 1;
+    memcpy(p, uep->ue_array[i], len);
+    array[i] = p;
+    p += len;
+    xfree(uep->ue_array[i]);
+  }
+  xfree(uep->ue_array);
+  uep->ue_array = array;
+  uep->ue_flags |= UE_PACKED;
+}
+
+/// @return  The number of bytes of memory used by the entries of "uhp".
+static size_t u_entries_mem_size(const u_header_T *uhp)
+{
+  size_t size = 0;
+  for (u_entry_T *uep = uhp->uh_entry; uep != NULL; uep = uep->ue_next) {
+    size += sizeof(u_entry_T) + (size_t)uep->ue_size * sizeof(char_u *);
+    for (long i = 0; i < uep->ue_size; i++) {
+      size += STRLEN(uep->ue_array[i]) + 1;
+    }
+  }
+  return size;
+}
+
+/// Update the memory counted for the entries of "uhp" after they changed.
+static void u_account(buf_T *buf, u_header_T *uhp)
+{
+  if (uhp == NULL) {
+    return;
+  }
+  size_t size = u_entries_mem_size(uhp);
+  buf->b_u_mem = buf->b_u_mem - uhp->uh_mem + size;
+  u_mem_total = u_mem_total - uhp->uh_mem + size;
+  uhp->uh_mem = size;
+}
+
+/// @return  The number of bytes of memory used by the entries of synced
+///          headers of all buffers.
+size_t u_mem_total_size(void)
+{
+  return u_mem_total;
+}
+
+/// Step from "uhp" to the next header when walking through the undo tree,
+/// starting at the oldest header, like in u_write_undo().  Headers that were
+/// visited have "uh_walk" set to "mark".
+///
+/// @return  NULL when the walk is done.
+static u_header_T *u_walk_next(u_header_T *uhp, int mark)
+{
+  if (uhp->uh_prev.ptr != NULL && uhp->uh_prev.ptr->uh_walk != mark) {
+    return uhp->uh_prev.ptr;
+  } else if (uhp->uh_alt_next.ptr != NULL
+             && uhp->uh_alt_next.ptr->uh_walk != mark) {
+    return uhp->uh_alt_next.ptr;
+  } else if (uhp->uh_next.ptr != NULL && uhp->uh_alt_prev.ptr == NULL
+             && uhp->uh_next.ptr->uh_walk != mark) {
+    return uhp->uh_next.ptr;
+  } else if (uhp->uh_alt_prev.ptr != NULL) {
+    return uhp->uh_alt_prev.ptr;
+  }
+  return uhp->uh_next.ptr;
+}
+
+/// Move the entries of the oldest headers of "buf" to its spill file while
+/// "*mem" is more than "limit".  The newest and current header are kept.
+static void u_spill_buf(buf_T *buf, const size_t *mem, size_t limit)
+{
+  int mark = ++lastmark;
+  u_header_T *uhp = buf->b_u_oldhead;
+  while (uhp != NULL && *mem > limit) {
+    if (uhp->uh_walk != mark) {
+      uhp->uh_walk = mark;
+      if (uhp->uh_entry != NULL && uhp != buf->b_u_newhead
+          && uhp != buf->b_u_curhead && !u_spill(buf, uhp)) {
+        return;
+      }
+    }
+    uhp = u_walk_next(uhp, mark);
+  }
+}
+
+/// Rewrite the spill file of "buf" with only the headers that are still in
+/// it, when the space of the headers that were read back is more than that.
+/// Only that space at the end of the file is reused otherwise, undoing and
+/// redoing could make the file grow without limit.
+static void u_spill_compact(buf_T *buf)
+{
+  undospill_T *sp = &buf->b_u_spill;
+
+  if (sp->sp_fp == NULL || sp->sp_size <= SPILL_COMPACT_MIN
+      || sp->sp_size - sp->sp_live <= sp->sp_live) {
+    return;
+  }
+  char *name = (char *)vim_tempname();
+  if (name == NULL) {
+    return;
+  }
+  FILE *fp = os_fopen(name, "w+");
+  if (fp == NULL) {
+    xfree(name);
+    return;
+  }
+
+  // Copy the headers, serialize_entries() reads them from the old file.
+  // Their offsets are only changed when all of them were copied.
+  kvec_t(u_header_T *) moved = KV_INITIAL_VALUE;
+  kvec_t(uint64_t) offsets = KV_INITIAL_VALUE;
+  bufinfo_T bi;
+  bi.bi_buf = buf;
+  bi.bi_fp = fp;
+  bi.bi_written = 0;
+  bool ok = true;
+  int mark = ++lastmark;
+  for (u_header_T *uhp = buf->b_u_oldhead; uhp != NULL && ok;
+       uhp = u_walk_next(uhp, mark)) {
+    if (uhp->uh_walk == mark) {
+      continue;
+    }
+    uhp->uh_walk = mark;
+    if (uhp->uh_spill_len > 0) {
+      kv_push(moved, uhp);
+      kv_push(offsets, (uint64_t)bi.bi_written);
+      ok = serialize_entries(&bi, uhp);
+    }
+  }
+
+  if (ok) {
+    for (size_t i = 0; i < kv_size(moved); i++) {
+      kv_A(moved, i)->uh_spill_off = kv_A(offsets, i);
+    }
+    fclose(sp->sp_fp);
+    os_remove(sp->sp_name);
+    xfree(sp->sp_name);
+    sp->sp_fp = fp;
+    sp->sp_name = name;
+    sp->sp_size = (uint64_t)bi.bi_written;
+    sp->sp_live = sp->sp_size;
+  } else {
+    fclose(fp);
+    os_remove(name);
+    xfree(name);
+  }
+  kv_destroy(moved);
+  kv_destroy(offsets);
+}
+
+/// Keep the undo memory of "buf" and of all buffers within 'undomaxmem' and
+/// 'undomaxmemtot'.
+static void u_check_mem(buf_T *buf)
+{
+  u_spill_compact(buf);
+  if (p_umm > 0 && buf->b_u_mem > (size_t)p_umm * 1024) {
+    u_spill_buf(buf, &buf->b_u_mem, (size_t)p_umm * 1024);
+  }
+  if (p_ummt > 0 && u_mem_total > (size_t)p_ummt * 1024) {
+    // Start with the buffer that was changed, then the others.
+    u_spill_buf(buf, &u_mem_total, (size_t)p_ummt * 1024);
+    FOR_ALL_BUFFERS(bp) {
+      if (u_mem_total <= (size_t)p_ummt * 1024) {
+        break;
+      }
+      u_spill_buf(bp, &u_mem_total, (size_t)p_ummt * 1024);
+    }
+  }
+}
+
+/// Move the entries of "uhp" to the spill file of "buf" and free them.
+///
+/// @return  false when the spill file cannot be written.
+static bool u_spill(buf_T *buf, u_header_T *uhp)
+{
+  undospill_T *sp = &buf->b_u_spill;
+
+  if (sp->sp_fp == NULL) {
+    sp->sp_name = (char *)vim_tempname();
+    if (sp->sp_name == NULL) {
+      return false;
+    }
+    sp->sp_fp = os_fopen(sp->sp_name, "w+");
+    if (sp->sp_fp == NULL) {
+      XFREE_CLEAR(sp->sp_name);
+      return false;
+    }
+    sp->sp_size = 0;
+    sp->sp_live = 0;
+  }
+
+  bufinfo_T bi;
+  bi.bi_buf = buf;
+  bi.bi_fp = sp->sp_fp;
+  bi.bi_written = 0;
+  if (vim_fseek(sp->sp_fp, (off_T)sp->sp_size, SEEK_SET) != 0
+      || !serialize_entries(&bi, uhp)) {
+    return false;
+  }
+  uhp->uh_spill_off = sp->sp_size;
+  uhp->uh_spill_len = (size_t)bi.bi_written;
+  sp->sp_size += bi.bi_written;
+  sp->sp_live += bi.bi_written;
+  sp->sp_count++;
+
+  u_entry_T *nuep;
+  for (u_entry_T *uep = uhp->uh_entry; uep != NULL; uep = nuep) {
+    nuep = uep->ue_next;
+    u_freeentry(uep, uep->ue_size);
+  }
+  uhp->uh_entry = NULL;
+  buf->b_u_mem -= uhp->uh_mem;
+  u_mem_total -= uhp->uh_mem;
+  uhp->uh_mem = 0;
+  g_stats.undo_spill++;
+  return true;
+}
+
+/// Read back the entries of "uhp" if they were moved to the spill file.
+///
+/// @return  false when they could not be read, "uhp" is marked unusable then.
+static bool u_unspill(buf_T *buf, u_header_T *uhp)
+{
+  if (uhp == NULL || uhp->uh_spill_len == 0) {
+    return true;
+  }
+  if (uhp->uh_flags & UH_UNREADABLE) {
+    emsg(_(e_unspill));
+    return false;
+  }
+  undospill_T *sp = &buf->b_u_spill;
+  bufinfo_T bi;
+  bi.bi_buf = buf;
+  bi.bi_fp = sp->sp_fp;
+  bi.bi_written = 0;
+  if (vim_fseek(sp->sp_fp, (off_T)uhp->uh_spill_off, SEEK_SET) != 0
+      || !unserialize_entries(&bi, uhp, sp->sp_name)) {
+    // Drop the entries that were read, applying only some of them would
+    // mess up the text.
+    u_entry_T *nuep;
+    for (u_entry_T *uep = uhp->uh_entry; uep != NULL; uep = nuep) {
+      nuep = uep->ue_next;
+      u_freeentry(uep, uep->ue_size);
+    }
+    uhp->uh_entry = NULL;
+    uhp->uh_flags |= UH_UNREADABLE;
+    emsg(_(e_unspill));
+    return false;
+  }
+  u_spill_forget(buf, uhp);
+  u_account(buf, uhp);
+  g_stats.undo_unspill++;
+  return true;
+}
+
+/// The entries of "uhp" in the spill file are not used anymore.
+static void u_spill_forget(buf_T *buf, u_header_T *uhp)
+{
+  undospill_T *sp = &buf->b_u_spill;
+
+  if (uhp->uh_spill_off + uhp->uh_spill_len == sp->sp_size) {
+    sp->sp_size = uhp->uh_spill_off;  // at the end, can be reused
+  }
+  sp->sp_live -= uhp->uh_spill_len;
+  uhp->uh_spill_len = 0;
+  if (--sp->sp_count == 0) {
+    sp->sp_size = 0;
+    sp->sp_live = 0;
+  }
+}
+
+/// Close and delete the spill file of "buf".
+static void u_spill_close(buf_T *buf)
+{
+  undospill_T *sp = &buf->b_u_spill;
+
+  if (sp->sp_fp != NULL) {
+    fclose(sp->sp_fp);
+    os_remove(sp->sp_name);
+    XFREE_CLEAR(sp->sp_name);
+    sp->sp_fp = NULL;
+  }
+  sp->sp_size = 0;
+  sp->sp_live = 0;
+  sp->sp_count = 0;
+}
+
 /*
  * invalidate the undo buffer; called when storage has already been released
  */
@@ -3045,6 +3940,7 @@ void u_clearall(buf_T *buf)
   buf->b_u_numhead = 0;
   buf->b_u_line_ptr = NULL;
   buf->b_u_line_lnum = 0;
+  CLEAR_POINTER(&buf->b_u_file);
 }
 
 /*
@@ -3134,6 +4030,42 @@ void u_blockfree(buf_T *buf)
     assert(buf->b_u_oldhead != previous_oldhead);
   }
   xfree(buf->b_u_line_ptr);
+  u_spill_close(buf);
+}
+
+/// @return  The number of bytes of memory used by the undo tree of "buf".
+size_t u_mem_size(buf_T *buf)
+{
+  size_t size = 0;
+  int mark = ++lastmark;
+  u_header_T *uhp = buf->b_u_oldhead;
+  while (uhp != NULL) {
+    if (uhp->uh_walk != mark) {
+      uhp->uh_walk = mark;
+      size += sizeof(u_header_T)
+              + kv_max(uhp->uh_extmark) * sizeof(ExtmarkUndoObject)
+              + u_entries_mem_size(uhp);
+    }
+
+    // Walk through the tree, like in u_write_undo().
+    if (uhp->uh_prev.ptr != NULL && uhp->uh_prev.ptr->uh_walk != mark) {
+      uhp = uhp->uh_prev.ptr;
+    } else if (uhp->uh_alt_next.ptr != NULL
+               && uhp->uh_alt_next.ptr->uh_walk != mark) {
+      uhp = uhp->uh_alt_next.ptr;
+    } else if (uhp->uh_next.ptr != NULL && uhp->uh_alt_prev.ptr == NULL
+               && uhp->uh_next.ptr->uh_walk != mark) {
+      uhp = uhp->uh_next.ptr;
+    } else if (uhp->uh_alt_prev.ptr != NULL) {
+      uhp = uhp->uh_alt_prev.ptr;
+    } else {
+      uhp = uhp->uh_next.ptr;
+    }
+  }
+  if (buf->b_u_line_ptr != NULL) {
+    size += STRLEN(buf->b_u_line_ptr) + 1;
+  }
+  return size;
 }
 
 /// Allocate memory and copy curbuf line into it.
@@ -3251,5 +4183,7 @@ u_header_T *u_force_get_undo_header(buf_T *buf)
       }
     }
   }
+  // The caller is going to add to it.
+  u_header_changed(uhp);
   return uhp;
 }
@@ -1,10 +1,14 @@
 #ifndef NVIM_UNDO_DEFS_H
 #define NVIM_UNDO_DEFS_H
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <time.h>  // for time_t
 
 #include "nvim/extmark_defs.h"
 #include "nvim/mark_defs.h"
+#include "nvim/os/fs_defs.h"
 #include "nvim/pos.h"
 
 typedef struct u_header u_header_T;
@@ -17,6 +21,34 @@ typedef struct {
   colnr_T vi_curswant;          // MAXCOL from w_curswant
 } visualinfo_T;
 
+/// The undo file that was last written or read for a buffer.  New undo
+/// headers are appended to it as long as it was not changed by someone else.
+typedef struct {
+  FileID uf_id;                 ///< identity of the file
+  uint64_t uf_size;             ///< size of the file, zero when it must be
+                                ///< written from scratch
+  uint64_t uf_dead;             ///< bytes of records that were superseded
+  uint64_t uf_state;            ///< size of the last state record
+} undofile_T;
+
+/// Temporary file that holds the entries of undo headers that were moved out
+/// of memory, see 'undomaxmem'.
+typedef struct {
+  FILE *sp_fp;
+  char *sp_name;
+  uint64_t sp_size;             ///< bytes in use at the start of the file
+  uint64_t sp_live;             ///< bytes of the headers still in the file
+  int sp_count;                 ///< number of headers in the file
+} undospill_T;
+
+/// State for computing the hash of the buffer text stored in the undo file.
+typedef struct {
+  uint64_t uh_v[4];
+  uint64_t uh_total;            ///< number of bytes hashed
+  uint8_t uh_buf[32];           ///< bytes not hashed yet
+  size_t uh_buflen;
+} undo_hash_T;
+
 #include "nvim/buffer_defs.h"
 
 typedef struct u_entry u_entry_T;
@@ -27,6 +59,9 @@ struct u_entry {
   linenr_T ue_lcount;           // linecount when u_save called
   char_u **ue_array;       // array of lines in undo block
   long ue_size;                 // number of lines in ue_array
+  int ue_flags;                 // see below
+  colnr_T ue_prefix;            // UE_DELTA: nr of bytes before the change
+  colnr_T ue_suffix;            // UE_DELTA: nr of bytes after the change
 #ifdef U_DEBUG
   int ue_magic;                 // magic number to check allocation
 #endif
@@ -64,20 +99,40 @@ struct u_header {
   time_t uh_time;               // timestamp when the change was made
   long uh_save_nr;              // set when the file was saved after the
                                 // changes in this block
+  size_t uh_filesize;           // size of the record for this header in the
+                                // undo file, zero when not written
+  bool uh_dirty;                // changed since it was written to the undo
+                                // file
+  size_t uh_mem;                // memory used by the entries, as counted in
+                                // b_u_mem
+  uint64_t uh_spill_off;        // offset of the entries in the spill file
+  size_t uh_spill_len;          // size of the entries in the spill file,
+                                // zero when they are in memory
 #ifdef U_DEBUG
   int uh_magic;                 // magic number to check allocation
 #endif
 };
 
+// values for ue_flags
+#define UE_DELTA    0x01        // ue_array[0] only holds the changed part of
+                                // the line, the ue_prefix bytes before it and
+                                // ue_suffix bytes after it are taken from the
+                                // line in the buffer
+#define UE_PACKED   0x02        // the lines are stored in the same
+                                // allocation as ue_array
+
 // values for uh_flags
 #define UH_CHANGED  0x01        // b_changed flag before undo/after redo
 #define UH_EMPTYBUF 0x02        // buffer was empty
 #define UH_RELOAD   0x04        // buffer was reloaded
+#define UH_UNREADABLE 0x08      // entries could not be read back from the
+                                // spill file, can't undo or redo
 
 /// Structure passed around between undofile functions.
 typedef struct {
   buf_T *bi_buf;
   FILE *bi_fp;
+  uint64_t bi_written;          ///< number of bytes written
 } bufinfo_T;
 
 #endif // NVIM_UNDO_DEFS_H
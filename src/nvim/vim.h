@@ -208,7 +208,7 @@ enum { FOLD_TEXT_LEN = 51, };  //!< buffer size for get_foldtext()
 #define MAXMAPLEN   50
 
 // Size in bytes of the hash used in the undo file.
-#define UNDO_HASH_SIZE 32
+#define UNDO_HASH_SIZE 8
 
 #define CLEAR_POINTER(ptr)  memset((ptr), 0, sizeof(*(ptr)))
 
@@ -10,6 +10,7 @@
 #include "nvim/buffer.h"
 #include "nvim/charset.h"
 #include "nvim/cursor.h"
+#include "nvim/decoration.h"
 #include "nvim/diff.h"
 #include "nvim/edit.h"
 #include "nvim/eval.h"
@@ -4829,6 +4830,7 @@ static void win_free(win_T *wp, tabpage_T *tp)
   }
 
   xfree(wp->w_lines);
+  decor_cache_free(wp);
 
   for (i = 0; i < wp->w_tagstacklen; i++) {
     xfree(wp->w_tagstack[i].tagname);
@@ -390,6 +390,64 @@ describe('api/buf', function()
       feed('<c-w>p')
       eq(3, funcs.winnr())
     end)
+
+    it('gets lines right when going back and forth through the buffer', function()
+      local hit = request('nvim__stats').ml_cache_hit
+      eq('ok', helpers.exec_lua([[
+        local lines = {}
+        for i = 1, 30000 do
+          lines[i] = i .. string.rep('w', i % 53)
+        end
+        vim.api.nvim_buf_set_lines(0, 0, -1, true, lines)
+        for i = 1, 10000, 7 do
+          for _, lnum in ipairs({i, i + 10000, i + 20000}) do
+            if vim.fn.getline(lnum) ~= lines[lnum] then
+              return {lnum, vim.fn.getline(lnum), lines[lnum]}
+            end
+          end
+          if i % 1000 == 1 then
+            vim.fn.setline(i + 15000, 'changed')
+            lines[i + 15000] = 'changed'
+            vim.api.nvim_buf_set_lines(0, i + 5000, i + 5001, true, {})
+            table.remove(lines, i + 5001)
+            vim.fn.append(i + 25000, 'new')
+            table.insert(lines, i + 25001, 'new')
+          end
+        end
+        return vim.deep_equal(lines, vim.api.nvim_buf_get_lines(0, 0, -1, true))
+               and 'ok' or 'differs'
+      ]]))
+      ok(request('nvim__stats').ml_cache_hit > hit)
+    end)
+
+    it('gets lines of a remembered block after lines were added before it', function()
+      eq({'899', '900', '901', 'changed', '900'}, helpers.exec_lua([[
+        local lines = {}
+        for i = 1, 1000 do
+          lines[i] = i .. string.rep('w', 100)
+        end
+        vim.api.nvim_buf_set_lines(0, 0, -1, true, lines)
+        local function get(lnum)
+          return (vim.fn.getline(lnum):gsub('w', ''))
+        end
+        local res = {}
+        get(900)
+        get(10)
+        vim.fn.append(10, 'x')
+        table.insert(res, get(900))
+        get(10)
+        vim.fn.deletebufline('', 11)
+        vim.fn.deletebufline('', 10)
+        table.insert(res, get(899))
+        table.insert(res, get(900))
+        get(10)
+        vim.fn.append(10, 'y')
+        vim.fn.setline(901, 'changed')
+        table.insert(res, get(901))
+        table.insert(res, get(900))
+        return res
+      ]]))
+    end)
   end)
 
   describe('nvim_buf_get_lines, nvim_buf_set_text', function()
@@ -769,4 +827,38 @@ describe('api/buf', function()
       eq(false, pcall(meths.buf_del_mark, 99, 'a'))
     end)
   end)
+
+  describe('nvim__buf_stats, nvim__stats', function()
+    it('reports memory used by the buffer', function()
+      local stats = request('nvim__buf_stats', 0)
+      eq(0, stats.undo_bytes)
+      eq(0, stats.decor_bytes)
+      local lines = {}
+      for i = 1, 10000 do
+        lines[i] = 'line ' .. i
+      end
+      curbufmeths.set_lines(0, -1, true, lines)
+      local ns = meths.create_namespace('test')
+      for i = 0, 99 do
+        curbufmeths.set_extmark(ns, i, 0, {virt_text={{'text', 'Comment'}}})
+      end
+
+      local stats2 = request('nvim__buf_stats', 0)
+      ok(stats2.memline_bytes > stats.memline_bytes + 10000 * 8)
+      ok(stats2.undo_bytes > 10000 * 8)
+      ok(stats2.extmark_bytes > stats.extmark_bytes)
+      ok(stats2.decor_bytes > 100 * 5)
+
+      command('bwipeout!')
+      eq(0, request('nvim__buf_stats', 0).undo_bytes)
+    end)
+
+    it('nvim__stats reports global memory use', function()
+      local stats = request('nvim__stats')
+      ok(stats.lua_bytes > 0)
+      command('let g:list = map(range(10000), "string(v:val)")')
+      ok(request('nvim__stats').eval_bytes > stats.eval_bytes + 10000 * 2)
+      ok(stats.rpc_bytes > 0)
+    end)
+  end)
 end)
@@ -352,6 +352,32 @@ describe('API/extmarks', function()
     eq({}, rv)
   end)
 
+  it('get_marks with overlap includes ranges which start before the region', function()
+    feed('A<cr>12345<cr>12345<cr>12345<cr>12345<esc>')
+    set_extmark(ns, 1, 0, 1, {end_row=3, end_col=2})
+    set_extmark(ns, 2, 1, 0, {end_row=1, end_col=4}) -- ends before the region
+    set_extmark(ns, 3, 2, 0, {end_row=4, end_col=0})
+    set_extmark(ns, 4, 2, 3)
+    set_extmark(ns2, 5, 0, 0, {end_row=4, end_col=0}) -- other namespace
+    eq({{3, 2, 0}, {4, 2, 3}}, get_extmarks(ns, {2, 0}, {2, 4}))
+    eq({{1, 0, 1}, {3, 2, 0}, {4, 2, 3}},
+       get_extmarks(ns, {2, 0}, {2, 4}, {overlap=true}))
+    eq({{1, 0, 1}, {3, 2, 0}}, get_extmarks(ns, {2, 1}, {2, 2}, {overlap=true}))
+    eq({{4, 2, 3}, {3, 2, 0}, {1, 0, 1}},
+       get_extmarks(ns, {2, 4}, {2, 0}, {overlap=true}))
+    eq({{1, 0, 1}}, get_extmarks(ns, {2, 0}, {2, 4}, {overlap=true, limit=1}))
+
+    -- ranges are still found after lines are added and removed in them
+    feed('ggjyy3p')
+    eq({{1, 0, 1}, {3, 5, 0}, {4, 5, 3}},
+       get_extmarks(ns, {5, 0}, {5, 4}, {overlap=true}))
+    feed('gg3jdd')
+    eq({{1, 0, 1}, {3, 4, 0}, {4, 4, 3}},
+       get_extmarks(ns, {4, 0}, {4, 4}, {overlap=true}))
+    eq("overlap is not an boolean",
+       pcall_err(get_extmarks, ns, 0, -1, {overlap='yes'}))
+  end)
+
 
   it('marks move with line insertations', function()
     set_extmark(ns, marks[1], 0, 0)
@@ -1030,6 +1056,21 @@ describe('API/extmarks', function()
     check_undo_redo(ns, marks[3], 0, 4, 0, 8)
   end)
 
+  it('substitutes multiple matches in a line with marks inside them', function()
+    feed('ddiab12cd12ef<esc>')
+    local before = {{0, 0}, {0, 2}, {0, 3}, {0, 4}, {0, 6}, {0, 7}, {0, 8}, {0, 10}}
+    local ids = batch_set(ns, before)
+    table.insert(ids, set_extmark(ns, 0, 0, 2, {right_gravity = false}))
+    table.insert(ids, set_extmark(ns, 0, 0, 8, {right_gravity = false}))
+    table.insert(before, {0, 2})
+    table.insert(before, {0, 8})
+    feed(':s/12/x/g<cr>')
+    expect('abxcdxef')
+    local after = {{0, 0}, {0, 3}, {0, 3}, {0, 3}, {0, 6}, {0, 6}, {0, 6}, {0, 8},
+                   {0, 2}, {0, 5}}
+    batch_check_undo_redo(ns, ids, before, after)
+  end)
+
   it('substitions over multiple lines with newline in pattern', function()
     feed('A<cr>67890<cr>xx<esc>')
     set_extmark(ns, marks[1], 0, 3)
@@ -1501,6 +1542,25 @@ describe('Extmarks buffer api with many marks', function()
     eq(ns_marks[ns2], get_marks(ns2))
   end)
 
+  it("can get and clear the marks of a small namespace", function()
+    local ns3 = request('nvim_create_namespace', "ns3")
+    local m1 = set_extmark(ns3, 0, 5, 1)
+    local m2 = set_extmark(ns3, 0, 5, 1, {right_gravity=false})
+    local m3 = set_extmark(ns3, 0, 2, 0, {end_row=10, end_col=1})
+    local m4 = set_extmark(ns3, 0, 20, 3)
+    eq({{m3, 2, 0}, {m2, 5, 1}, {m1, 5, 1}, {m4, 20, 3}}, get_extmarks(ns3, 0, -1))
+    eq({{m4, 20, 3}, {m1, 5, 1}, {m2, 5, 1}}, get_extmarks(ns3, {29, 0}, {5, 0}))
+    eq({{m2, 5, 1}}, get_extmarks(ns3, {3, 0}, -1, {limit=1}))
+
+    -- only the end of m3 is in the range
+    curbufmeths.clear_namespace(ns3, 8, 16)
+    eq({{m2, 5, 1}, {m1, 5, 1}, {m4, 20, 3}}, get_extmarks(ns3, 0, -1))
+    curbufmeths.clear_namespace(ns3, 0, -1)
+    eq({}, get_extmarks(ns3, 0, -1))
+    eq(ns_marks[ns1], get_marks(ns1))
+    eq(ns_marks[ns2], get_marks(ns2))
+  end)
+
   it("can delete line", function()
     feed('10Gdd')
     for _, marks in pairs(ns_marks) do
@@ -1536,4 +1596,57 @@ describe('Extmarks buffer api with many marks', function()
     eq({}, get_marks(ns1))
     eq({}, get_marks(ns2))
   end)
+
+  it("can set many marks at once", function()
+    local items = {}
+    for i = 0, 29 do
+      for j = 0, i, 2 do
+        table.insert(items, {i, j, {right_gravity = (j % 4 == 0)}})
+      end
+    end
+    local ids = curbufmeths.set_extmarks(ns1, items, {})
+    eq(#items, #ids)
+    for k, id in ipairs(ids) do
+      eq(nil, ns_marks[ns1][id])
+      ns_marks[ns1][id] = {items[k][1], items[k][2]}
+    end
+    -- An existing mark is moved.
+    local old_id = next(ns_marks[ns2])
+    eq({old_id}, curbufmeths.set_extmarks(ns2, {{3, 1, {id = old_id}}}, {}))
+    ns_marks[ns2][old_id] = {3, 1}
+    eq(ns_marks[ns1], get_marks(ns1))
+    eq(ns_marks[ns2], get_marks(ns2))
+
+    feed('5G3dd')
+    for _, marks in pairs(ns_marks) do
+      for _, mark in pairs(marks) do
+        if 4 <= mark[1] and mark[1] < 7 then
+          mark[1] = 4
+          mark[2] = 0
+        elseif mark[1] >= 7 then
+          mark[1] = mark[1] - 3
+        end
+      end
+    end
+    eq(ns_marks[ns1], get_marks(ns1))
+    eq(ns_marks[ns2], get_marks(ns2))
+  end)
+
+  it("can replace the marks of a namespace", function()
+    local ids = curbufmeths.set_extmarks(ns1, {{1, 0}, {2, 1, {end_row = 4, end_col = 2}}},
+                                         {clear = true})
+    eq({{ids[1], 1, 0}, {ids[2], 2, 1}}, get_extmarks(ns1, 0, -1))
+    eq({ids[2], 2, 1, {end_row = 4, end_col = 2}},
+       get_extmarks(ns1, 0, -1, {details = true})[2])
+    eq(ns_marks[ns2], get_marks(ns2))
+  end)
+
+  it("does not change anything for an invalid item", function()
+    eq("col value outside range",
+       pcall_err(curbufmeths.set_extmarks, ns1, {{1, 0}, {2, 99}}, {clear = true}))
+    eq("marks item 1 is not a [line, col, opts] Array",
+       pcall_err(curbufmeths.set_extmarks, ns1, {{1, 0}, {2}}, {}))
+    eq(ns_marks[ns1], get_marks(ns1))
+    eq(ns_marks[ns2], get_marks(ns2))
+  end)
 end)
@@ -3,8 +3,10 @@ local helpers = require('test.functional.helpers')(after_each)
 local clear = helpers.clear
 local command = helpers.command
 local eq = helpers.eq
+local eval = helpers.eval
 local feed = helpers.feed
 local funcs = helpers.funcs
+local meths = helpers.meths
 local nvim_prog = helpers.nvim_prog
 local request = helpers.request
 local retry = helpers.retry
@@ -12,6 +14,7 @@ local rmdir = helpers.rmdir
 local mkdir = helpers.mkdir
 local sleep = helpers.sleep
 local read_file = helpers.read_file
+local write_file = helpers.write_file
 local trim = helpers.trim
 local currentdir = helpers.funcs.getcwd
 local iswin = helpers.iswin
@@ -28,6 +31,7 @@ describe('fileio', function()
     os.remove('Xtest_startup_file2')
     os.remove('Xtest_тест.md')
     os.remove('Xtest-u8-int-max')
+    os.remove('Xtest-read-lines')
     rmdir('Xtest_startup_swapdir')
     rmdir('Xtest_backupdir')
   end)
@@ -137,5 +141,18 @@ describe('fileio', function()
     command('edit ++enc=utf32 Xtest-u8-int-max')
     assert_alive()
   end)
+
+  it(':edit reads lines spanning several read buffers', function()
+    clear()
+    local lines = {}
+    for i = 1, 20000 do
+      lines[i] = i .. ' tést ' .. string.rep('x', i % 23)
+    end
+    lines[10] = 'nul\0byte'
+    write_file('Xtest-read-lines', table.concat(lines, '\r\n') .. '\r\n')
+    command('edit Xtest-read-lines')
+    eq('dos', eval('&fileformat'))
+    eq(lines, meths.buf_get_lines(0, 0, -1, true))
+  end)
 end)
 
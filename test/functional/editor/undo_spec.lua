@@ -2,9 +2,15 @@ local helpers = require('test.functional.helpers')(after_each)
 
 local clear = helpers.clear
 local command = helpers.command
+local eq = helpers.eq
+local exec_lua = helpers.exec_lua
 local expect = helpers.expect
 local feed = helpers.feed
+local funcs = helpers.funcs
 local insert = helpers.insert
+local meths = helpers.meths
+local ok = helpers.ok
+local request = helpers.request
 
 describe('u CTRL-R g- g+', function()
   before_each(clear)
@@ -59,3 +65,135 @@ describe('u CTRL-R g- g+', function()
     undo_and_redo(4, 'g-', 'g+', '1')
   end)
 end)
+
+describe('undo of a long line', function()
+  local long = ('0123456789'):rep(10000)
+  local undofile = 'Xtest_undo_long_line'
+
+  before_each(function()
+    clear()
+    meths.buf_set_lines(0, 0, -1, true, {'first', long, 'last'})
+    command('let &undolevels = &undolevels')  -- start a new undo block
+  end)
+
+  after_each(function()
+    os.remove(undofile)
+  end)
+
+  -- Replaces a character at "cols" in line 2, each one is an undo step.
+  local function change(cols)
+    local line = long
+    for _, col in ipairs(cols) do
+      feed('2G' .. col .. '|rX')
+      line = line:sub(1, col - 1) .. 'X' .. line:sub(col + 1)
+    end
+    eq(line, funcs.getline(2))
+    return line
+  end
+
+  it('only keeps the changed part', function()
+    local line = change({1, 50000, 99999, 100000, 20})
+    local stats = request('nvim__buf_stats', 0)
+    ok(stats.undo_bytes < #long * 2)
+
+    feed('5u')
+    eq(long, funcs.getline(2))
+    feed('5<C-R>')
+    eq(line, funcs.getline(2))
+    feed('3u')
+    eq(long:sub(1, 49999) .. 'X' .. long:sub(50001), funcs.getline(2))
+  end)
+
+  it('works with :undojoin', function()
+    change({100})
+    command('undojoin | call setline(2, "X" . getline(2)[1:])')
+    feed('u')
+    eq(long, funcs.getline(2))
+  end)
+
+  it('is written to and read from an undo file', function()
+    local line = change({10, 60000})
+    command('wundo ' .. undofile)
+    command('bwipeout!')
+    meths.buf_set_lines(0, 0, -1, true, {'first', line, 'last'})
+    command('rundo ' .. undofile)
+    feed('2u')
+    eq(long, funcs.getline(2))
+    feed('<C-R>')
+    eq(long:sub(1, 9) .. 'X' .. long:sub(11), funcs.getline(2))
+  end)
+end)
+
+describe('undo of a large change', function()
+  before_each(clear)
+
+  it('restores all lines with one buffer update', function()
+    eq('ok', exec_lua([[
+      local lines = {}
+      for i = 1, 30000 do
+        lines[i] = i .. string.rep('u', i % 97)
+      end
+      vim.api.nvim_buf_set_lines(0, 0, -1, true, lines)
+      vim.cmd('let &undolevels = &undolevels')
+      vim.api.nvim_buf_set_lines(0, 10, 25000, true, {'a', 'b'})
+      vim.cmd('let &undolevels = &undolevels')
+      vim.api.nvim_buf_set_lines(0, 0, -1, true, {})
+
+      local events = 0
+      vim.api.nvim_buf_attach(0, false, {
+        on_lines = function() events = events + 1 end,
+      })
+      local function check(expected)
+        local buf = vim.api.nvim_buf_get_lines(0, 0, -1, true)
+        if #buf ~= #expected then
+          return {#buf, #expected}
+        end
+        for i, line in ipairs(expected) do
+          if buf[i] ~= line then
+            return {i, buf[i], line}
+          end
+        end
+      end
+
+      local changed = {}
+      table.move(lines, 1, 10, 1, changed)
+      table.move({'a', 'b'}, 1, 2, 11, changed)
+      table.move(lines, 25001, 30000, 13, changed)
+      vim.cmd('undo')
+      local err = check(changed)
+      vim.cmd('undo')
+      err = err or check(lines)
+      vim.cmd('redo')
+      err = err or check(changed)
+      vim.cmd('redo')
+      err = err or check({''})
+      if err then
+        return err
+      end
+      return events == 4 and 'ok' or events
+    ]]))
+  end)
+
+  it('gets the lines after the change right', function()
+    eq({'899', '910', '899', '910'}, exec_lua([[
+      local lines = {}
+      for i = 1, 1000 do
+        lines[i] = i .. string.rep('u', 100)
+      end
+      vim.api.nvim_buf_set_lines(0, 0, -1, true, lines)
+      vim.cmd('let &undolevels = &undolevels')
+      vim.api.nvim_buf_set_lines(0, 9, 20, true, {})
+      local function get(lnum)
+        return (vim.fn.getline(lnum):gsub('u', ''))
+      end
+      local res = {}
+      for _, cmd in ipairs({'undo', 'redo', 'undo', 'redo'}) do
+        get(900)
+        get(15)
+        vim.cmd(cmd)
+        table.insert(res, get(899))
+      end
+      return res
+    ]]))
+  end)
+end)
@@ -1,5 +1,6 @@
 local helpers = require('test.functional.helpers')(after_each)
 local clear, nvim, eq = helpers.clear, helpers.nvim, helpers.eq
+local funcs, insert = helpers.funcs, helpers.insert
 
 describe('sign', function()
   before_each(clear)
@@ -21,4 +22,19 @@ describe('sign', function()
       end)
     end)
   end)
+
+  it('keeps the signs in line order when lines are moved', function()
+    insert('a\nb\nc\nd\ne')
+    nvim('command', 'sign define Foo text=+')
+    for i = 1, 5 do
+      funcs.sign_place(i, '', 'Foo', '%', {lnum = i})
+    end
+    funcs.sign_place(6, '', 'Foo', '%', {lnum = 3, priority = 20})
+    nvim('command', '1,2move 4')
+    local placed = {}
+    for _, sign in ipairs(funcs.sign_getplaced('%')[1].signs) do
+      table.insert(placed, {sign.lnum, sign.id})
+    end
+    eq({{1, 6}, {1, 3}, {2, 4}, {3, 1}, {4, 2}, {5, 5}}, placed)
+  end)
 end)
@@ -6,7 +6,9 @@ local eq, eval, expect, source =
 local assert_alive = helpers.assert_alive
 local clear = helpers.clear
 local command = helpers.command
+local exec_lua = helpers.exec_lua
 local feed = helpers.feed
+local meths = helpers.meths
 local nvim_prog = helpers.nvim_prog
 local ok = helpers.ok
 local rmdir = helpers.rmdir
@@ -15,6 +17,8 @@ local spawn = helpers.spawn
 local nvim_async = helpers.nvim_async
 local expect_msg_seq = helpers.expect_msg_seq
 local pcall_err = helpers.pcall_err
+local read_file = helpers.read_file
+local retry = helpers.retry
 
 describe(':recover', function()
   before_each(clear)
@@ -86,6 +90,66 @@ describe(':preserve', function()
     ok(nil == string.find(swappath2, '%.%.%.'))
   end)
 
+  it('saves a hidden buffer, which is kept compressed', function()
+    local testfile = 'Xtest_recover_file2'
+    local init = [[
+      set directory^=]]..swapdir:gsub([[\]], [[\\]])..[[//
+      set swapfile fileformat=unix undolevels=-1 hidden
+    ]]
+    local lines = {}
+    for i = 1, 20000 do
+      lines[i] = 'line ' .. i .. string.rep(' text', i % 7)
+    end
+
+    source(init)
+    command('edit! '..testfile)
+    local buf = meths.get_current_buf()
+    meths.buf_set_lines(buf, 0, -1, true, lines)
+    command('enew')
+    -- Change the hidden buffer, then write it to the swapfile.
+    meths.buf_set_lines(buf, 9999, 10000, true, {'changed'})
+    lines[10000] = 'changed'
+    exec_lua([[vim.api.nvim_buf_call(..., function() vim.cmd('preserve') end)]],
+             buf)
+
+    local nvim2 = spawn({nvim_prog, '-u', 'NONE', '-i', 'NONE', '--embed'},
+                                true)
+    set_session(nvim2)
+    source(init)
+    command('autocmd SwapExists * let v:swapchoice = "r"')
+    command('silent edit! '..testfile)
+    eq(lines, meths.buf_get_lines(0, 0, -1, true))
+  end)
+
+end)
+
+describe("'updatecount'", function()
+  local swapdir = lfs.currentdir()..'/Xtest_updatecount_dir'
+  before_each(function()
+    clear()
+    rmdir(swapdir)
+    lfs.mkdir(swapdir)
+  end)
+  after_each(function()
+    command('%bwipeout!')
+    rmdir(swapdir)
+  end)
+
+  it('writes typed text to the swapfile in the background', function()
+    source([[
+      set directory^=]]..swapdir:gsub([[\]], [[\\]])..[[//
+      set swapfile fileformat=unix undolevels=-1 updatecount=1
+    ]])
+    command('edit! Xtest_updatecount_file')
+    feed('isometext<esc>')
+    local swappath = eval('swapname("%")')
+    retry(nil, 10000, function()
+      ok(nil ~= string.find(read_file(swappath) or '', 'sometext', 1, true))
+    end)
+    -- Closing the swapfile waits for the writes.
+    command('set noswapfile')
+    eq(nil, read_file(swappath))
+  end)
 end)
 
 describe('swapfile detection', function()
@@ -1,8 +1,17 @@
 local helpers = require('test.functional.helpers')(after_each)
+local Screen = require('test.functional.ui.screen')
 
 local eq = helpers.eq
 local clear = helpers.clear
 local exc_exec = helpers.exc_exec
+local command = helpers.command
+local exec_lua = helpers.exec_lua
+local funcs = helpers.funcs
+local insert = helpers.insert
+local ok = helpers.ok
+local request = helpers.request
+local retry = helpers.retry
+local write_file = helpers.write_file
 
 describe(':syntax', function()
   before_each(clear)
@@ -13,5 +22,177 @@ describe(':syntax', function()
       eq('Vim(syntax):E669: Unprintable character in group name',
          exc_exec('syntax keyword \024 foo bar'))
     end)
+
+    it('matches keywords with and without ignoring case', function()
+      insert('foo Foo fo food BAR bar bars')
+      command('syntax keyword Keyword foo')
+      command('syntax case ignore')
+      command('syntax keyword Keyword bar')
+      local names = {}
+      for _, col in ipairs({1, 5, 9, 12, 17, 21, 25}) do
+        table.insert(names, funcs.synIDattr(funcs.synID(1, col, 0), 'name'))
+      end
+      eq({'Keyword', '', '', '', 'Keyword', 'Keyword', ''}, names)
+    end)
+  end)
+
+  describe('match', function()
+    it('only skips patterns that cannot start in the line', function()
+      insert('xyz\nfoo Bar\n\195\137t\195\169')
+      command('syntax match Foo "fo\\+"')
+      command('syntax case ignore')
+      command('syntax match Bar "bar"')
+      command('syntax match Ete "\195\169t\195\169"')
+      local names = {}
+      for _, pos in ipairs({{1, 1}, {2, 1}, {2, 5}, {3, 1}}) do
+        table.insert(names, funcs.synIDattr(funcs.synID(pos[1], pos[2], 0), 'name'))
+      end
+      eq({'', 'Foo', 'Bar', 'Ete'}, names)
+    end)
+  end)
+
+  describe('while waiting for input', function()
+    local screen
+    before_each(function()
+      screen = Screen.new(10, 4)
+      screen:set_default_attr_ids({
+        [1] = {foreground = Screen.colors.Red},
+      })
+      screen:attach()
+      -- A "*" in each line, so that the region end is tried on every line.
+      exec_lua([[
+        local lines = {'a', '/*'}
+        for i = 3, 3000 do
+          lines[i] = i < 2500 and 'x*' or 'y'
+        end
+        lines[2500] = '*/'
+        vim.api.nvim_buf_set_lines(0, 0, -1, true, lines)
+      ]])
+      command('highlight Xcomment guifg=Red')
+      command('syntax sync fromstart')
+      command([[syntax region Xcomment start="/\*" end="\*/"]])
+    end)
+
+    -- Waits until states were saved down to line 2400 without a redraw
+    -- there.
+    local function wait_parsed_ahead()
+      retry(nil, nil, function()
+        ok(request('nvim__buf_stats', 0).syntax_lnum >= 2400)
+      end)
+    end
+
+    -- Shows line "lnum" at the top and checks that this did not parse from
+    -- far above it.
+    local function expect_at(lnum, commented)
+      command('syntime clear')
+      command('syntime on')
+      command('normal! ' .. lnum .. 'Gzt')
+      command('redraw')
+      command('syntime off')
+      local tries = 0
+      for line in funcs.execute('syntime report'):gmatch('[^\n]+') do
+        if line:find('Xcomment') then
+          tries = tries + tonumber(line:match('^%s*[%d.]+%s+(%d+)'))
+        end
+      end
+      ok(tries < 100)
+      local row = commented and '{1:%s}        |\n' or '%s        |\n'
+      screen:expect(row:format('^x*') .. row:format('x*') .. row:format('x*')
+                    .. '          |\n')
+    end
+
+    it('parses the end of the buffer before it is displayed', function()
+      screen:expect([[
+        ^a         |
+        {1:/*}        |
+        {1:x*}        |
+                  |
+      ]])
+      wait_parsed_ahead()
+      expect_at(2400, true)
+      command('normal! Gzb')
+      screen:expect([[
+        y         |
+        y         |
+        ^y         |
+                  |
+      ]])
+    end)
+
+    it('parses again after the text was changed', function()
+      screen:expect([[
+        ^a         |
+        {1:/*}        |
+        {1:x*}        |
+                  |
+      ]])
+      wait_parsed_ahead()
+      command('normal! 2Gdd')
+      screen:expect([[
+        a         |
+        ^x*        |
+        x*        |
+                  |
+      ]])
+      wait_parsed_ahead()
+      expect_at(2400, false)
+      command('normal! gg')
+      command('undo')
+      screen:expect([[
+        a         |
+        {1:^/*}        |
+        {1:x*}        |
+                  |
+      ]])
+      wait_parsed_ahead()
+      expect_at(2400, true)
+    end)
+  end)
+
+  describe('after reloading a buffer', function()
+    local fname = 'Xsyntax_reload'
+    local function write_text(first)
+      write_file(fname, first .. '\n' .. string.rep('x\n', 300) .. '*/\ny\n')
+    end
+    after_each(function()
+      os.remove(fname)
+    end)
+
+    it('uses the states from before only for unchanged text', function()
+      write_text('/*')
+      command('autocmd BufRead ' .. fname .. ' syntax sync fromstart')
+      command('autocmd BufRead ' .. fname
+              .. [[ syntax region Comment start="/\*" end="\*/"]])
+      command('edit ' .. fname)
+      eq('Comment', funcs.synIDattr(funcs.synID(301, 1, 0), 'name'))
+      command('edit!')
+      eq('Comment', funcs.synIDattr(funcs.synID(301, 1, 0), 'name'))
+      eq('', funcs.synIDattr(funcs.synID(303, 1, 0), 'name'))
+      write_text('x')
+      command('edit!')
+      eq('', funcs.synIDattr(funcs.synID(301, 1, 0), 'name'))
+    end)
+
+    it('checks the lines below a state that a match looks at', function()
+      -- The region only starts when the twelfth line is "x", the states
+      -- saved in between depend on that line.
+      local function write_lines(twelfth)
+        local lines = {'begin'}
+        for i = 2, 300 do
+          lines[i] = 'w'
+        end
+        lines[12] = twelfth
+        write_file(fname, table.concat(lines, '\n') .. '\n')
+      end
+      write_lines('x')
+      command('autocmd BufRead ' .. fname .. ' syntax sync fromstart linebreaks=12')
+      command('autocmd BufRead ' .. fname
+              .. [[ syntax region Comment start="^begin\n\%(.*\n\)\{10}x" end="^end"]])
+      command('edit ' .. fname)
+      eq('Comment', funcs.synIDattr(funcs.synID(200, 1, 0), 'name'))
+      write_lines('z')
+      command('edit!')
+      eq('', funcs.synIDattr(funcs.synID(200, 1, 0), 'name'))
+    end)
   end)
 end)
@@ -9,6 +9,10 @@ local feed_command = helpers.feed_command
 local funcs = helpers.funcs
 local meths = helpers.meths
 local iswin = helpers.iswin
+local read_file = helpers.read_file
+local retry = helpers.retry
+local assert_alive = helpers.assert_alive
+local nvim_prog = helpers.nvim_prog
 
 local fname = 'Xtest-functional-ex_cmds-write'
 local fname_bak = fname .. '~'
@@ -90,6 +94,70 @@ describe(':write', function()
     fifo:close()
   end)
 
+  describe("with 'asyncwrite'", function()
+    local lines
+
+    before_each(function()
+      if iswin() then
+        pending('not available on Windows')
+      end
+      command('set asyncwrite')
+      command('let g:written = 0')
+      command('autocmd BufWritePost * let g:written += 1')
+      lines = {}
+      for i = 1, 20000 do
+        lines[i] = i .. string.rep('z', i % 37)
+      end
+      command('edit ' .. fname)
+      meths.buf_set_lines(0, 0, -1, true, lines)
+    end)
+
+    it('writes the file and resets &modified when done', function()
+      command('write')
+      retry(nil, nil, function()
+        eq(1, eval('g:written'))
+      end)
+      eq(0, eval('&modified'))
+      eq(table.concat(lines, '\n') .. '\n', read_file(fname))
+    end)
+
+    it('keeps &modified when the buffer changed meanwhile', function()
+      command('write | call setline(1, "changed")')
+      retry(nil, nil, function()
+        eq(1, eval('g:written'))
+      end)
+      eq(1, eval('&modified'))
+      eq(table.concat(lines, '\n') .. '\n', read_file(fname))
+    end)
+
+    it('finishes the write before the buffer is wiped', function()
+      command('write | bwipe!')
+      eq(1, eval('g:written'))
+      eq(table.concat(lines, '\n') .. '\n', read_file(fname))
+    end)
+
+    it('does not use the buffer after BufWritePost wiped it', function()
+      command('autocmd BufWritePost * ++once bwipe!')
+      pcall(command, 'write | bwipe!')
+      assert_alive()
+      eq(1, eval('g:written'))
+      eq(0, funcs.bufexists(fname))
+      eq(table.concat(lines, '\n') .. '\n', read_file(fname))
+    end)
+
+    it('finishes the write before leaving', function()
+      funcs.system({nvim_prog, '-u', 'NONE', '-i', 'NONE', '--headless',
+                    '-c', 'set asyncwrite',
+                    '-c', 'let g:written = 0',
+                    '-c', 'autocmd BufWritePost * let g:written += 1',
+                    '-c', 'autocmd VimLeavePre * call writefile([g:written], "Xwritten")',
+                    '-c', 'edit ' .. fname,
+                    '-c', 'call setline(1, range(20000)) | write | qall!'})
+      eq('1\n', read_file('Xwritten'))
+      os.remove('Xwritten')
+    end)
+  end)
+
   it('errors out correctly', function()
     command('let $HOME=""')
     eq(funcs.fnamemodify('.', ':p:h'), funcs.fnamemodify('.', ':p:h:~'))
@@ -1,9 +1,13 @@
 -- Specs for :wundo and underlying functions
 
 local helpers = require('test.functional.helpers')(after_each)
+local lfs = require('lfs')
 local command, clear, eval, spawn, nvim_prog, set_session =
   helpers.command, helpers.clear, helpers.eval, helpers.spawn,
   helpers.nvim_prog, helpers.set_session
+local eq, expect, feed, funcs, ok, read_file, rmdir, write_file =
+  helpers.eq, helpers.expect, helpers.feed, helpers.funcs, helpers.ok,
+  helpers.read_file, helpers.rmdir, helpers.write_file
 
 
 describe(':wundo', function()
@@ -28,3 +32,122 @@ describe('u_* functions', function()
     session:close()
   end)
 end)
+
+describe("'undofile'", function()
+  local undodir = 'Xtest_undofile_dir'
+  local testfile = 'Xtest_undofile_file'
+
+  before_each(function()
+    clear()
+    rmdir(undodir)
+    lfs.mkdir(undodir)
+    command('set undofile undodir=' .. undodir)
+    command('edit ' .. testfile)
+  end)
+  after_each(function()
+    command('%bwipeout!')
+    os.remove(testfile)
+    rmdir(undodir)
+  end)
+
+  local function change(text)
+    feed('o' .. text .. '<esc>')
+    command('let &undolevels = &undolevels')  -- start a new undo block
+  end
+
+  local function undo_file()
+    return read_file(funcs.undofile(funcs.expand('%:p')))
+  end
+
+  it('appends new changes to the undo file', function()
+    change('one')
+    command('write')
+    local first = undo_file()
+    change('two')
+    change('three')
+    command('write')
+    local second = undo_file()
+    ok(#second > #first)
+    eq(first, second:sub(1, #first))
+
+    command('bwipeout')
+    command('edit ' .. testfile)
+    eq(3, funcs.undotree().seq_last)
+    feed('uu')
+    expect([[
+
+      one]])
+  end)
+
+  it('keeps undo branches written at different times', function()
+    change('one')
+    change('two')
+    command('write')
+    feed('u')
+    change('other')
+    command('write')
+    feed('g-')
+    command('write')
+
+    command('bwipeout')
+    command('edit ' .. testfile)
+    expect([[
+
+      one
+      two]])
+    feed('g+')
+    expect([[
+
+      one
+      other]])
+    eq(3, funcs.undotree().seq_last)
+  end)
+
+  it('is written from scratch when it is mostly superseded records', function()
+    for i = 1, 5 do
+      change('line ' .. i)
+    end
+    command('write')
+    local size = #undo_file()
+    for _ = 1, 20 do
+      feed('u')
+      command('write')
+      feed('<C-R>')
+      command('write')
+    end
+    ok(#undo_file() < 3 * size)
+
+    command('bwipeout')
+    command('edit ' .. testfile)
+    eq(5, funcs.undotree().seq_cur)
+    feed('5u')
+    expect('')
+  end)
+
+  it('ignores changes that were only partly appended', function()
+    change('one')
+    command('write')
+    local text = read_file(testfile)
+    local first = undo_file()
+    change('two')
+    command('write')
+    local second = undo_file()
+    local undo_name = funcs.undofile(funcs.expand('%:p'))
+    command('bwipeout')
+
+    -- As if writing stopped halfway through the second change.
+    write_file(undo_name, second:sub(1, #first + math.floor((#second - #first) / 2)), true)
+    write_file(testfile, text, true)
+    command('edit ' .. testfile)
+    eq(1, funcs.undotree().seq_last)
+
+    -- The incomplete end is not kept.
+    change('three')
+    command('write')
+    command('bwipeout')
+    command('edit ' .. testfile)
+    eq(2, funcs.undotree().seq_last)
+    feed('uu')
+    expect('')
+  end)
+end)
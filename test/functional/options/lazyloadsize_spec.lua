@@ -0,0 +1,117 @@
+local helpers = require('test.functional.helpers')(after_each)
+local clear = helpers.clear
+local command = helpers.command
+local eq = helpers.eq
+local eval = helpers.eval
+local exec_lua = helpers.exec_lua
+local funcs = helpers.funcs
+local ok = helpers.ok
+local read_file = helpers.read_file
+local request = helpers.request
+local write_file = helpers.write_file
+
+describe("'lazyloadsize'", function()
+  local fname = 'Xtest-lazyloadsize'
+
+  -- Writes a file of about 300 Kbyte, lines of varying length.
+  local function make_file(eol, last_eol)
+    local lines = {}
+    for i = 1, 30000 do
+      lines[i] = i .. string.rep('x', i % 13)
+    end
+    write_file(fname, table.concat(lines, eol) .. (last_eol and eol or ''))
+    return lines
+  end
+
+  local function check_lines(lines)
+    eq(#lines, funcs.line('$'))
+    eq('ok', exec_lua([[
+      local lines = ...
+      local buf = vim.api.nvim_buf_get_lines(0, 0, -1, true)
+      local off = 1
+      for i, line in ipairs(lines) do
+        if buf[i] ~= line then
+          return {'line', i, buf[i], line}
+        end
+        if vim.fn.line2byte(i) ~= off then
+          return {'line2byte', i, vim.fn.line2byte(i), off}
+        end
+        off = off + #line + 1
+      end
+      return 'ok'
+    ]], lines))
+  end
+
+  -- Bytes the buffer text uses in memory.  Only a few blocks are created
+  -- right after a file was read lazily, all of them otherwise.
+  local function memline_bytes()
+    return request('nvim__buf_stats', 0).memline_bytes
+  end
+
+  before_each(function()
+    clear()
+    command('set lazyloadsize=1')
+  end)
+
+  after_each(function()
+    os.remove(fname)
+  end)
+
+  it('reads a unix file', function()
+    local lines = make_file('\n', true)
+    command('edit ' .. fname)
+    ok(memline_bytes() < 50 * 1024)
+    eq('unix', eval('&fileformat'))
+    eq(1, eval('&endofline'))
+    check_lines(lines)
+  end)
+
+  it('reads a dos file without a final line break', function()
+    local lines = make_file('\r\n', false)
+    command('edit ' .. fname)
+    ok(memline_bytes() < 50 * 1024)
+    eq('dos', eval('&fileformat'))
+    eq(0, eval('&endofline'))
+    check_lines(lines)
+  end)
+
+  it('writes changes back to the same file', function()
+    local lines = make_file('\n', true)
+    command('edit ' .. fname)
+    command('1,100delete')
+    command('20000s/$/ changed/')
+    command('$put =\'last\'')
+    command('write')
+    table.insert(lines, 'last')
+    lines[20100] = lines[20100] .. ' changed'
+    for _ = 1, 100 do
+      table.remove(lines, 1)
+    end
+    eq(table.concat(lines, '\n') .. '\n', read_file(fname))
+    command('edit!')
+    check_lines(lines)
+  end)
+
+  it('reports an illegal byte when its line is loaded', function()
+    local lines = make_file('\n', true)
+    lines[20000] = lines[20000] .. '\255'
+    write_file(fname, table.concat(lines, '\n') .. '\n')
+    command('edit ' .. fname)
+    ok(memline_bytes() < 50 * 1024)
+    eq('', eval('v:errmsg'))
+    command('silent! call getline(20000)')
+    eq('E5801: Illegal byte in line 20000, the file is not valid UTF-8: ' .. fname,
+       eval('v:errmsg'))
+    check_lines(lines)
+    command('write')
+    eq(table.concat(lines, '\n') .. '\n', read_file(fname))
+  end)
+
+  it('is not used for files smaller than the limit', function()
+    command('set lazyloadsize=10000')
+    local lines = make_file('\n', true)
+    command('edit ' .. fname)
+    ok(memline_bytes() >= #read_file(fname))
+    check_lines(lines)
+  end)
+end)
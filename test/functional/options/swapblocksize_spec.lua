@@ -0,0 +1,48 @@
+local helpers = require('test.functional.helpers')(after_each)
+local clear = helpers.clear
+local command = helpers.command
+local eq = helpers.eq
+local exec_lua = helpers.exec_lua
+local ok = helpers.ok
+local pcall_err = helpers.pcall_err
+local request = helpers.request
+
+describe("'swapblocksize'", function()
+  before_each(clear)
+
+  it('rejects sizes a swap file cannot use', function()
+    eq('Vim(set):E474: Invalid argument: swapblocksize=1000',
+       pcall_err(command, 'set swapblocksize=1000'))
+    eq('Vim(set):E474: Invalid argument: swapblocksize=60000',
+       pcall_err(command, 'set swapblocksize=60000'))
+  end)
+
+  it('keeps text intact in buffers with large blocks', function()
+    command('set swapblocksize=32768')
+    command('enew')
+    local hit = request('nvim__stats').memfile_hit
+    eq('ok', exec_lua([[
+      local lines = {}
+      for i = 1, 30000 do
+        lines[i] = i .. string.rep('y', i % 101)
+      end
+      vim.api.nvim_buf_set_lines(0, 0, -1, true, lines)
+      vim.api.nvim_buf_set_lines(0, 100, 20000, true, {})
+      table.move(lines, 20001, 30000, 101)
+      for i = 30000 - 19900 + 1, 30000 do
+        lines[i] = nil
+      end
+      local buf = vim.api.nvim_buf_get_lines(0, 0, -1, true)
+      if #buf ~= #lines then
+        return {#buf, #lines}
+      end
+      for i, line in ipairs(lines) do
+        if buf[i] ~= line then
+          return {i, buf[i], line}
+        end
+      end
+      return 'ok'
+    ]]))
+    ok(request('nvim__stats').memfile_hit > hit)
+  end)
+end)
@@ -0,0 +1,104 @@
+local helpers = require('test.functional.helpers')(after_each)
+local clear = helpers.clear
+local command = helpers.command
+local eq = helpers.eq
+local exec_lua = helpers.exec_lua
+local meths = helpers.meths
+local ok = helpers.ok
+local pcall_err = helpers.pcall_err
+local request = helpers.request
+
+describe("'undomaxmem'", function()
+  before_each(clear)
+
+  local function change_lines(count)
+    exec_lua([[
+      local count = ...
+      for n = 1, count do
+        local lines = {}
+        for i = 1, 200 do
+          lines[i] = n .. ' ' .. i .. string.rep('x', 100)
+        end
+        vim.api.nvim_buf_set_lines(0, 0, -1, true, lines)
+        vim.cmd('let &undolevels = &undolevels')  -- close the undo block
+      end
+    ]], count)
+  end
+
+  it('rejects negative values', function()
+    eq('Vim(set):E487: Argument must be positive: undomaxmem=-1',
+       pcall_err(command, 'set undomaxmem=-1'))
+    eq('Vim(set):E487: Argument must be positive: undomaxmemtot=-1',
+       pcall_err(command, 'set undomaxmemtot=-1'))
+  end)
+
+  it('moves old changes out of memory and reads them back', function()
+    command('set undomaxmem=64 undolevels=1000')
+    command('enew')
+    local first = meths.buf_get_lines(0, 0, -1, true)
+    change_lines(40)
+    local last = meths.buf_get_lines(0, 0, -1, true)
+    local stats = request('nvim__stats')
+    ok(stats.undo_spill > 0)
+    ok(stats.undo_bytes <= 2 * 64 * 1024)
+
+    command('undo 0')
+    eq(first, meths.buf_get_lines(0, 0, -1, true))
+    ok(request('nvim__stats').undo_unspill > 0)
+    ok(request('nvim__stats').undo_bytes <= 2 * 64 * 1024)
+    command('redo 40')
+    ok(request('nvim__stats').undo_bytes <= 2 * 64 * 1024)
+    command('undo 40')
+    eq(last, meths.buf_get_lines(0, 0, -1, true))
+  end)
+
+  it('does not undo a change that cannot be read back', function()
+    command('set undomaxmem=64 undolevels=1000')
+    command('enew')
+    change_lines(40)
+    local last = meths.buf_get_lines(0, 0, -1, true)
+    ok(request('nvim__stats').undo_spill > 0)
+    -- Empty the spill file.
+    exec_lua([[
+      local dir = vim.fn.fnamemodify(vim.fn.tempname(), ':h')
+      local handle = vim.loop.fs_scandir(dir)
+      while handle do
+        local name, type = vim.loop.fs_scandir_next(handle)
+        if not name then
+          break
+        end
+        if type == 'file' then
+          io.open(dir .. '/' .. name, 'w'):close()
+        end
+      end
+    ]])
+
+    eq('Vim(undo):E5011: Cannot read undo text back from the temporary file', pcall_err(command, 'undo 0'))
+    local lines = meths.buf_get_lines(0, 0, -1, true)
+    local n = lines[1]:match('^%d+')
+    ok(n ~= nil and n ~= '40')
+    for i, line in ipairs(lines) do
+      eq(n .. ' ' .. i .. string.rep('x', 100), line)
+    end
+    eq('Vim(undo):E5011: Cannot read undo text back from the temporary file', pcall_err(command, 'undo 0'))
+    command('redo 40')
+    eq(last, meths.buf_get_lines(0, 0, -1, true))
+  end)
+
+  it('writes changes that are not in memory to the undo file', function()
+    command('set undomaxmem=64 undolevels=1000')
+    command('enew')
+    change_lines(40)
+    local last = meths.buf_get_lines(0, 0, -1, true)
+    ok(request('nvim__stats').undo_spill > 0)
+    command('wundo! Xtest_undomaxmem')
+    command('set undomaxmem=0')
+    command('bwipe!')
+    command('enew')
+    meths.buf_set_lines(0, 0, -1, true, last)
+    command('rundo Xtest_undomaxmem')
+    os.remove('Xtest_undomaxmem')
+    command('undo 1')
+    eq('1 1' .. string.rep('x', 100), meths.buf_get_lines(0, 0, 1, true)[1])
+  end)
+end)
@@ -5,6 +5,8 @@ local clear = helpers.clear
 local insert = helpers.insert
 local exec_lua = helpers.exec_lua
 local feed = helpers.feed
+local command = helpers.command
+local eq = helpers.eq
 local pending_c_parser = helpers.pending_c_parser
 
 before_each(clear)
@@ -613,4 +615,34 @@ describe('treesitter highlighting', function()
       [12] = {background = Screen.colors.Red, bold = true, foreground = Screen.colors.Grey100};
     }}
     end)
+
+  it("reuses the captures for redraws without edits", function()
+    if pending_c_parser(pending) then return end
+
+    insert(hl_text)
+    exec_lua [[
+      local parser = vim.treesitter.get_parser(0, "c")
+      test_hl = vim.treesitter.highlighter.new(parser, {queries = {c = hl_query}})
+      local query = test_hl:get_query("c"):query()
+      local iter_captures = query.iter_captures
+      query_runs = 0
+      query.iter_captures = function(...)
+        query_runs = query_runs + 1
+        return iter_captures(...)
+      end
+    ]]
+    command('redraw')
+    local runs = exec_lua('return query_runs')
+    eq(true, runs > 0)
+
+    feed('gg')
+    command('redraw!')
+    feed('G')
+    command('redraw!')
+    eq(runs, exec_lua('return query_runs'))
+
+    feed('ggx')
+    command('redraw')
+    eq(true, exec_lua('return query_runs') > runs)
+  end)
 end)
@@ -5,6 +5,8 @@ local eq = helpers.eq
 local insert = helpers.insert
 local exec_lua = helpers.exec_lua
 local feed = helpers.feed
+local funcs = helpers.funcs
+local eval = helpers.eval
 local pending_c_parser = helpers.pending_c_parser
 
 before_each(clear)
@@ -534,6 +536,49 @@ end]]
     eq({ {0, 10, 0, 13} }, ret)
   end)
 
+  it("parses buffers in the background", function()
+    insert([[
+      int main() {
+        int x = 3;
+      }]])
+
+    local res = exec_lua([[
+      local parser = vim.treesitter.get_parser(0, "c")
+      local done, trees
+      parser:parse_async(function(t) done, trees = true, t end)
+      vim.wait(5000, function() return done end)
+      local async = trees[1]:root():sexpr()
+      local valid = parser:is_valid()
+
+      -- A result for text that changed meanwhile is dropped.
+      done, trees = false, nil
+      parser:parse_async(function(t) done, trees = true, t end)
+      vim.api.nvim_buf_set_lines(0, 1, 2, true, {"  int y = 4;"})
+      vim.wait(5000, function() return done end)
+      local dropped = trees == nil and not parser:is_valid()
+
+      return { async, valid, dropped, parser:parse()[1]:root():sexpr() }
+    ]])
+
+    eq(true, res[2])
+    eq(true, res[3])
+    eq(res[1], res[4])
+  end)
+
+  it("exits while parsing in the background", function()
+    local script = [[
+      local lines = {}
+      for i = 1, 100000 do
+        lines[i] = 'int x' .. i .. ' = ' .. i .. ';'
+      end
+      vim.api.nvim_buf_set_lines(0, 0, -1, true, lines)
+      vim.treesitter.get_parser(0, 'c'):parse_async(function() end)
+    ]]
+    funcs.system({helpers.nvim_prog, '-u', 'NONE', '-i', 'NONE', '--headless',
+                  '-c', 'lua ' .. script:gsub('\n', ' '), '-c', 'qall!'})
+    eq(0, eval('v:shell_error'))
+  end)
+
   it("should use node range when omitted", function()
     local txt = [[
       int foo = 42;
@@ -9,6 +9,7 @@ local exec = helpers.exec
 local expect_events = helpers.expect_events
 local meths = helpers.meths
 local command = helpers.command
+local eq = helpers.eq
 
 describe('decorations providers', function()
   local screen
@@ -155,6 +156,122 @@ describe('decorations providers', function()
     ]]}
   end)
 
+  it('can cache the decorations of a line', function()
+    insert(mulholland)
+    setup_provider [[
+      local hl = a.nvim_get_hl_id_by_name "ErrorMsg"
+      local test_ns = a.nvim_create_namespace "mulholland"
+      calls = {}
+      function on_do(event, ...)
+        if event == "line" then
+          local win, buf, line = ...
+          calls[line+1] = (calls[line+1] or 0) + 1
+          a.nvim_buf_set_extmark(buf, test_ns, line, line,
+                             { end_line = line, end_col = line+1,
+                               hl_group = hl,
+                               ephemeral = true
+                              })
+          return "cache"
+        end
+      end
+    ]]
+
+    local grid = [[
+      {2:/}/ just to see if there was an accident |
+      /{2:/} on Mulholland Drive                  |
+      tr{2:y}_start();                            |
+      buf{2:r}ef_T save_buf;                      |
+      swit{2:c}h_buffer(&save_buf, buf);          |
+      posp {2:=} getmark(mark, false);            |
+      restor{2:e}_buffer(&save_buf);^              |
+                                              |
+    ]]
+    screen:expect{grid=grid}
+    local calls = exec_lua [[ return calls ]]
+
+    command('redraw!')
+    screen:expect{grid=grid}
+    eq(calls, exec_lua [[ return calls ]])
+
+    feed('3Gx')
+    screen:expect{grid=[[
+      {2:/}/ just to see if there was an accident |
+      /{2:/} on Mulholland Drive                  |
+      ^ry{2:_}start();                             |
+      buf{2:r}ef_T save_buf;                      |
+      swit{2:c}h_buffer(&save_buf, buf);          |
+      posp {2:=} getmark(mark, false);            |
+      restor{2:e}_buffer(&save_buf);              |
+                                              |
+    ]]}
+    calls[3] = calls[3] + 1
+    eq(calls, exec_lua [[ return calls ]])
+  end)
+
+  it('does not use cached decorations after the buffer was hidden', function()
+    insert(mulholland)
+    command('set hidden')
+    setup_provider [[
+      local hl = a.nvim_get_hl_id_by_name "ErrorMsg"
+      local test_ns = a.nvim_create_namespace "mulholland"
+      function on_do(event, ...)
+        if event == "win" then
+          local win, buf = ...
+          return buf == 1
+        elseif event == "line" then
+          local win, buf, line = ...
+          local text = a.nvim_buf_get_lines(buf, line, line+1, true)[1]
+          if text:sub(1, 2) == "//" then
+            a.nvim_buf_set_extmark(buf, test_ns, line, 0,
+                               { end_line = line, end_col = #text,
+                                 hl_group = hl,
+                                 ephemeral = true
+                                })
+          end
+          return "cache"
+        end
+      end
+    ]]
+
+    screen:expect{grid=[[
+      {2:// just to see if there was an accident} |
+      {2:// on Mulholland Drive}                  |
+      try_start();                            |
+      bufref_T save_buf;                      |
+      switch_buffer(&save_buf, buf);          |
+      posp = getmark(mark, false);            |
+      restore_buffer(&save_buf);^              |
+                                              |
+    ]]}
+
+    -- No decorations are drawn for the other buffer, while the first one is
+    -- changed when it is not in a window.
+    command('enew')
+    screen:expect{grid=[[
+      ^                                        |
+      {1:~                                       }|
+      {1:~                                       }|
+      {1:~                                       }|
+      {1:~                                       }|
+      {1:~                                       }|
+      {1:~                                       }|
+                                              |
+    ]]}
+    meths.buf_set_lines(1, 0, 0, true, {'xx'})
+
+    command('buffer 1 | normal! gg')
+    screen:expect{grid=[[
+      ^xx                                      |
+      {2:// just to see if there was an accident} |
+      {2:// on Mulholland Drive}                  |
+      try_start();                            |
+      bufref_T save_buf;                      |
+      switch_buffer(&save_buf, buf);          |
+      posp = getmark(mark, false);            |
+                                              |
+    ]]}
+  end)
+
   it('can predefine highlights', function()
     screen:try_resize(40, 16)
     insert(mulholland)
@@ -789,6 +906,40 @@ end]]
     ]]}
     helpers.assert_alive()
   end)
+
+  it('highlights a range which starts far above the window', function()
+    exec_lua([[
+      local ns = ...
+      local lines = {}
+      for i = 1, 1000 do
+        lines[i] = 'line ' .. i
+      end
+      vim.api.nvim_buf_set_lines(0, 0, -1, true, lines)
+      vim.api.nvim_buf_set_extmark(0, ns, 1, 0, {end_row=505, end_col=0, hl_group='ErrorMsg'})
+      for i = 0, 998 do
+        vim.api.nvim_buf_set_extmark(0, ns, i, 0, {})
+      end
+    ]], ns)
+    command('set scrolloff=0')
+    feed('500Gzt')
+    screen:expect{grid=[[
+      {4:^line 500}                                          |
+      {4:line 501}                                          |
+      {4:line 502}                                          |
+      {4:line 503}                                          |
+      {4:line 504}                                          |
+      {4:line 505}                                          |
+      line 506                                          |
+      line 507                                          |
+      line 508                                          |
+      line 509                                          |
+      line 510                                          |
+      line 511                                          |
+      line 512                                          |
+      line 513                                          |
+                                                        |
+    ]]}
+  end)
 end)
 
 describe('decorations: virtual lines', function()
@@ -0,0 +1,57 @@
+local helpers = require('test.functional.helpers')(after_each)
+local clear = helpers.clear
+local eq = helpers.eq
+local exec_lua = helpers.exec_lua
+
+before_each(clear)
+
+describe('line2byte() and byte2line()', function()
+  -- Checks every line against offsets summed up from the buffer text, so
+  -- that the chunk index is verified after edits all over the buffer.
+  local function check_offsets()
+    return exec_lua([[
+      local lines = vim.api.nvim_buf_get_lines(0, 0, -1, true)
+      local off = 1
+      for i, line in ipairs(lines) do
+        if vim.fn.line2byte(i) ~= off then
+          return {'line2byte', i, vim.fn.line2byte(i), off}
+        end
+        if vim.fn.byte2line(off) ~= i then
+          return {'byte2line', off, vim.fn.byte2line(off), i}
+        end
+        off = off + #line + 1
+      end
+      return 'ok'
+    ]])
+  end
+
+  it('stay correct in large buffers after scattered edits', function()
+    exec_lua([[
+      local lines = {}
+      for i = 1, 20000 do
+        lines[i] = string.rep('x', i % 37)
+      end
+      vim.api.nvim_buf_set_lines(0, 0, -1, true, lines)
+    ]])
+    eq('ok', check_offsets())
+
+    exec_lua([[
+      for i = 1, 200 do
+        local row = (i * 7919) % vim.api.nvim_buf_line_count(0)
+        if i % 3 == 0 then
+          vim.api.nvim_buf_set_lines(0, row, row + 1, true, {})
+        elseif i % 3 == 1 then
+          vim.api.nvim_buf_set_lines(0, row, row, true, {'inserted', 'lines'})
+        else
+          vim.api.nvim_buf_set_lines(0, row, row + 1, true, {string.rep('y', i)})
+        end
+      end
+    ]])
+    eq('ok', check_offsets())
+
+    exec_lua([[
+      vim.api.nvim_buf_set_lines(0, 1000, 15000, true, {})
+    ]])
+    eq('ok', check_offsets())
+  end)
+end)